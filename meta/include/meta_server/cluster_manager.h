@@ -2,11 +2,10 @@
 
 #include "server_manager.h"
 #include <memory>
+#include <unordered_map>
 #include "proto/meta.pb.h"
-#include "meta_map.h"
 #include "meta_common.h"
 
-using meta::MetaMap;
 using meta::ServerStatus;
 
 class ClusterManager {
@@ -15,8 +14,11 @@ public:
     uint64_t register_server(const Server& server);
     ServerStatus get_server_status(uint64_t server_id);
     bool set_server_status(uint64_t server_id, ServerStatus status);
+    // 当前状态在 expected 中才修改, 用于和客户端的状态修改并发的后台状态切换
+    bool compare_and_set_status(uint64_t server_id, const std::vector<ServerStatus>& expected, ServerStatus status);
 
 private:
     ClusterManager();
-    MetaMap<meta::InstanceKind, std::shared_ptr<ServerManager>> server_managers;
+    // ServerManager 只是本地的索引, 服务器列表本身在各自的 MetaMap 中复制
+    std::unordered_map<meta::InstanceKind, std::shared_ptr<ServerManager>> server_managers;
 };
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/*
+ * leader 上的心跳超时检测. 每个节点在最小堆里只有一个截止时间, 到期时如果期间收到过心跳就按最后一次心跳
+ * 重新入堆, 否则把节点标记为 TIMEOUT. 一个后台线程睡到最近的截止时间, 不扫描所有节点.
+ *
+ * 心跳只记在 leader 内存里, 不写 raft 日志; 状态变化 (TIMEOUT) 才通过 raft 提交. 换 leader 之后新 leader
+ * 把所有在服务状态的节点当作刚收到心跳, 给它们一个完整的超时时间.
+ */
+class LivenessTracker {
+public:
+    static LivenessTracker& instance();
+
+    void start();
+    void stop();
+
+    void heartbeat(uint64_t server_id);
+    // 客户端两次上报之间的最大间隔
+    uint32_t max_report_interval_ms() const;
+
+private:
+    using Deadline = std::pair<int64_t, uint64_t>;
+
+    LivenessTracker() = default;
+    void run();
+    // 返回超时的节点
+    std::vector<uint64_t> check(int64_t now_ms);
+    void reset(int64_t term, int64_t now_ms);
+
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::unordered_map<uint64_t, int64_t> last_seen;
+    std::priority_queue<Deadline, std::vector<Deadline>, std::greater<Deadline>> deadlines;
+    int64_t tracked_term = -1;
+    bool running = false;
+    std::thread checker;
+};
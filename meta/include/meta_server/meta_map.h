@@ -1,145 +1,278 @@
 #pragma once
-#include <iostream>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <string>
 #include <type_traits>
 #include <unordered_map>
-#include <initializer_list>
-#include <string>
-#include <typeinfo>
+#include <utility>
+#include <vector>
+#include <google/protobuf/message.h>
+#include "proto/meta_raft.pb.h"
 
 namespace meta {
+
+// key/value 的编码: 整数和枚举按定长字节, string 原样保存, protobuf 消息序列化
+template<typename T, typename Enable = void>
+struct MetaCodec;
+
+template<typename T>
+struct MetaCodec<T, std::enable_if_t<std::is_integral_v<T> || std::is_enum_v<T>>> {
+    static std::string encode(const T& value) {
+        return std::string(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+    static bool decode(const std::string& data, T* value) {
+        if (data.size() != sizeof(T)) {
+            return false;
+        }
+        std::memcpy(value, data.data(), sizeof(T));
+        return true;
+    }
+};
+
+template<>
+struct MetaCodec<std::string> {
+    static std::string encode(const std::string& value) {
+        return value;
+    }
+    static bool decode(const std::string& data, std::string* value) {
+        *value = data;
+        return true;
+    }
+};
+
+template<typename T>
+struct MetaCodec<T, std::enable_if_t<std::is_base_of_v<google::protobuf::Message, T>>> {
+    static std::string encode(const T& value) {
+        return value.SerializeAsString();
+    }
+    static bool decode(const std::string& data, T* value) {
+        return value->ParseFromString(data);
+    }
+};
+
+// 注册到 MetaStateMachine 的 map, 按名字区分, 名字在进程内唯一
+class MetaMapBase {
+public:
+    explicit MetaMapBase(const std::string& name);
+    virtual ~MetaMapBase();
+
+    const std::string& name() const {
+        return map_name;
+    }
+
+    // 以下接口只由状态机在 apply 或加载快照时调用
+    virtual void apply_put(const std::string& key, const std::string& value) = 0;
+    virtual void apply_erase(const std::string& key) = 0;
+    virtual void apply_update(const std::string& key, const std::string& arg) = 0;
+    virtual void clear_local() = 0;
+    virtual void dump(const std::function<void(const std::string&, const std::string&)>& fn) const = 0;
+
+protected:
+    // 提交一次写操作, 在本节点 apply 之后返回; 不是 leader 或者提交失败时返回 false
+    bool propose(MetaOp::Type type, std::string key, std::string value);
+
+private:
+    std::string map_name;
+};
+
+/*
+ * 通过 raft 复制的 map. 写操作 (insert/erase) 打包成 raft 日志提交, 各副本在 apply 时修改本地的
+ * local_map; 读操作直接读本地副本, 服务端在读之前检查 leader lease, 保证读到的是最新提交的值.
+ */
 template<typename K, typename V>
-class MetaMap {
+class MetaMap : public MetaMapBase {
 public:
-    using iterator = typename std::unordered_map<K, V>::iterator;
-    using const_iterator = typename std::unordered_map<K, V>::const_iterator;
+    // 本地副本变化时的回调, 在状态机线程中调用; 删除时 value 为 nullptr
+    using Listener = std::function<void(const K& key, const V* value)>;
+    // 把 update 的参数作用到当前值上, 返回 false 表示不修改; 在状态机线程中调用, 结果只能依赖参数和当前值
+    using Updater = std::function<bool(V* value, const std::string& arg)>;
 
-    MetaMap();
-    MetaMap(const std::unordered_map<K, V>& map);
-    MetaMap(std::initializer_list<std::pair<const K, V>> initList);
-    ~MetaMap();
+    explicit MetaMap(const std::string& name) : MetaMapBase(name) {}
 
-    // 插入元素
-    void insert(const K& key, const V& value);
+    // 需要在状态机启动之前设置
+    void set_listener(Listener fn) {
+        listener = std::move(fn);
+    }
+    void set_updater(Updater fn) {
+        updater = std::move(fn);
+    }
 
-    // 访问元素
+    // 插入或覆盖元素
+    bool insert(const K& key, const V& value);
+
+    // 访问元素, 不存在时 at 抛出 std::out_of_range
+    bool get(const K& key, V* value) const;
     V at(const K& key) const;
-    V& operator[](const K& key);
+    bool contains(const K& key) const;
 
     // 删除元素
-    void erase(const K& key);
+    bool erase(const K& key);
 
-    // 查找元素
-    iterator find(const K& key);
-    const_iterator find(const K& key) const;
+    // 在 apply 时用 updater 修改已有的元素, 不存在或者 updater 拒绝时不修改, 仍然返回 true
+    bool update(const K& key, std::string arg);
 
     // 获取大小
     size_t size() const;
 
-    // 清空 map
-    void clear();
+    // 本地副本的拷贝
+    std::vector<std::pair<K, V>> list() const;
 
-    // 迭代器接口
-    iterator begin();
-    const_iterator begin() const;
-    iterator end();
-    const_iterator end() const;
+    void apply_put(const std::string& key, const std::string& value) override;
+    void apply_erase(const std::string& key) override;
+    void apply_update(const std::string& key, const std::string& arg) override;
+    void clear_local() override;
+    void dump(const std::function<void(const std::string&, const std::string&)>& fn) const override;
 
 private:
+    mutable std::shared_mutex mtx;
     std::unordered_map<K, V> local_map;
+    Listener listener;
+    Updater updater;
 };
 
-// 构造函数
-template<typename K, typename V>
-MetaMap<K, V>::MetaMap() {
-    // 实现 Braft 节点的初始化，省略细节
-}
-
-// 用已有的 unordered_map 构造
+// 插入元素
 template<typename K, typename V>
-MetaMap<K, V>::MetaMap(const std::unordered_map<K, V>& map) : MetaMap() {
-    for (const auto& pair : map) {
-        insert(pair.first, pair.second);
-    }
+bool MetaMap<K, V>::insert(const K& key, const V& value) {
+    return propose(MetaOp::PUT, MetaCodec<K>::encode(key), MetaCodec<V>::encode(value));
 }
 
-// 支持初始化列表的构造函数
+// 访问元素
 template<typename K, typename V>
-MetaMap<K, V>::MetaMap(std::initializer_list<std::pair<const K, V>> initList) : MetaMap() {
-    for (const auto& pair : initList) {
-        insert(pair.first, pair.second);
+bool MetaMap<K, V>::get(const K& key, V* value) const {
+    std::shared_lock<std::shared_mutex> lock(mtx);
+    auto it = local_map.find(key);
+    if (it == local_map.end()) {
+        return false;
     }
+    *value = it->second;
+    return true;
 }
 
-// 析构函数
-template<typename K, typename V>
-MetaMap<K, V>::~MetaMap() {
-    // 实现 Braft 节点的关闭，省略细节
-}
-
-// 插入元素
-template<typename K, typename V>
-void MetaMap<K, V>::insert(const K& key, const V& value) {
-    local_map[key] = value;
-}
-
-// 访问元素
 template<typename K, typename V>
 V MetaMap<K, V>::at(const K& key) const {
+    std::shared_lock<std::shared_mutex> lock(mtx);
     return local_map.at(key);
 }
 
 template<typename K, typename V>
-V& MetaMap<K, V>::operator[](const K& key) {
-    return local_map[key];
+bool MetaMap<K, V>::contains(const K& key) const {
+    std::shared_lock<std::shared_mutex> lock(mtx);
+    return local_map.find(key) != local_map.end();
 }
 
 // 删除元素
 template<typename K, typename V>
-void MetaMap<K, V>::erase(const K& key) {
-    local_map.erase(key);
+bool MetaMap<K, V>::erase(const K& key) {
+    return propose(MetaOp::ERASE, MetaCodec<K>::encode(key), std::string());
 }
 
-// 查找元素
 template<typename K, typename V>
-typename MetaMap<K, V>::iterator MetaMap<K, V>::find(const K& key) {
-    return local_map.find(key);
-}
-
-template<typename K, typename V>
-typename MetaMap<K, V>::const_iterator MetaMap<K, V>::find(const K& key) const {
-    return local_map.find(key);
+bool MetaMap<K, V>::update(const K& key, std::string arg) {
+    return propose(MetaOp::UPDATE, MetaCodec<K>::encode(key), std::move(arg));
 }
 
 // 获取大小
 template<typename K, typename V>
 size_t MetaMap<K, V>::size() const {
+    std::shared_lock<std::shared_mutex> lock(mtx);
     return local_map.size();
 }
 
-// 清空 map
 template<typename K, typename V>
-void MetaMap<K, V>::clear() {
-    local_map.clear();
+std::vector<std::pair<K, V>> MetaMap<K, V>::list() const {
+    std::shared_lock<std::shared_mutex> lock(mtx);
+    return std::vector<std::pair<K, V>>(local_map.begin(), local_map.end());
 }
 
-// 迭代器接口
 template<typename K, typename V>
-typename MetaMap<K, V>::iterator MetaMap<K, V>::begin() {
-    return local_map.begin();
+void MetaMap<K, V>::apply_put(const std::string& key, const std::string& value) {
+    K k;
+    V v;
+    if (!MetaCodec<K>::decode(key, &k) || !MetaCodec<V>::decode(value, &v)) {
+        throw std::runtime_error("Fail to decode meta map entry of " + name());
+    }
+    {
+        std::unique_lock<std::shared_mutex> lock(mtx);
+        local_map[k] = v;
+    }
+    if (listener) {
+        listener(k, &v);
+    }
 }
 
 template<typename K, typename V>
-typename MetaMap<K, V>::const_iterator MetaMap<K, V>::begin() const {
-    return local_map.begin();
+void MetaMap<K, V>::apply_erase(const std::string& key) {
+    K k;
+    if (!MetaCodec<K>::decode(key, &k)) {
+        throw std::runtime_error("Fail to decode meta map key of " + name());
+    }
+    {
+        std::unique_lock<std::shared_mutex> lock(mtx);
+        local_map.erase(k);
+    }
+    if (listener) {
+        listener(k, nullptr);
+    }
+}
+
+template<typename K, typename V>
+void MetaMap<K, V>::apply_update(const std::string& key, const std::string& arg) {
+    K k;
+    if (!MetaCodec<K>::decode(key, &k)) {
+        throw std::runtime_error("Fail to decode meta map key of " + name());
+    }
+    if (!updater) {
+        throw std::runtime_error("Meta map " + name() + " has no updater");
+    }
+    // 只有状态机线程修改 local_map, 读和写之间不会有别的修改
+    V v;
+    {
+        std::shared_lock<std::shared_mutex> lock(mtx);
+        auto it = local_map.find(k);
+        if (it == local_map.end()) {
+            return;
+        }
+        v = it->second;
+    }
+    if (!updater(&v, arg)) {
+        return;
+    }
+    {
+        std::unique_lock<std::shared_mutex> lock(mtx);
+        local_map[k] = v;
+    }
+    if (listener) {
+        listener(k, &v);
+    }
 }
 
+// 清空 map
 template<typename K, typename V>
-typename MetaMap<K, V>::iterator MetaMap<K, V>::end() {
-    return local_map.end();
+void MetaMap<K, V>::clear_local() {
+    std::vector<K> keys;
+    {
+        std::unique_lock<std::shared_mutex> lock(mtx);
+        keys.reserve(local_map.size());
+        for (const auto& pair : local_map) {
+            keys.push_back(pair.first);
+        }
+        local_map.clear();
+    }
+    if (listener) {
+        for (const auto& key : keys) {
+            listener(key, nullptr);
+        }
+    }
 }
 
 template<typename K, typename V>
-typename MetaMap<K, V>::const_iterator MetaMap<K, V>::end() const {
-    return local_map.end();
+void MetaMap<K, V>::dump(const std::function<void(const std::string&, const std::string&)>& fn) const {
+    std::shared_lock<std::shared_mutex> lock(mtx);
+    for (const auto& pair : local_map) {
+        fn(MetaCodec<K>::encode(pair.first), MetaCodec<V>::encode(pair.second));
+    }
+}
 }
-}
\ No newline at end of file
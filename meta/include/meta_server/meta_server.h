@@ -24,4 +24,10 @@ public:
 
     void SetServerStatus(google::protobuf::RpcController *cntl_base, const meta::SetServerStatusRequest *request,
                          meta::SetServerStatusResponse *response, google::protobuf::Closure *done) override;
+
+    void Watch(google::protobuf::RpcController *cntl_base, const meta::WatchRequest *request,
+               meta::WatchResponse *response, google::protobuf::Closure *done) override;
+
+    void Report(google::protobuf::RpcController *cntl_base, const meta::ReportRequest *request,
+                meta::ReportResponse *response, google::protobuf::Closure *done) override;
 };
\ No newline at end of file
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <braft/raft.h>
+#include <brpc/controller.h>
+#include <bthread/countdown_event.h>
+#include <gflags/gflags.h>
+#include "proto/meta_raft.pb.h"
+#include "meta_map.h"
+
+DECLARE_string(meta_raft_peers);
+DECLARE_string(meta_raft_ip);
+DECLARE_string(meta_raft_group);
+DECLARE_string(meta_raft_data_path);
+DECLARE_int32(meta_election_timeout_ms);
+DECLARE_int32(meta_snapshot_interval_s);
+DECLARE_int32(meta_max_batch);
+DECLARE_int32(meta_max_inflight_batches);
+
+namespace meta {
+
+/*
+ * 所有 MetaMap 共用的 raft 状态机. 写操作先进入队列, 由 proposer 线程把排队的操作合并成一条日志提交,
+ * 同时在途的日志数有上限, 上限打满时新来的写操作在队列里攒成更大的批. apply 时按 map 名字分发;
+ * 快照把所有 map 写到一个 RocksDB 里.
+ *
+ * meta_raft_peers 为空时单机运行, 写操作直接在本地生效.
+ */
+class MetaStateMachine : public braft::StateMachine {
+public:
+    static MetaStateMachine& instance();
+
+    // 在 brpc server 启动之后调用, MetaMap 需要在这之前全部注册好, 否则回放日志时找不到
+    int start(int port);
+    void shutdown();
+
+    void register_map(MetaMapBase* map);
+    void unregister_map(MetaMapBase* map);
+
+    // 提交一次写操作, 阻塞到本节点 apply 完成
+    bool propose(MetaOp&& op);
+
+    bool is_leader() const;
+    // 本节点作为 leader 的任期, 不是 leader 时为 -1; 单机运行时为 0
+    int64_t term() const {
+        return FLAGS_meta_raft_peers.empty() ? 0 : leader_term.load(std::memory_order_acquire);
+    }
+    // leader lease 有效时, 本地副本包含所有已提交的写, 可以直接读
+    bool lease_valid() const;
+    std::string leader_addr() const;
+    // 正在 apply 或者最近 apply 的 raft 日志 index, 各副本上同一次修改的 revision 相同
+    uint64_t revision() const {
+        return applied_revision.load(std::memory_order_acquire);
+    }
+
+    void on_apply(braft::Iterator& iter) override;
+    void on_snapshot_save(braft::SnapshotWriter* writer, braft::Closure* done) override;
+    int on_snapshot_load(braft::SnapshotReader* reader) override;
+    void on_leader_start(int64_t term) override;
+    void on_leader_stop(const butil::Status& status) override;
+    void on_error(const braft::Error& e) override;
+
+private:
+    struct PendingOp {
+        MetaOp op;
+        bool ok = false;
+        bthread::CountdownEvent event{1};
+    };
+
+    // 一条日志对应的所有写操作, 日志 apply 或者失败之后唤醒它们
+    class BatchClosure : public braft::Closure {
+    public:
+        explicit BatchClosure(MetaStateMachine* fsm) : fsm(fsm) {}
+        void Run() override;
+
+        MetaStateMachine* fsm;
+        std::vector<PendingOp*> ops;
+    };
+
+    MetaStateMachine() = default;
+    void propose_loop();
+    void apply_op(const MetaOp& op);
+    void finish_batch();
+
+    std::atomic<braft::Node*> node{nullptr};
+    std::atomic<int64_t> leader_term{-1};
+    std::atomic<uint64_t> applied_revision{0};
+
+    mutable std::mutex maps_mtx;
+    std::unordered_map<std::string, MetaMapBase*> maps;
+    // 单机运行时串行化写操作
+    std::mutex standalone_mtx;
+
+    std::mutex queue_mtx;
+    std::condition_variable queue_cv;
+    std::deque<PendingOp*> queue;
+    int inflight_batches = 0;
+    bool stopping = false;
+    std::thread proposer;
+};
+
+// 服务端 rpc 入口的检查: 写请求要求本节点是 leader, 读请求要求 leader lease 有效, 否则返回 EPERM
+bool check_leader(brpc::Controller* cntl, bool read);
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <vector>
+#include "proto/task_2.pb.h"
+
+struct LoadEwma {
+    double cpu = 0;
+    double mem = 0;
+    double pmem = 0;
+    double ssd = 0;
+};
+
+/*
+ * 一个节点最近的负载上报. 环形缓冲区保存最近的样本, 用来取时间窗口内的峰值;
+ * EWMA 按样本间隔衰减, 上报频率不同的节点平滑程度一致.
+ */
+class NodeLoadHistory {
+public:
+    NodeLoadHistory(size_t capacity, double ewma_window_s);
+
+    void add(const meta::NodeLoadInfo& load);
+
+    const LoadEwma& ewma() const {
+        return smoothed;
+    }
+    uint64_t last_timestamp() const {
+        return last_ts;
+    }
+    // now - window_s 之后的样本中各项的最大值
+    meta::NodeLoadInfo peak(uint64_t now, uint64_t window_s) const;
+
+private:
+    std::vector<meta::NodeLoadInfo> samples;
+    size_t head = 0;
+    size_t count = 0;
+    double window;
+    LoadEwma smoothed;
+    uint64_t last_ts = 0;
+};
@@ -2,9 +2,13 @@
 
 #include <map>
 #include <memory>
+#include <shared_mutex>
+#include <unordered_map>
+#include "proto/meta.pb.h"
 #include "proto/task_2.pb.h"
 #include "meta_common.h"
 #include "meta_map.h"
+#include "node_load_history.h"
 
 using meta::NodeLoadInfo;
 using meta::NodeLoadInfoMap;
@@ -14,11 +18,21 @@ class ResourceManager {
 public:
     static ResourceManager& instance();
     uint64_t update_node_load_info(ServerID server_id, const NodeLoadInfo& NodeLoadInfo);
+    // 把增量上报合并到已有的负载上, 只有负载变化时才提交; meta 上还没有这个节点的负载且上报不是全量时
+    // need_full 置为 true. 提交失败返回 false
+    bool apply_load_delta(ServerID server_id, const meta::LoadDelta& delta, bool full, bool* need_full);
+
+    // 按加权的平滑负载从小到大挑选节点, 跳过上报过期、不在服务状态或者 pmem/ssd 余量不足的节点
+    void pick_nodes(const meta::PickNodesRequest& request, meta::PickNodesResponse* response);
 
 private:
     ResourceManager();
+    void on_load_update(ServerID server_id, const NodeLoadInfo* load);
 
-    // switch to meta_map
-    // std::map<ServerID, NodeLoadInfo> nodeLoadInfoMap;
+    // 通过 raft 复制到所有 meta server
     MetaMap<ServerID, NodeLoadInfo> nodeLoadInfoMap;
-};
\ No newline at end of file
+
+    // 各副本在 apply 时维护的负载历史, 只在本地
+    std::shared_mutex history_mtx;
+    std::unordered_map<ServerID, NodeLoadHistory> history;
+};
@@ -1,20 +1,26 @@
 #pragma once
 
 #include "server_struct.h"
+#include "meta_map.h"
+#include <string>
 #include <vector>
-#include <mutex>
 #include <stdexcept> // For std::runtime_error
 
 using meta::ServerStatus;
 
+// 一个 InstanceKind 的服务器列表, 通过 MetaMap 复制; 读请求走 ServerRegistry
 class ServerList {
 public:
-    void add_server(const Server& server);
-    void update_server_status(uint64_t id, meta::ServerStatus status);
+    explicit ServerList(const std::string& name);
+    // 写操作经 raft 提交, 提交失败 (例如不是 leader) 时返回 false
+    bool add_server(const Server& server);
+    bool update_server_status(uint64_t id, meta::ServerStatus status);
+    // 当前状态在 expected 中才修改, 判断在 apply 时进行, 不会覆盖这之前提交的状态修改
+    bool compare_and_set_status(uint64_t id, const std::vector<meta::ServerStatus>& expected,
+                                meta::ServerStatus status);
     // Add more methods as needed
     Server get_server_by_id(uint64_t id);
 
 private:
-    std::vector<Server> servers;
-    std::mutex mtx;
+    meta::MetaMap<uint64_t, meta::ServerInfo> servers;
 };
@@ -1,12 +1,10 @@
 #pragma once
 
 #include "server_list.h"
-#include <atomic>
-#include <mutex>
 
 class ServerManager {
 public:
-    ServerManager();
+    explicit ServerManager(meta::InstanceKind instance_kind);
     uint64_t add_server(const Server& server);
 
     Server get_server_by_id(uint64_t server_id);
@@ -14,9 +12,8 @@ public:
     ServerStatus get_server_status(uint64_t server_id);
 
     bool set_server_status(uint64_t server_id, ServerStatus status);
+    bool compare_and_set_status(uint64_t server_id, const std::vector<ServerStatus>& expected, ServerStatus status);
 
 private:
     ServerList server_list;
-    std::atomic<uint64_t> server_id_generator;
-    std::mutex mtx;
 };
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+#include "proto/meta.pb.h"
+
+// 服务器状态的轻量快照, 查状态时不拷贝 ServerInfo
+struct ServerStatusSnapshot {
+    uint64_t id;
+    meta::InstanceKind instance_kind;
+    meta::ServerStatus status;
+    uint64_t revision;
+};
+
+/*
+ * 所有 InstanceKind 共用的服务器索引, 按 id 分片, 每个分片一把读写锁. 由 ServerList 的 apply 回调维护,
+ * 读请求 O(1) 查到对应分片; 完整的 ServerInfo 以 shared_ptr<const> 保存, 读者只拿引用, 不拷贝 attributes.
+ *
+ * leader 上注册服务器时先在索引中预留 id, 提交失败再释放, 并发注册不需要全局锁.
+ */
+class ServerRegistry {
+public:
+    static ServerRegistry& instance();
+
+    // apply 线程调用
+    void put(const meta::ServerInfo& info, uint64_t revision);
+    void erase(uint64_t id);
+
+    bool get_status(uint64_t id, ServerStatusSnapshot* snapshot) const;
+    std::shared_ptr<const meta::ServerInfo> get(uint64_t id) const;
+    size_t size() const;
+    // 所有服务器的状态快照, 逐个分片加读锁
+    std::vector<ServerStatusSnapshot> list_status() const;
+
+    // 分配一个未被使用的 id 并预留
+    uint64_t allocate_id();
+    // 预留指定的 id, id 已存在或已被预留时返回 false
+    bool reserve(uint64_t id);
+    // 提交失败时释放预留; 已经 apply 的 id 不受影响
+    void release(uint64_t id);
+
+private:
+    static constexpr size_t kShardCount = 64;
+
+    struct Entry {
+        // 为 nullptr 时只是预留, 对读者不可见
+        std::shared_ptr<const meta::ServerInfo> info;
+        ServerStatusSnapshot snapshot;
+    };
+
+    struct alignas(64) Shard {
+        mutable std::shared_mutex mtx;
+        std::unordered_map<uint64_t, Entry> servers;
+    };
+
+    ServerRegistry() = default;
+
+    Shard& shard(uint64_t id) {
+        return shards[id % kShardCount];
+    }
+    const Shard& shard(uint64_t id) const {
+        return shards[id % kShardCount];
+    }
+
+    Shard shards[kShardCount];
+    // 已 apply 的最大 id, 换 leader 之后新分配的 id 从它之后开始
+    std::atomic<uint64_t> max_id{0};
+    std::atomic<uint64_t> next_id{1};
+    std::atomic<size_t> server_count{0};
+};
@@ -18,6 +18,8 @@ struct Server {
 
     template <typename Request>
     static Server from(const Request& req);
+
+    meta::ServerInfo to_info() const;
 };
 
 template <>
@@ -39,4 +41,37 @@ inline Server Server::from(const meta::RegisterServerRequest& req) {
         server.attributes[attribute.first] = attribute.second;
     }
     return server;
-}
\ No newline at end of file
+}
+
+template <>
+inline Server Server::from(const meta::ServerInfo& info) {
+    Server server;
+    server.id = info.id();
+    server.hostname = info.hostname();
+    server.rpc_port = info.rpc_port();
+    server.instance_kind = info.instance_kind();
+    server.status = info.status();
+    server.version = info.version();
+    server.git_branch = info.git_branch();
+    server.git_hash = info.git_hash();
+    for (const auto& attribute : info.attributes()) {
+        server.attributes[attribute.first] = attribute.second;
+    }
+    return server;
+}
+
+inline meta::ServerInfo Server::to_info() const {
+    meta::ServerInfo info;
+    info.set_id(id);
+    info.set_hostname(hostname);
+    info.set_rpc_port(rpc_port);
+    info.set_instance_kind(instance_kind);
+    info.set_status(status);
+    info.set_version(version);
+    info.set_git_branch(git_branch);
+    info.set_git_hash(git_hash);
+    for (const auto& attribute : attributes) {
+        (*info.mutable_attributes())[attribute.first] = attribute.second;
+    }
+    return info;
+}
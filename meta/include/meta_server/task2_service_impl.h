@@ -16,4 +16,7 @@ public:
 
     void UpdateNodeLoadInfo(google::protobuf::RpcController *cntl_base, const meta::UpdateNodeLoadInfoRequest *request,
                             meta::UpdateNodeLoadInfoResponse *response, google::protobuf::Closure *done) override;
+
+    void PickNodes(google::protobuf::RpcController *cntl_base, const meta::PickNodesRequest *request,
+                   meta::PickNodesResponse *response, google::protobuf::Closure *done) override;
 };
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <brpc/stream.h>
+#include "proto/meta.pb.h"
+
+/*
+ * 服务器变化的推送中心. 状态机线程 apply 之后调用 publish, 推送给所有订阅的 stream, 同时保留最近的
+ * 变化, 订阅者断开之后可以从上次看到的 revision 接着订阅. 推送是至少一次的, 客户端按 id 覆盖即可.
+ * stream 写满 (客户端消费不过来) 时直接关闭, 由客户端带着 revision 重新订阅.
+ */
+class WatchHub {
+public:
+    static WatchHub& instance();
+
+    // info 为 nullptr 表示删除
+    void publish(uint64_t revision, uint64_t server_id, const meta::ServerInfo* info);
+
+    // 先推送 revision 不小于 start_revision 的变化 (或者全量), 再加入订阅者; 返回推送到的 revision
+    uint64_t subscribe(brpc::StreamId stream, uint64_t start_revision);
+    void unsubscribe(brpc::StreamId stream);
+
+private:
+    WatchHub() = default;
+    static bool write(brpc::StreamId stream, const meta::WatchEvents& events);
+
+    std::mutex mtx;
+    uint64_t revision = 0;
+    // history 包含 revision 不小于 history_start 的所有变化
+    uint64_t history_start = 0;
+    bool has_history = false;
+    std::deque<meta::ServerEvent> history;
+    std::unordered_map<uint64_t, meta::ServerInfo> servers;
+    std::unordered_set<brpc::StreamId> watchers;
+};
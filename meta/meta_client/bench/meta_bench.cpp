@@ -0,0 +1,177 @@
+// meta server 的吞吐测试: 先并发注册一批服务器, 再按比例混合 GetServerStatus 和 SetServerStatus
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <vector>
+#include <brpc/channel.h>
+#include <bthread/bthread.h>
+#include <butil/string_splitter.h>
+#include <butil/time.h>
+#include <bvar/bvar.h>
+#include <gflags/gflags.h>
+#include "meta.pb.h"
+
+DEFINE_string(servers, "127.0.0.1:8100,127.0.0.1:8101,127.0.0.1:8102", "Addresses of all meta servers");
+DEFINE_int32(client_num, 1000, "Number of concurrent clients, each client is a bthread");
+DEFINE_string(connection_type, "single", "Connection type of the channels: single, pooled or short");
+DEFINE_int32(server_num, 10000, "Number of servers registered in the register phase");
+DEFINE_int32(duration_s, 10, "Duration of the status phase");
+DEFINE_int32(read_percent, 90, "Percent of GetServerStatus in the status phase, the rest are SetServerStatus");
+DEFINE_int32(timeout_ms, 3000, "RPC timeout");
+
+static std::vector<std::unique_ptr<brpc::Channel>> g_channels;
+static std::atomic<size_t> g_leader{0};
+
+// 发给当前认为的 leader, 返回 EPERM 或连不上时换下一个
+template <typename Call>
+static bool call_leader(Call&& call) {
+    for (size_t attempt = 0; attempt < g_channels.size() * 3; attempt++) {
+        size_t leader = g_leader.load(std::memory_order_relaxed);
+        brpc::Controller cntl;
+        meta::MetaService_Stub stub(g_channels[leader].get());
+        call(&stub, &cntl);
+        if (!cntl.Failed()) {
+            return true;
+        }
+        if (cntl.ErrorCode() != EPERM && cntl.ErrorCode() != ECONNREFUSED && cntl.ErrorCode() != EHOSTDOWN) {
+            LOG(WARNING) << "RPC failed: " << cntl.ErrorText();
+            return false;
+        }
+        g_leader.compare_exchange_strong(leader, (leader + 1) % g_channels.size());
+    }
+    return false;
+}
+
+// 每个客户端一个 bthread, 几千个并发客户端不需要几千个线程
+static void run_clients(const std::function<void(int)>& fn) {
+    struct Arg {
+        const std::function<void(int)>* fn;
+        int index;
+    };
+    std::vector<Arg> args(FLAGS_client_num);
+    std::vector<bthread_t> tids(FLAGS_client_num, INVALID_BTHREAD);
+    for (int i = 0; i < FLAGS_client_num; i++) {
+        args[i] = {&fn, i};
+        auto entry = [](void* arg) -> void* {
+            auto client = static_cast<Arg*>(arg);
+            (*client->fn)(client->index);
+            return nullptr;
+        };
+        if (bthread_start_background(&tids[i], nullptr, entry, &args[i]) != 0) {
+            LOG(ERROR) << "Fail to start client " << i;
+        }
+    }
+    for (auto tid : tids) {
+        if (tid != INVALID_BTHREAD) {
+            bthread_join(tid, nullptr);
+        }
+    }
+}
+
+static void print_phase(const char* name, int64_t ops, int64_t failed, int64_t elapsed_us,
+                        bvar::LatencyRecorder& latency) {
+    LOG(INFO) << name << ": " << ops * 1000000 / std::max<int64_t>(elapsed_us, 1) << " ops/s"
+              << ", ops=" << ops << ", failed=" << failed
+              << ", avg=" << latency.latency() << "us"
+              << ", p99=" << latency.latency_percentile(0.99) << "us";
+}
+
+int main(int argc, char* argv[]) {
+    gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+    brpc::ChannelOptions options;
+    options.timeout_ms = FLAGS_timeout_ms;
+    options.max_retry = 0;
+    options.connection_type = FLAGS_connection_type;
+    for (butil::StringSplitter sp(FLAGS_servers.c_str(), ','); sp; ++sp) {
+        std::unique_ptr<brpc::Channel> channel(new brpc::Channel);
+        const std::string addr(sp.field(), sp.length());
+        if (channel->Init(addr.c_str(), &options) != 0) {
+            LOG(ERROR) << "Fail to init channel to " << addr;
+            return -1;
+        }
+        g_channels.push_back(std::move(channel));
+    }
+    if (g_channels.empty()) {
+        LOG(ERROR) << "No meta server given";
+        return -1;
+    }
+
+    // 注册阶段, 每个请求都是一次写, 由 leader 合并成 raft 日志提交
+    std::vector<uint64_t> server_ids(FLAGS_server_num, 0);
+    std::atomic<int64_t> next{0};
+    std::atomic<int64_t> failed{0};
+    bvar::LatencyRecorder register_latency;
+    butil::Timer timer;
+    timer.start();
+    run_clients([&](int) {
+        for (int64_t i = next++; i < FLAGS_server_num; i = next++) {
+            meta::RegisterServerRequest request;
+            meta::RegisterServerResponse response;
+            request.set_hostname("bench-" + std::to_string(i));
+            request.set_rpc_port(8010);
+            request.set_instance_kind(meta::InstanceKind::TEST);
+            request.set_status(meta::ServerStatus::STARTING);
+            const int64_t begin = butil::cpuwide_time_us();
+            bool ok = call_leader([&](meta::MetaService_Stub* stub, brpc::Controller* cntl) {
+                stub->RegisterServer(cntl, &request, &response, nullptr);
+            });
+            register_latency << butil::cpuwide_time_us() - begin;
+            if (ok && response.id() != 0) {
+                server_ids[i] = response.id();
+            } else {
+                failed++;
+            }
+        }
+    });
+    timer.stop();
+    print_phase("register", FLAGS_server_num, failed.load(), timer.u_elapsed(), register_latency);
+
+    // 状态阶段, 读请求由 leader 在 lease 内直接读本地副本
+    std::atomic<int64_t> reads{0};
+    std::atomic<int64_t> writes{0};
+    failed = 0;
+    bvar::LatencyRecorder read_latency;
+    bvar::LatencyRecorder write_latency;
+    const int64_t deadline = butil::gettimeofday_us() + FLAGS_duration_s * 1000000L;
+    timer.start();
+    run_clients([&](int t) {
+        uint64_t seed = t + 1;
+        while (butil::gettimeofday_us() < deadline) {
+            seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+            const uint64_t id = server_ids[(seed >> 33) % server_ids.size()];
+            const bool is_read = static_cast<int>((seed >> 17) % 100) < FLAGS_read_percent;
+            const int64_t begin = butil::cpuwide_time_us();
+            bool ok;
+            if (is_read) {
+                meta::GetServerStatusRequest request;
+                meta::GetServerStatusResponse response;
+                request.set_id(id);
+                ok = call_leader([&](meta::MetaService_Stub* stub, brpc::Controller* cntl) {
+                    stub->GetServerStatus(cntl, &request, &response, nullptr);
+                });
+                read_latency << butil::cpuwide_time_us() - begin;
+                reads++;
+            } else {
+                meta::SetServerStatusRequest request;
+                meta::SetServerStatusResponse response;
+                request.set_id(id);
+                request.set_status((seed & 1) ? meta::ServerStatus::RUNNING : meta::ServerStatus::MAINTENANCE);
+                ok = call_leader([&](meta::MetaService_Stub* stub, brpc::Controller* cntl) {
+                    stub->SetServerStatus(cntl, &request, &response, nullptr);
+                });
+                write_latency << butil::cpuwide_time_us() - begin;
+                writes++;
+            }
+            if (!ok) {
+                failed++;
+            }
+        }
+    });
+    timer.stop();
+    print_phase("get_status", reads.load(), failed.load(), timer.u_elapsed(), read_latency);
+    print_phase("set_status", writes.load(), failed.load(), timer.u_elapsed(), write_latency);
+    LOG(INFO) << "total: " << (reads.load() + writes.load()) * 1000000 / std::max<int64_t>(timer.u_elapsed(), 1)
+              << " ops/s, failed=" << failed.load();
+    return 0;
+}
@@ -0,0 +1,43 @@
+// cluster_view.h
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "meta.pb.h"
+#include <brpc/channel.h>
+#include <brpc/stream.h>
+
+// 通过 MetaService::Watch 订阅, 在本地维护一份由 meta server 推送更新的集群视图
+class ClusterView : public brpc::StreamInputHandler {
+public:
+    explicit ClusterView(brpc::Channel *channel);
+    ~ClusterView();
+
+    // 建立订阅; 断开之后后台线程带着已看到的 revision 重新订阅
+    bool Start();
+    void Stop();
+
+    bool GetServer(uint64_t server_id, meta::ServerInfo *info);
+    std::vector<meta::ServerInfo> ListServers();
+    uint64_t Revision();
+
+    int on_received_messages(brpc::StreamId id, butil::IOBuf *const messages[], size_t size) override;
+    void on_idle_timeout(brpc::StreamId id) override;
+    void on_closed(brpc::StreamId id) override;
+
+private:
+    bool Subscribe();
+    void Run();
+
+    brpc::Channel *channel_;
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    std::unordered_map<uint64_t, meta::ServerInfo> servers_;
+    uint64_t revision_ = 0;
+    brpc::StreamId stream_ = brpc::INVALID_STREAM_ID;
+    bool running_ = false;
+    std::thread thread_;
+};
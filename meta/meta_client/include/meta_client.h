@@ -1,7 +1,13 @@
 // meta_client.h
 #pragma once
 
+#include <condition_variable>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
+#include "cluster_view.h"
 #include "meta.pb.h"
 #include "task_2.pb.h"
 #include <brpc/channel.h>
@@ -21,6 +27,17 @@ using meta::Task2Service_Stub;
 using meta::NodeLoadInfo;
 using meta::UpdateNodeLoadInfoRequest;
 using meta::UpdateNodeLoadInfoResponse;
+using meta::PickNodesRequest;
+using meta::PickNodesResponse;
+using meta::NodeRank;
+
+// 心跳和负载上报的参数. 负载稳定时上报间隔从 min_interval_ms 开始翻倍, 最大到 max_interval_ms
+// (同时不超过 meta server 返回的上限); 某一项负载变化达到 change_threshold 时回到 min_interval_ms
+struct ReportOptions {
+    int64_t min_interval_ms = 500;
+    int64_t max_interval_ms = 10000;
+    uint32_t change_threshold = 5;
+};
 
 class MetaClient {
 public:
@@ -32,6 +49,20 @@ public:
     ServerStatus GetServerStatus(uint64_t server_id);
 
     uint64_t UpdateNodeLoadInfo(NodeLoadInfo node_load_info);
+    // 最空闲的 count 个节点 (0 表示全部); 排名在本地缓存, 过期之后才重新请求 meta server
+    std::vector<NodeRank> PickNodes(uint32_t count, const std::vector<uint64_t> &exclude_ids = {});
+    void SetRankingTTL(int64_t ttl_ms);
+
+    // 后台线程定期上报心跳, 同时带上变化了的负载; 需要先注册
+    void StartReporting(const ReportOptions &options = ReportOptions());
+    void StopReporting();
+    // 记录一次负载采样, 两次上报之间的采样取平均
+    void RecordLoad(const NodeLoadInfo &load);
+
+    // 订阅集群变化, 之后的 GetCached* 读本地视图, 不再访问 meta server
+    bool WatchCluster();
+    ServerStatus GetCachedServerStatus(uint64_t server_id);
+    std::vector<meta::ServerInfo> GetCachedServers();
 
     // getter 和 setter
     uint64_t get_id() const;
@@ -39,4 +70,33 @@ public:
 private:
     uint64_t id;
     brpc::Channel channel_;
+    std::unique_ptr<ClusterView> view_;
+
+    std::mutex ranking_mtx_;
+    std::vector<NodeRank> ranking_;
+    int64_t ranking_time_ms_ = 0;
+    int64_t ranking_ttl_ms_ = 1000;
+
+    void ReportLoop();
+    static bool ParseLeader(const brpc::Controller &cntl, std::string *leader);
+    void UpdateReportChannel(const brpc::Controller &cntl);
+    // 上报失败返回 false; sent_load 表示这次带了负载
+    bool SendReport(bool *sent_load, int64_t *server_max_interval_ms);
+    static uint32_t LoadValue(const NodeLoadInfo &load, int index);
+
+    std::mutex report_mtx_;
+    std::condition_variable report_cv_;
+    // 连到 meta leader 的 channel, 为空时用 channel_; 只在上报线程中访问
+    std::unique_ptr<brpc::Channel> report_channel_;
+    std::thread reporter_;
+    bool reporting_ = false;
+    ReportOptions report_options_;
+    // 两次上报之间的采样累加, 依次是 cpu、mem、pmem、ssd
+    uint64_t load_sum_[4] = {0, 0, 0, 0};
+    uint32_t load_samples_ = 0;
+    // meta server 上已有的负载, 只有上报成功才更新
+    NodeLoadInfo reported_load_;
+    bool need_full_ = true;
+    // 负载变化达到阈值, 过了 min_interval_ms 就上报
+    bool load_changed_ = false;
 };
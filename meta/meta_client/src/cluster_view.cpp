@@ -0,0 +1,154 @@
+#include "cluster_view.h"
+#include <chrono>
+
+// 全量推送可能比较大, 放宽 stream 的窗口
+static const int64_t kWatchMaxBufSize = 64L * 1024 * 1024;
+
+ClusterView::ClusterView(brpc::Channel *channel) : channel_(channel) {}
+
+ClusterView::~ClusterView()
+{
+    Stop();
+}
+
+bool ClusterView::Start()
+{
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (running_) {
+            return true;
+        }
+        running_ = true;
+    }
+    bool ok = Subscribe();
+    thread_ = std::thread(&ClusterView::Run, this);
+    return ok;
+}
+
+void ClusterView::Stop()
+{
+    brpc::StreamId stream;
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (!running_) {
+            return;
+        }
+        running_ = false;
+        stream = stream_;
+    }
+    cv_.notify_all();
+    thread_.join();
+    if (stream == brpc::INVALID_STREAM_ID) {
+        return;
+    }
+    // 等 on_closed 回调结束, 之后才能析构
+    brpc::StreamClose(stream);
+    std::unique_lock<std::mutex> lock(mtx_);
+    cv_.wait_for(lock, std::chrono::seconds(1), [this] { return stream_ == brpc::INVALID_STREAM_ID; });
+}
+
+bool ClusterView::Subscribe()
+{
+    brpc::Controller cntl;
+    brpc::StreamId stream;
+    brpc::StreamOptions options;
+    options.handler = this;
+    options.max_buf_size = kWatchMaxBufSize;
+    if (brpc::StreamCreate(&stream, cntl, &options) != 0) {
+        return false;
+    }
+
+    meta::MetaService_Stub stub(channel_);
+    meta::WatchRequest request;
+    meta::WatchResponse response;
+    request.set_start_revision(Revision());
+    stub.Watch(&cntl, &request, &response, NULL);
+    if (cntl.Failed()) {
+        brpc::StreamClose(stream);
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mtx_);
+    stream_ = stream;
+    return true;
+}
+
+void ClusterView::Run()
+{
+    std::unique_lock<std::mutex> lock(mtx_);
+    while (running_) {
+        if (stream_ == brpc::INVALID_STREAM_ID) {
+            lock.unlock();
+            Subscribe();
+            lock.lock();
+        }
+        cv_.wait_for(lock, std::chrono::seconds(1));
+    }
+}
+
+bool ClusterView::GetServer(uint64_t server_id, meta::ServerInfo *info)
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    auto it = servers_.find(server_id);
+    if (it == servers_.end()) {
+        return false;
+    }
+    *info = it->second;
+    return true;
+}
+
+std::vector<meta::ServerInfo> ClusterView::ListServers()
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    std::vector<meta::ServerInfo> servers;
+    servers.reserve(servers_.size());
+    for (const auto &pair : servers_) {
+        servers.push_back(pair.second);
+    }
+    return servers;
+}
+
+uint64_t ClusterView::Revision()
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    return revision_;
+}
+
+int ClusterView::on_received_messages(brpc::StreamId id, butil::IOBuf *const messages[], size_t size)
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    for (size_t i = 0; i < size; i++) {
+        meta::WatchEvents events;
+        butil::IOBufAsZeroCopyInputStream wrapper(*messages[i]);
+        if (!events.ParseFromZeroCopyStream(&wrapper)) {
+            LOG(WARNING) << "Fail to parse watch events";
+            continue;
+        }
+        if (events.reset()) {
+            servers_.clear();
+        }
+        for (const auto &event : events.events()) {
+            if (event.type() == meta::ServerEvent::PUT) {
+                servers_[event.server().id()] = event.server();
+            } else {
+                servers_.erase(event.server().id());
+            }
+        }
+        if (events.reset() || events.revision() > revision_) {
+            revision_ = events.revision();
+        }
+    }
+    return 0;
+}
+
+void ClusterView::on_idle_timeout(brpc::StreamId id) {}
+
+void ClusterView::on_closed(brpc::StreamId id)
+{
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (id == stream_) {
+            stream_ = brpc::INVALID_STREAM_ID;
+        }
+    }
+    cv_.notify_all();
+}
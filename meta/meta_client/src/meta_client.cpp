@@ -1,19 +1,34 @@
 #include "meta_client.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <butil/time.h>
 
-MetaClient::MetaClient(const std::string &server_address)
+static brpc::ChannelOptions MetaChannelOptions()
 {
     brpc::ChannelOptions options;
     options.protocol = "baidu_std";
     options.connection_type = "single";
     options.timeout_ms = 1000;
     options.max_retry = 3;
-    
-    if (channel_.Init("127.0.0.1:8000", &options) != 0) {
+    return options;
+}
+
+MetaClient::MetaClient(const std::string &server_address)
+{
+    brpc::ChannelOptions options = MetaChannelOptions();
+    if (channel_.Init(server_address.c_str(), &options) != 0) {
         std::cerr << "Fail to initialize channel" << std::endl;
     }
 }
 
-MetaClient::~MetaClient() {}
+MetaClient::~MetaClient()
+{
+    // 先停掉上报和订阅, 它们都引用了 channel_
+    StopReporting();
+    view_.reset();
+}
 
 // 实现 getter 和 setter
 uint64_t MetaClient::get_id() const {
@@ -95,4 +110,285 @@ uint64_t MetaClient::UpdateNodeLoadInfo(NodeLoadInfo node_load_info)
     } else {
         return 0;
     }
-}
\ No newline at end of file
+}
+
+std::vector<NodeRank> MetaClient::PickNodes(uint32_t count, const std::vector<uint64_t> &exclude_ids)
+{
+    std::lock_guard<std::mutex> lock(ranking_mtx_);
+    const int64_t now = butil::gettimeofday_ms();
+    if (ranking_time_ms_ == 0 || now - ranking_time_ms_ >= ranking_ttl_ms_) {
+        // 缓存服务端默认权重下的完整排名, 过滤和截断在本地做
+        Task2Service_Stub stub(&channel_);
+        PickNodesRequest request;
+        PickNodesResponse response;
+        brpc::Controller cntl;
+        stub.PickNodes(&cntl, &request, &response, NULL);
+        if (!cntl.Failed()) {
+            ranking_.assign(response.nodes().begin(), response.nodes().end());
+            ranking_time_ms_ = now;
+        } else if (ranking_time_ms_ == 0) {
+            throw std::runtime_error("RPC failed");
+        }
+        // 请求失败时继续用旧的排名
+    }
+
+    std::vector<NodeRank> nodes;
+    for (const auto &node : ranking_) {
+        if (count != 0 && nodes.size() >= count) {
+            break;
+        }
+        if (std::find(exclude_ids.begin(), exclude_ids.end(), node.id()) == exclude_ids.end()) {
+            nodes.push_back(node);
+        }
+    }
+    return nodes;
+}
+
+void MetaClient::SetRankingTTL(int64_t ttl_ms)
+{
+    std::lock_guard<std::mutex> lock(ranking_mtx_);
+    ranking_ttl_ms_ = ttl_ms;
+}
+
+bool MetaClient::WatchCluster()
+{
+    if (!view_) {
+        view_.reset(new ClusterView(&channel_));
+    }
+    return view_->Start();
+}
+
+ServerStatus MetaClient::GetCachedServerStatus(uint64_t server_id)
+{
+    meta::ServerInfo info;
+    if (!view_ || !view_->GetServer(server_id, &info)) {
+        return meta::ServerStatus::UNKNOWN;
+    }
+    return info.status();
+}
+
+std::vector<meta::ServerInfo> MetaClient::GetCachedServers()
+{
+    if (!view_) {
+        return {};
+    }
+    return view_->ListServers();
+}
+
+uint32_t MetaClient::LoadValue(const NodeLoadInfo &load, int index)
+{
+    switch (index) {
+        case 0:
+            return load.cpuusage();
+        case 1:
+            return load.mem_usage();
+        case 2:
+            return load.pmem_usage();
+        default:
+            return load.ssd_usage();
+    }
+}
+
+void MetaClient::StartReporting(const ReportOptions &options)
+{
+    std::lock_guard<std::mutex> lock(report_mtx_);
+    if (reporting_) {
+        return;
+    }
+    report_options_ = options;
+    reporting_ = true;
+    reporter_ = std::thread(&MetaClient::ReportLoop, this);
+}
+
+void MetaClient::StopReporting()
+{
+    {
+        std::lock_guard<std::mutex> lock(report_mtx_);
+        if (!reporting_) {
+            return;
+        }
+        reporting_ = false;
+    }
+    report_cv_.notify_all();
+    reporter_.join();
+}
+
+void MetaClient::RecordLoad(const NodeLoadInfo &load)
+{
+    std::lock_guard<std::mutex> lock(report_mtx_);
+    for (int i = 0; i < 4; i++) {
+        const uint32_t value = LoadValue(load, i);
+        load_sum_[i] += value;
+        if (std::abs(static_cast<int64_t>(value) - LoadValue(reported_load_, i)) >=
+            report_options_.change_threshold) {
+            load_changed_ = true;
+        }
+    }
+    load_samples_++;
+    // meta server 还没有负载时尽快补上全量
+    load_changed_ = load_changed_ || need_full_;
+    if (load_changed_) {
+        report_cv_.notify_all();
+    }
+}
+
+// follower 返回 "Not leader, leader is ip:port:idx", raft 和 MetaService 用同一个端口
+bool MetaClient::ParseLeader(const brpc::Controller &cntl, std::string *leader)
+{
+    static const std::string kLeaderIs = "leader is ";
+    if (cntl.ErrorCode() != EPERM) {
+        return false;
+    }
+    const std::string &text = cntl.ErrorText();
+    auto pos = text.find(kLeaderIs);
+    if (pos == std::string::npos) {
+        return false;
+    }
+    std::string addr = text.substr(pos + kLeaderIs.size());
+    auto colon = addr.find(':');
+    if (colon == std::string::npos) {
+        return false;
+    }
+    colon = addr.find(':', colon + 1);
+    if (colon != std::string::npos) {
+        addr.resize(colon);
+    }
+    // 还没有选出 leader
+    if (addr == "0.0.0.0:0") {
+        return false;
+    }
+    *leader = addr;
+    return true;
+}
+
+// 只在上报线程中调用. 失败时如果对方告知了 leader 就改连 leader, 否则回到构造时的地址
+void MetaClient::UpdateReportChannel(const brpc::Controller &cntl)
+{
+    std::string leader;
+    if (!ParseLeader(cntl, &leader)) {
+        report_channel_.reset();
+        return;
+    }
+    std::unique_ptr<brpc::Channel> channel(new brpc::Channel);
+    brpc::ChannelOptions options = MetaChannelOptions();
+    if (channel->Init(leader.c_str(), &options) != 0) {
+        LOG(WARNING) << "Fail to initialize channel to meta leader " << leader;
+        report_channel_.reset();
+        return;
+    }
+    LOG(INFO) << "Report to meta leader " << leader;
+    report_channel_ = std::move(channel);
+}
+
+// 调用时持有 report_mtx_, 发送 rpc 时释放
+bool MetaClient::SendReport(bool *sent_load, int64_t *server_max_interval_ms)
+{
+    meta::ReportRequest request;
+    meta::ReportResponse response;
+    brpc::Controller cntl;
+
+    NodeLoadInfo current = reported_load_;
+    if (load_samples_ > 0) {
+        current.set_cpuusage(load_sum_[0] / load_samples_);
+        current.set_mem_usage(load_sum_[1] / load_samples_);
+        current.set_pmem_usage(load_sum_[2] / load_samples_);
+        current.set_ssd_usage(load_sum_[3] / load_samples_);
+    }
+    const bool full = need_full_ && load_samples_ > 0;
+    auto changed = [&](int index) {
+        return full || std::abs(static_cast<int64_t>(LoadValue(current, index)) - LoadValue(reported_load_, index)) >=
+                           report_options_.change_threshold;
+    };
+    auto *delta = request.mutable_load();
+    if (changed(0)) {
+        delta->set_cpuusage(current.cpuusage());
+    }
+    if (changed(1)) {
+        delta->set_mem_usage(current.mem_usage());
+    }
+    if (changed(2)) {
+        delta->set_pmem_usage(current.pmem_usage());
+    }
+    if (changed(3)) {
+        delta->set_ssd_usage(current.ssd_usage());
+    }
+    request.set_id(this->id);
+    request.set_timestamp(time(NULL));
+    request.set_full(full);
+    const uint32_t samples = load_samples_;
+    std::fill(std::begin(load_sum_), std::end(load_sum_), 0);
+    load_samples_ = 0;
+    load_changed_ = false;
+
+    report_mtx_.unlock();
+    // 心跳只有 leader 处理, 发到 follower 时按返回的 leader 地址重发一次
+    for (int attempt = 0; attempt < 2; attempt++) {
+        cntl.Reset();
+        MetaService_Stub stub(report_channel_ ? report_channel_.get() : &channel_);
+        stub.Report(&cntl, &request, &response, NULL);
+        if (!cntl.Failed()) {
+            break;
+        }
+        UpdateReportChannel(cntl);
+        if (!report_channel_) {
+            break;
+        }
+    }
+    report_mtx_.lock();
+
+    if (cntl.Failed()) {
+        // 这段时间的平均值作为一次采样放回去, 下次重试
+        if (samples > 0) {
+            for (int i = 0; i < 4; i++) {
+                load_sum_[i] += LoadValue(current, i);
+            }
+            load_samples_++;
+        }
+        return false;
+    }
+    // 只有发出去的项才算 meta server 已知
+    if (delta->has_cpuusage()) {
+        reported_load_.set_cpuusage(delta->cpuusage());
+    }
+    if (delta->has_mem_usage()) {
+        reported_load_.set_mem_usage(delta->mem_usage());
+    }
+    if (delta->has_pmem_usage()) {
+        reported_load_.set_pmem_usage(delta->pmem_usage());
+    }
+    if (delta->has_ssd_usage()) {
+        reported_load_.set_ssd_usage(delta->ssd_usage());
+    }
+    need_full_ = response.need_full() || (need_full_ && !full);
+    if (response.max_interval_ms() > 0) {
+        *server_max_interval_ms = response.max_interval_ms();
+    }
+    *sent_load = full || delta->ByteSizeLong() > 0;
+    return true;
+}
+
+void MetaClient::ReportLoop()
+{
+    std::unique_lock<std::mutex> lock(report_mtx_);
+    int64_t interval_ms = report_options_.min_interval_ms;
+    int64_t server_max_interval_ms = report_options_.max_interval_ms;
+    while (reporting_) {
+        const auto last_report = std::chrono::steady_clock::now();
+        bool sent_load = false;
+        if (!SendReport(&sent_load, &server_max_interval_ms)) {
+            LOG(WARNING) << "Fail to report to meta server, server id " << this->id;
+            interval_ms = report_options_.min_interval_ms;
+        } else if (sent_load) {
+            interval_ms = report_options_.min_interval_ms;
+        } else {
+            // 负载稳定, 只有心跳, 逐渐拉长间隔
+            interval_ms = std::min({interval_ms * 2, report_options_.max_interval_ms, server_max_interval_ms});
+        }
+        // 至少间隔 min_interval_ms; 之后负载变化达到阈值就提前上报
+        const auto min_deadline = last_report + std::chrono::milliseconds(report_options_.min_interval_ms);
+        const auto deadline =
+            last_report + std::chrono::milliseconds(std::max(interval_ms, report_options_.min_interval_ms));
+        report_cv_.wait_until(lock, min_deadline, [this] { return !reporting_; });
+        report_cv_.wait_until(lock, deadline, [this] { return !reporting_ || load_changed_; });
+    }
+}
@@ -1,4 +1,5 @@
 #include "cluster_manager.h"
+#include "server_registry.h"
 
 ClusterManager& ClusterManager::instance() {
     static ClusterManager instance;
@@ -7,7 +8,7 @@ ClusterManager& ClusterManager::instance() {
 
 ClusterManager::ClusterManager() {
     // Initialize ServerManagers for each InstanceKind
-    server_managers[meta::InstanceKind::TEST] = std::make_shared<ServerManager>();
+    server_managers[meta::InstanceKind::TEST] = std::make_shared<ServerManager>(meta::InstanceKind::TEST);
 }
 
 uint64_t ClusterManager::register_server(const Server& server) {
@@ -21,20 +22,37 @@ uint64_t ClusterManager::register_server(const Server& server) {
 
 ServerStatus ClusterManager::get_server_status(uint64_t server_id)
 {
-    for (auto& [instance_kind, server_manager] : server_managers) {
-        auto status = server_manager->get_server_status(server_id);
-        if (status != ServerStatus::UNKNOWN) {
-            return status;
-        }
+    // id 在所有 InstanceKind 之间唯一, 直接查索引
+    ServerStatusSnapshot snapshot;
+    if (!ServerRegistry::instance().get_status(server_id, &snapshot)) {
+        return ServerStatus::UNKNOWN;
     }
-};
+    return snapshot.status;
+}
 
 bool ClusterManager::set_server_status(uint64_t server_id, ServerStatus status)
 {
-    for (auto& [instance_kind, server_manager] : server_managers) {
-        if (server_manager->set_server_status(server_id, status)) {
-            return true;
-        }
+    ServerStatusSnapshot snapshot;
+    if (!ServerRegistry::instance().get_status(server_id, &snapshot)) {
+        return false;
+    }
+    auto it = server_managers.find(snapshot.instance_kind);
+    if (it == server_managers.end()) {
+        return false;
+    }
+    return it->second->set_server_status(server_id, status);
+}
+
+bool ClusterManager::compare_and_set_status(uint64_t server_id, const std::vector<ServerStatus>& expected,
+                                            ServerStatus status)
+{
+    ServerStatusSnapshot snapshot;
+    if (!ServerRegistry::instance().get_status(server_id, &snapshot)) {
+        return false;
+    }
+    auto it = server_managers.find(snapshot.instance_kind);
+    if (it == server_managers.end()) {
+        return false;
     }
-    return false;
+    return it->second->compare_and_set_status(server_id, expected, status);
 }
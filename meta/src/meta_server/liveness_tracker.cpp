@@ -0,0 +1,132 @@
+#include "liveness_tracker.h"
+#include <algorithm>
+#include <chrono>
+#include <butil/logging.h>
+#include <butil/time.h>
+#include <gflags/gflags.h>
+#include "cluster_manager.h"
+#include "meta_state_machine.h"
+#include "server_registry.h"
+
+DEFINE_int32(heartbeat_timeout_s, 30, "Servers without a report in this many seconds are marked TIMEOUT");
+
+static int64_t timeout_ms() {
+    return FLAGS_heartbeat_timeout_s * 1000L;
+}
+
+static bool is_alive(meta::ServerStatus status) {
+    return status == meta::ServerStatus::STARTING || status == meta::ServerStatus::RUNNING;
+}
+
+LivenessTracker& LivenessTracker::instance() {
+    static LivenessTracker instance;
+    return instance;
+}
+
+void LivenessTracker::start() {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (running) {
+        return;
+    }
+    running = true;
+    checker = std::thread(&LivenessTracker::run, this);
+}
+
+void LivenessTracker::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (!running) {
+            return;
+        }
+        running = false;
+    }
+    cv.notify_all();
+    checker.join();
+}
+
+uint32_t LivenessTracker::max_report_interval_ms() const {
+    // 留出两次上报失败的余量
+    return static_cast<uint32_t>(timeout_ms() / 3);
+}
+
+void LivenessTracker::heartbeat(uint64_t server_id) {
+    const int64_t now = butil::gettimeofday_ms();
+    std::lock_guard<std::mutex> lock(mtx);
+    auto [it, inserted] = last_seen.try_emplace(server_id, now);
+    it->second = now;
+    if (inserted) {
+        deadlines.emplace(now + timeout_ms(), server_id);
+    }
+}
+
+void LivenessTracker::reset(int64_t term, int64_t now_ms) {
+    last_seen.clear();
+    deadlines = decltype(deadlines)();
+    tracked_term = term;
+    if (term < 0) {
+        return;
+    }
+    for (const auto& snapshot : ServerRegistry::instance().list_status()) {
+        if (is_alive(snapshot.status)) {
+            last_seen[snapshot.id] = now_ms;
+            deadlines.emplace(now_ms + timeout_ms(), snapshot.id);
+        }
+    }
+}
+
+std::vector<uint64_t> LivenessTracker::check(int64_t now_ms) {
+    std::vector<uint64_t> expired;
+    while (!deadlines.empty() && deadlines.top().first <= now_ms) {
+        const uint64_t server_id = deadlines.top().second;
+        deadlines.pop();
+        auto it = last_seen.find(server_id);
+        if (it == last_seen.end()) {
+            continue;
+        }
+        if (it->second + timeout_ms() > now_ms) {
+            deadlines.emplace(it->second + timeout_ms(), server_id);
+            continue;
+        }
+        // 下次心跳时重新跟踪
+        last_seen.erase(it);
+        expired.push_back(server_id);
+    }
+    return expired;
+}
+
+void LivenessTracker::run() {
+    std::unique_lock<std::mutex> lock(mtx);
+    while (running) {
+        const int64_t now = butil::gettimeofday_ms();
+        const int64_t term = meta::MetaStateMachine::instance().term();
+        if (term != tracked_term) {
+            reset(term, now);
+        }
+        std::vector<uint64_t> expired;
+        if (term >= 0) {
+            expired = check(now);
+        }
+        if (!expired.empty()) {
+            lock.unlock();
+            for (auto server_id : expired) {
+                ServerStatusSnapshot snapshot;
+                if (ServerRegistry::instance().get_status(server_id, &snapshot) && is_alive(snapshot.status)) {
+                    LOG(WARNING) << "Server " << server_id << " has no report in " << FLAGS_heartbeat_timeout_s
+                                 << "s, mark it TIMEOUT";
+                    // 检查之后客户端可能又改了状态 (例如 STOPPING), 只在 apply 时仍然在服务状态才改成 TIMEOUT
+                    ClusterManager::instance().compare_and_set_status(
+                        server_id, {meta::ServerStatus::STARTING, meta::ServerStatus::RUNNING},
+                        meta::ServerStatus::TIMEOUT);
+                }
+            }
+            lock.lock();
+            continue;
+        }
+        // 睡到最近的截止时间, 最多 1 秒, 以便及时发现 leader 变化
+        int64_t wait_ms = 1000;
+        if (!deadlines.empty()) {
+            wait_ms = std::min(wait_ms, std::max<int64_t>(deadlines.top().first - now, 0));
+        }
+        cv.wait_for(lock, std::chrono::milliseconds(wait_ms));
+    }
+}
@@ -1,10 +1,22 @@
+#include "liveness_tracker.h"
 #include "meta_server.h"
+#include "meta_state_machine.h"
 #include "task2_service_impl.h"
+#include <braft/raft.h>
 #include <brpc/server.h>
+#include <gflags/gflags.h>
 #include <unordered_map>
 #include <mutex>
 
+DEFINE_int32(port, 8000, "Listen port of meta server, raft also uses this port");
+
 int main(int argc, char* argv[]) {
+    gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+    // 状态机回放日志和加载快照之前, 所有 MetaMap 都要注册好
+    ClusterManager::instance();
+    ResourceManager::instance();
+
     brpc::Server server;
 
     MetaServiceImpl meta_service_impl;
@@ -17,13 +29,24 @@ int main(int argc, char* argv[]) {
         LOG(ERROR) << "Failed to add service";
         return -1;
     }
+    if (braft::add_service(&server, FLAGS_port) != 0) {
+        LOG(ERROR) << "Failed to add raft service";
+        return -1;
+    }
 
     brpc::ServerOptions options;
-    if (server.Start(8000, &options) != 0) {
+    if (server.Start(FLAGS_port, &options) != 0) {
         LOG(ERROR) << "Failed to start server";
         return -1;
     }
+    if (meta::MetaStateMachine::instance().start(FLAGS_port) != 0) {
+        LOG(ERROR) << "Failed to start meta state machine";
+        return -1;
+    }
+    LivenessTracker::instance().start();
 
     server.RunUntilAskedToQuit();
-    return 0; 
-}
\ No newline at end of file
+    LivenessTracker::instance().stop();
+    meta::MetaStateMachine::instance().shutdown();
+    return 0;
+}
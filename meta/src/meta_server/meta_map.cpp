@@ -1,5 +1,23 @@
 #include "meta_map.h"
+#include "meta_state_machine.h"
 
 namespace meta {
 
+MetaMapBase::MetaMapBase(const std::string& name) : map_name(name) {
+    MetaStateMachine::instance().register_map(this);
+}
+
+MetaMapBase::~MetaMapBase() {
+    MetaStateMachine::instance().unregister_map(this);
+}
+
+bool MetaMapBase::propose(MetaOp::Type type, std::string key, std::string value) {
+    MetaOp op;
+    op.set_type(type);
+    op.set_map_name(map_name);
+    op.set_key(std::move(key));
+    op.set_value(std::move(value));
+    return MetaStateMachine::instance().propose(std::move(op));
+}
+
 }
@@ -1,4 +1,26 @@
 #include "meta_server.h"
+#include "liveness_tracker.h"
+#include "meta_state_machine.h"
+#include "resource_manager.h"
+#include "server_registry.h"
+#include "watch_hub.h"
+
+// 订阅者的 stream 只用来推送, 关闭时从 WatchHub 中移除
+class WatchStreamHandler : public brpc::StreamInputHandler {
+public:
+    int on_received_messages(brpc::StreamId id, butil::IOBuf *const messages[], size_t size) override
+    {
+        return 0;
+    }
+    void on_idle_timeout(brpc::StreamId id) override
+    {}
+    void on_closed(brpc::StreamId id) override
+    {
+        WatchHub::instance().unsubscribe(id);
+    }
+};
+
+static WatchStreamHandler g_watch_stream_handler;
 
 MetaServiceImpl::~MetaServiceImpl()
 {}
@@ -7,8 +29,15 @@ void MetaServiceImpl::RegisterServer(google::protobuf::RpcController *cntl_base,
                                      google::protobuf::Closure *done)
 {
     brpc::ClosureGuard done_guard(done);
+    auto cntl = static_cast<brpc::Controller *>(cntl_base);
+    if (!meta::check_leader(cntl, false)) {
+        return;
+    }
     auto server = Server::from(*request);
     uint64_t server_id = ClusterManager::instance().register_server(server);
+    if (server_id == 0) {
+        response->set_message("Fail to register server");
+    }
     response->set_id(server_id);
 }
 
@@ -24,6 +53,10 @@ void MetaServiceImpl::GetServerStatus(google::protobuf::RpcController *cntl_base
                                       google::protobuf::Closure *done)
 {
     brpc::ClosureGuard done_guard(done);
+    // leader lease 有效时直接读本地副本
+    if (!meta::check_leader(static_cast<brpc::Controller *>(cntl_base), true)) {
+        return;
+    }
     auto server_id = request->id();
     auto server_status = ClusterManager::instance().get_server_status(server_id);
     response->set_status(server_status);
@@ -34,6 +67,9 @@ void MetaServiceImpl::SetServerStatus(google::protobuf::RpcController *cntl_base
                                       google::protobuf::Closure *done)
 {
     brpc::ClosureGuard done_guard(done);
+    if (!meta::check_leader(static_cast<brpc::Controller *>(cntl_base), false)) {
+        return;
+    }
     auto server_id = request->id();
     auto server_status = request->status();
     auto old_status = ClusterManager::instance().get_server_status(server_id);
@@ -42,4 +78,54 @@ void MetaServiceImpl::SetServerStatus(google::protobuf::RpcController *cntl_base
         // 重启服务
     }
     response->set_status(server_status);
-}
\ No newline at end of file
+}
+
+void MetaServiceImpl::Watch(google::protobuf::RpcController *cntl_base, const meta::WatchRequest *request,
+                            meta::WatchResponse *response, google::protobuf::Closure *done)
+{
+    brpc::ClosureGuard done_guard(done);
+    auto cntl = static_cast<brpc::Controller *>(cntl_base);
+    // 任意副本都可以订阅, 推送的是该副本 apply 的变化; revision 是 raft 日志 index, 换副本之后可以接着订阅
+    brpc::StreamId stream;
+    brpc::StreamOptions options;
+    options.handler = &g_watch_stream_handler;
+    if (brpc::StreamAccept(&stream, *cntl, &options) != 0) {
+        cntl->SetFailed(EINVAL, "Fail to accept watch stream");
+        return;
+    }
+    response->set_revision(meta::MetaStateMachine::instance().revision());
+    // 先回复, stream 建立之后再推送
+    done_guard.reset(nullptr);
+    WatchHub::instance().subscribe(stream, request->start_revision());
+}
+
+void MetaServiceImpl::Report(google::protobuf::RpcController *cntl_base, const meta::ReportRequest *request,
+                             meta::ReportResponse *response, google::protobuf::Closure *done)
+{
+    brpc::ClosureGuard done_guard(done);
+    auto cntl = static_cast<brpc::Controller *>(cntl_base);
+    // 心跳只在 leader 上跟踪
+    if (!meta::check_leader(cntl, false)) {
+        return;
+    }
+    auto server_id = request->id();
+    ServerStatusSnapshot snapshot;
+    if (!ServerRegistry::instance().get_status(server_id, &snapshot)) {
+        cntl->SetFailed(ENOENT, "Server %lu is not registered", server_id);
+        return;
+    }
+    LivenessTracker::instance().heartbeat(server_id);
+    if (snapshot.status == meta::ServerStatus::TIMEOUT) {
+        // 超时之后又恢复上报
+        ClusterManager::instance().compare_and_set_status(server_id, {meta::ServerStatus::TIMEOUT},
+                                                          meta::ServerStatus::RUNNING);
+    }
+    bool need_full = false;
+    if (!ResourceManager::instance().apply_load_delta(server_id, request->load(), request->full(), &need_full)) {
+        cntl->SetFailed(EAGAIN, "Fail to update load of server %lu", server_id);
+        return;
+    }
+    response->set_timestamp(time(NULL));
+    response->set_need_full(need_full);
+    response->set_max_interval_ms(LivenessTracker::instance().max_report_interval_ms());
+}
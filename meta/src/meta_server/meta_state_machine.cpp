@@ -0,0 +1,425 @@
+#include "meta_state_machine.h"
+#include <memory>
+#include <stdexcept>
+#include <braft/storage.h>
+#include <braft/util.h>
+#include <brpc/closure_guard.h>
+#include <butil/files/file_enumerator.h>
+#include <butil/files/file_path.h>
+#include <butil/file_util.h>
+#include <butil/iobuf.h>
+#include <bthread/bthread.h>
+#include <rocksdb/db.h>
+#include <rocksdb/write_batch.h>
+
+DEFINE_string(meta_raft_peers, "",
+              "Initial raft configuration, e.g. 127.0.0.1:8100:0,127.0.0.1:8101:0,127.0.0.1:8102:0. "
+              "Empty means running standalone without raft");
+DEFINE_string(meta_raft_ip, "", "IP of this peer in meta_raft_peers, empty means butil::my_ip()");
+DEFINE_string(meta_raft_group, "meta", "Id of the raft group");
+DEFINE_string(meta_raft_data_path, "./meta_data", "Directory of raft log, raft meta and snapshots");
+DEFINE_int32(meta_election_timeout_ms, 1000, "Raft election timeout, leader lease is derived from it");
+DEFINE_int32(meta_snapshot_interval_s, 3600, "Interval between two raft snapshots");
+DEFINE_int32(meta_max_batch, 256, "Max number of meta writes coalesced into one raft log entry");
+DEFINE_int32(meta_max_inflight_batches, 4, "Max number of proposed but not yet applied raft log entries");
+
+namespace braft {
+DECLARE_bool(raft_enable_leader_lease);
+}
+
+namespace meta {
+
+static const std::string kSnapshotDb = "meta_rocksdb";
+
+MetaStateMachine& MetaStateMachine::instance() {
+    static MetaStateMachine instance;
+    return instance;
+}
+
+int MetaStateMachine::start(int port) {
+    if (FLAGS_meta_raft_peers.empty()) {
+        LOG(INFO) << "meta_raft_peers is empty, meta server runs standalone";
+        return 0;
+    }
+    butil::EndPoint addr(butil::my_ip(), port);
+    if (!FLAGS_meta_raft_ip.empty() && butil::str2ip(FLAGS_meta_raft_ip.c_str(), &addr.ip) != 0) {
+        LOG(ERROR) << "Invalid meta_raft_ip " << FLAGS_meta_raft_ip;
+        return -1;
+    }
+    // 本地读依赖 leader lease
+    braft::FLAGS_raft_enable_leader_lease = true;
+
+    braft::NodeOptions options;
+    if (options.initial_conf.parse_from(FLAGS_meta_raft_peers) != 0) {
+        LOG(ERROR) << "Fail to parse meta_raft_peers " << FLAGS_meta_raft_peers;
+        return -1;
+    }
+    options.election_timeout_ms = FLAGS_meta_election_timeout_ms;
+    options.fsm = this;
+    options.node_owns_fsm = false;
+    options.snapshot_interval_s = FLAGS_meta_snapshot_interval_s;
+    const std::string prefix = "local://" + FLAGS_meta_raft_data_path;
+    options.log_uri = prefix + "/log";
+    options.raft_meta_uri = prefix + "/raft_meta";
+    options.snapshot_uri = prefix + "/snapshot";
+
+    auto raft_node = new braft::Node(FLAGS_meta_raft_group, braft::PeerId(addr));
+    if (raft_node->init(options) != 0) {
+        LOG(ERROR) << "Fail to init raft node " << addr;
+        delete raft_node;
+        return -1;
+    }
+    node.store(raft_node);
+    proposer = std::thread(&MetaStateMachine::propose_loop, this);
+    return 0;
+}
+
+void MetaStateMachine::shutdown() {
+    braft::Node* raft_node = node.load();
+    if (raft_node == nullptr) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(queue_mtx);
+        stopping = true;
+    }
+    queue_cv.notify_all();
+    proposer.join();
+    // 还没提交的写操作直接失败, 已提交的由 node 关闭时回调
+    std::deque<PendingOp*> pending;
+    {
+        std::lock_guard<std::mutex> lock(queue_mtx);
+        pending.swap(queue);
+    }
+    for (auto op : pending) {
+        op->ok = false;
+        op->event.signal();
+    }
+    raft_node->shutdown(nullptr);
+    raft_node->join();
+    node.store(nullptr);
+    delete raft_node;
+}
+
+void MetaStateMachine::register_map(MetaMapBase* map) {
+    std::lock_guard<std::mutex> lock(maps_mtx);
+    if (!maps.emplace(map->name(), map).second) {
+        throw std::runtime_error("Meta map with same name already exists: " + map->name());
+    }
+}
+
+void MetaStateMachine::unregister_map(MetaMapBase* map) {
+    std::lock_guard<std::mutex> lock(maps_mtx);
+    auto it = maps.find(map->name());
+    if (it != maps.end() && it->second == map) {
+        maps.erase(it);
+    }
+}
+
+bool MetaStateMachine::propose(MetaOp&& op) {
+    if (FLAGS_meta_raft_peers.empty()) {
+        std::lock_guard<std::mutex> lock(standalone_mtx);
+        applied_revision.fetch_add(1, std::memory_order_acq_rel);
+        try {
+            apply_op(op);
+        } catch (std::exception& e) {
+            LOG(ERROR) << e.what();
+            return false;
+        }
+        return true;
+    }
+    if (!is_leader()) {
+        return false;
+    }
+    PendingOp pending;
+    pending.op = std::move(op);
+    {
+        std::lock_guard<std::mutex> lock(queue_mtx);
+        if (stopping) {
+            return false;
+        }
+        queue.push_back(&pending);
+    }
+    queue_cv.notify_one();
+    pending.event.wait();
+    return pending.ok;
+}
+
+void MetaStateMachine::propose_loop() {
+    while (true) {
+        std::unique_ptr<BatchClosure> batch(new BatchClosure(this));
+        {
+            std::unique_lock<std::mutex> lock(queue_mtx);
+            queue_cv.wait(lock, [this] {
+                return stopping || (!queue.empty() && inflight_batches < FLAGS_meta_max_inflight_batches);
+            });
+            if (stopping) {
+                return;
+            }
+            while (!queue.empty() && batch->ops.size() < static_cast<size_t>(FLAGS_meta_max_batch)) {
+                batch->ops.push_back(queue.front());
+                queue.pop_front();
+            }
+            inflight_batches++;
+        }
+
+        // 失去 leader 身份之后的日志由 expected_term 拒绝
+        const int64_t term = leader_term.load(std::memory_order_acquire);
+        if (term < 0) {
+            batch->status().set_error(EPERM, "Not leader");
+            batch.release()->Run();
+            continue;
+        }
+        MetaLogEntry entry;
+        for (auto op : batch->ops) {
+            entry.add_ops()->Swap(&op->op);
+        }
+        butil::IOBuf data;
+        butil::IOBufAsZeroCopyOutputStream wrapper(&data);
+        if (!entry.SerializeToZeroCopyStream(&wrapper)) {
+            batch->status().set_error(EINVAL, "Fail to serialize meta log entry");
+            batch.release()->Run();
+            continue;
+        }
+        braft::Task task;
+        task.data = &data;
+        task.done = batch.release();
+        task.expected_term = term;
+        node.load()->apply(task);
+    }
+}
+
+void MetaStateMachine::BatchClosure::Run() {
+    std::unique_ptr<BatchClosure> self_guard(this);
+    const bool ok = status().ok();
+    if (!ok) {
+        LOG(WARNING) << "Fail to commit " << ops.size() << " meta ops: " << status();
+    }
+    for (auto op : ops) {
+        op->ok = ok;
+        op->event.signal();
+    }
+    fsm->finish_batch();
+}
+
+void MetaStateMachine::finish_batch() {
+    {
+        std::lock_guard<std::mutex> lock(queue_mtx);
+        inflight_batches--;
+    }
+    queue_cv.notify_one();
+}
+
+void MetaStateMachine::apply_op(const MetaOp& op) {
+    MetaMapBase* map = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(maps_mtx);
+        auto it = maps.find(op.map_name());
+        if (it != maps.end()) {
+            map = it->second;
+        }
+    }
+    if (map == nullptr) {
+        LOG(WARNING) << "Skip op of unknown meta map " << op.map_name();
+        return;
+    }
+    switch (op.type()) {
+        case MetaOp::PUT:
+            map->apply_put(op.key(), op.value());
+            break;
+        case MetaOp::UPDATE:
+            map->apply_update(op.key(), op.value());
+            break;
+        default:
+            map->apply_erase(op.key());
+            break;
+    }
+}
+
+void MetaStateMachine::on_apply(braft::Iterator& iter) {
+    for (; iter.valid(); iter.next()) {
+        // leader 上的 done 在 apply 之后执行, 唤醒等待的写操作
+        braft::AsyncClosureGuard done_guard(iter.done());
+        MetaLogEntry entry;
+        butil::IOBufAsZeroCopyInputStream wrapper(iter.data());
+        if (!entry.ParseFromZeroCopyStream(&wrapper)) {
+            LOG(ERROR) << "Fail to parse meta log entry at index " << iter.index();
+            iter.set_error_and_rollback();
+            return;
+        }
+        applied_revision.store(iter.index(), std::memory_order_release);
+        try {
+            for (const auto& op : entry.ops()) {
+                apply_op(op);
+            }
+        } catch (std::exception& e) {
+            LOG(ERROR) << "Fail to apply meta log entry at index " << iter.index() << ": " << e.what();
+            iter.set_error_and_rollback();
+            return;
+        }
+    }
+}
+
+struct SnapshotArg {
+    braft::SnapshotWriter* writer;
+    braft::Closure* done;
+    std::vector<std::pair<std::string, std::string>> entries;
+};
+
+// 在 bthread 里写 RocksDB, 不阻塞后续日志的 apply
+static void* save_snapshot(void* arg) {
+    std::unique_ptr<SnapshotArg> snapshot(static_cast<SnapshotArg*>(arg));
+    brpc::ClosureGuard done_guard(snapshot->done);
+    const std::string path = snapshot->writer->get_path() + "/" + kSnapshotDb;
+
+    rocksdb::Options options;
+    options.create_if_missing = true;
+    options.error_if_exists = true;
+    rocksdb::DB* db = nullptr;
+    auto status = rocksdb::DB::Open(options, path, &db);
+    if (!status.ok()) {
+        snapshot->done->status().set_error(EIO, "Fail to open %s: %s", path.c_str(), status.ToString().c_str());
+        return nullptr;
+    }
+    std::unique_ptr<rocksdb::DB> db_guard(db);
+    rocksdb::WriteBatch batch;
+    for (const auto& entry : snapshot->entries) {
+        batch.Put(entry.first, entry.second);
+    }
+    status = db->Write(rocksdb::WriteOptions(), &batch);
+    if (status.ok()) {
+        status = db->Flush(rocksdb::FlushOptions());
+    }
+    if (status.ok()) {
+        status = db->Close();
+    }
+    if (!status.ok()) {
+        snapshot->done->status().set_error(EIO, "Fail to write %s: %s", path.c_str(), status.ToString().c_str());
+        return nullptr;
+    }
+    db_guard.reset();
+
+    butil::FileEnumerator files(butil::FilePath(path), false, butil::FileEnumerator::FILES);
+    for (auto file = files.Next(); !file.empty(); file = files.Next()) {
+        if (snapshot->writer->add_file(kSnapshotDb + "/" + file.BaseName().value()) != 0) {
+            snapshot->done->status().set_error(EIO, "Fail to add file %s to snapshot", file.value().c_str());
+            return nullptr;
+        }
+    }
+    return nullptr;
+}
+
+void MetaStateMachine::on_snapshot_save(braft::SnapshotWriter* writer, braft::Closure* done) {
+    // 在状态机线程里拷贝所有 map, 这时不会有 apply 和它并发
+    auto snapshot = new SnapshotArg{writer, done, {}};
+    {
+        std::lock_guard<std::mutex> lock(maps_mtx);
+        for (const auto& [name, map] : maps) {
+            map->dump([&](const std::string& key, const std::string& value) {
+                std::string db_key = name;
+                db_key.push_back('\0');
+                db_key.append(key);
+                snapshot->entries.emplace_back(std::move(db_key), value);
+            });
+        }
+    }
+    bthread_t tid;
+    if (bthread_start_urgent(&tid, nullptr, save_snapshot, snapshot) != 0) {
+        PLOG(ERROR) << "Fail to start bthread";
+        save_snapshot(snapshot);
+    }
+}
+
+int MetaStateMachine::on_snapshot_load(braft::SnapshotReader* reader) {
+    CHECK(!is_leader()) << "Leader is not supposed to load snapshot";
+    braft::SnapshotMeta snapshot_meta;
+    if (reader->load_meta(&snapshot_meta) != 0) {
+        LOG(ERROR) << "Fail to load snapshot meta";
+        return -1;
+    }
+    applied_revision.store(snapshot_meta.last_included_index(), std::memory_order_release);
+    const std::string path = reader->get_path() + "/" + kSnapshotDb;
+    rocksdb::DB* db = nullptr;
+    auto status = rocksdb::DB::OpenForReadOnly(rocksdb::Options(), path, &db);
+    if (!status.ok()) {
+        LOG(ERROR) << "Fail to open " << path << ": " << status.ToString();
+        return -1;
+    }
+    std::unique_ptr<rocksdb::DB> db_guard(db);
+
+    std::lock_guard<std::mutex> lock(maps_mtx);
+    for (const auto& pair : maps) {
+        pair.second->clear_local();
+    }
+    std::unique_ptr<rocksdb::Iterator> it(db->NewIterator(rocksdb::ReadOptions()));
+    try {
+        for (it->SeekToFirst(); it->Valid(); it->Next()) {
+            const std::string db_key = it->key().ToString();
+            const size_t pos = db_key.find('\0');
+            auto map = pos == std::string::npos ? maps.end() : maps.find(db_key.substr(0, pos));
+            if (map == maps.end()) {
+                LOG(WARNING) << "Skip snapshot entry of unknown meta map";
+                continue;
+            }
+            map->second->apply_put(db_key.substr(pos + 1), it->value().ToString());
+        }
+    } catch (std::exception& e) {
+        LOG(ERROR) << "Fail to load snapshot " << path << ": " << e.what();
+        return -1;
+    }
+    if (!it->status().ok()) {
+        LOG(ERROR) << "Fail to read " << path << ": " << it->status().ToString();
+        return -1;
+    }
+    return 0;
+}
+
+void MetaStateMachine::on_leader_start(int64_t term) {
+    leader_term.store(term, std::memory_order_release);
+    LOG(INFO) << "Meta node becomes leader, term " << term;
+}
+
+void MetaStateMachine::on_leader_stop(const butil::Status& status) {
+    leader_term.store(-1, std::memory_order_release);
+    LOG(INFO) << "Meta node steps down: " << status;
+}
+
+void MetaStateMachine::on_error(const braft::Error& e) {
+    LOG(ERROR) << "Meta state machine meets error: " << e;
+}
+
+bool MetaStateMachine::is_leader() const {
+    return FLAGS_meta_raft_peers.empty() || leader_term.load(std::memory_order_acquire) > 0;
+}
+
+bool MetaStateMachine::lease_valid() const {
+    if (FLAGS_meta_raft_peers.empty()) {
+        return true;
+    }
+    braft::Node* raft_node = node.load();
+    if (raft_node == nullptr) {
+        return false;
+    }
+    braft::LeaderLeaseStatus status;
+    raft_node->get_leader_lease_status(&status);
+    return status.state == braft::LEASE_VALID && status.term == leader_term.load(std::memory_order_acquire);
+}
+
+std::string MetaStateMachine::leader_addr() const {
+    braft::Node* raft_node = node.load();
+    if (raft_node == nullptr) {
+        return "unknown";
+    }
+    return raft_node->leader_id().to_string();
+}
+
+bool check_leader(brpc::Controller* cntl, bool read) {
+    auto& fsm = MetaStateMachine::instance();
+    if (read ? fsm.lease_valid() : fsm.is_leader()) {
+        return true;
+    }
+    cntl->SetFailed(EPERM, "Not leader, leader is %s", fsm.leader_addr().c_str());
+    return false;
+}
+
+}
@@ -0,0 +1,42 @@
+#include "node_load_history.h"
+#include <algorithm>
+#include <cmath>
+
+NodeLoadHistory::NodeLoadHistory(size_t capacity, double ewma_window_s)
+    : samples(std::max<size_t>(capacity, 1)), window(std::max(ewma_window_s, 1.0)) {}
+
+void NodeLoadHistory::add(const meta::NodeLoadInfo& load) {
+    if (count == 0) {
+        smoothed = {static_cast<double>(load.cpuusage()), static_cast<double>(load.mem_usage()),
+                    static_cast<double>(load.pmem_usage()), static_cast<double>(load.ssd_usage())};
+    } else {
+        // 间隔越长, 新样本的权重越大
+        const double dt = load.timestamp() > last_ts ? static_cast<double>(load.timestamp() - last_ts) : 1.0;
+        const double alpha = 1.0 - std::exp(-dt / window);
+        smoothed.cpu += alpha * (load.cpuusage() - smoothed.cpu);
+        smoothed.mem += alpha * (load.mem_usage() - smoothed.mem);
+        smoothed.pmem += alpha * (load.pmem_usage() - smoothed.pmem);
+        smoothed.ssd += alpha * (load.ssd_usage() - smoothed.ssd);
+    }
+    last_ts = std::max(last_ts, load.timestamp());
+
+    samples[head] = load;
+    head = (head + 1) % samples.size();
+    count = std::min(count + 1, samples.size());
+}
+
+meta::NodeLoadInfo NodeLoadHistory::peak(uint64_t now, uint64_t window_s) const {
+    meta::NodeLoadInfo result;
+    for (size_t i = 0; i < count; i++) {
+        const auto& sample = samples[(head + samples.size() - 1 - i) % samples.size()];
+        if (sample.timestamp() + window_s < now && i > 0) {
+            break;
+        }
+        result.set_cpuusage(std::max(result.cpuusage(), sample.cpuusage()));
+        result.set_mem_usage(std::max(result.mem_usage(), sample.mem_usage()));
+        result.set_pmem_usage(std::max(result.pmem_usage(), sample.pmem_usage()));
+        result.set_ssd_usage(std::max(result.ssd_usage(), sample.ssd_usage()));
+        result.set_timestamp(std::max(result.timestamp(), sample.timestamp()));
+    }
+    return result;
+}
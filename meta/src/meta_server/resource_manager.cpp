@@ -1,16 +1,147 @@
 #include "resource_manager.h"
+#include <algorithm>
+#include <ctime>
+#include <mutex>
+#include <unordered_set>
+#include <gflags/gflags.h>
+#include "server_registry.h"
+
+DEFINE_int32(load_history_size, 60, "Number of recent load reports kept per node");
+DEFINE_int32(load_ewma_window_s, 30, "Time constant of the load EWMA");
+DEFINE_int32(load_peak_window_s, 60, "Window of the pmem/ssd peak used by headroom checks");
+DEFINE_int32(load_stale_s, 30, "Nodes without a load report in this many seconds are not picked");
+DEFINE_int32(load_cpu_weight, 1, "Default weight of cpu usage when picking nodes");
+DEFINE_int32(load_mem_weight, 1, "Default weight of memory usage when picking nodes");
+DEFINE_int32(load_pmem_weight, 2, "Default weight of pmem usage when picking nodes");
+DEFINE_int32(load_ssd_weight, 2, "Default weight of ssd usage when picking nodes");
 
 ResourceManager& ResourceManager::instance() {
     static ResourceManager instance;
     return instance;
 }
 
-ResourceManager::ResourceManager() {
+ResourceManager::ResourceManager() : nodeLoadInfoMap("node_load_info") {
+    nodeLoadInfoMap.set_listener([this](const ServerID& server_id, const NodeLoadInfo* load) {
+        on_load_update(server_id, load);
+    });
 }
 
 uint64_t ResourceManager::update_node_load_info(ServerID server_id, const NodeLoadInfo& NodeLoadInfo)
 {
-    // nodeLoadInfoMap.nodeloadinfomap().insert(server_id, NodeLoadInfo);
-    nodeLoadInfoMap[server_id] = NodeLoadInfo;
-    return 0;
+    // 用 leader 的时钟打时间戳, 随日志复制, 各副本上的历史一致
+    meta::NodeLoadInfo load = NodeLoadInfo;
+    load.set_timestamp(static_cast<uint64_t>(time(NULL)));
+    if (!nodeLoadInfoMap.insert(server_id, load)) {
+        return 0;
+    }
+    return server_id;
+}
+
+bool ResourceManager::apply_load_delta(ServerID server_id, const meta::LoadDelta& delta, bool full, bool* need_full)
+{
+    *need_full = false;
+    NodeLoadInfo load;
+    const bool found = nodeLoadInfoMap.get(server_id, &load);
+    if (!found && !full) {
+        *need_full = true;
+        return true;
+    }
+    bool changed = !found;
+    auto merge = [&changed](bool has, uint32_t value, uint32_t old, auto set) {
+        if (has && value != old) {
+            set(value);
+            changed = true;
+        }
+    };
+    merge(delta.has_cpuusage(), delta.cpuusage(), load.cpuusage(), [&load](uint32_t v) { load.set_cpuusage(v); });
+    merge(delta.has_mem_usage(), delta.mem_usage(), load.mem_usage(), [&load](uint32_t v) { load.set_mem_usage(v); });
+    merge(delta.has_pmem_usage(), delta.pmem_usage(), load.pmem_usage(),
+          [&load](uint32_t v) { load.set_pmem_usage(v); });
+    merge(delta.has_ssd_usage(), delta.ssd_usage(), load.ssd_usage(), [&load](uint32_t v) { load.set_ssd_usage(v); });
+    // 负载没变时不写日志, 上报本身只作为心跳; 但要在 pick_nodes 认为它过期之前刷新一次时间戳
+    const uint64_t now = static_cast<uint64_t>(time(NULL));
+    if (!changed && load.timestamp() + FLAGS_load_stale_s / 2 > now) {
+        return true;
+    }
+    return update_node_load_info(server_id, load) != 0;
+}
+
+void ResourceManager::on_load_update(ServerID server_id, const NodeLoadInfo* load)
+{
+    std::unique_lock<std::shared_mutex> lock(history_mtx);
+    if (load == nullptr) {
+        history.erase(server_id);
+        return;
+    }
+    auto it = history.find(server_id);
+    if (it == history.end()) {
+        it = history.emplace(server_id, NodeLoadHistory(FLAGS_load_history_size, FLAGS_load_ewma_window_s)).first;
+    }
+    it->second.add(*load);
+}
+
+static bool is_serving(meta::ServerStatus status)
+{
+    return status == meta::ServerStatus::STARTING || status == meta::ServerStatus::RUNNING;
+}
+
+void ResourceManager::pick_nodes(const meta::PickNodesRequest& request, meta::PickNodesResponse* response)
+{
+    const uint64_t now = static_cast<uint64_t>(time(NULL));
+    double cpu_weight = request.cpu_weight();
+    double mem_weight = request.mem_weight();
+    double pmem_weight = request.pmem_weight();
+    double ssd_weight = request.ssd_weight();
+    if (cpu_weight + mem_weight + pmem_weight + ssd_weight == 0) {
+        cpu_weight = FLAGS_load_cpu_weight;
+        mem_weight = FLAGS_load_mem_weight;
+        pmem_weight = FLAGS_load_pmem_weight;
+        ssd_weight = FLAGS_load_ssd_weight;
+    }
+    const double total_weight = std::max(cpu_weight + mem_weight + pmem_weight + ssd_weight, 1.0);
+    const std::unordered_set<uint64_t> excluded(request.exclude_ids().begin(), request.exclude_ids().end());
+
+    std::vector<meta::NodeRank> ranks;
+    {
+        std::shared_lock<std::shared_mutex> lock(history_mtx);
+        ranks.reserve(history.size());
+        for (const auto& [server_id, node] : history) {
+            if (excluded.count(server_id) != 0 || node.last_timestamp() + FLAGS_load_stale_s < now) {
+                continue;
+            }
+            // 没有注册的节点只看负载
+            ServerStatusSnapshot snapshot;
+            if (ServerRegistry::instance().get_status(server_id, &snapshot) && !is_serving(snapshot.status)) {
+                continue;
+            }
+            const auto peak = node.peak(now, FLAGS_load_peak_window_s);
+            if (100 - std::min(peak.pmem_usage(), 100U) < request.min_pmem_headroom() ||
+                100 - std::min(peak.ssd_usage(), 100U) < request.min_ssd_headroom()) {
+                continue;
+            }
+            const auto& ewma = node.ewma();
+            meta::NodeRank rank;
+            rank.set_id(server_id);
+            rank.set_score((cpu_weight * ewma.cpu + mem_weight * ewma.mem + pmem_weight * ewma.pmem +
+                            ssd_weight * ewma.ssd) / total_weight);
+            auto load = rank.mutable_load();
+            load->set_cpuusage(static_cast<uint32_t>(ewma.cpu + 0.5));
+            load->set_mem_usage(static_cast<uint32_t>(ewma.mem + 0.5));
+            load->set_pmem_usage(static_cast<uint32_t>(ewma.pmem + 0.5));
+            load->set_ssd_usage(static_cast<uint32_t>(ewma.ssd + 0.5));
+            load->set_timestamp(node.last_timestamp());
+            *rank.mutable_peak() = peak;
+            ranks.push_back(std::move(rank));
+        }
+    }
+
+    const auto by_score = [](const meta::NodeRank& a, const meta::NodeRank& b) {
+        return a.score() != b.score() ? a.score() < b.score() : a.id() < b.id();
+    };
+    size_t count = request.count() == 0 ? ranks.size() : std::min<size_t>(request.count(), ranks.size());
+    std::partial_sort(ranks.begin(), ranks.begin() + count, ranks.end(), by_score);
+    for (size_t i = 0; i < count; i++) {
+        *response->add_nodes() = std::move(ranks[i]);
+    }
+    response->set_timestamp(now);
 }
@@ -1,43 +1,65 @@
 #include "server_list.h"
+#include <algorithm>
+#include "meta_state_machine.h"
+#include "server_registry.h"
+#include "watch_hub.h"
 
-void ServerList::add_server(const Server& server) {
-    std::lock_guard<std::mutex> lock(mtx);
-
-    // Check if server with same id already exists
-    for (auto& srv : servers) {
-        if (srv.id == server.id) {
-            throw std::runtime_error("Server with same ID already exists.");
+ServerList::ServerList(const std::string& name) : servers(name) {
+    // 每次 apply 之后更新索引, 并把变化推送给订阅者
+    servers.set_listener([](const uint64_t& id, const meta::ServerInfo* info) {
+        const uint64_t revision = meta::MetaStateMachine::instance().revision();
+        if (info != nullptr) {
+            ServerRegistry::instance().put(*info, revision);
+        } else {
+            ServerRegistry::instance().erase(id);
         }
-    }
-
-    servers.push_back(server);
+        WatchHub::instance().publish(revision, id, info);
+    });
+    servers.set_updater([](meta::ServerInfo* info, const std::string& arg) {
+        meta::ServerStatusUpdate update;
+        if (!update.ParseFromString(arg)) {
+            throw std::runtime_error("Fail to decode server status update");
+        }
+        if (update.expected_size() > 0 &&
+            std::find(update.expected().begin(), update.expected().end(), info->status()) == update.expected().end()) {
+            return false;
+        }
+        if (info->status() == update.status()) {
+            return false;
+        }
+        info->set_status(update.status());
+        return true;
+    });
 }
 
-void ServerList::update_server_status(uint64_t id, meta::ServerStatus status) {
-    std::lock_guard<std::mutex> lock(mtx);
-
-    // Find the server with the given id and update its status
-    for (auto& srv : servers) {
-        if (srv.id == id) {
-            srv.status = status;
-            return; // Exit the loop after updating status
-        }
-    }
+bool ServerList::add_server(const Server& server) {
+    return servers.insert(server.id, server.to_info());
+}
 
+bool ServerList::update_server_status(uint64_t id, meta::ServerStatus status) {
     // If server with given id not found, throw an exception
-    throw std::runtime_error("Server with specified ID not found.");
+    if (ServerRegistry::instance().get(id) == nullptr) {
+        throw std::runtime_error("Server with specified ID not found.");
+    }
+    // 只提交状态, 在 apply 时修改当前的 ServerInfo, 不会覆盖并发提交的其他修改
+    return compare_and_set_status(id, {}, status);
 }
 
-Server ServerList::get_server_by_id(uint64_t id) {
-    std::lock_guard<std::mutex> lock(mtx);
-
-    // Find the server with the given id and return it
-    for (auto& srv : servers) {
-        if (srv.id == id) {
-            return srv;
-        }
+bool ServerList::compare_and_set_status(uint64_t id, const std::vector<meta::ServerStatus>& expected,
+                                        meta::ServerStatus status) {
+    meta::ServerStatusUpdate update;
+    update.set_status(status);
+    for (auto s : expected) {
+        update.add_expected(s);
     }
+    return servers.update(id, update.SerializeAsString());
+}
 
+Server ServerList::get_server_by_id(uint64_t id) {
+    auto info = ServerRegistry::instance().get(id);
     // If server with given id not found, throw an exception
-    throw std::runtime_error("Server with specified ID not found.");
-}
\ No newline at end of file
+    if (info == nullptr) {
+        throw std::runtime_error("Server with specified ID not found.");
+    }
+    return Server::from(*info);
+}
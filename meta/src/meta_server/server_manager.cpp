@@ -1,18 +1,23 @@
 #include "server_manager.h"
+#include "server_registry.h"
 
-ServerManager::ServerManager() : server_id_generator(1) {}
+ServerManager::ServerManager(meta::InstanceKind instance_kind)
+    : server_list("servers/" + meta::InstanceKind_Name(instance_kind)) {}
 
 uint64_t ServerManager::add_server(const Server& server) {
-    std::lock_guard<std::mutex> lock(mtx);
-    if (server.id != 0) {
-        server_list.add_server(server);
-        return server.id;
-    } else {
-        Server new_server = server;
-        new_server.id = server_id_generator++;
-        server_list.add_server(new_server);
-        return new_server.id;
+    auto& registry = ServerRegistry::instance();
+    Server new_server = server;
+    if (new_server.id == 0) {
+        new_server.id = registry.allocate_id();
+    } else if (!registry.reserve(new_server.id)) {
+        // Check if server with same id already exists
+        throw std::runtime_error("Server with same ID already exists.");
     }
+    if (!server_list.add_server(new_server)) {
+        registry.release(new_server.id);
+        return 0;
+    }
+    return new_server.id;
 }
 
 Server ServerManager::get_server_by_id(uint64_t server_id) {
@@ -20,14 +25,22 @@ Server ServerManager::get_server_by_id(uint64_t server_id) {
 }
 
 ServerStatus ServerManager::get_server_status(uint64_t server_id) {
-    return server_list.get_server_by_id(server_id).status;
+    ServerStatusSnapshot snapshot;
+    if (!ServerRegistry::instance().get_status(server_id, &snapshot)) {
+        return ServerStatus::UNKNOWN;
+    }
+    return snapshot.status;
 }
 
 bool ServerManager::set_server_status(uint64_t server_id, ServerStatus status) {
     try {
-        server_list.update_server_status(server_id, status);
-        return true;
+        return server_list.update_server_status(server_id, status);
     } catch (std::runtime_error& e) {
         return false;
     }
 }
+
+bool ServerManager::compare_and_set_status(uint64_t server_id, const std::vector<ServerStatus>& expected,
+                                           ServerStatus status) {
+    return server_list.compare_and_set_status(server_id, expected, status);
+}
@@ -0,0 +1,103 @@
+#include "server_registry.h"
+#include <mutex>
+
+ServerRegistry& ServerRegistry::instance() {
+    static ServerRegistry instance;
+    return instance;
+}
+
+void ServerRegistry::put(const meta::ServerInfo& info, uint64_t revision) {
+    auto ptr = std::make_shared<const meta::ServerInfo>(info);
+    auto& s = shard(info.id());
+    {
+        std::unique_lock<std::shared_mutex> lock(s.mtx);
+        auto& entry = s.servers[info.id()];
+        if (entry.info == nullptr) {
+            server_count.fetch_add(1, std::memory_order_relaxed);
+        }
+        entry.info = std::move(ptr);
+        entry.snapshot = {info.id(), info.instance_kind(), info.status(), revision};
+    }
+    uint64_t cur = max_id.load(std::memory_order_relaxed);
+    while (cur < info.id() && !max_id.compare_exchange_weak(cur, info.id(), std::memory_order_relaxed)) {
+    }
+}
+
+void ServerRegistry::erase(uint64_t id) {
+    auto& s = shard(id);
+    std::unique_lock<std::shared_mutex> lock(s.mtx);
+    auto it = s.servers.find(id);
+    if (it != s.servers.end() && it->second.info != nullptr) {
+        s.servers.erase(it);
+        server_count.fetch_sub(1, std::memory_order_relaxed);
+    }
+}
+
+bool ServerRegistry::get_status(uint64_t id, ServerStatusSnapshot* snapshot) const {
+    auto& s = shard(id);
+    std::shared_lock<std::shared_mutex> lock(s.mtx);
+    auto it = s.servers.find(id);
+    if (it == s.servers.end() || it->second.info == nullptr) {
+        return false;
+    }
+    *snapshot = it->second.snapshot;
+    return true;
+}
+
+std::shared_ptr<const meta::ServerInfo> ServerRegistry::get(uint64_t id) const {
+    auto& s = shard(id);
+    std::shared_lock<std::shared_mutex> lock(s.mtx);
+    auto it = s.servers.find(id);
+    if (it == s.servers.end()) {
+        return nullptr;
+    }
+    return it->second.info;
+}
+
+size_t ServerRegistry::size() const {
+    return server_count.load(std::memory_order_relaxed);
+}
+
+std::vector<ServerStatusSnapshot> ServerRegistry::list_status() const {
+    std::vector<ServerStatusSnapshot> result;
+    result.reserve(size());
+    for (const auto& s : shards) {
+        std::shared_lock<std::shared_mutex> lock(s.mtx);
+        for (const auto& pair : s.servers) {
+            if (pair.second.info != nullptr) {
+                result.push_back(pair.second.snapshot);
+            }
+        }
+    }
+    return result;
+}
+
+uint64_t ServerRegistry::allocate_id() {
+    while (true) {
+        // 保证新 id 大于所有已 apply 的 id
+        uint64_t floor = max_id.load(std::memory_order_relaxed) + 1;
+        uint64_t cur = next_id.load(std::memory_order_relaxed);
+        while (cur < floor && !next_id.compare_exchange_weak(cur, floor, std::memory_order_relaxed)) {
+        }
+        uint64_t id = next_id.fetch_add(1, std::memory_order_relaxed);
+        // 显式指定的 id 可能已经占用了它
+        if (reserve(id)) {
+            return id;
+        }
+    }
+}
+
+bool ServerRegistry::reserve(uint64_t id) {
+    auto& s = shard(id);
+    std::unique_lock<std::shared_mutex> lock(s.mtx);
+    return s.servers.emplace(id, Entry{nullptr, {}}).second;
+}
+
+void ServerRegistry::release(uint64_t id) {
+    auto& s = shard(id);
+    std::unique_lock<std::shared_mutex> lock(s.mtx);
+    auto it = s.servers.find(id);
+    if (it != s.servers.end() && it->second.info == nullptr) {
+        s.servers.erase(it);
+    }
+}
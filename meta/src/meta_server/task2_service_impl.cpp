@@ -1,4 +1,5 @@
 #include "task2_service_impl.h"
+#include "meta_state_machine.h"
 
 Task2ServiceImpl::~Task2ServiceImpl()
 {}
@@ -8,8 +9,19 @@ void Task2ServiceImpl::UpdateNodeLoadInfo(google::protobuf::RpcController *cntl_
                                          google::protobuf::Closure *done)
 {
     brpc::ClosureGuard done_guard(done);
+    if (!meta::check_leader(static_cast<brpc::Controller *>(cntl_base), false)) {
+        return;
+    }
     auto server_id = request->id();
     auto node_load_info = request->nodeloadinfo();
     ResourceManager::instance().update_node_load_info(server_id, node_load_info);
     response->set_id(server_id);
-}
\ No newline at end of file
+}
+
+void Task2ServiceImpl::PickNodes(google::protobuf::RpcController *cntl_base, const meta::PickNodesRequest *request,
+                                 meta::PickNodesResponse *response, google::protobuf::Closure *done)
+{
+    brpc::ClosureGuard done_guard(done);
+    // 负载本身是近似值, 任意副本都可以回答, 不要求 leader lease
+    ResourceManager::instance().pick_nodes(*request, response);
+}
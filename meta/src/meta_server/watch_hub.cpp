@@ -0,0 +1,111 @@
+#include "watch_hub.h"
+#include <vector>
+#include <butil/iobuf.h>
+#include <gflags/gflags.h>
+
+DEFINE_int32(watch_history_size, 100000, "Number of recent server events kept for resuming watchers");
+
+WatchHub& WatchHub::instance() {
+    static WatchHub instance;
+    return instance;
+}
+
+bool WatchHub::write(brpc::StreamId stream, const meta::WatchEvents& events) {
+    butil::IOBuf buf;
+    butil::IOBufAsZeroCopyOutputStream wrapper(&buf);
+    if (!events.SerializeToZeroCopyStream(&wrapper)) {
+        return false;
+    }
+    return brpc::StreamWrite(stream, buf) == 0;
+}
+
+void WatchHub::publish(uint64_t rev, uint64_t server_id, const meta::ServerInfo* info) {
+    std::vector<brpc::StreamId> broken;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        meta::WatchEvents events;
+        events.set_revision(rev);
+        auto event = events.add_events();
+        event->set_revision(rev);
+        if (info != nullptr) {
+            event->set_type(meta::ServerEvent::PUT);
+            *event->mutable_server() = *info;
+            servers[server_id] = *info;
+        } else {
+            event->set_type(meta::ServerEvent::DELETE);
+            event->mutable_server()->set_id(server_id);
+            servers.erase(server_id);
+        }
+
+        // 重启后第一次变化之前的历史是未知的, 同一个 revision 可能是快照加载出来的全量
+        if (!has_history) {
+            has_history = true;
+            history_start = rev;
+        }
+        revision = rev;
+        history.push_back(*event);
+        while (history.size() > static_cast<size_t>(FLAGS_watch_history_size)) {
+            // 同一个 revision 的变化可能只淘汰了一部分, 只能从下一个 revision 开始续订
+            history_start = history.front().revision + 1;
+            history.pop_front();
+        }
+
+        for (auto stream : watchers) {
+            if (!write(stream, events)) {
+                broken.push_back(stream);
+            }
+        }
+        for (auto stream : broken) {
+            watchers.erase(stream);
+        }
+    }
+    for (auto stream : broken) {
+        LOG(WARNING) << "Watcher stream " << stream << " is full or closed, close it";
+        brpc::StreamClose(stream);
+    }
+}
+
+uint64_t WatchHub::subscribe(brpc::StreamId stream, uint64_t start_revision) {
+    uint64_t current;
+    bool ok = true;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        current = revision;
+        meta::WatchEvents events;
+        events.set_revision(revision);
+        if (start_revision != 0 && has_history && start_revision >= history_start && start_revision <= revision) {
+            // 一条 raft 日志中的多个操作共享一个 revision, 客户端可能只收到了其中一部分,
+            // 所以从 start_revision 本身开始重发, 重复的变化按 id 覆盖是幂等的
+            for (const auto& event : history) {
+                if (event.revision() >= start_revision) {
+                    *events.add_events() = event;
+                }
+            }
+        } else if (start_revision != revision || !has_history) {
+            // 历史不够或者客户端来自更新的副本, 推送全量
+            events.set_reset(true);
+            for (const auto& pair : servers) {
+                auto event = events.add_events();
+                event->set_type(meta::ServerEvent::PUT);
+                event->set_revision(revision);
+                *event->mutable_server() = pair.second;
+            }
+        }
+        if (events.reset() || events.events_size() > 0) {
+            ok = write(stream, events);
+        }
+        if (ok) {
+            watchers.insert(stream);
+        }
+    }
+    if (!ok) {
+        LOG(WARNING) << "Fail to write initial events to watcher stream " << stream;
+        brpc::StreamClose(stream);
+    }
+    return current;
+}
+
+void WatchHub::unsubscribe(brpc::StreamId stream) {
+    std::lock_guard<std::mutex> lock(mtx);
+    watchers.erase(stream);
+}
@@ -22,6 +22,8 @@ int main(int argc, char* argv[]) {
     brpc::Channel channel;
 
     MetaClient client("http://127.0.0.1:8000");
+    // 订阅集群变化, 本地视图由 meta server 推送更新
+    client.WatchCluster();
     auto id = client.RegisterServer();
     LOG(INFO) << "Server id: " << id;
 
@@ -34,6 +36,8 @@ int main(int argc, char* argv[]) {
     status = client.GetServerStatus(client.get_id());
     sleep(1); // wait for server to update status
     LOG(INFO) << "Server status after setting: " << status;
+    LOG(INFO) << "Cached server status: " << client.GetCachedServerStatus(client.get_id())
+              << ", cached servers: " << client.GetCachedServers().size();
 
     NodeLoadInfo node_load_info;
     node_load_info.set_cpuusage(0.5);
@@ -44,6 +48,17 @@ int main(int argc, char* argv[]) {
     id = client.UpdateNodeLoadInfo(node_load_info);
     LOG(INFO) << "Server id: " << id;
 
+    // 后台上报心跳和负载, 负载只在变化时带上
+    client.StartReporting();
+    client.RecordLoad(node_load_info);
+    sleep(1);
+
+    // 按负载挑选节点, 排名在客户端缓存
+    for (const auto &node : client.PickNodes(3)) {
+        LOG(INFO) << "Picked node " << node.id() << ", score " << node.score();
+    }
+
+    client.StopReporting();
     google::ShutdownGoogleLogging();
     
     return 0;
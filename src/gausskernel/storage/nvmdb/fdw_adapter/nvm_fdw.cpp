@@ -19,6 +19,8 @@
 #include "parser/parsetree.h"
 #include "access/sysattr.h"
 #include "storage/ipc.h"
+#include "storage/buf/block.h"
+#include "vecexecutor/vecnodes.h"
 
 // 重新定义 google log
 #undef LOG
@@ -26,11 +28,26 @@
 #undef FATAL
 #define LOG(severity) COMPACT_GOOGLE_LOG_ ## severity.stream()
 
+#include <algorithm>
 #include <map>
 
 namespace NVMDB {
-DECLARE_int64(cache_size);
-DECLARE_int64(cache_elasticity);
+DECLARE_int64(tuple_cache_bytes);
+DECLARE_bool(group_commit);
+DECLARE_int64(group_commit_max_wait_us);
+DECLARE_int64(group_commit_max_batch);
+DECLARE_int32(recovery_threads_per_dir);
+DECLARE_bool(heap_bulk_load);
+DECLARE_int32(heap_parallel_scan_workers);
+DECLARE_int32(heap_parallel_scan_min_extents);
+DECLARE_bool(change_stream);
+DECLARE_int64(change_stream_batch_bytes);
+DECLARE_int64(change_stream_flush_interval_us);
+DECLARE_int64(change_stream_tx_max_bytes);
+DECLARE_string(heap_tier_dir);
+DECLARE_int64(heap_tier_ssd_bytes);
+DECLARE_int64(heap_tier_pmem_limit_bytes);
+DECLARE_int32(heap_tier_cold_rounds);
 }
 
 void InitNvmThread();
@@ -106,7 +123,8 @@ static const char *g_nvmdbErrcodeStr[] = {
     "index not support nullable col",
     "index size over limit",
     "col size over limit",
-    "index not support expr"
+    "index not support expr",
+    "too many indexes"
 };
 
 static inline const char *NvmGetErrcodeStr(NVM_ERRCODE err) {
@@ -191,7 +209,50 @@ void NvmThreadlocalTableMapClear() {
     g_nvmdbTableLocal.Clear();
 }
 
-void NvmDropTable(Oid oid) {
+/*
+ * DROP TABLE / DROP INDEX / TRUNCATE 只登记, 事务提交时才真正执行, 回滚时丢弃.
+ * 子事务回滚时丢弃它登记的操作, 子事务提交时并入父事务.
+ */
+enum class NvmPendingKind {
+    DROP_TABLE,
+    DROP_INDEX,
+    TRUNCATE,
+};
+
+struct NvmPendingDDL {
+    NvmPendingKind kind;
+    Oid tableOid;
+    Oid indexOid;   // 只有 DROP_INDEX 有效
+    SubTransactionId subId;
+    NVMDB::uint32 reservedTrees;    // 只有 TRUNCATE 有效, 为清空的索引预留的 PACTree 槽位
+};
+thread_local std::vector<NvmPendingDDL> g_nvmPendingDDLs;
+
+static void NvmAddPendingDDL(NvmPendingKind kind, Oid tableOid, Oid indexOid, NVMDB::uint32 reservedTrees = 0) {
+    g_nvmPendingDDLs.push_back({kind, tableOid, indexOid, GetCurrentSubTransactionId(), reservedTrees});
+}
+
+static bool NvmIsPendingTruncate(Oid tableOid) {
+    for (auto &ddl : g_nvmPendingDDLs) {
+        if (ddl.kind == NvmPendingKind::TRUNCATE && ddl.tableOid == tableOid) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// 删除索引树; 其他会话可能还拿着 index, 等 csn 之前开始的事务都结束后再释放
+static void NvmDropIndex(Oid tableOid, Oid indexOid, uint64 csn) {
+    std::lock_guard<std::mutex> lock_guard(g_tableMutex);
+    NVMDB::NVMIndex *index = nullptr;
+    auto iter = g_nvmdbTable.Find(tableOid);
+    if (iter != g_nvmdbTable.End()) {
+        index = iter->second->DelIndex(indexOid);
+    }
+    NVMDB::RetireIndexTree(indexOid, index, csn);
+}
+
+static void NvmDropTable(Oid oid, uint64 csn) {
     auto iter = g_nvmdbTableLocal.Find(oid);
     if (iter != g_nvmdbTableLocal.End()) {
         g_nvmdbTableLocal.Erase(iter);
@@ -200,13 +261,83 @@ void NvmDropTable(Oid oid) {
     std::lock_guard<std::mutex> lock_guard(g_tableMutex);
     iter = g_nvmdbTable.Find(oid);
     if (iter != g_nvmdbTable.End()) {
-        iter->second->Dropped();
+        NVMDB::Table *table = iter->second;
+        while (table->GetIndexCount() > 0) {
+            auto *index = table->DelIndex(table->GetIndex(0)->Id());
+            NVMDB::RetireIndexTree(index->Id(), index, csn);
+        }
+        table->Dropped();
         g_nvmdbTable.Erase(iter);
     }
 
     NVMDB::g_heapSpace->DropTable(oid);
 }
 
+// 提交时仍然持有 AccessExclusiveLock, 没有并发访问, 索引个数与登记时相同
+static void NvmTruncateTable(Oid oid, uint64 csn, NVMDB::uint32 reservedTrees) {
+    std::lock_guard<std::mutex> lock_guard(g_tableMutex);
+    auto iter = g_nvmdbTable.Find(oid);
+    if (iter == g_nvmdbTable.End()) {
+        NVMDB::UnreserveIndexTrees(reservedTrees);
+        return;
+    }
+    NVMDB::Table *table = iter->second;
+    DCHECK(table->GetIndexCount() == reservedTrees);
+    NVMDB::HeapTruncate(table);
+    for (NVMDB::NVMIndex *index : table->GetIndexes()) {
+        index->Truncate(csn);
+    }
+}
+
+static void NvmApplyPendingDDLs() {
+    if (g_nvmPendingDDLs.empty()) {
+        return;
+    }
+    // 提交之后开始的事务快照都大于 csn, 看不到被删除的表和索引
+    uint64 csn = NVMDB::ProcessArray::GetGlobalProcArray()->getGlobalCSN();
+    for (auto &ddl : g_nvmPendingDDLs) {
+        switch (ddl.kind) {
+            case NvmPendingKind::DROP_TABLE:
+                NvmDropTable(ddl.tableOid, csn);
+                break;
+            case NvmPendingKind::DROP_INDEX:
+                NvmDropIndex(ddl.tableOid, ddl.indexOid, csn);
+                break;
+            case NvmPendingKind::TRUNCATE:
+                NvmTruncateTable(ddl.tableOid, csn, ddl.reservedTrees);
+                break;
+        }
+    }
+    g_nvmPendingDDLs.clear();
+}
+
+static void NvmDiscardPendingDDLs() {
+    for (auto &ddl : g_nvmPendingDDLs) {
+        NVMDB::UnreserveIndexTrees(ddl.reservedTrees);
+    }
+    g_nvmPendingDDLs.clear();
+}
+
+static void NvmSubxactPendingDDLs(SubXactEvent event, SubTransactionId mySubid, SubTransactionId parentSubid) {
+    if (event == SUBXACT_EVENT_ABORT_SUB) {
+        auto iter = g_nvmPendingDDLs.begin();
+        while (iter != g_nvmPendingDDLs.end()) {
+            if (iter->subId != mySubid) {
+                ++iter;
+                continue;
+            }
+            NVMDB::UnreserveIndexTrees(iter->reservedTrees);
+            iter = g_nvmPendingDDLs.erase(iter);
+        }
+    } else if (event == SUBXACT_EVENT_COMMIT_SUB) {
+        for (auto &ddl : g_nvmPendingDDLs) {
+            if (ddl.subId == mySubid) {
+                ddl.subId = parentSubid;
+            }
+        }
+    }
+}
+
 NVMDB::Table *NvmGetTableByOid(Oid oid) {
     // 检查Table定义是否在本地缓存中
     auto iter = g_nvmdbTableLocal.Find(oid);
@@ -272,6 +403,10 @@ NVMDB::Table *NvmGetTableByOid(Oid oid) {
         NVMDB::uint64 index_len = 0;
         Oid indexOid = lfirst_oid(l);
         auto *index = new (std::nothrow) NVMDB::NVMIndex(indexOid);
+        if (unlikely(!index->HasTree())) {
+            ereport(ERROR, (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED), errmodule(MOD_NVM),
+                            errmsg("too many NVM indexes, cannot open index %u", indexOid)));
+        }
         Relation indexRel = RelationIdGetRelation(indexOid);
         uint32 colCount = indexRel->rd_index->indnatts;
         auto *indexDesc = NVMDB::IndexDescCreate(colCount);
@@ -305,6 +440,11 @@ static inline NVMDB::Table *NvmGetTableByOidWrapper(Oid oid) {
     if (unlikely(table == nullptr)) {
         ereport(ERROR, (errcode(ERRCODE_T_R_SERIALIZATION_FAILURE), errmsg("Get nvm table fail(%d)!", static_cast<int>(NVM_ERRCODE::NVM_ERRCODE_TABLE_NOT_FOUND))));
     }
+    // TRUNCATE 到提交时才清空数据, 之前本事务看到的还是原来的行, 写入的行也会被清空
+    if (unlikely(NvmIsPendingTruncate(oid))) {
+        ereport(ERROR, (errcode(ERRCODE_FDW_OPERATION_NOT_SUPPORTED), errmodule(MOD_NVM),
+                        errmsg("cannot access NVM table %u after TRUNCATE in the same transaction", oid)));
+    }
     return table;
 }
 
@@ -534,9 +674,63 @@ NVMDB::Transaction *NVMGetCurrentTxContext() {
     return u_sess->nvm_cxt.m_nvmTx;
 }
 
+/*
+ * COPY FROM 出错时执行器直接释放内存上下文, 不会走到 EndForeignModify.
+ * 登记还没有释放的批量导入, 创建它的 (子) 事务回滚时释放, 顶层事务结束时释放剩下的.
+ */
+thread_local std::vector<std::pair<NVMDB::HeapBulkLoader *, SubTransactionId>> g_nvmBulkLoaders;
+
+static NVMDB::HeapBulkLoader *NVMBulkLoaderCreate(NVMDB::Transaction *tx, NVMDB::Table *table) {
+    auto *loader = new NVMDB::HeapBulkLoader(tx, table);
+    g_nvmBulkLoaders.emplace_back(loader, GetCurrentSubTransactionId());
+    return loader;
+}
+
+static void NVMBulkLoaderFree(NVMDB::HeapBulkLoader *loader) {
+    if (loader == nullptr) {
+        return;
+    }
+    auto iter = std::find_if(g_nvmBulkLoaders.begin(), g_nvmBulkLoaders.end(),
+                             [loader](const std::pair<NVMDB::HeapBulkLoader *, SubTransactionId> &entry) {
+                                 return entry.first == loader;
+                             });
+    DCHECK(iter != g_nvmBulkLoaders.end());
+    if (iter != g_nvmBulkLoaders.end()) {
+        g_nvmBulkLoaders.erase(iter);
+    }
+    delete loader;
+}
+
+// subId 为 InvalidSubTransactionId 时释放全部
+static void NVMBulkLoaderCleanup(SubTransactionId subId) {
+    auto iter = g_nvmBulkLoaders.begin();
+    while (iter != g_nvmBulkLoaders.end()) {
+        if (subId == InvalidSubTransactionId || iter->second == subId) {
+            delete iter->first;
+            iter = g_nvmBulkLoaders.erase(iter);
+        } else {
+            ++iter;
+        }
+    }
+}
+
+static void NVMBulkLoaderSubxact(SubXactEvent event, SubTransactionId mySubid, SubTransactionId parentSubid) {
+    if (event == SUBXACT_EVENT_ABORT_SUB) {
+        NVMBulkLoaderCleanup(mySubid);
+    } else if (event == SUBXACT_EVENT_COMMIT_SUB) {
+        for (auto &entry : g_nvmBulkLoaders) {
+            if (entry.second == mySubid) {
+                entry.second = parentSubid;
+            }
+        }
+    }
+}
+
 void NVMStateFree(NVMFdwState *nvmState) {
     if (nvmState != nullptr) {
         delete nvmState->mIter;
+        delete nvmState->mScanFilter;
+        NVMBulkLoaderFree(nvmState->mBulkLoader);
 
         if (nvmState->mAttrsUsed != nullptr) {
             pfree(nvmState->mAttrsUsed);
@@ -679,10 +873,7 @@ void NVMColUpdateData(NVMDB::RAMTuple &tuple, uint16 colIndex, Datum datum, Oid
 }
 
 void NVMInsertTuple2AllIndex(NVMDB::Transaction *tx, NVMDB::Table *table, NVMDB::RAMTuple *tuple, NVMDB::RowId rowId) {
-    uint32 count = table->GetIndexCount();
-
-    for (uint32 i = 0; i < count; i++) {
-        auto *index = table->GetIndex(i);
+    for (auto *index : table->GetIndexes()) {
         CHECK(index != nullptr);
         NVMDB::DRAMIndexTuple indexTuple(table->GetColDesc(), index->GetIndexDesc(), index->GetColCount(), index->GetRowLen());
 
@@ -692,11 +883,21 @@ void NVMInsertTuple2AllIndex(NVMDB::Transaction *tx, NVMDB::Table *table, NVMDB:
     }
 }
 
-void NVMDeleteTupleFromAllIndex(NVMDB::Transaction *tx, NVMDB::Table *table, NVMDB::RAMTuple *tuple, NVMDB::RowId rowId) {
-    uint32 count = table->GetIndexCount();
+// COPY FROM: 行和所有索引键都交给批量导入, 在 Finish 时写入
+void NVMBulkLoadTuple(NVMDB::HeapBulkLoader *loader, NVMDB::Table *table, NVMDB::RAMTuple *tuple) {
+    auto rowId = loader->Insert(tuple);
+    for (auto *index : table->GetIndexes()) {
+        CHECK(index != nullptr);
+        NVMDB::DRAMIndexTuple indexTuple(table->GetColDesc(), index->GetIndexDesc(), index->GetColCount(), index->GetRowLen());
+
+        indexTuple.ExtractFromTuple(tuple);
+
+        loader->IndexInsert(index, &indexTuple, rowId);
+    }
+}
 
-    for (uint32 i = 0; i < count; i++) {
-        NVMDB::NVMIndex *index = table->GetIndex(i);
+void NVMDeleteTupleFromAllIndex(NVMDB::Transaction *tx, NVMDB::Table *table, NVMDB::RAMTuple *tuple, NVMDB::RowId rowId) {
+    for (NVMDB::NVMIndex *index : table->GetIndexes()) {
         CHECK(index != nullptr);
 
         NVMDB::DRAMIndexTuple indexTuple(table->GetColDesc(), index->GetIndexDesc(), index->GetColCount(), index->GetRowLen());
@@ -723,13 +924,15 @@ void NVMDeleteTupleFromIndex(NVMDB::Transaction *tx, NVMDB::Table *table, NVMDB:
     tx->IndexDelete(index, &indexTuple, rowId);
 }
 
-void NVMFillSlotByTuple(TupleTableSlot *slot, NVMDB::Table *table, NVMDB::RAMTuple *tuple) {
-    TupleDesc tupdesc = slot->tts_tupleDescriptor;
+// 变长类型的 Datum 直接指向 tuple 中的数据, 使用期间 tuple 必须有效
+// attrsUsed 不为空时只转换其中的列, 其余列填为 NULL
+void NVMFillDatumsByTuple(TupleDesc tupdesc, NVMDB::Table *table, NVMDB::RAMTuple *tuple, Datum *values,
+                          bool *isnull, const uint8 *attrsUsed = nullptr) {
     uint64 cols = table->GetColCount();
 
     for (uint64 i = 0; i < cols; i++) {
-        slot->tts_isnull[i] = tuple->IsNull(i);
-        if (slot->tts_isnull[i]) {
+        isnull[i] = tuple->IsNull(i) || (attrsUsed != nullptr && !BITMAP_GET(attrsUsed, i));
+        if (isnull[i]) {
             continue;
         }
         switch (tupdesc->attrs[i].atttypid) {
@@ -742,26 +945,31 @@ void NVMFillSlotByTuple(TupleTableSlot *slot, NVMDB::Table *table, NVMDB::RAMTup
                 auto *result = (bytea *)data;
                 uint32 len = *(uint32 *)data;
                 SET_VARSIZE(result, len + VARHDRSZ);
-                slot->tts_values[i] = PointerGetDatum(result);
+                values[i] = PointerGetDatum(result);
                 break;
             }
             case NUMERICOID: {
                 auto *d = (DecimalSt *)(tuple->GetCol(i));
-                slot->tts_values[i] = NumericGetDatum(NVMNumericToPG(d));
+                values[i] = NumericGetDatum(NVMNumericToPG(d));
                 break;
             }
             case INTERVALOID:
             case TINTERVALOID:
             case TIMETZOID:
-                slot->tts_values[i] = (Datum)(tuple->GetCol(i));
+                values[i] = (Datum)(tuple->GetCol(i));
                 break;
             default:
-                tuple->GetCol(i, (char *)&(slot->tts_values[i]));
+                tuple->GetCol(i, (char *)&(values[i]));
                 break;
         }
     }
 }
 
+void NVMFillSlotByTuple(TupleTableSlot *slot, NVMDB::Table *table, NVMDB::RAMTuple *tuple,
+                        const uint8 *attrsUsed = nullptr) {
+    NVMFillDatumsByTuple(slot->tts_tupleDescriptor, table, tuple, slot->tts_values, slot->tts_isnull, attrsUsed);
+}
+
 inline bool NVMIsNotEqualOper(OpExpr *op) {
     switch (op->opno) {
         case INT48NEOID:
@@ -1089,11 +1297,13 @@ inline void RevertKeyOperation(KEY_OPER &oper) {
 // 检查给定的表达式是否可以利用NVM索引进行优化。
 bool NvmMatchIndexs(NVMFdwState *state, uint32 col, NvmMatchIndexArr *matchArray, Expr *expr, Expr *parent, KEY_OPER oper) {
     bool result = false;
-    uint32 indexCount = state->mTable->GetIndexCount();
+    const NVMDB::Table::IndexList &indexes = state->mTable->GetIndexes();
+    uint64 snapshot = state->mCurrTx->GetIndexLookupSnapshot().snapshot;
 
-    for (uint32 i = 0; i < indexCount; i++) {   // 遍历该Table的所有 NVM 索引
-        NVMDB::NVMIndex *index = state->mTable->GetIndex(i);
-        if (index != nullptr && index->IsFieldPresent(col)) {
+    for (uint32 i = 0; i < indexes.size(); i++) {   // 遍历该Table的所有 NVM 索引
+        NVMDB::NVMIndex *index = indexes[i];
+        // 正在在线构建, 或者构建时的快照比本事务新的索引不能用来扫描
+        if (index != nullptr && index->ReadableBy(snapshot) && index->IsFieldPresent(col)) {
             if (matchArray->m_idx[i] == nullptr) {
                 matchArray->m_idx[i] = (NvmMatchIndex *)palloc0(sizeof(NvmMatchIndex)); // 记录当前列在指定索引中的匹配情况
                 matchArray->m_idx[i]->m_ix = index;
@@ -1276,6 +1486,21 @@ NVMDB::NVMIndex *NvmGetBestIndex(NVMFdwState *state, NvmMatchIndexArr *matchArra
     return constraint->mIndex;
 }
 
+// 索引的所有列都是等值匹配, 并且 ANALYZE 统计过索引的不同键个数时, 用它估计返回的行数; 否则返回 defaultRows
+double NvmEstimateIndexRows(const NVMFdwConstraint *constraint, double tuples, double defaultRows) {
+    NVMDB::NVMIndex *index = constraint->mIndex;
+    uint64 distinct = index->GetDistinctKeys();
+    if (distinct == 0 || constraint->mMatchCount != index->GetColCount()) {
+        return defaultRows;
+    }
+    for (uint32 i = 0; i < constraint->mMatchCount; i++) {
+        if (constraint->mOper[i] != KEY_OPER::READ_KEY_EXACT) {
+            return defaultRows;
+        }
+    }
+    return clamp_row_est(tuples / distinct);
+}
+
 void NVMVarcharToIndexKey(Datum datum, NVMDB::DRAMIndexTuple *tuple, uint32 colIndex, uint64 maxLen) {
     bool noValue = false;
 
@@ -1433,13 +1658,121 @@ NVMDB::NVMIndexIter *NvmIndexIterOpen(ForeignScanState *node, NVMFdwState *festa
     return result;
 }
 
+static inline Expr *NvmStripRelabel(Expr *expr) {
+    while (expr != nullptr && IsA(expr, RelabelType)) {
+        expr = ((RelabelType *)expr)->arg;
+    }
+    return expr;
+}
+
+static inline bool NvmIsScanColumn(Expr *expr, ::Index scanRelid, TupleDesc desc) {
+    if (expr == nullptr || !IsA(expr, Var)) {
+        return false;
+    }
+    auto *v = (Var *)expr;
+    return v->varno == scanRelid && v->varlevelsup == 0 && v->varattno > 0 && v->varattno <= desc->natts &&
+           v->vartype == desc->attrs[v->varattno - 1].atttypid;
+}
+
+static NVMDB::HeapScanFilter::Oper NvmKeyOperToFilterOper(KEY_OPER oper) {
+    switch (oper) {
+        case KEY_OPER::READ_KEY_EXACT:
+            return NVMDB::HeapScanFilter::Oper::EQ;
+        case KEY_OPER::READ_KEY_OR_NEXT:
+            return NVMDB::HeapScanFilter::Oper::GE;
+        case KEY_OPER::READ_KEY_AFTER:
+            return NVMDB::HeapScanFilter::Oper::GT;
+        case KEY_OPER::READ_KEY_OR_PREV:
+            return NVMDB::HeapScanFilter::Oper::LE;
+        case KEY_OPER::READ_KEY_BEFORE:
+            return NVMDB::HeapScanFilter::Oper::LT;
+        default:
+            CHECK(false) << "should not enter here!";
+    }
+    return NVMDB::HeapScanFilter::Oper::EQ;
+}
+
+// 下推 "列 op 常量" 和 "列 IS [NOT] NULL", 列和常量必须是同一类型, 不支持的条件只由执行器判断
+static bool NvmPushDownQual(NVMDB::HeapScanFilter *filter, ::Index scanRelid, TupleDesc desc, Expr *expr) {
+    if (IsA(expr, NullTest)) {
+        auto *test = (NullTest *)expr;
+        auto *arg = NvmStripRelabel(test->arg);
+        if (test->argisrow || !NvmIsScanColumn(arg, scanRelid, desc)) {
+            return false;
+        }
+        auto oper = test->nulltesttype == IS_NULL ? NVMDB::HeapScanFilter::Oper::IS_NULL
+                                                   : NVMDB::HeapScanFilter::Oper::IS_NOT_NULL;
+        return filter->AddQual(((Var *)arg)->varattno - 1, oper);
+    }
+
+    if (!IsA(expr, OpExpr) || list_length(((OpExpr *)expr)->args) != 2) {
+        return false;
+    }
+    auto *op = (OpExpr *)expr;
+    KEY_OPER oper;
+    if (!NVMGetKeyOperation(op, oper)) {
+        return false;
+    }
+    auto *l = NvmStripRelabel((Expr *)linitial(op->args));
+    auto *r = NvmStripRelabel((Expr *)lsecond(op->args));
+    if (IsA(l, Const) && NvmIsScanColumn(r, scanRelid, desc)) {
+        std::swap(l, r);
+        RevertKeyOperation(oper);
+    }
+    if (!NvmIsScanColumn(l, scanRelid, desc) || !IsA(r, Const)) {
+        return false;
+    }
+    auto *v = (Var *)l;
+    auto *c = (Const *)r;
+    if (c->constisnull || !c->constbyval || c->consttype != v->vartype) {
+        return false;
+    }
+    // 定长类型按 Datum 的低位字节存储, 和 NVMColInitData 一致
+    Datum value = c->constvalue;
+    return filter->AddQual(v->varattno - 1, NvmKeyOperToFilterOper(oper), (char *)&value);
+}
+
+/*
+ * 顺序扫描时把简单条件和用到的列下推到 HeapReadBatch, 在 tuple 缓存上过滤, 只拷贝和转换需要的列.
+ * UPDATE/DELETE 需要完整的行, 只下推条件.
+ */
+NVMDB::HeapScanFilter *NvmBuildScanFilter(ForeignScanState *node, NVMFdwState *festate) {
+    auto *filter = new (std::nothrow) NVMDB::HeapScanFilter(festate->mTable);
+    CHECK(filter != nullptr);
+    TupleDesc desc = RelationGetDescr(node->ss.ss_currentRelation);
+    ::Index scanRelid = ((Scan *)node->ss.ps.plan)->scanrelid;
+    ListCell *lc = nullptr;
+    foreach (lc, node->ss.ps.plan->qual) {
+        (void)NvmPushDownQual(filter, scanRelid, desc, (Expr *)lfirst(lc));
+    }
+
+    if (festate->mCtidNum == 0 && festate->mAttrsUsed != nullptr) {
+        std::vector<uint32> colIds;
+        uint32 colCount = std::min<uint32>(festate->mTable->GetColCount(), festate->mNumAttrs);
+        for (uint32 i = 0; i < colCount; i++) {
+            if (BITMAP_GET(festate->mAttrsUsed, i)) {
+                colIds.push_back(i);
+            }
+        }
+        filter->SetProjection(colIds.data(), static_cast<uint32>(colIds.size()));
+    }
+    return filter;
+}
+
 NvmFdwIter *NvmGetIter(ForeignScanState *node, NVMFdwState *festate) {
     if (festate->mIter == nullptr) {
         if (festate->mConst.mIndex != nullptr) {
             festate->mIter = new (std::nothrow) NvmFdwIndexIter(NvmIndexIterOpen(node, festate));
         } else {
             DLOG(INFO) << "Table with oid: " << festate->mForeignTableId << " does not have index!";
-            festate->mIter = new (std::nothrow) NvmFdwSeqIter(NVMDB::HeapUpperRowId(festate->mTable));
+            // UPDATE/DELETE 需要看到本事务自己的修改, 仍然串行扫描
+            if (festate->mCtidNum == 0 && NVMDB::HeapParallelScanEnabled(festate->mCurrTx, festate->mTable)) {
+                festate->mIter = new (std::nothrow) NvmFdwParallelSeqIter(festate->mCurrTx, festate->mTable,
+                                                                          festate->mScanFilter);
+            } else {
+                festate->mIter = new (std::nothrow) NvmFdwBatchSeqIter(festate->mCurrTx, festate->mTable,
+                                                                       festate->mScanFilter);
+            }
         }
         CHECK(festate->mIter != nullptr);
     }
@@ -1449,30 +1782,15 @@ NvmFdwIter *NvmGetIter(ForeignScanState *node, NVMFdwState *festate) {
 
 void NVMIndexRestore(NVMDB::Table *table, NVMDB::NVMIndex *index) {
     NVMDB::Transaction *tx = NVMGetCurrentTxContext();
-    NVMDB::RAMTuple tuple(table->GetColDesc(), table->GetRowLen());
-
-    for (NVMDB::RowId rowId = 0; rowId < HeapUpperRowId(table); rowId++) {
-        NVMDB::HamStatus status = HeapRead(tx, table, rowId, &tuple);
-        if (status == NVMDB::HamStatus::OK) {
-            NVMInsertTuple2Index(tx, table, index, &tuple, rowId);
-        }
-    }
-}
-
-void NVMIndexDeleteAllData(NVMDB::Table *table, NVMDB::NVMIndex *index) {
-    NVMDB::Transaction *tx = NVMGetCurrentTxContext();
-    NVMDB::RAMTuple tuple(table->GetColDesc(), table->GetRowLen());
-
-    for (NVMDB::RowId rowId = 0; rowId < HeapUpperRowId(table); rowId++) {
-        NVMDB::HamStatus status = HeapRead(tx, table, rowId, &tuple);
-        if (status == NVMDB::HamStatus::OK) {
-            NVMDeleteTupleFromIndex(tx, table, index, &tuple, rowId);
-        }
+    NvmFdwBatchSeqIter iter(tx, table);
+    while (iter.Valid()) {
+        NVMInsertTuple2Index(tx, table, index, iter.GetTuple(), iter.GetRowId());
+        iter.Next();
     }
 }
 
 NVM_ERRCODE CreateIndex(IndexStmt *stmt, ::TransactionId tid) {
-    NVMDB::IndexColumnDesc *indexDesc;
+    NVMDB::IndexColumnDesc *indexDesc = nullptr;
     NVMDB::NVMIndex *index = nullptr;
     ListCell *lc = nullptr;
     NVM_ERRCODE result = NVM_ERRCODE::NVM_SUCCESS;
@@ -1493,6 +1811,12 @@ NVM_ERRCODE CreateIndex(IndexStmt *stmt, ::TransactionId tid) {
             break;
         }
 
+        // 删除之后还没有回收的索引也占着 PACTree 槽位
+        if (unlikely(!index->HasTree())) {
+            result = NVM_ERRCODE::NVM_ERRCODE_INDEX_COUNT_EXC_LIMIT;
+            break;
+        }
+
         indexDesc = NVMDB::IndexDescCreate(colCount);
         if (unlikely(indexDesc == nullptr)) {
             result = NVM_ERRCODE::NVM_ERRCODE_NO_MEM;
@@ -1548,16 +1872,23 @@ NVM_ERRCODE CreateIndex(IndexStmt *stmt, ::TransactionId tid) {
 
         index->SetIndexDesc(indexDesc, colCount, index_len);
 
-        table->AddIndex(index);
-
-        NVMIndexRestore(table, index);
+        if (!NVMDB::HeapBuildIndexOnline(NVMGetCurrentTxContext(), table, index)) {
+            // 本事务已经写过这张表, 在线建索引会等待自己结束, 改为用本事务建索引
+            table->AddIndex(index);
+            NVMIndexRestore(table, index);
+        }
     } while (false);
 
 CREATE_INDEX_OUT:
     if (result != NVM_ERRCODE::NVM_SUCCESS) {
+        if (index != nullptr) {
+            NVMDB::DropIndexTree(index->Id());
+        }
         delete index;
         IndexDescDelete(indexDesc);
-        ereport(ERROR, (errcode(ERRCODE_T_R_SERIALIZATION_FAILURE), errmsg("NVM create index fail:%s!", NvmGetErrcodeStr(result))));
+        int sqlErrcode = result == NVM_ERRCODE::NVM_ERRCODE_INDEX_COUNT_EXC_LIMIT ? ERRCODE_PROGRAM_LIMIT_EXCEEDED
+                                                                                 : ERRCODE_T_R_SERIALIZATION_FAILURE;
+        ereport(ERROR, (errcode(sqlErrcode), errmsg("NVM create index fail:%s!", NvmGetErrcodeStr(result))));
     }
 
     return result;
@@ -1573,15 +1904,20 @@ NVM_ERRCODE DropIndex(DropForeignStmt *stmt, ::TransactionId tid) {
             break;
         }
 
-        auto *index = table->DelIndex(stmt->indexoid);
+        NVMDB::NVMIndex *index = nullptr;
+        for (NVMDB::NVMIndex *i : table->GetIndexes()) {
+            if (i->Id() == stmt->indexoid) {
+                index = i;
+                break;
+            }
+        }
         if (index == nullptr) {
             result = NVM_ERRCODE::NVM_ERRCODE_INDEX_NOT_FOUND;
             break;
         }
 
-        NVMIndexDeleteAllData(table, index);
-
-        delete index;
+        // 每个索引一棵 PACTree, 提交时直接删除整棵树, 不需要逐个删除 key
+        NvmAddPendingDDL(NvmPendingKind::DROP_INDEX, stmt->reloid, stmt->indexoid);
     } while (false);
 
     if (result != NVM_ERRCODE::NVM_SUCCESS) {
@@ -1594,7 +1930,9 @@ NVM_ERRCODE DropIndex(DropForeignStmt *stmt, ::TransactionId tid) {
 NVM_ERRCODE DropTable(DropForeignStmt *stmt, ::TransactionId tid) {
     NVM_ERRCODE result = NVM_ERRCODE::NVM_SUCCESS;
 
-    NvmDropTable(stmt->reloid);
+    // 先加载表定义, 保证提交时能找到它的全部索引
+    (void)NvmGetTableByOid(stmt->reloid);
+    NvmAddPendingDDL(NvmPendingKind::DROP_TABLE, stmt->reloid, InvalidOid);
 
     return result;
 }
@@ -1698,10 +2036,13 @@ static void NVMGetForeignRelSize(PlannerInfo *root, RelOptInfo *baserel, Oid for
     }
 
     baserel->fdw_private = festate;
-    static constexpr double NVMDB_ESTIMATED_QUANTITY = 100000;
     static constexpr double NVMDB_START_UP_COST = 0.1;
-    baserel->rows = NVMDB_ESTIMATED_QUANTITY;
-    baserel->tuples = NVMDB_ESTIMATED_QUANTITY;
+    // ANALYZE 过的表 (relpages > 0) 使用 pg_class 中的行数, 否则用已分配的 RowId 个数作为上界估计
+    if (rel->rd_rel->relpages == 0) {
+        baserel->tuples = clamp_row_est(NVMDB::HeapUpperRowId(table));
+    }
+    baserel->rows = clamp_row_est(baserel->tuples * clauselist_selectivity(root, baserel->baserestrictinfo,
+                                                                           baserel->relid, JOIN_INNER, nullptr));
     festate->mConst.mStartupCost = NVMDB_START_UP_COST;
     festate->mConst.mCost = baserel->rows * festate->mConst.mStartupCost;
     festate->mConstPara.mStartupCost = NVMDB_START_UP_COST;
@@ -1740,10 +2081,7 @@ static void NVMGetForeignPaths(PlannerInfo *root, RelOptInfo *baserel, Oid forei
 
     List *bestClause = nullptr;
     if (NVMDB_FDW::NvmGetBestIndex(pFdwState, &matchArray, &(pFdwState->mConst)) != nullptr) {
-        double ntuples = pFdwState->mConst.mCost;
-        ntuples = ntuples * clauselist_selectivity(root, bestClause, 0, JOIN_INNER, nullptr);
-        ntuples = clamp_row_est(ntuples);
-        baserel->rows = baserel->tuples = ntuples;
+        baserel->rows = NVMDB_FDW::NvmEstimateIndexRows(&(pFdwState->mConst), baserel->tuples, baserel->rows);
     }
 
     List *usablePathkeys = nullptr;
@@ -1790,10 +2128,10 @@ static void NVMGetForeignPaths(PlannerInfo *root, RelOptInfo *baserel, Oid forei
         }
 
         if (NVMDB_FDW::NvmGetBestIndex(pFdwState, &matchArray, &(pFdwState->mConstPara)) != nullptr) {
-            double ntuples = pFdwState->mConstPara.mCost;
-            ntuples = ntuples * clauselist_selectivity(root, bestClause, 0, JOIN_INNER, nullptr);
-            ntuples = clamp_row_est(ntuples);
-            baserel->rows = baserel->tuples = ntuples;
+            double ntuples = baserel->tuples * clauselist_selectivity(root, bestClause, baserel->relid, JOIN_INNER,
+                                                                      nullptr);
+            ntuples = NVMDB_FDW::NvmEstimateIndexRows(&(pFdwState->mConstPara), baserel->tuples,
+                                                      clamp_row_est(ntuples));
             fpIx = (Path *)create_foreignscan_path(root, baserel, pFdwState->mConstPara.mStartupCost,
                                                    pFdwState->mConstPara.mCost, usablePathkeys,
                                                    nullptr,  /* no outer rel either */
@@ -1801,6 +2139,7 @@ static void NVMGetForeignPaths(PlannerInfo *root, RelOptInfo *baserel, Oid forei
                                                    nullptr);
 
             fpIx->param_info = bestPath->param_info;
+            fpIx->rows = ntuples;
         }
     }
 
@@ -2074,6 +2413,10 @@ static void NVMBeginForeignScan(ForeignScanState *node, int eflags) {
             break;
         }
     }
+
+    if (festate->mConst.mIndex == nullptr) {
+        festate->mScanFilter = NVMDB_FDW::NvmBuildScanFilter(node, festate);
+    }
 }
 
 // NVMIterateForeignScan 函数用于从外部表扫描中获取下一行。它在查询执行期间调用。
@@ -2100,22 +2443,32 @@ static TupleTableSlot *NVMIterateForeignScan(ForeignScanState *node) {
     bool found = false;
     TupleTableSlot *result = nullptr;
 
-    char *tupleAddr = (char *)palloc(table->GetRowLen());
-    NVMDB::RAMTuple tuple(table->GetColDesc(), table->GetRowLen(), tupleAddr);
-
     auto *iter = NVMDB_FDW::NvmGetIter(node, festate);
-    while (iter->Valid()) {
-        status = NVMDB::HeapRead(festate->mCurrTx, table, iter->GetRowId(), &tuple);
-        if (status == NVMDB::HamStatus::OK) {
-            found = true;
-            break;
+    // 批量迭代器已经完成读取和可见性判断, 直接使用其缓冲区中的行
+    NVMDB::RAMTuple *batchTuple = iter->Valid() ? iter->GetTuple() : nullptr;
+    char *tupleAddr = batchTuple == nullptr ? (char *)palloc(table->GetRowLen()) : nullptr;
+    NVMDB::RAMTuple rowTuple(table->GetColDesc(), table->GetRowLen(), tupleAddr);
+    NVMDB::RAMTuple *tuple = &rowTuple;
+
+    if (batchTuple != nullptr) {
+        tuple = batchTuple;
+        found = true;
+    } else {
+        while (iter->Valid()) {
+            status = NVMDB::HeapRead(festate->mCurrTx, table, iter->GetRowId(), tuple);
+            if (status == NVMDB::HamStatus::OK) {
+                found = true;
+                break;
+            }
+            iter->Next();
         }
-        iter->Next();
     }
 
     if (found) {
         (void)ExecClearTuple(slot);
-        NVMDB_FDW::NVMFillSlotByTuple(slot, table, &tuple);
+        // SELECT 只转换用到的列, UPDATE/DELETE 需要完整的行
+        const uint8 *attrsUsed = festate->mCtidNum == 0 ? festate->mAttrsUsed : nullptr;
+        NVMDB_FDW::NVMFillSlotByTuple(slot, table, tuple, attrsUsed);
         ExecStoreVirtualTuple(slot);
         result = slot;
 
@@ -2130,7 +2483,7 @@ static TupleTableSlot *NVMIterateForeignScan(ForeignScanState *node) {
             HeapTupleHeaderSetCmin(resultTup->t_data, InvalidTransactionId);
         }
         iter->Next();
-    } else {
+    } else if (tupleAddr != nullptr) {
         pfree(tupleAddr);
     }
 
@@ -2141,6 +2494,62 @@ static TupleTableSlot *NVMIterateForeignScan(ForeignScanState *node) {
     return result;
 }
 
+// 向量化执行时一次填满一个 VectorBatch. 顺序扫描的批量迭代器已经在 tuple 缓存上完成可见性判断和条件过滤,
+// 这里只做列转换; 变长和按引用传递的列通过 AddVar 拷贝到 batch 自己的缓冲区, 不受迭代器缓冲区轮换的影响.
+// 索引扫描的迭代器不带 tuple, 仍然逐行 HeapRead.
+static VectorBatch *NVMVecIterateForeignScan(VecForeignScanState *node) {
+    DLOG(INFO) << "NVMVecIterateForeignScan is called!";
+    VectorBatch *batch = node->m_pScanBatch;
+    batch->Reset(true);
+    if (node->ss.is_scan_end) {
+        return batch;
+    }
+
+    auto *festate = (NVMDB_FDW::NVMFdwState *)node->fdw_state;
+    NVMDB::Table *table = festate->mTable;
+    TupleDesc desc = RelationGetDescr(node->ss.ss_currentRelation);
+    Datum *values = node->m_values;
+    bool *nulls = node->m_nulls;
+
+    auto *iter = NVMDB_FDW::NvmGetIter(node, festate);
+    char *tupleAddr = (iter->Valid() && iter->GetTuple() == nullptr) ? (char *)palloc(table->GetRowLen()) : nullptr;
+    NVMDB::RAMTuple rowTuple(table->GetColDesc(), table->GetRowLen(), tupleAddr);
+    while (batch->m_rows < BatchMaxSize && iter->Valid()) {
+        NVMDB::RAMTuple *tuple = iter->GetTuple();
+        if (tuple == nullptr) {
+            if (NVMDB::HeapRead(festate->mCurrTx, table, iter->GetRowId(), &rowTuple) != NVMDB::HamStatus::OK) {
+                iter->Next();
+                continue;
+            }
+            tuple = &rowTuple;
+        }
+
+        NVMDB_FDW::NVMFillDatumsByTuple(desc, table, tuple, values, nulls, festate->mAttrsUsed);
+        int row = batch->m_rows;
+        for (int i = 0; i < batch->m_cols; i++) {
+            ScalarVector *vec = &(batch->m_arr[i]);
+            if (nulls[i]) {
+                vec->SetNull(row);
+            } else if (vec->m_desc.encoded) {
+                vec->AddVar(values[i], row);
+            } else {
+                vec->m_vals[row] = values[i];
+            }
+            vec->m_rows++;
+        }
+        batch->m_rows++;
+        iter->Next();
+    }
+
+    if (tupleAddr != nullptr) {
+        pfree(tupleAddr);
+    }
+    if (!iter->Valid()) {
+        node->ss.is_scan_end = true;
+    }
+    return batch;
+}
+
 // ReScanForeignScan 函数用于重新扫描外部表。它在查询执行期间调用。
 // ReScanForeignScan 函数接收以下参数：
 //     node: 要执行的 ForeignScan 计划节点
@@ -2179,16 +2588,127 @@ static void NVMEndForeignScan(ForeignScanState *node) {
     }
 }
 
-static bool NVMAnalyzeForeignTable(Relation relation, AcquireSampleRowsFunc *func, BlockNumber *totalpages,
-                                   void *additionalData, bool estimateTableRowNum) {
-    DLOG(INFO) << "NVMAnalyzeForeignTable is empty!";
-    return true;
+// ANALYZE 时把 RowId 空间按 NVM_ANALYZE_BLOCK_ROWS 划分为逻辑块, 至少返回 1 块, 以区分没有 ANALYZE 过的表
+static inline BlockNumber NvmAnalyzeBlockCount(NVMDB::RowId upper) {
+    BlockNumber blocks = (upper + NVM_ANALYZE_BLOCK_ROWS - 1) / NVM_ANALYZE_BLOCK_ROWS;
+    return blocks == 0 ? 1 : blocks;
+}
+
+// 蓄水池采样: 前 targrows 行直接放入, 之后按 Vitter 算法随机替换, 与 heap 表的 acquire_sample_rows 相同.
+// 返回当前行应该放入的位置, -1 表示跳过当前行. liverows 是之前已经处理过的行数.
+static int NvmReservoirPick(int targrows, int numrows, double liverows, double *rowstoskip, double *rstate) {
+    if (numrows < targrows) {
+        return numrows;
+    }
+    if (*rowstoskip < 0) {
+        *rowstoskip = anl_get_next_S(liverows, targrows, rstate);
+    }
+    int pos = -1;
+    if (*rowstoskip <= 0) {
+        pos = (int)(targrows * anl_random_fract());
+        Assert(pos >= 0 && pos < targrows);
+    }
+    *rowstoskip -= 1;
+    return pos;
 }
 
+// AcquireSampleRows 函数从外部表中随机采样 targrows 行, 用于生成 pg_statistic.
+// 用 BlockSampler 从 RowId 逻辑块中随机选出最多 targrows 块, 每块通过 HeapReadBatch 读出对当前快照可见的行,
+// 再用蓄水池算法选出样本; 总行数按已读逻辑块的平均可见行数估计. 同时重新统计每个索引的不同键个数.
 static int NVMAcquireSampleRowsFunc(Relation relation, int elevel, HeapTuple *rows, int targrows, double *totalrows,
                                     double *totaldeadrows, void *additionalData, bool estimateTableRowNum) {
-    DLOG(INFO) << "NVMAcquireSampleRowsFunc is empty!";
-    return 0;
+    DLOG(INFO) << "NVMAcquireSampleRowsFunc is called!";
+    NVMDB::Table *table = NVMDB_FDW::NvmGetTableByOidWrapper(RelationGetRelid(relation));
+    NVMDB::Transaction *tx = NVMDB_FDW::NVMGetCurrentTxContext();
+    if (NVMDB_FDW::NvmIsTxInAbortState(tx)) {
+        NVMDB_FDW::NvmRaiseAbortTxError();
+    }
+
+    TupleDesc tupDesc = RelationGetDescr(relation);
+    const NVMDB::RowId upper = NVMDB::HeapUpperRowId(table);
+    const BlockNumber totalBlocks = NvmAnalyzeBlockCount(upper);
+    BlockSamplerData bs;
+    BlockSampler_Init(&bs, totalBlocks, targrows);
+
+    const uint64 rowLen = table->GetRowLen();
+    char *rowData = (char *)palloc(rowLen * NVM_ANALYZE_BLOCK_ROWS);
+    NVMDB::RAMTuple *tuples[NVM_ANALYZE_BLOCK_ROWS];
+    NVMDB::RowId rowIds[NVM_ANALYZE_BLOCK_ROWS];
+    for (uint32 i = 0; i < NVM_ANALYZE_BLOCK_ROWS; i++) {
+        tuples[i] = new NVMDB::RAMTuple(table->GetColDesc(), rowLen, rowData + i * rowLen);
+    }
+    auto *values = (Datum *)palloc(tupDesc->natts * sizeof(Datum));
+    auto *nulls = (bool *)palloc(tupDesc->natts * sizeof(bool));
+    MemoryContext oldcontext = CurrentMemoryContext;
+    MemoryContext tupcontext = AllocSetContextCreate(CurrentMemoryContext, "nvm_fdw analyze context",
+                                                     ALLOCSET_DEFAULT_MINSIZE, ALLOCSET_DEFAULT_INITSIZE,
+                                                     ALLOCSET_DEFAULT_MAXSIZE);
+
+    int numrows = 0;
+    double liverows = 0;
+    double rowstoskip = -1;
+    double rstate = anl_init_selection_state(targrows);
+    BlockNumber scannedBlocks = 0;
+    while (BlockSampler_HasMore(&bs)) {
+        vacuum_delay_point();
+        BlockNumber block = BlockSampler_Next(&bs);
+        NVMDB::RowId cursor = block * NVM_ANALYZE_BLOCK_ROWS;
+        NVMDB::RowId end = std::min<NVMDB::RowId>(cursor + NVM_ANALYZE_BLOCK_ROWS, upper);
+        uint32 count = NVMDB::HeapReadBatch(tx, table, &cursor, end, tuples, rowIds, NVM_ANALYZE_BLOCK_ROWS);
+        scannedBlocks++;
+        for (uint32 i = 0; i < count; i++) {
+            int pos = NvmReservoirPick(targrows, numrows, liverows, &rowstoskip, &rstate);
+            if (pos >= 0) {
+                if (pos < numrows) {
+                    heap_freetuple(rows[pos]);
+                } else {
+                    numrows++;
+                }
+                (void)MemoryContextSwitchTo(tupcontext);
+                NVMDB_FDW::NVMFillDatumsByTuple(tupDesc, table, tuples[i], values, nulls);
+                (void)MemoryContextSwitchTo(oldcontext);
+                rows[pos] = heap_form_tuple(tupDesc, values, nulls);
+                MemoryContextReset(tupcontext);
+            }
+            liverows += 1;
+        }
+    }
+
+    MemoryContextDelete(tupcontext);
+    for (auto *tuple : tuples) {
+        delete tuple;
+    }
+    pfree(rowData);
+    pfree(values);
+    pfree(nulls);
+
+    *totalrows = scannedBlocks == 0 ? 0 : floor(liverows / scannedBlocks * totalBlocks + 0.5);
+    *totaldeadrows = 0;
+
+    if (!estimateTableRowNum) {
+        NVMDB::LookupSnapshot snapshot = tx->GetIndexLookupSnapshot();
+        for (NVMDB::NVMIndex *index : table->GetIndexes()) {
+            uint64 distinct = index->AnalyzeDistinctKeys(snapshot);
+            ereport(elevel, (errmsg("\"%s\": index %u contains " UINT64_FORMAT " distinct keys",
+                                    RelationGetRelationName(relation), index->Id(), distinct)));
+        }
+    }
+
+    ereport(elevel, (errmsg("\"%s\": scanned %u of %u row blocks, containing %.0f live rows; "
+                            "%d rows in sample, %.0f estimated total rows",
+                            RelationGetRelationName(relation), scannedBlocks, totalBlocks, liverows, numrows,
+                            *totalrows)));
+    return numrows;
+}
+
+// AnalyzeForeignTable 函数判断外部表是否支持 ANALYZE, 并返回采样函数和表的大小 (逻辑块数)
+static bool NVMAnalyzeForeignTable(Relation relation, AcquireSampleRowsFunc *func, BlockNumber *totalpages,
+                                   void *additionalData, bool estimateTableRowNum) {
+    DLOG(INFO) << "NVMAnalyzeForeignTable is called!";
+    NVMDB::Table *table = NVMDB_FDW::NvmGetTableByOidWrapper(RelationGetRelid(relation));
+    *totalpages = NvmAnalyzeBlockCount(NVMDB::HeapUpperRowId(table));
+    *func = NVMAcquireSampleRowsFunc;
+    return true;
 }
 
 // ValidateTableDef 函数用于验证外部表的表定义。它在创建或更改外部表时调用。
@@ -2313,6 +2833,10 @@ static TupleTableSlot *NVMExecForeignInsert(EState *estate, ResultRelInfo *resul
         nvmState->mNumAttrs = RelationGetNumberOfAttributes(resultRelInfo->ri_RelationDesc);
         nvmState->mConst.mCost = std::numeric_limits<double>::max();
         nvmState->mConstPara.mCost = std::numeric_limits<double>::max();
+        // 只有 COPY FROM 不调用 BeginForeignModify, 走批量导入
+        if (NVMDB::FLAGS_heap_bulk_load) {
+            nvmState->mBulkLoader = NVMDB_FDW::NVMBulkLoaderCreate(tx, table);
+        }
         resultRelInfo->ri_FdwState = nvmState;
     }
 
@@ -2331,6 +2855,11 @@ static TupleTableSlot *NVMExecForeignInsert(EState *estate, ResultRelInfo *resul
         }
     }
 
+    if (nvmState->mBulkLoader != nullptr) {
+        NVMDB_FDW::NVMBulkLoadTuple(nvmState->mBulkLoader, table, &tuple);
+        return slot;
+    }
+
     // the data has not been insert into NVM for now
     auto rowId = HeapInsert(tx, table, &tuple);
 
@@ -2393,11 +2922,12 @@ static TupleTableSlot *NVMExecForeignUpdate(EState *estate, ResultRelInfo *resul
         ereport(ERROR, (errcode(ERRCODE_T_R_SERIALIZATION_FAILURE), errmsg("NVM Update fail(%d)!", static_cast<int>(ret3))));
     }
 
-    std::vector<bool> indexColChange(table->GetIndexCount(), false);
+    const NVMDB::Table::IndexList &indexes = table->GetIndexes();
+    std::vector<bool> indexColChange(indexes.size(), false);
     for (uint64 i = 0; i < num; i++) {
         if (BITMAP_GET(fdwState->mAttrsModified, i)) {
             for (uint32 k = 0; k < indexColChange.size(); k++) {
-                NVMDB::NVMIndex *index = table->GetIndex(k);
+                NVMDB::NVMIndex *index = indexes[k];
                 if (index != nullptr && index->IsFieldPresent(i)) {
                     indexColChange[k] = true;
                 }
@@ -2407,7 +2937,7 @@ static TupleTableSlot *NVMExecForeignUpdate(EState *estate, ResultRelInfo *resul
 
     for (uint32 k = 0; k < indexColChange.size(); k++) {
         if (indexColChange[k]) {
-            NVMDB::NVMIndex *index = table->GetIndex(k);
+            NVMDB::NVMIndex *index = indexes[k];
             NVMDB_FDW::NVMInsertTuple2Index(fdwState->mCurrTx, table, index, &tuple, rowId.m_rowId);
             NVMDB_FDW::NVMDeleteTupleFromIndex(fdwState->mCurrTx, table, index, &tupleOrg, rowId.m_rowId);
         }
@@ -2468,6 +2998,11 @@ static void NVMEndForeignModify(EState *estate, ResultRelInfo *resultRelInfo) {
     DLOG(INFO) << "NVMEndForeignModify is called!";
     auto *fdwState = (NVMDB_FDW::NVMFdwState *)resultRelInfo->ri_FdwState;
 
+    if (fdwState->mBulkLoader != nullptr) {
+        fdwState->mBulkLoader->Finish();
+        DLOG(INFO) << "NVMDB bulk loaded rows: " << fdwState->mBulkLoader->GetLoadedRows();
+    }
+
     if (!fdwState->mAllocInScan) {
         NVMDB_FDW::NVMStateFree(fdwState);
         resultRelInfo->ri_FdwState = nullptr;
@@ -2484,16 +3019,60 @@ static int NVMGetFdwType() {
     return NVM_ORC;
 }
 
+/*
+ * TRUNCATE 直接回收 heap 的 extent 并重建索引树, 不写 undo. 只登记, 到事务提交时 (仍然持有
+ * AccessExclusiveLock) 才执行, 事务回滚时什么都不做. 提交之前本事务看到的还是原来的行, 所以不允许在
+ * 事务块中执行, 也不允许在写过 NVM 数据的事务中执行, 之后本事务再访问这张表会报错.
+ */
 static void NVMTruncateForeignTable(TruncateStmt *stmt, Relation rel) {
-    DLOG(INFO) << "NVMTruncateForeignTable is empty!";
-}
-
+    DLOG(INFO) << "NVMTruncateForeignTable is called!";
+    if (IsTransactionBlock()) {
+        ereport(ERROR, (errcode(ERRCODE_ACTIVE_SQL_TRANSACTION), errmodule(MOD_NVM),
+                        errmsg("TRUNCATE NVM table \"%s\" cannot run inside a transaction block",
+                               RelationGetRelationName(rel))));
+    }
+    NVMDB::Transaction *tx = NVMDB_FDW::NVMGetCurrentTxContext();
+    if (tx->HasWrites()) {
+        ereport(ERROR, (errcode(ERRCODE_FDW_OPERATION_NOT_SUPPORTED), errmodule(MOD_NVM),
+                        errmsg("cannot truncate NVM table \"%s\" in a transaction that has modified NVM tables",
+                               RelationGetRelationName(rel))));
+    }
+    // 先加载表定义, 保证提交时能找到它的全部索引
+    NVMDB::Table *table = NVMDB_FDW::NvmGetTableByOidWrapper(RelationGetRelid(rel));
+    // 原来的索引树要等快照结束才回收, 提交时新建的空树需要另外的槽位, 在这里预留, 提交时不会失败
+    NVMDB::uint32 reservedTrees = table->GetIndexCount();
+    if (!NVMDB::ReserveIndexTrees(reservedTrees)) {
+        ereport(ERROR, (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED), errmodule(MOD_NVM),
+                        errmsg("too many NVM indexes, cannot truncate NVM table \"%s\"", RelationGetRelationName(rel))));
+    }
+    NVMDB_FDW::NvmAddPendingDDL(NVMDB_FDW::NvmPendingKind::TRUNCATE, RelationGetRelid(rel), InvalidOid, reservedTrees);
+}
+
+/* 回收已删除且不再可见的行, 行号留给之后的插入复用; 可以和其他事务并发执行 */
 static void NVMVacuumForeignTable(VacuumStmt *stmt, Relation rel) {
-    DLOG(INFO) << "NVMVacuumForeignTable is empty!";
+    DLOG(INFO) << "NVMVacuumForeignTable is called!";
+    NVMDB::Transaction *tx = NVMDB_FDW::NVMGetCurrentTxContext();
+    auto *table = NVMDB_FDW::NvmGetTableByOidWrapper(RelationGetRelid(rel));
+    uint64 reclaimed = NVMDB::HeapVacuum(tx, table);
+    ereport(DEBUG1, (errmodule(MOD_NVM), errmsg("vacuum NVM table \"%s\": %lu deleted rows reclaimed",
+                                                RelationGetRelationName(rel), reclaimed)));
 }
 
+/* ixoid 无效时返回 heap 占用的 NVM 空间, 否则返回对应索引数据节点的空间. 有并发写入时索引的统计是近似值 */
 static uint64_t NVMGetForeignRelationMemSize(Oid reloid, Oid ixoid) {
-    DLOG(INFO) << "NVMGetForeignRelationMemSize is empty!";
+    DLOG(INFO) << "NVMGetForeignRelationMemSize is called!";
+    auto *table = NVMDB_FDW::NvmGetTableByOid(reloid);
+    if (table == nullptr) {
+        return 0;
+    }
+    if (!OidIsValid(ixoid)) {
+        return NVMDB::HeapAllocatedBytes(table);
+    }
+    for (NVMDB::NVMIndex *index : table->GetIndexes()) {
+        if (index->Id() == ixoid) {
+            return index->GetStats().nodes * NVMDB::LIST_NODE_SIZE;
+        }
+    }
     return 0;
 }
 
@@ -2507,14 +3086,25 @@ static void NVMXactCallback(XactEvent event, void *arg) {
     if (event == XACT_EVENT_START) {
         trans->Begin();
     } else if (event == XACT_EVENT_COMMIT) {
+        NVMDB::StopHeapParallelScans();
         trans->Commit();
+        NVMDB_FDW::NvmApplyPendingDDLs();
     } else if (event == XACT_EVENT_ABORT) {
+        // 出错退出的扫描不会走到 EndForeignScan, 在事务结束前停掉它的工作线程
+        NVMDB::StopHeapParallelScans();
         trans->Abort();
+        NVMDB_FDW::NvmDiscardPendingDDLs();
+    }
+    if (event == XACT_EVENT_COMMIT || event == XACT_EVENT_ABORT) {
+        NVMDB_FDW::NVMBulkLoaderCleanup(InvalidSubTransactionId);
+        NVMDB::ReclaimRetiredIndexTrees(NVMDB::ProcessArray::GetGlobalProcArray()->getGlobalMinCSN());
     }
 }
 
 static void NVMSubxactCallback(SubXactEvent event, SubTransactionId mySubid, SubTransactionId parentSubid, void *arg) {
-    DLOG(INFO) << "NVMSubxactCallback is empty!";
+    DLOG(INFO) << "NVMSubxactCallback is call! event == " << event;
+    NVMDB_FDW::NvmSubxactPendingDDLs(event, mySubid, parentSubid);
+    NVMDB_FDW::NVMBulkLoaderSubxact(event, mySubid, parentSubid);
 }
 
 Datum nvm_fdw_handler(PG_FUNCTION_ARGS) {
@@ -2527,6 +3117,7 @@ Datum nvm_fdw_handler(PG_FUNCTION_ARGS) {
     fdwroutine->ExplainForeignScan = NVMExplainForeignScan;
     fdwroutine->BeginForeignScan = NVMBeginForeignScan;
     fdwroutine->IterateForeignScan = NVMIterateForeignScan;
+    fdwroutine->VecIterateForeignScan = NVMVecIterateForeignScan;
     fdwroutine->ReScanForeignScan = NVMReScanForeignScan;
     fdwroutine->EndForeignScan = NVMEndForeignScan;
     fdwroutine->AnalyzeForeignTable = NVMAnalyzeForeignTable;
@@ -2590,9 +3181,36 @@ void InitNvm() {
         }
     }
 
-    NVMDB::FLAGS_cache_size = gflags::Int64FromEnv("NVMCacheSize", 16384);
-    NVMDB::FLAGS_cache_elasticity = gflags::Int64FromEnv("NVMCacheElasticity", 64);
-    LOG(INFO) << "NVMDB lru size: " << NVMDB::FLAGS_cache_size << ", elasticity: " << NVMDB::FLAGS_cache_elasticity;
+    NVMDB::FLAGS_tuple_cache_bytes = gflags::Int64FromEnv("NVMTupleCacheBytes", 1024 * 1024 * 1024);
+    LOG(INFO) << "NVMDB tuple cache bytes: " << NVMDB::FLAGS_tuple_cache_bytes;
+    NVMDB::FLAGS_group_commit = gflags::BoolFromEnv("NVMGroupCommit", false);
+    NVMDB::FLAGS_group_commit_max_wait_us = gflags::Int64FromEnv("NVMGroupCommitMaxWaitUs", 20);
+    NVMDB::FLAGS_group_commit_max_batch = gflags::Int64FromEnv("NVMGroupCommitMaxBatch", 32);
+    LOG(INFO) << "NVMDB group commit: " << NVMDB::FLAGS_group_commit << ", max wait us: "
+              << NVMDB::FLAGS_group_commit_max_wait_us << ", max batch: " << NVMDB::FLAGS_group_commit_max_batch;
+    NVMDB::FLAGS_recovery_threads_per_dir = gflags::Int32FromEnv("NVMRecoveryThreadsPerDir", 4);
+    LOG(INFO) << "NVMDB recovery threads per dir: " << NVMDB::FLAGS_recovery_threads_per_dir;
+    NVMDB::FLAGS_heap_bulk_load = gflags::BoolFromEnv("NVMHeapBulkLoad", true);
+    LOG(INFO) << "NVMDB heap bulk load: " << NVMDB::FLAGS_heap_bulk_load;
+    NVMDB::FLAGS_heap_parallel_scan_workers = gflags::Int32FromEnv("NVMParallelScanWorkers", 4);
+    NVMDB::FLAGS_heap_parallel_scan_min_extents = gflags::Int32FromEnv("NVMParallelScanMinExtents", 4);
+    LOG(INFO) << "NVMDB parallel scan workers: " << NVMDB::FLAGS_heap_parallel_scan_workers
+              << ", min extents: " << NVMDB::FLAGS_heap_parallel_scan_min_extents;
+    NVMDB::FLAGS_change_stream = gflags::BoolFromEnv("NVMChangeStream", false);
+    NVMDB::FLAGS_change_stream_batch_bytes = gflags::Int64FromEnv("NVMChangeStreamBatchBytes", 256 * 1024);
+    NVMDB::FLAGS_change_stream_flush_interval_us = gflags::Int64FromEnv("NVMChangeStreamFlushIntervalUs", 1000);
+    NVMDB::FLAGS_change_stream_tx_max_bytes = gflags::Int64FromEnv("NVMChangeStreamTxMaxBytes", 64 * 1024 * 1024);
+    LOG(INFO) << "NVMDB change stream: " << NVMDB::FLAGS_change_stream << ", batch bytes: "
+              << NVMDB::FLAGS_change_stream_batch_bytes << ", flush interval us: "
+              << NVMDB::FLAGS_change_stream_flush_interval_us << ", tx max bytes: "
+              << NVMDB::FLAGS_change_stream_tx_max_bytes;
+    NVMDB::FLAGS_heap_tier_dir = gflags::StringFromEnv("NVMHeapTierDir", "");
+    NVMDB::FLAGS_heap_tier_ssd_bytes = gflags::Int64FromEnv("NVMHeapTierSSDBytes", 1024LL * 1024 * 1024 * 1024);
+    NVMDB::FLAGS_heap_tier_pmem_limit_bytes = gflags::Int64FromEnv("NVMHeapTierPMemLimitBytes", 0);
+    NVMDB::FLAGS_heap_tier_cold_rounds = gflags::Int32FromEnv("NVMHeapTierColdRounds", 60);
+    LOG(INFO) << "NVMDB heap tier dir: " << NVMDB::FLAGS_heap_tier_dir << ", ssd bytes: "
+              << NVMDB::FLAGS_heap_tier_ssd_bytes << ", pmem limit bytes: " << NVMDB::FLAGS_heap_tier_pmem_limit_bytes
+              << ", cold rounds: " << NVMDB::FLAGS_heap_tier_cold_rounds;
 
     if (needInit) {
         LOG(INFO) << "NVMDB begin init.";
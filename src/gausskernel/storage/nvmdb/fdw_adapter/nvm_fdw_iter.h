@@ -1,6 +1,7 @@
 #pragma  once
 #include "index/nvm_index_iter.h"
 #include "index/nvm_index.h"
+#include "nvm_access.h"
 
 // PG fdw库的 log 和 google log 冲突
 #undef LOG
@@ -13,6 +14,10 @@
 #include "pgstat.h"
 
 constexpr int NVM_MAX_KEY_COLUMNS = 10U;
+// 顺序扫描时一次从 heap 批量读取的行数
+constexpr uint32 NVM_SEQ_SCAN_BATCH_SIZE = 64U;
+// ANALYZE 采样时 RowId 逻辑块的大小, 一个逻辑块通过一次 HeapReadBatch 读完
+constexpr uint32 NVM_ANALYZE_BLOCK_ROWS = NVM_SEQ_SCAN_BATCH_SIZE;
 
 namespace NVMDB_FDW {
 
@@ -43,6 +48,9 @@ public:
 
     virtual NVMDB::RowId GetRowId() = 0;
 
+    // 批量迭代器返回已通过可见性判断的当前行, 逐行迭代器返回 nullptr, 由调用者 HeapRead
+    virtual NVMDB::RAMTuple *GetTuple() { return nullptr; }
+
     virtual ~NvmFdwIter() = default;
 };
 
@@ -79,6 +87,106 @@ private:
     const NVMDB::RowId m_maxRowId;
 };
 
+// 不存在索引时的批量顺序扫描, 每次通过 HeapReadBatch 读取一批可见且满足 filter 的行
+// 使用两个缓冲区轮换, 保证上一次返回给 slot 的行在下一批读入时仍然有效
+class NvmFdwBatchSeqIter : public NvmFdwIter {
+public:
+    NvmFdwBatchSeqIter(const NVMDB::Transaction *tx, const NVMDB::Table *table,
+                       const NVMDB::HeapScanFilter *filter = nullptr) noexcept
+        : m_tx(tx), m_table(table), m_filter(filter), m_maxRowId(NVMDB::HeapUpperRowId(table)) {
+        const uint64 rowLen = table->GetRowLen();
+        for (auto &buffer : m_buffers) {
+            buffer.m_rowData = new char[rowLen * NVM_SEQ_SCAN_BATCH_SIZE];
+            for (uint32 i = 0; i < NVM_SEQ_SCAN_BATCH_SIZE; i++) {
+                buffer.m_tuples[i] = new NVMDB::RAMTuple(table->GetColDesc(), rowLen, buffer.m_rowData + i * rowLen);
+            }
+        }
+        Fill();
+    }
+
+    ~NvmFdwBatchSeqIter() override {
+        for (auto &buffer : m_buffers) {
+            for (auto *tuple : buffer.m_tuples) {
+                delete tuple;
+            }
+            delete[] buffer.m_rowData;
+        }
+    }
+
+    void Next() override {
+        m_pos++;
+        if (m_pos >= m_count) {
+            Fill();
+        }
+    }
+
+    bool Valid() override { return m_pos < m_count; }
+
+    NVMDB::RowId GetRowId() override { return m_buffers[m_curBuf].m_rowIds[m_pos]; }
+
+    NVMDB::RAMTuple *GetTuple() override { return m_buffers[m_curBuf].m_tuples[m_pos]; }
+
+private:
+    void Fill() {
+        m_curBuf ^= 1U;
+        m_pos = 0;
+        auto &buffer = m_buffers[m_curBuf];
+        m_count = NVMDB::HeapReadBatch(m_tx, m_table, &m_cursor, m_maxRowId,
+                                       buffer.m_tuples, buffer.m_rowIds, NVM_SEQ_SCAN_BATCH_SIZE, m_filter);
+    }
+
+    struct BatchBuffer {
+        char *m_rowData = nullptr;
+        NVMDB::RAMTuple *m_tuples[NVM_SEQ_SCAN_BATCH_SIZE]{};
+        NVMDB::RowId m_rowIds[NVM_SEQ_SCAN_BATCH_SIZE]{};
+    };
+
+    const NVMDB::Transaction *m_tx;
+    const NVMDB::Table *m_table;
+    const NVMDB::HeapScanFilter *m_filter;
+    const NVMDB::RowId m_maxRowId;
+    NVMDB::RowId m_cursor = 0;
+    BatchBuffer m_buffers[2];
+    uint32 m_curBuf = 0;
+    uint32 m_pos = 0;
+    uint32 m_count = 0;
+};
+
+// 大表的顺序扫描由多个工作线程并行读取和判断可见性, 当前线程只负责把行转换成 Datum
+class NvmFdwParallelSeqIter : public NvmFdwIter {
+public:
+    NvmFdwParallelSeqIter(const NVMDB::Transaction *tx, const NVMDB::Table *table,
+                          const NVMDB::HeapScanFilter *filter = nullptr)
+        : m_scan(tx, table, static_cast<uint32>(NVMDB::FLAGS_heap_parallel_scan_workers), filter) {
+        Fill();
+    }
+
+    void Next() override {
+        m_pos++;
+        if (m_pos >= m_count) {
+            Fill();
+        }
+    }
+
+    bool Valid() override { return m_pos < m_count; }
+
+    NVMDB::RowId GetRowId() override { return m_rowIds[m_pos]; }
+
+    NVMDB::RAMTuple *GetTuple() override { return m_tuples[m_pos]; }
+
+private:
+    void Fill() {
+        m_pos = 0;
+        m_count = m_scan.NextBatch(&m_tuples, &m_rowIds);
+    }
+
+    NVMDB::HeapParallelScan m_scan;
+    NVMDB::RAMTuple **m_tuples = nullptr;
+    NVMDB::RowId *m_rowIds = nullptr;
+    uint32 m_pos = 0;
+    uint32 m_count = 0;
+};
+
 // 检测是否能用索引优化
 class NvmMatchIndex {
 public:
@@ -168,6 +276,10 @@ struct NVMFdwState {
     NVMDB::RowId mRowIndex;
     bool mCursorOpened;
     NVMDB_FDW::NvmFdwIter *mIter;
+    // 下推到顺序扫描的条件和投影列, 执行器仍会判断所有条件
+    NVMDB::HeapScanFilter *mScanFilter;
+    // COPY FROM 使用的批量导入, 在 EndForeignModify 中 Finish; 出错时由事务回滚释放, 见 NVMBulkLoaderCreate
+    NVMDB::HeapBulkLoader *mBulkLoader;
 };
 
 constexpr char *NVM_REC_TID_NAME = "ctid";
@@ -185,6 +297,7 @@ enum class NVM_ERRCODE {
     NVM_ERRCODE_INDEX_SIZE_EXC_LIMIT,
     NVM_ERRCODE_COL_COUNT_EXC_LIMIT,
     NVM_ERRCODE_INDEX_NOT_SUPPORT_EXPR,
+    NVM_ERRCODE_INDEX_COUNT_EXC_LIMIT,
     NVM_ERRCODE_INVALID
 };
 
@@ -20,8 +20,11 @@ static_assert(NVMDB_UNDO_SEGMENT_NUM >= NVMDB_MAX_THREAD_NUM, "");
 
 // for pactree oplog
 static constexpr int NVMDB_NUM_LOGS_PER_THREAD = 512;
-static constexpr int NVMDB_OPLOG_WORKER_THREAD_PER_GROUP = 1;
+// 每个 group 的 oplog worker 池的上限, 实际参与应用 oplog 的 worker 数由 combiner 按积压动态调整
+static constexpr int NVMDB_OPLOG_WORKER_THREAD_PER_GROUP = 4;
 static constexpr int NVMDB_OPLOG_QUEUE_MAX_CAPACITY = 10000;
+// 每个索引一棵 PACTree, 所有树共享 PMem 内存池与后台线程
+static constexpr int NVMDB_PACTREE_MAX_TREE_NUM = 4096;
 
 class DirectoryConfig {
 public:
@@ -22,6 +22,12 @@ public:
 
     void SyncRelease(uint32 bit);
 
+    // 标记某一位已被占用, 用于按持久化的信息重建 bitmap
+    void SyncSet(uint32 bit);
+
+    // 清空所有位, 调用者保证没有并发访问
+    void Reset();
+
     inline uint32 get_highest_bit() const {
         DCHECK(m_highestBit >= 0 && m_highestBit < m_size);
         return m_highestBit;
@@ -50,6 +50,7 @@ inline bool TxInfoIsTxSlot(uint64 txInfo) {
 }
 
 static constexpr uint32 NVM_PAGE_SIZE = 8192;
+static constexpr uint32 NVM_CACHE_LINE_SIZE = 64;
 static constexpr uint32 NVMInvalidPageId = 0;
 
 static inline bool NVMPageIdIsValid(uint32 pageId) {
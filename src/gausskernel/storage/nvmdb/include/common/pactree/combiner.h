@@ -2,10 +2,16 @@
 #define PACTREE_COMBINER_H
 
 #include "common/pdl_art/string_key.h"
+#include "common/pactree/worker_thread.h"
+#include <chrono>
 
 namespace NVMDB {
 
 constexpr int MAX_LOG_QUEUE_SIZE = 100;
+// 连续多少个采样周期没有积压才减少一个 worker
+constexpr int OPLOG_SCALE_DOWN_ROUNDS = 10;
+
+void PublishPACTreeOplogStats(const PACTreeOplogStats &stats);
 
 class CombinerThread {
 public:
@@ -66,12 +72,81 @@ public:
         return minDoneCountWt;
     }
 
+    // 等待所有 worker 应用完目前为止下发的 merged log
+    void WaitForWorkers(int activeGrp) {
+        for (auto i = 0; i < activeGrp * NVMDB_OPLOG_WORKER_THREAD_PER_GROUP; i++) {
+            while (g_WorkerThreadInst[i]->GetLogDoneCount() < doneCountCombiner) {
+                usleep(1);
+            }
+        }
+    }
+
     bool MergedLogsToBeFreed() {
         return logQueue.empty();
     }
+
+    /*
+     * 按积压调整每个 group 参与应用 oplog 的 worker 数, 每个采样周期检查一次:
+     * 落后 combiner 的 merged log 数达到 FLAGS_pactree_oplog_scale_up_lag 时增加一个 worker,
+     * 连续 OPLOG_SCALE_DOWN_ROUNDS 个周期没有积压时减少一个. 修改前等待所有 worker 应用完已下发的
+     * merged log, 避免同一个 key 的 oplog 在分片变化前后被不同 worker 乱序应用.
+     */
+    void AdjustWorkers(int activeGrp) {
+        auto now = std::chrono::steady_clock::now();
+        auto elapsedUs = std::chrono::duration_cast<std::chrono::microseconds>(now - lastSampleTime).count();
+        if (elapsedUs < FLAGS_pactree_oplog_scale_interval_us) {
+            return;
+        }
+        PACTreeOplogStats stats;
+        int target[NVMDB_MAX_GROUP]{};
+        bool changed = false;
+        for (int grp = 0; grp < activeGrp; grp++) {
+            unsigned long minDoneCount = ULONG_MAX;
+            for (int i = grp; i < activeGrp * NVMDB_OPLOG_WORKER_THREAD_PER_GROUP; i += activeGrp) {
+                minDoneCount = std::min(minDoneCount, g_WorkerThreadInst[i]->GetLogDoneCount());
+                stats.appliedOps += g_WorkerThreadInst[i]->opcount.load(std::memory_order_relaxed);
+            }
+            uint64_t lag = doneCountCombiner - std::min(minDoneCount, doneCountCombiner);
+            stats.maxLag = std::max(stats.maxLag, lag);
+
+            int active = g_oplogActiveWorkers[grp].load(std::memory_order_relaxed);
+            target[grp] = active;
+            if (lag >= static_cast<uint64_t>(FLAGS_pactree_oplog_scale_up_lag)) {
+                idleRounds[grp] = 0;
+                target[grp] = std::min(active + 1, NVMDB_OPLOG_WORKER_THREAD_PER_GROUP);
+            } else if (lag == 0 && ++idleRounds[grp] >= OPLOG_SCALE_DOWN_ROUNDS) {
+                idleRounds[grp] = 0;
+                target[grp] = std::max(active - 1, GetMinWorkers());
+            }
+            changed |= (target[grp] != active);
+        }
+        if (changed) {
+            WaitForWorkers(activeGrp);
+            for (int grp = 0; grp < activeGrp; grp++) {
+                g_oplogActiveWorkers[grp].store(target[grp], std::memory_order_release);
+            }
+        }
+        for (int grp = 0; grp < activeGrp; grp++) {
+            stats.activeWorkers[grp] = target[grp];
+        }
+        if (elapsedUs > 0 && stats.appliedOps >= lastAppliedOps) {
+            stats.appliedOpsPerSec = (stats.appliedOps - lastAppliedOps) * 1000000 / elapsedUs;
+        }
+        lastAppliedOps = stats.appliedOps;
+        lastSampleTime = now;
+        PublishPACTreeOplogStats(stats);
+    }
+
+    static int GetMinWorkers() {
+        return std::max(1, std::min<int>(FLAGS_pactree_oplog_min_workers, NVMDB_OPLOG_WORKER_THREAD_PER_GROUP));
+    }
+
 private:
     std::queue<std::pair<unsigned long, std::vector<OpStruct *> *>> logQueue;
     unsigned long doneCountCombiner{0};
+    std::chrono::steady_clock::time_point lastSampleTime{std::chrono::steady_clock::now()};
+    uint64_t lastAppliedOps{0};
+    int idleRounds[NVMDB_MAX_GROUP]{};
 };
 
 }  // namespace NVMDB
@@ -7,9 +7,12 @@ namespace NVMDB {
 
 class LinkedList {
 public:
-    ListNode *Initialize();
+    ListNode *Initialize(uint32_t treeSlot);
 
-    bool Insert(Key_t &key, Val_t value, ListNode *head);
+    // 释放链表中的所有节点, 调用者保证没有并发访问
+    void Destroy();
+
+    bool Insert(Key_t &key, Val_t value, ListNode *head, bool keepExisting = false);
 
     bool Lookup(Key_t &key, Val_t &value, ListNode *head) const;
 
@@ -17,13 +20,34 @@ public:
                      ListNode *head, int maxRange, LookupSnapshot snapshot,
                      std::vector<std::pair<Key_t, Val_t>> &result) const;
 
+    /*
+     * 只读取 startKey 所在的一个数据节点, 把其中 [startKey, endKey) 范围内可见的 key 写入 result (先清空).
+     * 返回 true 表示扫描已经结束; 否则 *next 为下一个数据节点, *resumeKey 为继续扫描的起始 key.
+     */
+    bool ScanNode(Key_t &startKey, Key_t &endKey, ListNode *head, LookupSnapshot snapshot, ScanBuffer &result,
+                  ListNode **next, Key_t *resumeKey) const;
+
+    /*
+     * 从 head 开始每隔 stride 个数据节点读取一个, 把其中 [startKey, endKey) 范围内可见的 key 按链表顺序追加到 result
+     * (先清空). 跳过的节点只读 next 指针, 不加锁.
+     */
+    void SampleNodes(Key_t &startKey, Key_t &endKey, ListNode *head, uint64_t stride, LookupSnapshot snapshot,
+                     ScanBuffer &result) const;
+
     static void Print(ListNode *head);
 
     static uint32_t Size(ListNode *head);
 
+    // 遍历所有数据节点统计占用, 不加锁, 只在没有并发写入时调用
+    static void GetStats(ListNode *head, PACTreeStats *stats);
+
     ListNode *GetHead();
 
-    void Recover(void *sl);
+    // 每次启动时调用, 使上次运行中残留的节点锁失效
+    void Recover();
+
+    // 将一条未完成的 oplog 重放到 sl 对应的 search layer 上
+    static void RecoverOpLog(OpStruct *oplog, void *sl);
 
 private:
     // 每次启动版本+1
@@ -32,11 +56,6 @@ private:
     NVMPtr<ListNode> headPtr;
 
     NVMPtr<ListNode> tailPtr;
-
-    // 500 *200
-    OpStruct oplogs[100000];
-
-    int nunOpLogs[112];
 };
 
 }  // namespace NVMDB
@@ -54,13 +54,71 @@ struct KVItem {
     VarLenString key;  // 变长key，放到后面，方便直接读
 };
 
+/*
+ * 扫描结果缓冲区. key 按实际长度连续存放在 m_keys 中, 不再为每个结果复制一个定长 (KEYLENGTH) 的 Key_t;
+ * 游标扫描时反复复用同一个缓冲区, 容量稳定后不再分配内存.
+ */
+class ScanBuffer {
+public:
+    void Clear() {
+        m_keys.clear();
+        m_entries.clear();
+    }
+
+    bool Empty() const {
+        return m_entries.empty();
+    }
+
+    size_t Size() const {
+        return m_entries.size();
+    }
+
+    void Append(const Key_t &prefix, const VarLenString &remain, Val_t value) {
+        uint32_t length = prefix.keyLength + remain.keyLength;
+        Entry entry{static_cast<uint32_t>(m_keys.size()), length, value};
+        m_keys.insert(m_keys.end(), prefix.getData(), prefix.getData() + prefix.keyLength);
+        m_keys.insert(m_keys.end(), remain.getData(), remain.getData() + remain.keyLength);
+        m_entries.push_back(entry);
+    }
+
+    const char *KeyData(size_t i) const {
+        return m_keys.data() + m_entries[i].offset;
+    }
+
+    uint32_t KeyLength(size_t i) const {
+        return m_entries[i].length;
+    }
+
+    Val_t Value(size_t i) const {
+        return m_entries[i].value;
+    }
+
+private:
+    struct Entry {
+        uint32_t offset;
+        uint32_t length;
+        Val_t value;
+    };
+    std::vector<char> m_keys;
+    std::vector<Entry> m_entries;
+};
+
+/* 数据节点占用统计, 用于观察 key 编码的空间效率 */
+struct PACTreeStats {
+    uint64_t nodes{0};
+    uint64_t keys{0};
+    uint64_t keyBytes{0};  // 还原出的完整 key 的总长度
+    uint64_t kvBytes{0};   // KV item 在节点内实际占用的字节数 (去掉 prefix, 按 8 字节对齐)
+};
+
 class ListNode {
 public:
     void MakePrefix();
 
     ListNode() : nextKv(0), currPerm(0) {}
 
-    bool Insert(Key_t &key, Val_t value, int duringSplit);
+    // 返回 key 是否已经存在, keepExisting 时不覆盖已存在的 value
+    bool Insert(Key_t &key, Val_t value, int duringSplit, bool keepExisting = false);
 
     bool Lookup(Key_t &key, Val_t &value);
 
@@ -68,6 +126,12 @@ public:
     bool ScanInOrder(Key_t &startKey, Key_t &endKey, int maxRange, LookupSnapshot snapshot,
                      std::vector<std::pair<Key_t, Val_t>> &result, bool continueScan, bool *needPrune);
 
+    /* 同上, 读取本节点 [startKey, endKey) 内可见的 key, 按变长格式追加到 result */
+    bool ScanInOrder(Key_t &startKey, Key_t &endKey, LookupSnapshot snapshot, ScanBuffer &result, bool *needPrune);
+
+    /* 累加本节点的统计信息, 不加锁, 只在没有并发写入时调用 */
+    void GetStats(PACTreeStats *stats);
+
     void SetCur(NVMPtr<ListNode> ptr) {
         this->curPtr = ptr;
     }
@@ -128,6 +192,14 @@ public:
         return min <= key && key < max;
     }
 
+    void SetTreeSlot(uint32_t slot) {
+        this->treeSlot = slot;
+    }
+
+    uint32_t GetTreeSlot() const {
+        return treeSlot;
+    }
+
     void RecoverSplit(OpStruct *oplog);
 
     void Print() const {}
@@ -141,7 +213,8 @@ private:
     uint8_t nextKv;  // 下一个 KV Item 的offset
     uint8_t currPerm;
     bool deleted;
-    uint8_t unusedVariable[5]{};  // 占位，补齐到8字节对齐
+    uint8_t unusedVariable[1]{};  // 占位，补齐到8字节对齐
+    uint32_t treeSlot{0};         // 所属树的槽位, 写 oplog 时使用
 
     LinePointArray permutation[2];
 
@@ -166,12 +239,16 @@ private:
         currPerm = (currPerm + 1) % PERM_MOD;
     }
 
-    VarLenString *GetRemainKey(Key_t *origin_key) const;
+    void GetRemainKey(const Key_t &originKey, Key_t *remainKey) const;
 
     void GetOriginKey(VarLenString *remain_key, Key_t *origin_key);
 
     KVItem *GetKVItem(uint8_t offset);
 
+    template <typename Emit>
+    bool ScanItems(Key_t &startKey, Key_t &endKey, int todo, LookupSnapshot snapshot, bool continueScan,
+                   bool *needPrune, Emit &&emit);
+
     static auto GetKVItemSize(KVItem *kv) {
         return sizeof(Val_t) + sizeof(kv->key.keyLength) + kv->key.keyLength;
     }
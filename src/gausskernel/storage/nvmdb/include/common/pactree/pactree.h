@@ -2,28 +2,27 @@
 #define pactreeAPI_H
 
 #include "common/pactree/pactree_impl.h"
+#include <algorithm>
+#include <unordered_map>
 
 namespace NVMDB {
 
+// 一棵独立的 PACTree, 由 PACTreeManager 创建和释放
 class PACTree {
 public:
-    explicit PACTree() {  // dir not used, get from g_dirPaths
-        pt = InitPT();
-    }
+    PACTree(PACTreeImpl *pt, uint32_t slot, uint32_t treeId) : pt(pt), slot(slot), treeId(treeId) {}
 
-    ~PACTree() {
-        pt->~PACTreeImpl();
-        pt = nullptr;
-        PMem::UnmountPMEMPool();
-        LNodeReport();
+    bool Insert(Key_t &key, Val_t val) {
+        return pt->Insert(slot, key, val);
     }
 
-    bool Insert(Key_t &key, Val_t val) {
-        return pt->Insert(key, val);
+    // key 已存在时保留原来的 value, 返回 true
+    bool InsertIfAbsent(Key_t &key, Val_t val) {
+        return pt->Insert(slot, key, val, true);
     }
 
     Val_t lookup(Key_t &key, bool *found) {
-        return pt->Lookup(key, found);
+        return pt->Lookup(slot, key, found);
     }
 
     void scan(Key_t &startKey,
@@ -32,7 +31,222 @@ public:
               LookupSnapshot snapshot,
               bool reverse,
               std::vector<std::pair<Key_t, Val_t>> &result) {
-        pt->Scan(startKey, endKey, max_range, snapshot, reverse, result);
+        pt->Scan(slot, startKey, endKey, max_range, snapshot, reverse, result);
+    }
+
+    ListNode *seek(Key_t &key) {
+        return pt->Seek(slot, key);
+    }
+
+    bool scanNode(Key_t &startKey, Key_t &endKey, ListNode *node, LookupSnapshot snapshot, ScanBuffer &result,
+                  ListNode **next, Key_t *resumeKey) {
+        return pt->ScanNode(slot, startKey, endKey, node, snapshot, result, next, resumeKey);
+    }
+
+    // 每隔 stride 个数据节点读取一个节点中可见的 key, 见 LinkedList::SampleNodes
+    void sampleNodes(Key_t &startKey, Key_t &endKey, uint64_t stride, LookupSnapshot snapshot, ScanBuffer &result) {
+        pt->SampleNodes(slot, startKey, endKey, stride, snapshot, result);
+    }
+
+    // 数据节点个数, 只沿链表读 next 指针
+    uint64_t GetNodeCount() {
+        return pt->GetNodeCount(slot);
+    }
+
+    // 统计数据节点的占用情况, 调用者保证没有并发写入
+    PACTreeStats GetStats() {
+        PACTreeStats stats;
+        pt->GetStats(slot, &stats);
+        return stats;
+    }
+
+    uint32_t GetTreeId() const {
+        return treeId;
+    }
+
+    uint32_t GetSlot() const {
+        return slot;
+    }
+
+private:
+    PACTreeImpl *pt;
+    uint32_t slot;
+    uint32_t treeId;
+};
+
+/*
+ * 数据层游标: 只在开始时通过 search layer 定位一次, 之后沿着链表逐个读取后继数据节点,
+ * 每次缓存一个节点中对快照可见的 key. 连续跨越的节点越多, 说明是长范围扫描, 预取下一个节点的 cache line 也越多.
+ * 缓存的 key 是变长的, 通过 CurrKeyData/CurrKeyLength 访问, 指针在 Next 之前有效.
+ */
+class PACTreeCursor {
+public:
+    PACTreeCursor(PACTree *tree, Key_t &startKey, Key_t &endKey, LookupSnapshot snapshot)
+        : m_tree(tree), m_nextKey(startKey), m_endKey(endKey), m_snapshot(snapshot) {
+        m_node = tree->seek(startKey);
+        Fill();
+    }
+
+    bool Valid() const {
+        return m_pos < m_entries.Size();
+    }
+
+    void Next() {
+        DCHECK(Valid());
+        m_pos++;
+        if (m_pos == m_entries.Size()) {
+            Fill();
+        }
+    }
+
+    const char *CurrKeyData() const {
+        return m_entries.KeyData(m_pos);
+    }
+
+    uint32_t CurrKeyLength() const {
+        return m_entries.KeyLength(m_pos);
+    }
+
+    Val_t CurrVal() const {
+        return m_entries.Value(m_pos);
+    }
+
+private:
+    // 读取下一个数据节点, 直到读到可见的 key 或者扫描结束
+    void Fill() {
+        m_entries.Clear();
+        m_pos = 0;
+        while (!m_end && m_entries.Empty()) {
+            ListNode *next = nullptr;
+            m_end = m_tree->scanNode(m_nextKey, m_endKey, m_node, m_snapshot, m_entries, &next, &m_nextKey);
+            if (!m_end) {
+                m_node = next;
+                PrefetchNode();
+            }
+        }
+    }
+
+    void PrefetchNode() {
+        auto *addr = reinterpret_cast<const char *>(m_node);
+        for (uint32_t i = 0; i < m_prefetchLines; i++) {
+            __builtin_prefetch(addr + i * NVM_CACHE_LINE_SIZE);
+        }
+        m_prefetchLines = std::min(m_prefetchLines * 2, MAX_PREFETCH_LINES);
+    }
+
+    static constexpr uint32_t MIN_PREFETCH_LINES = 4;  // 节点头和 permutation
+    static constexpr uint32_t MAX_PREFETCH_LINES = LIST_NODE_SIZE / NVM_CACHE_LINE_SIZE;
+
+    PACTree *m_tree;
+    ListNode *m_node{nullptr};
+    Key_t m_nextKey;
+    Key_t m_endKey;
+    LookupSnapshot m_snapshot;
+    bool m_end{false};
+    uint32_t m_prefetchLines{MIN_PREFETCH_LINES};
+    size_t m_pos{0};
+    ScanBuffer m_entries;
+};
+
+/*
+ * 所有 PACTree 共享的运行环境: PMem 内存池, oplog 以及后台 worker/combiner 线程.
+ * 每棵树有自己的数据层链表和 search layer, 删除一棵树只需要摘掉它的树根, 不需要遍历其中的 key.
+ */
+class PACTreeManager {
+public:
+    explicit PACTreeManager() {  // dir not used, get from g_dirPaths
+        pt = InitPT();
+    }
+
+    ~PACTreeManager() {
+        for (auto &it : trees) {
+            delete it.second;
+        }
+        trees.clear();
+        pt->~PACTreeImpl();
+        pt = nullptr;
+        PMem::UnmountPMEMPool();
+        LNodeReport();
+    }
+
+    /*
+     * 返回 treeId 对应的树, 不存在时创建, 没有空闲槽位时返回 nullptr.
+     * useReserved 为 true 时消耗一个 ReserveTrees 预留的槽位, 否则不会占用别人预留的槽位.
+     */
+    PACTree *CreateTree(uint32_t treeId, bool useReserved = false) {
+        std::lock_guard<std::mutex> lockGuard(mtx);
+        if (useReserved) {
+            DCHECK(reserved > 0);
+            reserved--;
+        }
+        PACTree *tree = OpenTree(treeId);
+        if (tree == nullptr) {
+            if (!useReserved && pt->GetFreeSlotCount() <= reserved) {
+                LOG(WARNING) << "Too many PACTrees, treeId: " << treeId << ", reserved: " << reserved;
+                return nullptr;
+            }
+            uint32_t slot = pt->CreateTree(treeId);
+            if (slot == PACTREE_INVALID_SLOT) {
+                return nullptr;
+            }
+            tree = new PACTree(pt, slot, treeId);
+            trees.emplace(treeId, tree);
+        }
+        return tree;
+    }
+
+    // 预留 count 个槽位, 之后同样次数的 CreateTree(treeId, true) 一定成功; 空闲槽位不够时返回 false
+    bool ReserveTrees(uint32_t count) {
+        std::lock_guard<std::mutex> lockGuard(mtx);
+        if (pt->GetFreeSlotCount() < reserved + count) {
+            return false;
+        }
+        reserved += count;
+        return true;
+    }
+
+    // 放弃还没有用掉的预留槽位
+    void UnreserveTrees(uint32_t count) {
+        std::lock_guard<std::mutex> lockGuard(mtx);
+        DCHECK(reserved >= count);
+        reserved -= count;
+    }
+
+    // 返回 treeId 对应的树, 不存在时返回 nullptr
+    PACTree *GetTree(uint32_t treeId) {
+        std::lock_guard<std::mutex> lockGuard(mtx);
+        return OpenTree(treeId);
+    }
+
+    // 删除 treeId 对应的树, 调用者保证之后不会再访问这棵树; PMem 由后台线程异步回收
+    void DropTree(uint32_t treeId) {
+        std::lock_guard<std::mutex> lockGuard(mtx);
+        PACTree *tree = OpenTree(treeId);
+        if (tree == nullptr) {
+            return;
+        }
+        pt->DropTree(tree->GetSlot());
+        trees.erase(treeId);
+        delete tree;
+    }
+
+    // 把 treeId 对应的树从管理器中摘下并标记删除, 返回句柄 (不存在时返回 nullptr).
+    // 之后 CreateTree/GetTree 看不到这棵树, 已经拿到句柄的线程仍可以访问, 直到调用者 ReleaseTree(tree)
+    PACTree *DetachTree(uint32_t treeId) {
+        std::lock_guard<std::mutex> lockGuard(mtx);
+        PACTree *tree = OpenTree(treeId);
+        if (tree == nullptr) {
+            return nullptr;
+        }
+        pt->DetachTree(tree->GetSlot());
+        trees.erase(treeId);
+        return tree;
+    }
+
+    // 回收 DetachTree 摘下的树并释放句柄, 调用者保证之后不会再访问这棵树
+    void ReleaseTree(PACTree *tree) {
+        pt->DropTree(tree->GetSlot());
+        delete tree;
     }
 
     void registerThread(int grpId = 0) {
@@ -44,7 +258,28 @@ public:
     }
 
 private:
+    PACTree *OpenTree(uint32_t treeId) {
+        auto it = trees.find(treeId);
+        if (it != trees.end()) {
+            return it->second;
+        }
+        uint32_t slot = pt->FindTree(treeId);
+        if (slot == PACTREE_INVALID_SLOT) {
+            return nullptr;
+        }
+        auto *tree = new PACTree(pt, slot, treeId);
+        trees.emplace(treeId, tree);
+        return tree;
+    }
+
     PACTreeImpl *pt;
+
+    std::mutex mtx;
+
+    std::unordered_map<uint32_t, PACTree *> trees;
+
+    // 已经预留还没有用掉的槽位个数
+    uint32_t reserved = 0;
 };
 
 }  // namespace NVMDB
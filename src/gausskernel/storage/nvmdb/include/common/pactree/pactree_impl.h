@@ -7,35 +7,110 @@
 
 namespace NVMDB {
 
-extern std::vector<SearchLayer *> g_perGrpSlPtr;
+static constexpr uint32_t PACTREE_INVALID_SLOT = UINT32_MAX;
+
+/*
+ * PACTree 持久化格式的版本, 保存在 PMem 池的 PACTreeImpl 开头. 版本 2: 每个索引一棵树, key 不带 idxId 前缀
+ * (KEY_EXTRA_LENGTH 为 5), 索引 undo 记录为 [IndexId][Key_t]. 旧版本的镜像没有这个头, 启动时拒绝打开,
+ * 避免按新格式误读; 索引在 undo 回滚之前启动, 所以这里的检查也保护了 undo 中的索引记录.
+ */
+static constexpr uint64_t PACTREE_FORMAT_MAGIC = 0x4E564D4450415452ULL;  // "NVMDPATR"
+static constexpr uint32_t PACTREE_FORMAT_VERSION = 2;
+
+extern SearchLayer *g_perTreeSlPtr[NVMDB_PACTREE_MAX_TREE_NUM][NVMDB_MAX_GROUP];
 extern std::set<ThreadData *> g_threadDataSet;
 
+enum class PACTreeState : uint8_t {
+    FREE,
+    ACTIVE,
+    DROPPED,  // 已删除, 等待 combiner 线程回收
+};
+
+/*
+ * 一棵 PACTree 的持久化根: 数据层链表和每个 group 一个 search layer.
+ * PMem 内存池, oplog 和后台 worker/combiner 线程由所有树共享.
+ */
+struct PACTreeRoot {
+    uint32_t treeId;
+    std::atomic<PACTreeState> state;
+    LinkedList dl;
+    NVMPtr<SearchLayer> slPtr[NVMDB_MAX_GROUP];
+};
+
 class PACTreeImpl {
 public:
-    explicit PACTreeImpl(int numGrp, root_obj *root);
+    explicit PACTreeImpl(int numGrp);
 
     ~PACTreeImpl();
 
-    bool Insert(Key_t &key, Val_t val);
+    // 创建一棵新树, 返回槽位; 没有空闲槽位 (删除之后还没有回收的树也占着槽位) 时返回 PACTREE_INVALID_SLOT.
+    // 调用者负责串行化 CreateTree
+    uint32_t CreateTree(uint32_t treeId);
+
+    // 空闲槽位的个数, 调用者负责与 CreateTree 串行化
+    uint32_t GetFreeSlotCount() const;
+
+    // 查找 treeId 对应的树, 不存在时返回 PACTREE_INVALID_SLOT
+    uint32_t FindTree(uint32_t treeId) const;
+
+    // 只持久化地标记删除, FindTree 不再返回它, 但仍可以通过槽位访问; 崩溃重启时由 Recover 回收
+    void DetachTree(uint32_t slot);
+
+    // 标记删除 (如果还没有), 内存由 combiner 线程在确认没有线程访问后回收
+    void DropTree(uint32_t slot);
+
+    // 回收已删除的树
+    void FreeTree(uint32_t slot);
+
+    bool Insert(uint32_t slot, Key_t &key, Val_t val, bool keepExisting = false);
 
     void RegisterThread(int grpId);
 
     void UnregisterThread();
 
-    Val_t Lookup(Key_t &key, bool *found);
+    Val_t Lookup(uint32_t slot, Key_t &key, bool *found);
 
     void Recover();
 
-    void Scan(Key_t &startKey, Key_t &endKey, int maxRange, LookupSnapshot snapshot, bool reverse,
+    void Scan(uint32_t slot, Key_t &startKey, Key_t &endKey, int maxRange, LookupSnapshot snapshot, bool reverse,
               std::vector<std::pair<Key_t, Val_t>> &result);
 
-    static SearchLayer *CreateSearchLayer(root_obj *root, int threadId);
+    // 通过 search layer 找到 key 附近的数据节点, 作为 ScanNode 的起点
+    ListNode *Seek(uint32_t slot, Key_t &key) {
+        return getJumpNode(slot, key);
+    }
+
+    bool ScanNode(uint32_t slot, Key_t &startKey, Key_t &endKey, ListNode *node, LookupSnapshot snapshot,
+                  ScanBuffer &result, ListNode **next, Key_t *resumeKey) {
+        return roots[slot].dl.ScanNode(startKey, endKey, node, snapshot, result, next, resumeKey);
+    }
+
+    void SampleNodes(uint32_t slot, Key_t &startKey, Key_t &endKey, uint64_t stride, LookupSnapshot snapshot,
+                     ScanBuffer &result) {
+        roots[slot].dl.SampleNodes(startKey, endKey, roots[slot].dl.GetHead(), stride, snapshot, result);
+    }
+
+    uint64_t GetNodeCount(uint32_t slot) {
+        return LinkedList::Size(roots[slot].dl.GetHead());
+    }
+
+    void GetStats(uint32_t slot, PACTreeStats *stats) {
+        LinkedList::GetStats(roots[slot].dl.GetHead(), stats);
+    }
 
     static int GetThreadGroupId();
 
     static void SetThreadGroupId(int grpId);
 
-    void Init(int numGrp, root_obj *root);
+    void Init(int numGrp);
+
+    bool IsCompatibleFormat() const {
+        return formatMagic == PACTREE_FORMAT_MAGIC && formatVersion == PACTREE_FORMAT_VERSION;
+    }
+
+    uint32_t GetFormatVersion() const {
+        return formatMagic == PACTREE_FORMAT_MAGIC ? formatVersion : 0;
+    }
 
 #ifdef PACTREE_ENABLE_STATS
     std::atomic<uint64_t> total_sl_time;
@@ -43,14 +118,23 @@ public:
 #endif
 
 protected:
-    void CreateWorkerThread(int numGrp, root_obj *root);
+    void CreateWorkerThread(int numGrp);
 
     void CreateCombinerThread();
 
-    ListNode *getJumpNode(Key_t &key);
+    void StartThreads(int numGrp);
+
+    // 重启后打开所有树的 search layer
+    void OpenTrees();
+
+    ListNode *getJumpNode(uint32_t slot, Key_t &key);
 
 private:
-    LinkedList dl;
+    // 必须在最前面, 旧格式镜像的同一位置不会是 PACTREE_FORMAT_MAGIC
+    uint64_t formatMagic;
+    uint32_t formatVersion;
+
+    PACTreeRoot roots[NVMDB_PACTREE_MAX_TREE_NUM];
 
     // CurrentOne but there should be group number of threads
     std::vector<std::thread *> *wtArray;
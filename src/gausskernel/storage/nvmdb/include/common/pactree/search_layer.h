@@ -36,6 +36,16 @@ public:
         dummyIdx = new ART_ROWEX::Tree(LoadIntKeyFunction);
     }
 
+    // 释放整棵 ART 占用的 PMem, 调用者保证没有并发访问
+    void Destroy() {
+        auto *tree = idxPtr.getVaddr();
+        tree->Destroy();
+        PMem::free((void *)idxPtr.getRawPtr());
+        idx = nullptr;
+        delete dummyIdx;
+        dummyIdx = nullptr;
+    }
+
     void SetGroupId(int nma) {
         this->group = nma;
         this->grpMask = 1 << nma;
@@ -54,8 +64,13 @@ public:
         Key k;
         SetKey(k, key);
         idx->Insert(k, reinterpret_cast<unsigned long>(ptr), t);
-        if (key < curMin)
-            curMin = key;
+        if (key < curMin) {
+            // 同一 group 可能有多个 worker 并发插入, 最小值很少变化, 用一把全局锁即可
+            std::lock_guard<std::mutex> lockGuard(CurMinLock());
+            if (key < curMin) {
+                curMin = key;
+            }
+        }
         numInserts++;
         return true;
     }
@@ -100,12 +115,17 @@ public:
         return numInserts;
     }
 private:
+    static std::mutex &CurMinLock() {
+        static std::mutex lock;
+        return lock;
+    }
+
     Key minKey;
     Key_t curMin;
     NVMPtr<ART_ROWEX::Tree> idxPtr;
     ART_ROWEX::Tree *idx{nullptr};
     ART_ROWEX::Tree *dummyIdx{nullptr};
-    uint32_t numInserts{0};
+    std::atomic<uint32_t> numInserts{0};
 };
 
 using SearchLayer = PDLARTIndex;
@@ -2,14 +2,36 @@
 #define PACTREE_WORKERTHREAD_H
 
 #include "common/pdl_art/op_log.h"
+#include "gflags/gflags.h"
 
 namespace NVMDB {
 
+DECLARE_int32(pactree_oplog_min_workers);
+DECLARE_int32(pactree_oplog_scale_up_lag);
+DECLARE_int64(pactree_oplog_scale_interval_us);
+
 extern int g_lockCapacity;
 
+/*
+ * 每个 group 当前参与应用 oplog 的 worker 数. 第 i 个 worker 属于 group i % activeGrp, 在组内的序号为
+ * i / activeGrp, 只应用 key 的哈希落在自己序号上的 oplog, 序号不小于该值的 worker 只消费队列不做事.
+ * 只有 combiner 在所有 worker 应用完已下发的 merged log 之后修改, 保证同一个 key 的 oplog 按顺序应用.
+ */
+extern std::atomic<int> g_oplogActiveWorkers[NVMDB_MAX_GROUP];
+
+struct PACTreeOplogStats {
+    uint64_t appliedOps{0};         // 累计应用到 search layer 的 oplog 数
+    uint64_t appliedOpsPerSec{0};   // 最近一个采样周期的应用速率
+    uint64_t maxLag{0};             // worker 落后 combiner 的 merged log 数, 取各 group 的最大值
+    int activeWorkers[NVMDB_MAX_GROUP]{};
+};
+
+// combiner 每个采样周期更新一次
+PACTreeOplogStats GetPACTreeOplogStats();
+
 class WorkerThread {
 public:
-    unsigned long opcount{0};
+    std::atomic<uint64_t> opcount{0};
 
     WorkerThread(int id, int activeGrp);
 
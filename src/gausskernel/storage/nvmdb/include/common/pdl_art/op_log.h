@@ -46,7 +46,7 @@ public:
         return true;
     }
     static void WriteOpLog(OpStruct *oplog, OpStruct::Operation op, const Key_t& key, void *oldNodeRawPtr, uint16_t poolId,
-                           const Key_t& newKey, Val_t newVal);
+                           const Key_t& newKey, Val_t newVal, uint16_t treeSlot);
     static OpStruct *allocOpLog();
 private:
     std::mutex qLock[2];
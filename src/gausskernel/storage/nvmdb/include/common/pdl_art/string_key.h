@@ -112,6 +112,8 @@ public:
 
     char* getData() { return (char *)data; }
 
+    const char* getData() const { return (const char *)data; }
+
     // 找下一个开始的Key
     void next() {
         if (keyLength <= 0) {
@@ -142,6 +144,7 @@ public:
     uint8_t hash;                       // 1
     Step step;                          // 4
     std::atomic<uint8_t> searchLayers;  // 1
+    uint16_t treeSlot;                  // 2, 所属树的槽位
     Key_t key;                          //  8
     void *oldNodePtr;                   // old node_ptr 8
     PMEMoid newNodeOid;                 // new node_ptr 16
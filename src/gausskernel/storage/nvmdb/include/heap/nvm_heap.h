@@ -2,17 +2,34 @@
 #define NVMDB_HEAP_SPACE_H
 
 #include "table_space/nvm_table_space.h"
+#include "table_space/nvm_cold_store.h"
+#include "gflags/gflags.h"
 
 namespace NVMDB {
 
+DECLARE_string(heap_tier_dir);
+DECLARE_int64(heap_tier_ssd_bytes);
+DECLARE_int64(heap_tier_pmem_limit_bytes);
+DECLARE_int32(heap_tier_interval_ms);
+DECLARE_int32(heap_tier_cold_rounds);
+
 void HeapCreate(const std::shared_ptr<DirectoryConfig>& dirConfig);
 
 void HeapBootStrap(const std::shared_ptr<DirectoryConfig>& dirConfig);
 
+// 启动把冷 extent 换出到 SSD 的后台线程, 需要在 undo 挂载之后调用. 没有配置 heap_tier_dir 时不启动
+void HeapStartTiering();
+
+// 后台线程的一轮: 时钟加一, heap 占用的 PMem 超过 heap_tier_pmem_limit_bytes 时换出冷 extent, 返回换出的个数
+uint32 HeapTierOnce();
+
 void HeapExitProcess();
 
 extern TableSpace *g_heapSpace;
 
+// 冷 extent 所在的 SSD 文件, 没有打开冷热分层时为空
+extern ColdExtentStore *g_heapColdStore;
+
 }  // namespace NVMDB
 
-#endif  // NVMDB_HEAP_SPACE_H
\ No newline at end of file
+#endif  // NVMDB_HEAP_SPACE_H
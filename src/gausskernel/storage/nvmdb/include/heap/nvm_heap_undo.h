@@ -12,12 +12,17 @@ UndoRecPtr PrepareUpdateUndo(Transaction *tx, uint32 segHead, RowId rowid, const
 
 UndoRecPtr PrepareDeleteUndo(Transaction *tx, uint32 segHead, RowId rowid, const NVMTuple& old_tuple);
 
+// 批量导入: 一条 undo 覆盖 [rowid, rowid + count) 中由 tx 写入的行
+UndoRecPtr PrepareBulkInsertUndo(Transaction *tx, uint32 segHead, RowId rowid, uint16 row_len, uint32 count);
+
 void UndoInsert(const UndoRecord *undo);
 
 void UndoUpdate(const UndoRecord *undo);
 
 void UndoDelete(const UndoRecord *undo);
 
+void UndoBulkInsert(const UndoRecord *undo);
+
 void UndoUpdate(const UndoRecord *undo, NVMTuple *tuple, char* rowData);
 
 }  // namespace NVMDB
@@ -3,13 +3,21 @@
 
 #include "table_space/nvm_table_space.h"
 #include "heap/nvm_tuple.h"
+#include "heap/nvm_tuple_cache.h"
 #include "nvm_vecstore.h"
 #include "common/nvm_spinlock.h"
 #include <atomic>
+#include <bitset>
 #include <functional>
 
 namespace NVMDB {
 
+// 当前线程写入NVM的heap数据量(字节), 供benchmark统计每个事务的写入量
+extern thread_local uint64 g_heapNVMWriteBytes;
+
+// 冷热分层的时钟, 后台线程每一轮加一. extent 被访问时记录当时的时钟, 多轮没有变化的 extent 是冷的
+extern std::atomic<uint32> g_heapTierClock;
+
 class RowIdMapEntry {
 public:
     inline void Lock() { m_mutex.lock(); }
@@ -20,53 +28,133 @@ public:
 
     inline bool IsValid() const { return m_isTupleValid; }
 
+    // 调用者需持有锁: 从全局 tuple 缓存中取出该 tuple 的缓存, 未缓存时分配缓存并从 NVM 加载
     template <typename T=NVMTuple>
     T *loadDRAMCache(size_t tupleSize) {
         DCHECK(tupleSize <= MAX_TUPLE_LEN);
+        auto *tupleCache = TupleCache::GetGlobalTupleCache();
+        DCHECK(tupleCache != nullptr);
         // 防止段错误, 重新加载tuple
-        if (m_dramCache.size() < tupleSize) {
+        if (m_dramCacheSize < tupleSize) {
             clearCache();
         }
-        if (m_dramCache.empty()) {
-            m_dramCache.resize(tupleSize);
-            errno_t ret = memcpy_s(m_dramCache.data(), tupleSize, m_nvmAddr, tupleSize);
+        if (m_dramCache == nullptr) {
+            m_dramCache = tupleCache->Allocate(this, tupleSize);
+            m_dramCacheSize = tupleSize;
+            errno_t ret = memcpy_s(m_dramCache, tupleSize, m_nvmAddr, tupleSize);
             SecureRetCheck(ret);
+        } else {
+            tupleCache->Touch(m_dramCache);
+        }
+        return reinterpret_cast<T *>(m_dramCache);
+    }
+
+    // 扫描专用, 调用者需持有锁: 已缓存的tuple读缓存, 否则直接返回NVM地址, 不加载缓存也不设置访问位
+    const char *peekTuple(size_t tupleSize) const {
+        if (m_dramCacheSize >= tupleSize) {
+            return m_dramCache;
         }
-        return reinterpret_cast<T *>(m_dramCache.data());
+        return m_nvmAddr;
     }
 
+    inline const char *getNVMAddr() const { return m_nvmAddr; }
+
     void flushToNVM() {
-        if (m_dramCache.empty()) {
+        if (m_dramCache == nullptr) {
             LOG(ERROR) << "DRAM cache is empty!";
             return;
         }
-        errno_t ret = memcpy_s(m_nvmAddr, m_dramCache.size(), m_dramCache.data(), m_dramCache.size());
+        errno_t ret = memcpy_s(m_nvmAddr, m_dramCacheSize, m_dramCache, m_dramCacheSize);
         SecureRetCheck(ret);
+        g_heapNVMWriteBytes += m_dramCacheSize;
     }
 
     void flushHeaderToNVM() {
-        if (m_dramCache.size() < NVMTupleHeadSize) {
+        if (m_dramCacheSize < NVMTupleHeadSize) {
             LOG(ERROR) << "DRAM cache is empty!";
             return;
         }
-        errno_t ret = memcpy_s(m_nvmAddr, NVMTupleHeadSize, m_dramCache.data(), NVMTupleHeadSize);
+        errno_t ret = memcpy_s(m_nvmAddr, NVMTupleHeadSize, m_dramCache, NVMTupleHeadSize);
         SecureRetCheck(ret);
+        g_heapNVMWriteBytes += NVMTupleHeadSize;
+    }
+
+    /*
+     * 只落盘 header 和被更新的列. cols 中的偏移量相对于 tuple 的数据区.
+     * 落盘以 cache line 为单位: 把涉及到的 cache line 标记出来, 再按连续的 cache line 段整段拷贝,
+     * 避免对同一 cache line 的多次部分写.
+     */
+    void flushColumnsToNVM(const UndoColumnDesc *cols, uint32 colCnt) {
+        const size_t tupleSize = m_dramCacheSize;
+        if (tupleSize < NVMTupleHeadSize) {
+            LOG(ERROR) << "DRAM cache is empty!";
+            return;
+        }
+        constexpr uint64 lineSize = NVM_CACHE_LINE_SIZE;
+        const auto nvmAddr = reinterpret_cast<uint64>(m_nvmAddr);
+        const uint64 baseLine = nvmAddr / lineSize;
+        std::bitset<(MAX_TUPLE_LEN + NVMTupleHeadSize) / NVM_CACHE_LINE_SIZE + 2> dirtyLines;
+        const auto markRange = [&](uint64 offset, uint64 len) {
+            DCHECK(offset + len <= tupleSize);
+            if (len == 0) {
+                return;
+            }
+            uint64 lastLine = (nvmAddr + offset + len - 1) / lineSize - baseLine;
+            for (uint64 line = (nvmAddr + offset) / lineSize - baseLine; line <= lastLine; line++) {
+                dirtyLines.set(line);
+            }
+        };
+        markRange(0, NVMTupleHeadSize);
+        for (uint32 i = 0; i < colCnt; i++) {
+            markRange(NVMTupleHeadSize + cols[i].m_colOffset, cols[i].m_colLen);
+        }
+
+        const uint64 lineCnt = (nvmAddr + tupleSize - 1) / lineSize - baseLine + 1;
+        uint64 line = 0;
+        while (line < lineCnt) {
+            if (!dirtyLines.test(line)) {
+                line++;
+                continue;
+            }
+            uint64 endLine = line;
+            while (endLine < lineCnt && dirtyLines.test(endLine)) {
+                endLine++;
+            }
+            // 首尾的 cache line 不能越过 tuple 的边界
+            uint64 start = std::max((baseLine + line) * lineSize, nvmAddr) - nvmAddr;
+            uint64 end = std::min((baseLine + endLine) * lineSize, nvmAddr + tupleSize) - nvmAddr;
+            errno_t ret = memcpy_s(m_nvmAddr + start, end - start, m_dramCache + start, end - start);
+            SecureRetCheck(ret);
+            g_heapNVMWriteBytes += end - start;
+            line = endLine;
+        }
+    }
+
+    // tuple 的事务已经提交, 用提交 CSN 替换 header 中的 TxSlotPtr, 只写回 8 字节的 m_txInfo. 调用者需持有锁
+    void stampCSN(uint64 csn) {
+        DCHECK(TxInfoIsCSN(csn));
+        if (m_dramCacheSize >= NVMTupleHeadSize) {
+            reinterpret_cast<NVMTuple *>(m_dramCache)->m_txInfo = csn;
+        }
+        reinterpret_cast<NVMTuple *>(m_nvmAddr)->m_txInfo = csn;
+        g_heapNVMWriteBytes += sizeof(uint64);
     }
 
     // 针对非read modify write设计, 直接写入
     void wrightThroughCache(const std::function<void(char*)>& nvmFunc, size_t syncSize) {
         // 如果缓存size不够, 清理缓存
-        if (syncSize < m_dramCache.size()) {
+        if (syncSize < m_dramCacheSize) {
             clearCache();
         }
+        g_heapNVMWriteBytes += syncSize;
         // 对于未读缓存的tuple, 直接写NVM
-        if (m_dramCache.empty()) {
+        if (m_dramCache == nullptr) {
             nvmFunc(m_nvmAddr);
             return;
         }
         // 对于读缓存的tuple, 先写dram之后刷盘
-        nvmFunc(m_dramCache.data());
-        errno_t ret = memcpy_s(m_nvmAddr, syncSize, m_dramCache.data(), syncSize);
+        nvmFunc(m_dramCache);
+        errno_t ret = memcpy_s(m_nvmAddr, syncSize, m_dramCache, syncSize);
         SecureRetCheck(ret);
     }
 
@@ -77,20 +165,41 @@ public:
         m_isTupleValid = true;
     }
 
-public:
-    // 每张表, 每个线程一个LRU, 引用计数相关
-    int increaseReference() { return m_referenceCount.fetch_add(1); }
-
-    int decreaseReference() { return m_referenceCount.fetch_sub(1); }
+    // 所在 extent 被回收 (TRUNCATE), 下次访问时按新的 NVM 地址重新初始化. 调用者需持有锁
+    void Invalidate() {
+        m_isTupleValid = false;
+        m_nvmAddr = nullptr;
+        clearCache();
+    }
 
-    int getReferenceCount(std::memory_order memoryOrder) const { return m_referenceCount.load(memoryOrder); }
+    /*
+     * 回收已删除的行 (VACUUM): NVM 上清除占用和删除标记, 之后这个行号可以重新分配. 调用者需持有锁.
+     * 先清除占用标记, 中途崩溃时这一行要么仍是已删除的行, 要么是空行.
+     */
+    void Reclaim() {
+        auto *tuple = reinterpret_cast<NVMTuple *>(m_nvmAddr);
+        tuple->m_isUsed = false;
+        std::atomic_thread_fence(std::memory_order_release);
+        tuple->m_isDeleted = false;
+        tuple->m_prev = InvalidUndoRecPtr;
+        g_heapNVMWriteBytes += NVMTupleHeadSize;
+        clearCache();
+    }
 
-    // 清理缓存 (此操作会释放空间)
-    inline void clearAndShrinkCache() { std::vector<char>().swap(m_dramCache); }
+    // 缓存被全局 tuple 缓存淘汰, 槽位由 TupleCache 回收. 调用者需持有锁
+    inline void dropCache() {
+        m_dramCache = nullptr;
+        m_dramCacheSize = 0;
+    }
 
-protected:
-    // 清理缓存 (此操作不释放空间)
-    inline void clearCache() { m_dramCache.clear(); }
+    // 清理缓存, 槽位归还全局 tuple 缓存. 调用者需持有锁
+    inline void clearCache() {
+        if (m_dramCache == nullptr) {
+            return;
+        }
+        TupleCache::GetGlobalTupleCache()->Release(m_dramCache);
+        dropCache();
+    }
 
 private:
     PassiveSpinner42 m_mutex;
@@ -98,9 +207,9 @@ private:
 
 private:
     char *m_nvmAddr = nullptr;
-    // 引用计数, 当变为0时销毁对应缓存
-    std::atomic<int> m_referenceCount = {0};
-    std::vector<char> m_dramCache = {};
+    // 全局 tuple 缓存中的槽位, 以及缓存的 tuple 长度
+    char *m_dramCache = nullptr;
+    size_t m_dramCacheSize = 0;
 };
 
 namespace {
@@ -111,12 +220,16 @@ constexpr int RowIdMapSegmentLen = 128 * 1024;
 class RowIdMap {
 public:
     // rowLen: 定长存储, 每一行数据的最大长度
-    RowIdMap(TableSpace *tableSpace, uint32 segHead, uint32 rowLen) : m_rowLen(rowLen), m_extendFlag(0) {
+    // coldStore 不为空时记录每个 extent 的访问时钟, 冷 extent 可以换出到 SSD
+    RowIdMap(TableSpace *tableSpace, uint32 segHead, uint32 rowLen, ColdExtentStore *coldStore = nullptr)
+        : m_rowLen(rowLen), m_extendFlag(0) {
         m_segmentCapacity = 16; // 初始段数, 在不够用时原子性扩展
         m_segments.store(new RowIdMapEntry *[m_segmentCapacity]());
-        m_rowidMgr = new RowIDMgr(tableSpace, segHead, rowLen);
-        auto tuplesPerExtent = m_rowidMgr->getTuplesPerExtent();
-        m_vecStore = new VecStore(tableSpace, segHead, tuplesPerExtent);
+        m_rowidMgr = new RowIDMgr(tableSpace, segHead, rowLen, coldStore);
+        m_vecStore = new VecStore(tableSpace, m_rowidMgr, segHead);
+        if (coldStore != nullptr) {
+            m_extentTicks = std::make_unique<std::atomic<uint32>[]>(HEAP_MAX_LEAF_EXTENTS);
+        }
     }
 
     RowId getNextEmptyRow() {
@@ -135,12 +248,69 @@ public:
         }
     }
 
+    /*
+     * 批量导入独占一个 extent: 返回其行号范围 [*begin, *end) 和第一行的 NVM 地址, extent 内的行连续存放.
+     * *isNew 为 false 表示这个 extent 重启前已经部分使用过, 调用者需要跳过其中已占用的行.
+     */
+    char *AcquireExtent(RowId *begin, RowId *end, bool *isNew) {
+        m_vecStore->AcquireExtent(begin, end);
+        *isNew = m_rowidMgr->getNVMTupleByRowId(*begin, false) == nullptr;
+        return m_rowidMgr->getNVMTupleByRowId(*begin, true);
+    }
+
+    // rowId 所在 extent 中的行都已分配出去, 在 FSM 中置位
+    void SetExtentFull(RowId rowId) { m_rowidMgr->setExtentFull(rowId / m_rowidMgr->getTuplesPerExtent()); }
+
+    void ClearExtentFull(RowId rowId) { m_rowidMgr->clearExtentFull(rowId / m_rowidMgr->getTuplesPerExtent()); }
+
+    // 行内容绕过 entry 直接写入 NVM 之后, 丢弃 [begin, end) 中已加载的 DRAM 缓存
+    void DropCache(RowId begin, RowId end);
+
     inline uint32 GetRowLen() const { return m_rowLen; }
 
+    inline uint32 GetTuplesPerExtent() const { return m_rowidMgr->getTuplesPerExtent(); }
+
     RowId getUpperRowId() const { return m_rowidMgr->getUpperRowId(); }
 
     RowIdMapEntry *GetEntry(RowId rowId, bool isRead);
 
+    /*
+     * 给 GetEntry 返回的 entry 加锁. 取到 entry 之后它所在的 extent 可能被换出到 SSD,
+     * 加锁后发现 entry 已失效时, 把 extent 读回 PMem 并重新初始化 entry.
+     */
+    inline void LockEntry(RowId rowId, RowIdMapEntry *entry) {
+        entry->Lock();
+        if (unlikely(!entry->IsValid())) {
+            char *nvmTuple = m_rowidMgr->getNVMTupleByRowId(rowId, false);
+            DCHECK(nvmTuple != nullptr);
+            entry->Init(nvmTuple);
+        }
+    }
+
+    // extent 是否已经换出到 SSD
+    bool IsExtentCold(uint32 leafExtentId) const { return m_rowidMgr->isExtentCold(leafExtentId); }
+
+    /*
+     * 把最近 coldRounds 轮没有被访问过的已满 extent 换出到 SSD, 最多换出 maxExtents 个, 返回换出的个数.
+     * 只换出 FSM 中已满的 extent: 行号分配和批量导入只会直接访问未满的 extent.
+     */
+    uint32 SpillColdExtents(uint32 coldRounds, uint32 maxExtents);
+
+    // 换出到 SSD 的 extent 个数
+    uint32 GetColdExtents() const { return m_rowidMgr->getColdExtents(); }
+
+    // 清空整张表: 作废所有 entry, 回收所有 leaf extent, 重置行号分配状态. 调用者保证没有并发访问
+    void Truncate();
+
+    // VACUUM 回收的行号交给分配器复用
+    void ReleaseRowIds(const std::vector<RowId> &rowIds) { m_vecStore->ReleaseRowIds(rowIds); }
+
+    // heap 占用的 NVM 空间, 包括 root page 和已分配的 leaf extent
+    uint64 GetAllocatedBytes() const {
+        const uint64 extentBytes = GetPageCountPerExtent(HEAP_EXTENT_SIZE) * NVM_PAGE_SIZE;
+        return (m_rowidMgr->getAllocatedExtents() + 1) * extentBytes;
+    }
+
 protected:
     void SetExtendFlag() {
         m_extendFlag.fetch_add(1);
@@ -162,6 +332,22 @@ protected:
 
     void Extend(int segId);
 
+    // 记录 extent 的访问时钟, 时钟没变时不写, 避免热点 extent 的 cache line 在线程间来回传递
+    inline void TouchExtent(RowId rowId) {
+        const uint32 leafExtentId = rowId / m_rowidMgr->getTuplesPerExtent();
+        if (leafExtentId >= HEAP_MAX_LEAF_EXTENTS) {
+            return;
+        }
+        const uint32 clock = g_heapTierClock.load(std::memory_order_relaxed);
+        auto &tick = m_extentTicks[leafExtentId];
+        if (tick.load(std::memory_order_relaxed) != clock) {
+            tick.store(clock, std::memory_order_relaxed);
+        }
+    }
+
+    // 持有 extent 中所有行的锁, 检查行都已提交之后换出
+    bool SpillExtent(uint32 leafExtentId);
+
 private:
     std::atomic<uint32> m_extendFlag;
     std::atomic<RowIdMapEntry **> m_segments{};
@@ -174,10 +360,19 @@ private:
 
     uint32 m_rowLen;
     std::mutex m_mutex;
+
+    // 每个 leaf extent 最近一次被访问时的 g_heapTierClock, 只有打开冷热分层时才分配
+    std::unique_ptr<std::atomic<uint32>[]> m_extentTicks;
 };
 
 RowIdMap *GetRowIdMap(uint32 segHead, uint32 row_len);
 
+// 在所有表中换出冷 extent, 最多换出 maxExtents 个, 返回换出的个数
+uint32 SpillColdHeapExtents(uint32 coldRounds, uint32 maxExtents);
+
+// 所有表的 heap 占用的 PMem 空间
+uint64 GetHeapAllocatedBytes();
+
 void InitGlobalRowIdMapCache();
 
 void InitLocalRowIdMapCache();
@@ -2,22 +2,46 @@
 #define NVMDB_ROWID_MGR_H
 
 #include "table_space/nvm_table_space.h"
+#include "table_space/nvm_cold_store.h"
 #include "heap/nvm_tuple.h"
 
 namespace NVMDB {
 
 static const ExtentSizeType HEAP_EXTENT_SIZE = EXT_SIZE_2M;
 
+/*
+ * Table segment 的 root page 布局:
+ *     [MaxPageNum][Page Maps: HEAP_MAX_LEAF_EXTENTS 个 uint32][FSM: HEAP_MAX_LEAF_EXTENTS 位]
+ * FSM 中每个 leaf extent 一位, 置位表示该 extent 中的行都已经分配出去. 重启后 VecStore 据此跳过已满的 extent,
+ * 不必再逐行探测. root page 由 allocNewExtent 清零, 旧的 segment 中 FSM 全为 0, 等价于所有 extent 都未满.
+ */
+static constexpr uint32 HEAP_MAX_LEAF_EXTENTS = 256 * 1024;
+static constexpr uint32 HEAP_ROOT_FSM_OFFSET = (sizeof(uint32) * (1 + HEAP_MAX_LEAF_EXTENTS) + 7) / 8 * 8;
+static constexpr uint32 HEAP_ROOT_FSM_SIZE = HEAP_MAX_LEAF_EXTENTS / BIS_PER_BYTE;
+
+/*
+ * 换出到 SSD 的 leaf extent, 在 page map 中记录为 HEAP_COLD_EXTENT_FLAG | slot 号.
+ * 表空间最多 16TB, 页号小于 2^31, 最高位不会和页号冲突.
+ */
+static constexpr uint32 HEAP_COLD_EXTENT_FLAG = 1U << 31;
+
+static inline bool HeapExtentIsCold(uint32 pageId) {
+    return (pageId & HEAP_COLD_EXTENT_FLAG) != 0;
+}
+
 class RowIDMgr {
 public:
     // 为 Table 提供进一步抽象 rowId 为一个 Table 中的行 ID
     // segHead: Table 的入口, 为 Page id 类型, 存储所有 leaf extent 对应的 page ids
-    RowIDMgr(TableSpace *tableSpace, uint32 segHead, uint32 tupleLen)
+    // coldStore 为空时不换出冷 extent
+    RowIDMgr(TableSpace *tableSpace, uint32 segHead, uint32 tupleLen, ColdExtentStore *coldStore = nullptr)
         : m_tableSpace(tableSpace),
+          m_coldStore(coldStore),
           m_segHead(segHead),
           m_tupleLen(tupleLen + NVMTupleHeadSize) {
         // 一个table segment的总逻辑空间 - header 除以每个tuple长度
         m_tuplesPerExtent = GetExtentSize(HEAP_EXTENT_SIZE) / m_tupleLen;
+        CHECK(HEAP_ROOT_FSM_OFFSET + HEAP_ROOT_FSM_SIZE <= GetExtentSize(HEAP_EXTENT_SIZE));
     }
 
     // 根据 rowid 读取NVM中Table对应的记录
@@ -28,15 +52,20 @@ public:
 
         uint32 *extentIds = GetLeafPageExtentIds();
         /* 1. check leaf page existing. If not, try to allocate a new page */
-        if (!NVMPageIdIsValid(extentIds[leafExtentId])) {    // pageId
+        if (leafExtentId >= HEAP_MAX_LEAF_EXTENTS || !NVMPageIdIsValid(extentIds[leafExtentId])) {    // pageId
             if (!append) {  // 只读请求, 不需要创建 leafPage
                 return nullptr;
             }
+            CHECK(leafExtentId < HEAP_MAX_LEAF_EXTENTS) << "Table segment is full, segHead: " << m_segHead;
             UpdateMaxPageId(leafExtentId);
             tryAllocNewPage(leafExtentId);
         }
 
         uint32 pageId = extentIds[leafExtentId];
+        if (unlikely(HeapExtentIsCold(pageId))) {
+            loadColdExtent(leafExtentId);
+            pageId = extentIds[leafExtentId];
+        }
         DCHECK(NVMPageIdIsValid(pageId));
         char *leafPage = m_tableSpace->getNvmAddrByPageId(pageId);
         char *leafData = (char *)GetExtentAddr(leafPage);
@@ -51,6 +80,114 @@ public:
     // 每个heap page extent能存储的tuple数量
     [[nodiscard]] inline uint32 getTuplesPerExtent() const { return m_tuplesPerExtent; };
 
+    // FSM 中 leaf extent 是否已满
+    bool isExtentFull(uint32 leafExtentId) const {
+        DCHECK(leafExtentId < HEAP_MAX_LEAF_EXTENTS);
+        const uint64 *fsm = GetFSM();
+        return (fsm[leafExtentId / FSM_UNIT_BITS] & (1LLU << (leafExtentId % FSM_UNIT_BITS))) != 0;
+    }
+
+    // 一个 extent 中的行号都分配出去之后置位, 单个 8 字节原子写, 崩溃后要么置位要么未置位
+    void setExtentFull(uint32 leafExtentId) {
+        DCHECK(leafExtentId < HEAP_MAX_LEAF_EXTENTS);
+        uint64 *fsm = GetFSM();
+        __sync_fetch_and_or(&fsm[leafExtentId / FSM_UNIT_BITS], 1LLU << (leafExtentId % FSM_UNIT_BITS));
+    }
+
+    // extent 中有行被回收之后清除, 重启后这个 extent 会被重新分配并探测出空行
+    void clearExtentFull(uint32 leafExtentId) {
+        DCHECK(leafExtentId < HEAP_MAX_LEAF_EXTENTS);
+        uint64 *fsm = GetFSM();
+        __sync_fetch_and_and(&fsm[leafExtentId / FSM_UNIT_BITS], ~(1LLU << (leafExtentId % FSM_UNIT_BITS)));
+    }
+
+    // 已分配过的最大 leaf extent 号
+    inline uint32 getMaxLeafExtentId() const { return GetMaxPageId(); }
+
+    // 已分配的 leaf extent 个数
+    uint32 getAllocatedExtents() {
+        uint32 *extentIds = GetLeafPageExtentIds();
+        uint32 count = 0;
+        for (uint32 i = 0; i <= GetMaxPageId(); i++) {
+            if (NVMPageIdIsValid(extentIds[i]) && !HeapExtentIsCold(extentIds[i])) {
+                count++;
+            }
+        }
+        return count;
+    }
+
+    // 换出到 SSD 的 leaf extent 个数
+    uint32 getColdExtents() {
+        uint32 *extentIds = GetLeafPageExtentIds();
+        uint32 count = 0;
+        for (uint32 i = 0; i <= GetMaxPageId(); i++) {
+            if (HeapExtentIsCold(extentIds[i])) {
+                count++;
+            }
+        }
+        return count;
+    }
+
+    // leaf extent 是否在 PMem 上 (分配过并且没有被换出)
+    bool isExtentHot(uint32 leafExtentId) {
+        DCHECK(leafExtentId < HEAP_MAX_LEAF_EXTENTS);
+        uint32 pageId = GetLeafPageExtentIds()[leafExtentId];
+        return NVMPageIdIsValid(pageId) && !HeapExtentIsCold(pageId);
+    }
+
+    bool isExtentCold(uint32 leafExtentId) {
+        DCHECK(leafExtentId < HEAP_MAX_LEAF_EXTENTS);
+        return HeapExtentIsCold(GetLeafPageExtentIds()[leafExtentId]);
+    }
+
+    /*
+     * 把 leaf extent 的内容写到 SSD, page map 改为指向 slot, 再回收 PMem 上的 extent.
+     * 调用者需持有 extent 中所有行的锁, 并保证没有绕过行锁直接访问这个 extent 的线程.
+     * 写 page map 之前崩溃最多泄漏 slot, 写 page map 之后崩溃最多泄漏 PMem extent.
+     */
+    bool spillExtent(uint32 leafExtentId) {
+        DCHECK(m_coldStore != nullptr);
+        std::lock_guard<std::mutex> lock_guard(m_tableSpaceMutex);
+        uint32 *extentIds = GetLeafPageExtentIds();
+        const uint32 pageId = extentIds[leafExtentId];
+        if (!NVMPageIdIsValid(pageId) || HeapExtentIsCold(pageId)) {
+            return false;
+        }
+        const char *data = GetExtentAddr(m_tableSpace->getNvmAddrByPageId(pageId));
+        const uint32 slot = m_coldStore->Write(data, GetExtentSize(HEAP_EXTENT_SIZE));
+        if (slot == ColdExtentStore::INVALID_SLOT) {
+            return false;
+        }
+        extentIds[leafExtentId] = HEAP_COLD_EXTENT_FLAG | slot;
+        m_tableSpace->releaseExtent(m_segHead, pageId);
+        return true;
+    }
+
+    /*
+     * 释放所有 leaf extent, 只保留 root page. 先清空 root 中的 page map 再回收 extent,
+     * 中途崩溃最多泄漏 extent, 不会留下指向已回收 extent 的 page map.
+     */
+    void truncate() {
+        std::lock_guard<std::mutex> lock_guard(m_tableSpaceMutex);
+        std::vector<uint32> coldSlots;
+        uint32 *extentIds = GetLeafPageExtentIds();
+        for (uint32 i = 0; i <= GetMaxPageId(); i++) {
+            if (HeapExtentIsCold(extentIds[i])) {
+                coldSlots.push_back(extentIds[i] & ~HEAP_COLD_EXTENT_FLAG);
+            }
+        }
+        char *rootPage = m_tableSpace->getNvmAddrByPageId(m_segHead);
+        const uint32 mapSize = (GetMaxPageId() + 2) * sizeof(uint32);  // MaxPageNum + Page Maps
+        int ret = memset_s(GetExtentAddr(rootPage), mapSize, 0, mapSize);
+        SecureRetCheck(ret);
+        ret = memset_s(GetFSM(), HEAP_ROOT_FSM_SIZE, 0, HEAP_ROOT_FSM_SIZE);
+        SecureRetCheck(ret);
+        m_tableSpace->truncateSegment(m_segHead);
+        for (uint32 slot : coldSlots) {
+            m_coldStore->Free(slot);
+        }
+    }
+
 protected:
     // Table Segment Header 存储 MaxPageNum 和 PageMap
     uint32 *GetLeafPageExtentIds() {
@@ -73,6 +210,13 @@ protected:
         return *(uint32 *)GetExtentAddr(rootPage);
     }
 
+    static constexpr uint32 FSM_UNIT_BITS = 64;
+
+    inline uint64 *GetFSM() const {
+        char *rootPage = m_tableSpace->getNvmAddrByPageId(m_segHead);
+        return reinterpret_cast<uint64 *>(GetExtentAddr(rootPage) + HEAP_ROOT_FSM_OFFSET);
+    }
+
     // 基于 m_segHead 分配新的 extent, 并存储在 m_segHead 中
     void tryAllocNewPage(uint32 leafExtentId) {
         std::lock_guard<std::mutex> lock_guard(m_tableSpaceMutex);
@@ -85,9 +229,30 @@ protected:
         extentIds[leafExtentId] = m_tableSpace->allocNewExtent(HEAP_EXTENT_SIZE, m_segHead, leafExtentId);
     }
 
+    /*
+     * 把换出到 SSD 的 leaf extent 读回新分配的 PMem extent. 先写好内容再修改 page map,
+     * 崩溃时 page map 仍指向 SSD 上的 slot, 新 extent 泄漏.
+     */
+    void loadColdExtent(uint32 leafExtentId) {
+        std::lock_guard<std::mutex> lock_guard(m_tableSpaceMutex);
+        uint32 *extentIds = GetLeafPageExtentIds();
+        const uint32 coldId = extentIds[leafExtentId];
+        if (!HeapExtentIsCold(coldId)) {
+            return;  // 其他线程已经读回
+        }
+        CHECK(m_coldStore != nullptr) << "Cold extent found but heap tiering is disabled, segHead: " << m_segHead;
+        const uint32 slot = coldId & ~HEAP_COLD_EXTENT_FLAG;
+        const uint32 pageId = m_tableSpace->allocNewExtent(HEAP_EXTENT_SIZE, m_segHead, leafExtentId);
+        m_coldStore->Read(slot, GetExtentAddr(m_tableSpace->getNvmAddrByPageId(pageId)),
+                          GetExtentSize(HEAP_EXTENT_SIZE));
+        extentIds[leafExtentId] = pageId;
+        m_coldStore->Free(slot);
+    }
+
 private:
     std::mutex m_tableSpaceMutex;
     TableSpace *m_tableSpace;   // Table space, 保存真正的文件
+    ColdExtentStore *m_coldStore;   // 冷 extent 所在的 SSD 文件
     const uint32 m_segHead;   // 当前 Table 的 page id 入口
     const uint32 m_tupleLen;  // 实际上每行占用的NVM的长度, 每行定长
     uint32 m_tuplesPerExtent;  // 每个Table segment能保存的数组数量
@@ -161,6 +161,22 @@ public:
         m_updateCnt++;
     }
 
+    // 按偏移更新一段列数据 (回放变更流), 和 UpdateColInc 一样记录被更新的区间
+    inline void UpdateColRange(const UndoColumnDesc &col, const char *const colData) {
+        DCHECK(col.m_colOffset + col.m_colLen <= m_rowLen);
+        m_updateLen += col.m_colLen;
+        m_updatedCols[m_updateCnt] = col;
+        int ret = memcpy_s(m_rowData + col.m_colOffset, m_rowLen - col.m_colOffset, colData, col.m_colLen);
+        SecureRetCheck(ret);
+
+        m_updateCnt++;
+    }
+
+    inline void ClearUpdatedCols() {
+        m_updateCnt = 0;
+        m_updateLen = 0;
+    }
+
     inline void GetUpdatedCols(UndoColumnDesc *&updatedCols, uint32 &updateCnt, uint64 &updateLen) const {
         updatedCols = m_updatedCols.get();
         updateCnt = m_updateCnt;
@@ -240,8 +256,14 @@ public:
 
     void Serialize(char *buf, size_t bufLen);
 
+    // 只序列化 header 和被更新的列 (由 UpdateCols/UpdateColInc 记录), buf 中其余部分保持不变
+    void SerializeUpdatedCols(char *buf, size_t bufLen);
+
     void Deserialize(const char *buf);
 
+    // 只拷贝 header 和 cols 描述的列, 其余列的内容未定义
+    void Deserialize(const char *buf, const UndoColumnDesc *cols, uint32 colCnt);
+
     void FetchPreVersion(char* buffer);
 
     [[nodiscard]] inline bool IsUsed() const { return m_nvmTuple.m_isUsed; }
@@ -259,6 +281,10 @@ public:
     inline uint64 getRowLen() const { return m_rowLen; }
 
     inline const auto& getNVMTuple() const { return m_nvmTuple; }
+
+    inline void setNullBitmap(const NvmNullType &nullBitmap) { m_nvmTuple.m_nullBitmap = nullBitmap; }
+
+    inline const char *getRowData() const { return m_rowData; }
 };
 
 static const int NVMTupleHeadSize = sizeof(NVMTuple);
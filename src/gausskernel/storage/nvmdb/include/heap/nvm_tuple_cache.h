@@ -0,0 +1,181 @@
+#ifndef NVMDB_TUPLE_CACHE_H
+#define NVMDB_TUPLE_CACHE_H
+
+#include "common/nvm_types.h"
+#include "common/nvm_cfg.h"
+#include "glog/logging.h"
+#include "gflags/gflags.h"
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace NVMDB {
+
+DECLARE_int64(tuple_cache_bytes);
+
+class RowIdMapEntry;
+
+struct TupleCacheStats {
+    uint64 hits;
+    uint64 misses;
+    uint64 evictions;
+    uint64 usedBytes;
+    // 实际申请的 chunk 内存, 包含未使用的槽位
+    uint64 chunkBytes;
+    uint64 budgetBytes;
+};
+
+/*
+ * 全实例共享的 tuple DRAM 缓存, 替代每个线程每张表一个的 LRU.
+ * 缓存按 cache line 对齐的大小分级, 每一级是一个 slab: 按 chunk 批量申请内存, 槽位用完后放回所在 chunk 的空闲链表复用,
+ * 稳定运行时加载和淘汰都不需要申请内存. 槽位全部空闲的 chunk 会被释放 (每级保留最后一个), slab 需要增长而 chunk
+ * 内存已超出预算时, 先淘汰其他级中使用最少的 chunk 并释放, 避免 chunk 内存随用到的级数增长.
+ * 所有 slab 共用一个字节预算, 超出预算时用 CLOCK 淘汰: 命中时只设置访问位, 指针扫过时清除访问位,
+ * 访问位已清除且 entry 能加锁的槽位被淘汰. 淘汰只 TryLock 其他 entry, 不会和持有 entry 锁的线程死锁.
+ */
+class TupleCache {
+public:
+    explicit TupleCache(uint64 budgetBytes) : m_budgetBytes(budgetBytes) { }
+
+    ~TupleCache();
+
+    TupleCache(const TupleCache &) = delete;
+
+    TupleCache &operator=(const TupleCache &) = delete;
+
+    // 为 owner 分配至少 size 字节的缓存, 必要时淘汰其他 entry 的缓存. 调用者需持有 owner 的锁
+    char *Allocate(RowIdMapEntry *owner, uint32 size);
+
+    // 归还 Allocate 返回的缓存. 调用者需持有 owner 的锁
+    void Release(char *buf);
+
+    // 缓存命中, 设置访问位
+    void Touch(char *buf);
+
+    [[nodiscard]] TupleCacheStats GetStats() const;
+
+public:
+    inline static void InitGlobalTupleCache() {
+        DCHECK(g_tupleCache == nullptr);
+        g_tupleCache = std::make_unique<TupleCache>(FLAGS_tuple_cache_bytes);
+    }
+
+    inline static void DestroyGlobalTupleCache() {
+        g_tupleCache = nullptr;
+    }
+
+    inline static auto* GetGlobalTupleCache() {
+        return g_tupleCache.get();
+    }
+
+private:
+    // 每个槽位的头部, 之后是缓存的数据
+    struct alignas(16) SlotHeader {
+        RowIdMapEntry *m_owner;
+        // 槽位在 CLOCK 环中的下标
+        uint32 m_ringIndex;
+        uint16 m_classId;
+        std::atomic<bool> m_referenced;
+    };
+
+    static constexpr uint32 SLOT_ALIGN = NVM_CACHE_LINE_SIZE;
+    static constexpr size_t CHUNK_SIZE = 2 * 1024 * 1024;
+    static constexpr uint32 SIZE_CLASS_NUM = (MAX_TUPLE_LEN + sizeof(SlotHeader) - 1) / SLOT_ALIGN + 1;
+    static constexpr uint32 INVALID_INDEX = UINT32_MAX;
+
+    // chunk 按 CHUNK_SIZE 对齐, 头部占第一个槽位, 由槽位地址即可找到所在 chunk
+    struct ChunkHeader {
+        // 空闲槽位链表, next 指针存放在槽位的数据区
+        char *m_freeList;
+        uint32 m_usedSlots;
+        // chunk 在 m_chunks 中的下标
+        uint32 m_chunkIndex;
+        // chunk 在 m_partialChunks 中的下标, 没有空闲槽位时为 INVALID_INDEX
+        uint32 m_partialIndex;
+    };
+    static_assert(sizeof(ChunkHeader) <= SLOT_ALIGN, "chunk header must fit in the first slot");
+
+    struct alignas(NVM_CACHE_LINE_SIZE) SizeClass {
+        std::mutex m_mutex;
+        std::vector<ChunkHeader *> m_chunks;
+        // 还有空闲槽位的 chunk
+        std::vector<ChunkHeader *> m_partialChunks;
+        // 正在使用的槽位, CLOCK 指针只扫这些槽位; 淘汰或归还时用最后一个槽位填补空位
+        std::vector<char *> m_ring;
+        uint64 m_clockHand = 0;
+    };
+
+    struct alignas(NVM_CACHE_LINE_SIZE) Counters {
+        std::atomic<uint64> m_hits = {0};
+        std::atomic<uint64> m_misses = {0};
+        std::atomic<uint64> m_evictions = {0};
+    };
+
+    static inline SlotHeader *GetSlotHeader(char *buf) {
+        return reinterpret_cast<SlotHeader *>(buf - sizeof(SlotHeader));
+    }
+
+    static inline uint32 GetClassId(uint32 size) {
+        return (size + sizeof(SlotHeader) - 1) / SLOT_ALIGN;
+    }
+
+    static inline uint32 GetSlotSize(uint32 classId) {
+        return (classId + 1) * SLOT_ALIGN;
+    }
+
+    static inline uint64 GetSlotsPerChunk(uint32 classId) {
+        return CHUNK_SIZE / GetSlotSize(classId) - 1;
+    }
+
+    static inline ChunkHeader *GetChunk(SlotHeader *header) {
+        return reinterpret_cast<ChunkHeader *>(reinterpret_cast<uintptr_t>(header) & ~(CHUNK_SIZE - 1));
+    }
+
+    static inline char *GetSlot(ChunkHeader *chunk, uint32 classId, uint64 index) {
+        return reinterpret_cast<char *>(chunk) + (index + 1) * GetSlotSize(classId);
+    }
+
+    static inline char *&GetNextFreeSlot(char *slot) {
+        return *reinterpret_cast<char **>(slot + sizeof(SlotHeader));
+    }
+
+    // 为 slab 申请一个新 chunk, 调用者需持有该 slab 的锁
+    void AllocateChunk(uint32 classId);
+
+    // 释放一个槽位全部空闲的 chunk, 调用者需持有该 slab 的锁
+    void ReleaseChunk(SizeClass &sizeClass, ChunkHeader *chunk);
+
+    // 把槽位从 CLOCK 环中移出并放回所在 chunk 的空闲链表. chunk 全部空闲时释放, keepLastChunk 为 true 时保留本级
+    // 最后一个 chunk, 避免只有少量槽位的 slab 反复申请释放. 调用者需持有该 slab 的锁
+    void FreeSlot(SizeClass &sizeClass, SlotHeader *header, bool keepLastChunk = true);
+
+    // 在 classId 对应的 slab 中淘汰一个槽位, 调用者需持有该 slab 的锁
+    bool EvictOne(uint32 classId);
+
+    // 在其他 slab 中淘汰一个槽位, 只 TryLock 其他 slab, 避免两个线程互相等待对方的 slab
+    bool EvictFromOthers(uint32 classId);
+
+    // 在其他 slab 中找使用槽位最少的 chunk, 淘汰其中所有槽位并释放, 只 TryLock 其他 slab.
+    // 持有锁的 entry 淘汰不掉时放弃, 返回是否释放了 chunk
+    bool ReclaimChunkFromOthers(uint32 classId);
+
+    Counters &GetLocalCounters();
+
+    uint64 m_budgetBytes;
+
+    std::atomic<uint64> m_usedBytes = {0};
+
+    std::atomic<uint64> m_chunkBytes = {0};
+
+    std::array<SizeClass, SIZE_CLASS_NUM> m_classes;
+
+    std::array<Counters, NVMDB_MAX_GROUP> m_counters;
+
+    static std::unique_ptr<TupleCache> g_tupleCache;
+};
+
+}  // namespace NVMDB
+
+#endif  // NVMDB_TUPLE_CACHE_H
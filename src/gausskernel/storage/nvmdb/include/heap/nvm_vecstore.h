@@ -4,9 +4,13 @@
 #include "heap/nvm_rowid_mgr.h"
 #include "table_space/nvm_table_space.h"
 #include "common/nvm_global_bitmap.h"
+#include <atomic>
 #include <mutex>
 
 namespace NVMDB {
+// 每次从共享的空闲行号中取到线程本地的个数
+static constexpr uint32 FREE_ROWID_FETCH_BATCH = 64;
+
 /*
  * All tuples in a table are logically in a vector indexed by row id. The vector is implemented as a two-level page
  * table. The segment head of the table is the first level page (root page), storing page number of all second level
@@ -16,26 +20,47 @@ namespace NVMDB {
  *     1. Find a unique RowID according to local cache and global bitmap.
  *     2. If corresponding physic page does not exist, allocating a new one.
  *     3. If corresponding physic page exists, and corresponding tuple is used, then return to step 1 and find a new
- *        RowId. This scenario happens after recovery, as global bitmap is reset. In future, if we make FSM info
- *        persistent, this step can be eliminated.
+ *        RowId. This scenario happens after recovery, as global bitmap is rebuilt from the persistent FSM in the
+ *        root page: extents whose rows were all handed out are skipped, only extents that were partially allocated
+ *        (or had rows reclaimed by VACUUM) before the restart are probed.
  */
 class VecStore {
 public:
-    VecStore(TableSpace *tableSpace, uint32 segHead, uint32 row_len);
+    VecStore(TableSpace *tableSpace, RowIDMgr *rowidMgr, uint32 segHead);
 
     ~VecStore() = default;
 
-    RowId tryNextRowid() const;
+    RowId tryNextRowid();
+
+    // 从 GlobalBitMap 中独占一个 extent, 返回其行号范围 [*begin, *end)
+    void AcquireExtent(RowId *begin, RowId *end);
+
+    // 接收 VACUUM 回收的行号, 所有线程共享, 分配时优先复用
+    void ReleaseRowIds(const std::vector<RowId> &rowIds);
+
+    // TRUNCATE 之后重置分配状态. 各线程本地缓存的 range 和空闲行号在下次分配时发现版本变化后丢弃
+    void Reset();
 
 private:
+    // 从共享的空闲行号中取出最多 count 个, 返回取到的个数
+    uint32 FetchFreeRowIds(RowId *rowIds, uint32 count);
+
     // Table 入口地址, 为 page id
     uint32 m_segHead = 0;
     // 每次扩展出的table segment可以存储的page数量
     uint32 m_tuplesPerExtent = 0;
+    // 维护 root page 中持久化的 FSM
+    RowIDMgr *m_rowidMgr = nullptr;
     // Table space, 用于存储 table
     TableSpace *m_tableSpace = nullptr;
     // 每个目录对应一个GlobalBitMap
     std::vector<std::unique_ptr<GlobalBitMap>> m_gbm;
+    // 每次 Reset 加一, 与线程本地缓存中的版本不一致时, 本地缓存失效
+    std::atomic<uint64> m_version{0};
+    // VACUUM 回收的行号
+    std::mutex m_freeMutex;
+    std::vector<RowId> m_freeRowIds;
+    std::atomic<size_t> m_freeCount{0};
 };
 
 }  // namespace NVMDB
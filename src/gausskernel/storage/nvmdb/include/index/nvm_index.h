@@ -3,11 +3,16 @@
 
 #include "index/nvm_index_iter.h"
 #include "index/nvm_index_tuple.h"
+#include "gflags/gflags.h"
+
+#include <atomic>
 
 namespace NVMDB {
 
-/* idx id + tag + row id */
-static constexpr uint32 KEY_EXTRA_LENGTH = sizeof(uint32)  + 1  + sizeof(uint32) ;
+DECLARE_int64(analyze_index_sample_nodes);
+
+/* tag + row id, 每个索引一棵 PACTree, key 中不需要再带上 idx id */
+static constexpr uint32 KEY_EXTRA_LENGTH = 1 + sizeof(uint32);
 static constexpr uint32 KEY_DATA_LENGTH = KEYLENGTH - KEY_EXTRA_LENGTH;
 
 // allocate pactree
@@ -20,6 +25,34 @@ void InitLocalIndex(int grpId);
 
 void DestroyLocalIndex();
 
+// 类型为oid, 唯一确定一个index
+using IndexId = uint32;
+
+// 返回索引对应的 PACTree, 不存在时创建; PACTree 槽位用完时返回 nullptr. useReserved 见 ReserveIndexTrees
+PACTree *OpenIndexTree(IndexId id, bool useReserved = false);
+
+// 为之后 count 次 OpenIndexTree(id, true) 预留槽位, 槽位不够时返回 false; 没有用掉的要 UnreserveIndexTrees
+bool ReserveIndexTrees(uint32 count);
+
+void UnreserveIndexTrees(uint32 count);
+
+// 返回索引对应的 PACTree, 不存在(比如已被删除)时返回 nullptr
+PACTree *GetIndexTree(IndexId id);
+
+// 删除索引的全部数据, 调用者保证没有其他线程还在访问这棵树
+void DropIndexTree(IndexId id);
+
+class NVMIndex;
+
+/*
+ * 删除已提交的索引: OpenIndexTree/GetIndexTree 立即看不到这棵树, 但树和 index 对象 (可以为空) 要等到
+ * 快照不大于 csn 的事务全部结束之后才在 ReclaimRetiredIndexTrees 中释放, 在此之前拿到 index 的会话可以继续访问.
+ */
+void RetireIndexTree(IndexId id, NVMIndex *index, uint64 csn);
+
+// 释放 csn 小于 minSnapshotCSN 的已删除索引, minSnapshotCSN 为 UINT64_MAX 时全部释放
+void ReclaimRetiredIndexTrees(uint64 minSnapshotCSN);
+
 inline IndexColumnDesc *IndexDescCreate(uint32 colCount) {
     DCHECK(colCount != 0);
     return new IndexColumnDesc[colCount];
@@ -29,19 +62,35 @@ inline void IndexDescDelete(IndexColumnDesc *desc) {
     delete[] desc;
 }
 
-// 类型为oid, 唯一确定一个index
-using IndexId = uint32;
+// 索引键: 索引列编码 + tag + row id
+inline void EncodeIndexKey(const DRAMIndexTuple *tuple, Key_t *key, RowId rowId) {
+    char *data = key->getData();
+    int len = tuple->Encode(data);
+    data += len;
+    *data = CODE_ROWID;
+    EncodeUint32(data + 1, rowId);
+    key->keyLength = KEY_EXTRA_LENGTH + len;
+    DCHECK(key->keyLength <= KEYLENGTH);
+}
 
 class NVMIndex {
     IndexId m_idxId;
+    PACTree *m_tree;
     uint32 m_colCnt = 0;
     uint64 m_rowLen = 0;
     IndexColumnDesc *m_indexDes = nullptr;
     uint8 *m_colBitmap = nullptr;
+    std::atomic<uint64> m_distinctKeys{0};  // 最近一次 ANALYZE 得到的不同索引键个数, 0 表示未统计
+    std::atomic<uint64> m_readyCSN{0};      // 快照不小于它的事务才能通过索引读, 见 SetBuilding
 
 public:
+    // PACTree 槽位用完时 HasTree 返回 false, 调用者需要检查
     explicit NVMIndex(IndexId id)
-        : m_idxId(id) { }
+        : m_idxId(id), m_tree(OpenIndexTree(id)) { }
+
+    [[nodiscard]] bool HasTree() const {
+        return m_tree != nullptr;
+    }
 
     ~NVMIndex() {
         delete[] m_colBitmap;
@@ -49,15 +98,7 @@ public:
     }
 
     void Encode(DRAMIndexTuple *tuple, Key_t *key, RowId rowId) const {
-        char *data = key->getData();
-        EncodeUint32(data, m_idxId);
-        data += sizeof(uint32);
-        int len = tuple->Encode(data);
-        data += len;
-        *data = CODE_ROWID;
-        EncodeUint32(data + 1, rowId);
-        key->keyLength = KEY_EXTRA_LENGTH + len;
-        DCHECK(key->keyLength <= KEYLENGTH);
+        EncodeIndexKey(tuple, key, rowId);
     }
 
     /* find begin <= key <= end */
@@ -71,22 +112,56 @@ public:
         Encode(begin, &kb, 0);
         Encode(end, &ke, 0xffffffff);
 
-        auto iter = new NVMIndexIter(kb, ke, snapshot, max_range, reverse);
+        auto iter = new NVMIndexIter(m_tree, kb, ke, snapshot, max_range, reverse);
         return iter;
     }
 
     void Insert(DRAMIndexTuple *tuple, RowId rowId) const {
-        PACTree *pt = GetGlobalPACTree();
         Key_t key;
         Encode(tuple, &key, rowId);
-        pt->Insert(key, INVALID_CSN);
+        m_tree->Insert(key, INVALID_CSN);
+    }
+
+    // 插入已经 Encode 好的键
+    void InsertKey(Key_t key) const {
+        m_tree->Insert(key, INVALID_CSN);
+    }
+
+    // 插入已经 Encode 好的键, 键已存在 (被并发的写事务插入或标记删除) 时保留原来的 value
+    void InsertKeyIfAbsent(Key_t key) const {
+        m_tree->InsertIfAbsent(key, INVALID_CSN);
     }
 
     void Delete(DRAMIndexTuple *tuple, RowId rowId, TxSlotPtr tx) const {
-        PACTree *pt = GetGlobalPACTree();
         Key_t key;
         Encode(tuple, &key, rowId);
-        pt->Insert(key, tx);
+        m_tree->Insert(key, tx);
+    }
+
+    /*
+     * 估计对 snapshot 可见的不同索引键 (去掉 rowid 后缀) 个数: 数据节点不超过 analyze_index_sample_nodes 时逐个统计,
+     * 否则沿数据层等间隔读取这么多个节点, 由样本外推. 由 ANALYZE 调用, 结果缓存下来供优化器估算等值匹配返回的行数.
+     */
+    uint64 AnalyzeDistinctKeys(LookupSnapshot snapshot);
+
+    uint64 GetDistinctKeys() const {
+        return m_distinctKeys.load(std::memory_order_relaxed);
+    }
+
+    // 索引数据节点的占用统计, 调用者保证没有并发写入
+    PACTreeStats GetStats() const {
+        return m_tree->GetStats();
+    }
+
+    /*
+     * 清空索引: 换成一棵空树, 原来的 PACTree 等快照不大于 csn 的事务结束之后回收, 在此之前仍然占着槽位,
+     * 所以新树使用调用者事先通过 ReserveIndexTrees 预留的槽位. 调用者保证没有并发访问
+     */
+    void Truncate(uint64 csn) {
+        RetireIndexTree(m_idxId, nullptr, csn);
+        m_tree = OpenIndexTree(m_idxId, true);
+        DCHECK(m_tree != nullptr);
+        m_distinctKeys.store(0, std::memory_order_relaxed);
     }
 
     // 表总共有几列
@@ -133,6 +208,22 @@ public:
     IndexId Id() const {
         return m_idxId;
     }
+
+    /*
+     * 在线建索引期间索引只写不读: 写事务照常维护, 但优化器不能用它扫描.
+     * 建好后 SetReady 记下建索引的快照, 更早的快照看得到的一些旧版本没有对应的键, 仍然不能用这个索引.
+     */
+    void SetBuilding() {
+        m_readyCSN.store(UINT64_MAX, std::memory_order_release);
+    }
+
+    void SetReady(uint64 buildSnapshot) {
+        m_readyCSN.store(buildSnapshot, std::memory_order_release);
+    }
+
+    bool ReadableBy(uint64 snapshot) const {
+        return snapshot >= m_readyCSN.load(std::memory_order_acquire);
+    }
 };
 
 }  // namespace NVMDB
@@ -6,74 +6,40 @@
 
 namespace NVMDB {
 
-PACTree *GetGlobalPACTree();
-
+// 基于 PACTree 数据层游标的索引迭代器, 沿着数据节点链表顺序读取, 不会为每一批结果重新查找 search layer
 class NVMIndexIter {
 public:
-    NVMIndexIter(Key_t &begin, Key_t &end, LookupSnapshot snapshot, int maxSize, bool reverse)
-        : cursor(0), m_keyEnd(end), m_snapshot(snapshot), m_maxSize(maxSize), m_reverse(reverse) {
-        if (maxSize == 0) {
-            // no size limit, use m_defaultRange
-            search(begin, end, m_defaultRange, snapshot, reverse);
-            return;
-        }
-        search(begin, end, maxSize, snapshot, reverse);
+    NVMIndexIter(PACTree *tree, Key_t &begin, Key_t &end, LookupSnapshot snapshot, int maxSize, bool reverse)
+        : m_cursor(tree, begin, end, snapshot), m_maxSize(maxSize) {
+        CHECK(!reverse) << "Reverse index scan is not supported.";
     }
 
     void Next() {
-        cursor++;
-        if (cursor < m_result.size()) {
-            return;
-        }
-        // 超过范围, 并且 exceed range limit, set invalid
-        if (m_maxSize != 0) {
-            m_valid = false;
-            return;
-        }
-        Key_t new_kb = LastKey();
-        new_kb.next();
-        search(new_kb, m_keyEnd, m_defaultRange, m_snapshot, m_reverse);
-        cursor = 0;
+        m_cursor.Next();
+        m_count++;
     }
 
-    [[nodiscard]] bool Valid() const { return m_valid; }
+    // maxSize = 0, means no limit
+    [[nodiscard]] bool Valid() const {
+        return m_cursor.Valid() && (m_maxSize == 0 || m_count < m_maxSize);
+    }
 
     RowId Curr() {
-        DCHECK(m_valid);
-        auto& key = m_result[cursor].first;
-        char *buf = key.getData();
-        buf += key.keyLength - 1 - sizeof(uint32);
+        DCHECK(Valid());
+        const char *buf = m_cursor.CurrKeyData();
+        buf += m_cursor.CurrKeyLength() - 1 - sizeof(uint32);
         DCHECK(*buf == CODE_ROWID);
         return (RowId)DecodeUint32(buf + 1);
     }
 
-    [[nodiscard]] Key_t &LastKey() { return m_result.back().first; }
-
-protected:
-    void search(Key_t &kb, Key_t &ke, int max_range, LookupSnapshot snapshot, bool reverse) {
-        auto* pt = GetGlobalPACTree();
-        pt->scan(kb, ke, max_range, snapshot, reverse, m_result);
-        m_valid = !m_result.empty();
-    }
-
 private:
-    std::vector<std::pair<Key_t, Val_t>> m_result;
+    PACTreeCursor m_cursor;
 
-    // 搜索结果是否存在
-    bool m_valid = false;
-
-    int cursor;
+    // 已经返回的结果数
+    int m_count = 0;
 
     // maxSize = 0, means no limit
     int m_maxSize;
-
-    bool m_reverse;
-
-    Key_t m_keyEnd;
-
-    LookupSnapshot m_snapshot;
-
-    static constexpr auto m_defaultRange = 6;
 };
 
 }  // namespace NVMDB
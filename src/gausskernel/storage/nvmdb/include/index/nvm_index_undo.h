@@ -5,10 +5,29 @@
 #include "transaction/nvm_transaction.h"
 
 namespace NVMDB {
+
+/* IndexBulkInsertUndo: [IndexBulkInsertUndoData][IndexBulkUndoColumn * colCnt], 见 Transaction::PrepareIndexBulkInsertUndo */
+struct IndexBulkInsertUndoData {
+    IndexId m_idxId;
+    uint32 m_segHead;   // 表的 segment head, undo 头中的 m_rowLen 是表的行长
+    RowId m_rowBegin;
+    uint32 m_count;
+    uint32 m_colCnt;
+};
+
+// 索引列在行内的位置, 顺序与索引列相同
+struct IndexBulkUndoColumn {
+    uint32 m_colType;
+    uint32 m_colLen;
+    uint64 m_colOffset;
+};
+
 void UndoIndexInsert(const UndoRecord *undo);
 
 void UndoIndexDelete(const UndoRecord *undo);
 
+void UndoIndexBulkInsert(const UndoRecord *undo);
+
 }  // namespace NVMDB
 
 #endif  // NVMDB_INDEX_UNDO_H
@@ -3,9 +3,23 @@
 
 #include "transaction/nvm_transaction.h"
 #include "nvm_table.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
 
 namespace NVMDB {
 
+DECLARE_bool(heap_delta_update);
+DECLARE_bool(heap_csn_stamp);
+DECLARE_bool(heap_bulk_load);
+DECLARE_int32(heap_parallel_scan_workers);
+DECLARE_int32(heap_parallel_scan_min_extents);
+
 /* heap access method status */
 enum class HamStatus {
     OK,
@@ -22,10 +36,245 @@ RowId HeapInsert(Transaction *tx, Table *table, RAMTuple *tuple);
 
 HamStatus HeapRead(const Transaction *tx, const Table *table, RowId rowid, RAMTuple *tuple);
 
+/*
+ * 下推到顺序扫描的过滤条件和投影列. 多个条件之间是 AND 关系, 只支持定长整数类的列和常量比较,
+ * 以及基于 null bitmap 的 IS NULL / IS NOT NULL.
+ * 过滤条件直接在 DRAM 缓存或 NVM 上的 tuple 上判断, 不满足条件的行不拷贝; 满足条件的行只拷贝投影列和条件中的列.
+ */
+class HeapScanFilter {
+public:
+    enum class Oper : uint8 {
+        EQ,
+        NE,
+        LT,
+        LE,
+        GT,
+        GE,
+        IS_NULL,
+        IS_NOT_NULL,
+    };
+
+    explicit HeapScanFilter(const Table *table);
+
+    /*
+     * 添加条件 "colId oper value", value 和列在 tuple 中的存储格式相同, IS NULL / IS NOT NULL 不需要 value.
+     * 列的类型不支持时返回 false, 调用者需要自己判断该条件.
+     */
+    bool AddQual(uint32 colId, Oper oper, const char *value = nullptr);
+
+    // 只拷贝 colIds 中的列 (可以为空, 只需要行号或行数时), 没有设置投影列时拷贝整行
+    void SetProjection(const uint32 *colIds, uint32 colCnt);
+
+    [[nodiscard]] bool Match(const NvmNullType &nullBitmap, const char *rowData) const;
+
+    // 按投影列拷贝 tuple, 调用者需持有行锁
+    void Deserialize(RAMTuple *tuple, const char *nvmTuple) const;
+
+    [[nodiscard]] bool HasQuals() const { return !m_quals.empty(); }
+
+private:
+    struct Qual {
+        uint32 m_colId;
+        Oper m_oper;
+        // 和列的存储格式相同的常量
+        char m_value[sizeof(uint64)];
+    };
+
+    template <typename T>
+    static bool Compare(Oper oper, const char *colData, const char *value);
+
+    void AddCopyColumn(uint32 colId);
+
+    const Table *m_table;
+    std::vector<Qual> m_quals;
+    // 需要拷贝的列, 按偏移量排序并合并相邻的列
+    std::vector<UndoColumnDesc> m_copyCols;
+    bool m_projected = false;
+};
+
+/*
+ * 批量顺序读: 从 *cursor 开始向 end 扫描, 将对 tx 可见的行依次写入 tuples[i], 行号写入 rowIds[i],
+ * 直到写满 batchSize 行或扫描到 end. 返回写入的行数, *cursor 推进到下一个未扫描的行号.
+ * 与逐行 HeapRead 不同, 未缓存的行直接从NVM读取, 不加载DRAM缓存, 也不加入LRU.
+ * filter 不为空时只返回满足条件的行, 并且只拷贝 filter 的投影列.
+ */
+uint32 HeapReadBatch(const Transaction *tx, const Table *table, RowId *cursor, RowId end,
+                     RAMTuple **tuples, RowId *rowIds, uint32 batchSize, const HeapScanFilter *filter = nullptr);
+
 HamStatus HeapUpdate(Transaction *tx, Table *table, RowId rowid, RAMTuple *new_tuple);
 
 HamStatus HeapDelete(Transaction *tx, Table *table, RowId rowid);
 
+/*
+ * 清空表中所有行并回收 heap 占用的 extent, 只保留 segment 的 root page, 表的 segment head 不变.
+ * 不走事务, 也不写 undo; 调用者保证没有并发访问, 且没有未提交的事务写过这张表.
+ */
+void HeapTruncate(Table *table);
+
+/*
+ * 回收已删除、且对所有活跃事务都不再可见的行: 清除行的占用标记, 行号交给分配器复用.
+ * 可以和其他事务并发执行, 不回收 extent. 返回回收的行数.
+ */
+uint64 HeapVacuum(const Transaction *tx, Table *table);
+
+// heap 占用的 NVM 空间 (字节)
+uint64 HeapAllocatedBytes(const Table *table);
+
+/*
+ * 并行顺序扫描: [0, HeapUpperRowId) 按 extent 对齐切成区间, 工作线程通过共享计数器领取区间,
+ * 以 tx 的快照用 HeapReadBatch 读出可见的行, 按批放入有界队列. 调用者线程按批取出, 行的顺序不确定.
+ * 工作线程的事务共用 tx 在 ProcessArray 中的槽位, tx 需要在扫描结束之后才能结束.
+ * tx 自己的修改对工作线程不可见, 所以只用于没有写过数据的事务, 见 HeapParallelScanEnabled.
+ */
+class HeapParallelScan {
+public:
+    static constexpr uint32 BATCH_SIZE = 64;
+
+    // filter 由调用者持有, 需要在扫描结束之前一直有效
+    HeapParallelScan(const Transaction *tx, const Table *table, uint32 workerNum,
+                     const HeapScanFilter *filter = nullptr);
+
+    ~HeapParallelScan();
+
+    HeapParallelScan(const HeapParallelScan &) = delete;
+
+    HeapParallelScan &operator=(const HeapParallelScan &) = delete;
+
+    /*
+     * 取出下一批可见的行, 返回行数, 0 表示扫描结束. 返回的 tuple 和行号在之后的两次调用期间都有效,
+     * 调用者可以在读下一批时继续使用上一批的最后一行.
+     */
+    uint32 NextBatch(RAMTuple ***tuples, RowId **rowIds);
+
+    // 通知工作线程退出并等待其结束, 可以在扫描完成之前调用, 之后 NextBatch 只返回已经读出的行
+    void Stop();
+
+private:
+    struct Batch {
+        std::unique_ptr<char[]> m_rowData;
+        RAMTuple *m_tuples[BATCH_SIZE]{};
+        RowId m_rowIds[BATCH_SIZE]{};
+        uint32 m_count = 0;
+    };
+
+    void WorkerMain();
+
+    // 领取下一个区间, 扫描完成时返回 false
+    bool NextRange(RowId *begin, RowId *end);
+
+    // 取一个空闲的 batch, 扫描被终止时返回 nullptr
+    Batch *AcquireFreeBatch();
+
+    const Transaction *m_tx;
+    const Table *m_table;
+    const HeapScanFilter *m_filter;
+    const RowId m_upper;
+    const uint32 m_rangeRows;
+    std::atomic<uint64> m_nextRange{0};
+
+    std::vector<std::unique_ptr<Batch>> m_batches;
+    std::mutex m_mutex;
+    std::condition_variable m_readyCond;
+    std::condition_variable m_freeCond;
+    std::deque<Batch *> m_ready;
+    std::vector<Batch *> m_free;
+    Batch *m_current = nullptr;
+    Batch *m_previous = nullptr;
+    uint32 m_runningWorkers = 0;
+    bool m_stop = false;
+    std::vector<std::thread> m_workers;
+};
+
+// 表足够大, 并且 tx 没有写过数据时, 顺序扫描使用 HeapParallelScan
+bool HeapParallelScanEnabled(const Transaction *tx, const Table *table);
+
+// 停掉当前线程创建的所有 HeapParallelScan 的工作线程. 扫描出错时调用者可能来不及析构, 在事务结束时调用
+void StopHeapParallelScans();
+
+/*
+ * 在线建索引, 不阻塞写事务:
+ *   1. 索引以只写状态加入 table, 之后开始写这张表的事务都会维护它, 但优化器还不会用它扫描;
+ *   2. 等待之前开始写这张表、可能没看到新索引的事务结束, 再开始一个只读事务取快照;
+ *   3. 以这个快照并行扫描, 只投影索引列, 键分段排序后按键序插入, 不写 undo.
+ *      写事务在建索引期间的修改由它们自己写入索引, 已存在的键 (包括写事务的删除标记) 不会被覆盖;
+ *   4. 记下快照, 快照不小于它的事务才能通过这个索引读.
+ * tx 是调用者的事务. tx 已经写过这张表时第 2 步会等到自己, 直接返回 false, 由调用者用 tx 阻塞地建索引.
+ */
+bool HeapBuildIndexOnline(const Transaction *tx, Table *table, NVMIndex *index);
+
+/*
+ * 批量导入 (COPY FROM), 与逐行的 HeapInsert + IndexInsert 相比:
+ *   1. 每次独占一个 extent, 行号连续分配, 不经过线程本地的 range 和空闲行号;
+ *   2. tuple 先在 DRAM 中攒成一批, 整批用 non-temporal store 写入 NVM, 不加载 tuple 缓存;
+ *   3. 每批行只写一条 HeapBulkInsertUndo, 覆盖整个行号区间;
+ *   4. 索引键先缓存在 DRAM 中, 排序后按键序插入 PACTree. IndexBulkInsertUndo 只记录键对应的行号区间,
+ *      回滚时重新读出这些行编码出键, undo 的大小与导入的行数无关.
+ * 行和索引键在写入 NVM 之前对本事务也不可见, 调用者需要在读这张表之前调用 Finish.
+ * 一个 loader 只能由一个线程使用.
+ */
+class HeapBulkLoader {
+public:
+    HeapBulkLoader(Transaction *tx, Table *table);
+
+    ~HeapBulkLoader() = default;
+
+    HeapBulkLoader(const HeapBulkLoader &) = delete;
+
+    HeapBulkLoader &operator=(const HeapBulkLoader &) = delete;
+
+    RowId Insert(RAMTuple *tuple);
+
+    void IndexInsert(NVMIndex *index, DRAMIndexTuple *indexTuple, RowId rowId);
+
+    // 写入所有暂存的行和索引键, extent 中剩余的行号交给分配器复用
+    void Finish();
+
+    [[nodiscard]] uint64 GetLoadedRows() const { return m_loadedRows; }
+
+private:
+    RowId NextEmptyRow();
+
+    void FlushRows();
+
+    // 缓存的一个索引的键, 以及这些键对应的行号区间
+    struct IndexKeys {
+        NVMIndex *index;
+        const ColumnDesc *rowDes;
+        const IndexColumnDesc *indexDes;
+        uint32 colCnt;
+        std::vector<Key_t> keys;
+        std::vector<std::pair<RowId, uint32>> rowRanges;
+    };
+
+    void FlushIndexKeys(IndexKeys *entry);
+
+    inline char *GetNVMTuple(RowId rowId) const {
+        return m_extentAddr + static_cast<size_t>(rowId - m_extentBegin) * m_tupleSize;
+    }
+
+    Transaction *m_tx;
+    Table *m_table;
+    RowIdMap *m_rowIdMap;
+    const size_t m_tupleSize;
+
+    // 当前独占的 extent, [m_nextRowId, m_extentEnd) 是还没有分配的行号
+    char *m_extentAddr = nullptr;
+    RowId m_extentBegin = InvalidRowId;
+    RowId m_extentEnd = InvalidRowId;
+    RowId m_nextRowId = InvalidRowId;
+    // extent 重启前部分使用过, 需要跳过已占用的行
+    bool m_probeUsed = false;
+
+    // 暂存的行, 行号为 [m_stageBegin, m_stageBegin + m_stageCount)
+    std::vector<char> m_stage;
+    uint32 m_stageRows = 0;
+    RowId m_stageBegin = InvalidRowId;
+    uint32 m_stageCount = 0;
+
+    std::vector<IndexKeys> m_indexKeys;
+    uint64 m_loadedRows = 0;
+};
+
 }  // namespace NVMDB
 
 #endif  // NVMDB_HEAP_ACCESS_H
\ No newline at end of file
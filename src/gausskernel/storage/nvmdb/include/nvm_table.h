@@ -3,6 +3,8 @@
 
 #include "heap/nvm_rowid_map.h"
 #include "index/nvm_index.h"
+#include <memory>
+#include <mutex>
 #include <vector>
 
 namespace NVMDB {
@@ -75,32 +77,49 @@ public:
         return m_rowLen;
     }
 
+    using IndexList = std::vector<NVMIndex *>;
+
+    /*
+     * 索引列表写时复制: AddIndex/DelIndex 复制出新列表再发布, 旧列表留到表析构时才释放, 所以读者不加锁,
+     * 拿到的列表在表的生命周期内一直有效. 需要多次访问的调用者应该取一次 GetIndexes 再遍历, 保证看到同一个版本.
+     */
+    const IndexList &GetIndexes() const {
+        return *m_indexes.load(std::memory_order_acquire);
+    }
+
     uint32 GetIndexCount() const {
-        return index.size();
+        return GetIndexes().size();
     }
 
     NVMIndex *GetIndex(uint16 num) const {
-        DCHECK(num < index.size());
-        if (num < index.size()) {
-            return index[num];
+        const IndexList &indexes = GetIndexes();
+        DCHECK(num < indexes.size());
+        if (num < indexes.size()) {
+            return indexes[num];
         } else {
             return nullptr;
         }
     }
 
     void AddIndex(NVMIndex *i) {
-        index.push_back(i);
+        std::lock_guard<std::mutex> lockGuard(m_indexMutex);
+        auto *indexes = new IndexList(GetIndexes());
+        indexes->push_back(i);
+        PublishIndexes(indexes);
     }
 
     NVMIndex *DelIndex(IndexId id) {
+        std::lock_guard<std::mutex> lockGuard(m_indexMutex);
         NVMIndex *ret = nullptr;
-        for (auto iter = index.begin(); iter != index.end(); ++iter) {
+        auto *indexes = new IndexList(GetIndexes());
+        for (auto iter = indexes->begin(); iter != indexes->end(); ++iter) {
             if ((*iter)->Id() == id) {
                 ret = *iter;
-                index.erase(iter);
+                indexes->erase(iter);
                 break;
             }
         }
+        PublishIndexes(indexes);
         return ret;
     }
 
@@ -136,15 +155,39 @@ public:
         return m_desc.col_desc[colIndex].m_isNotNull;
     }
 
+    /*
+     * 写事务第一次修改这张表时登记, 事务结束 (提交或回滚完成) 时注销. 返回登记的 epoch 奇偶位, 注销时传回.
+     * 在线建索引把索引加入表之后调用 WaitForOldWriters: 推进 epoch, 等待推进之前登记的写事务全部结束.
+     * 之后登记的写事务一定能看到新索引并自己维护它, 所以新的写事务不会被阻塞.
+     */
+    uint32 WriterEnter();
+
+    void WriterExit(uint32 epochSlot);
+
+    void WaitForOldWriters();
+
     ~Table() { TableDescDestroy(&m_desc); }
 
 private:
+    // 调用时持有 m_indexMutex
+    void PublishIndexes(IndexList *indexes) {
+        m_indexVersions.emplace_back(indexes);
+        m_indexes.store(indexes, std::memory_order_release);
+    }
+
     TableId m_tableId{0};
     uint32 m_segHead{0};
     TableDesc m_desc;
-    std::vector<NVMDB::NVMIndex *> index;
+    IndexList m_emptyIndexes;
+    std::atomic<const IndexList *> m_indexes{&m_emptyIndexes};
+    // 发布过的所有索引列表
+    std::vector<std::unique_ptr<IndexList>> m_indexVersions;
+    std::mutex m_indexMutex;
     std::atomic<uint32> refCount{0};
     std::atomic<bool> isDropped{false};
+    std::atomic<uint64> m_writerEpoch{0};
+    std::atomic<uint64> m_writers[2] = {{0}, {0}};
+    std::mutex m_writerEpochMutex;
 };
 
 }  // namespace NVMDB
@@ -0,0 +1,74 @@
+#ifndef NVMDB_COLD_STORE_H
+#define NVMDB_COLD_STORE_H
+
+#include "common/nvm_types.h"
+#include "glog/logging.h"
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace NVMDB {
+
+/*
+ * SSD 上存放冷 extent 的文件, 由定长的 slot 组成, 每个 slot 保存一个 extent 的内容.
+ * 文件布局: [头部][slot 占用位图][slot 0][slot 1]...
+ * 位图在 DRAM 中有一份, 修改时写回文件. 分配 slot 时先写数据再写位图并落盘, 调用者之后才能引用这个 slot;
+ * 释放时位图不落盘, 崩溃后最多泄漏 slot, 不会把仍被引用的 slot 分配出去.
+ */
+class ColdExtentStore {
+public:
+    static constexpr uint32 INVALID_SLOT = UINT32_MAX;
+
+    // init 为 true 时重建文件, 否则打开已有的文件 (不存在时创建), slotCount 以文件中记录的为准
+    ColdExtentStore(const std::string &path, uint32 slotSize, uint32 slotCount, bool init);
+
+    ~ColdExtentStore();
+
+    ColdExtentStore(const ColdExtentStore &) = delete;
+
+    ColdExtentStore &operator=(const ColdExtentStore &) = delete;
+
+    // 把 len 字节写入一个新的 slot 并落盘, 返回 slot 号, 空间不足时返回 INVALID_SLOT
+    uint32 Write(const char *data, size_t len);
+
+    void Read(uint32 slot, char *data, size_t len) const;
+
+    void Free(uint32 slot);
+
+    [[nodiscard]] inline uint32 GetSlotSize() const { return m_slotSize; }
+
+    [[nodiscard]] uint32 GetUsedSlots();
+
+private:
+    struct FileHeader {
+        uint64 m_magic;
+        uint32 m_slotSize;
+        uint32 m_slotCount;
+    };
+
+    static constexpr uint64 COLD_STORE_MAGIC = 0x4e564d434f4c4431;  // "NVMCOLD1"
+    static constexpr uint32 COLD_STORE_HEADER_SIZE = 4096;
+    static constexpr uint32 BITMAP_UNIT_BITS = 64;
+
+    inline uint64 SlotOffset(uint32 slot) const {
+        return m_dataOffset + static_cast<uint64>(slot) * m_slotSize;
+    }
+
+    // 写回 slot 所在的位图单元
+    void WriteBitmapUnit(uint32 slot);
+
+    std::string m_path;
+    int m_fd = -1;
+    uint32 m_slotSize;
+    uint32 m_slotCount;
+    uint64 m_dataOffset;
+
+    std::mutex m_mutex;
+    std::vector<uint64> m_bitmap;
+    uint32 m_usedSlots = 0;
+    uint32 m_hint = 0;
+};
+
+}  // namespace NVMDB
+
+#endif  // NVMDB_COLD_STORE_H
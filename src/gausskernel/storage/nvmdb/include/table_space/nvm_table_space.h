@@ -292,6 +292,20 @@ public:
         *pageId = NVMInvalidPageId;
     }
 
+    // 把 segment 中的一个 extent (不能是 root) 从 segment 链表中摘下并回收, 用于冷 extent 换出到 SSD
+    void releaseExtent(uint32 rootPageId, uint32 pageId) {
+        std::lock_guard<std::mutex> guard(m_tableMetadataMutex);
+        DCHECK(rootPageId != pageId);
+        auto* pageNode = getFPLNode(pageId);
+        DCHECK(pageId == pageNode->m_pageId);
+        auto& node = pageNode->m_pageList;
+        getFPLNode(node.prev)->m_pageList.next = node.next;
+        getFPLNode(node.next)->m_pageList.prev = node.prev;
+        auto sizeType = static_cast<ExtentSizeType>(pageNode->m_pageSize);
+        auto& extHeadPageId = getFPLRootPageIdRef(spaceIdFromGlobalPageId(pageId), sizeType);
+        pushFPLNode(pageId, extHeadPageId);
+    }
+
     // rootPageId 对应一个segment 的 root，回收整个 segment，并且置 *rootPageId 为null
     void freeSegment(uint32* rootPageId) {
         std::lock_guard<std::mutex> guard(m_tableMetadataMutex);
@@ -313,6 +327,21 @@ public:
         *rootPageId = NVMInvalidPageId;
     }
 
+    // 回收 segment 中除 root 之外的所有 extent, root 保留 (segment head 不变), root 中的内容由调用者重置
+    void truncateSegment(uint32 rootPageId) {
+        std::lock_guard<std::mutex> guard(m_tableMetadataMutex);
+        DCHECK(rootPageId == getFPLNode(rootPageId)->m_pageId);
+        while (getFPLNode(rootPageId)->m_pageList.prev != rootPageId) {
+            // 链表中不止 root 一个节点时, popFPLNode 不会修改 headPageId
+            uint32 headPageId = rootPageId;
+            auto pageId = popFPLNode(headPageId);
+            DCHECK(headPageId == rootPageId);
+            auto sizeType = static_cast<ExtentSizeType>(getFPLNode(pageId)->m_pageSize);
+            auto& extHeadPageId = getFPLRootPageIdRef(spaceIdFromGlobalPageId(pageId), sizeType);
+            pushFPLNode(pageId, extHeadPageId);
+        }
+    }
+
 public:
     /* 将存储oid->表地址的映射写入表空间的1号page */
     void CreateTable(uint32 pgTableOID, uint32 tableSegHead) {
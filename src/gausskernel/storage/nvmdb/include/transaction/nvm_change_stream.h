@@ -0,0 +1,341 @@
+#ifndef NVMDB_CHANGE_STREAM_H
+#define NVMDB_CHANGE_STREAM_H
+
+#include "heap/nvm_tuple.h"
+#include "undo/nvm_undo_segment.h"
+#include "table_space/nvm_logic_file.h"
+#include "common/nvm_cfg.h"
+#include "glog/logging.h"
+#include "gflags/gflags.h"
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace NVMDB {
+
+DECLARE_bool(change_stream);
+DECLARE_int64(change_stream_batch_bytes);
+DECLARE_int64(change_stream_flush_interval_us);
+DECLARE_int64(change_stream_tx_max_bytes);
+
+enum class ChangeType : uint8 {
+    INSERT,
+    UPDATE,
+    DELETE,
+    // 事务对这张表的变更超过 change_stream_tx_max_bytes 没有记录, 订阅者需要从快照重新同步这张表
+    RESYNC,
+};
+
+/*
+ * 一行的变更, 之后是 m_payload 字节的数据:
+ *   INSERT / UPDATE: [NvmNullType][列区间个数 uint32][UndoColumnDesc * 个数][各区间的数据],
+ *                    INSERT 和整行更新只有一个覆盖整行的区间, 增量更新只有被更新的列;
+ *   DELETE / RESYNC: 没有数据, RESYNC 的 m_rowId 无效.
+ */
+struct ChangeRecord {
+    TableId m_tableId;
+    RowId m_rowId;
+    uint32 m_payload;
+    ChangeType m_type;
+    char data[0];
+};
+
+// 变更记录按 8 字节对齐存放, 后面的记录和事务头都是对齐的
+inline size_t ChangeRecordSize(uint32 payload) {
+    return (sizeof(ChangeRecord) + payload + sizeof(uint64) - 1) / sizeof(uint64) * sizeof(uint64);
+}
+
+// 一个已提交事务的变更: [ChangeTxHead][ChangeRecord * m_recordCnt], m_len 不含 head
+struct ChangeTxHead {
+    uint64 m_csn;
+    uint32 m_recordCnt;
+    uint32 m_len;
+};
+
+/*
+ * 事务执行期间在 DRAM 中攒本事务的变更, 提交时整体交给 ChangeStream, 回滚时丢弃.
+ * 变更来自 heap 写操作已经算好的 tuple 和被更新的列, 不需要再读 NVM 或 undo.
+ * 缓冲区超过 change_stream_tx_max_bytes 时 (比如大批量导入) 丢弃已经攒下的变更, 之后只为本事务修改过的
+ * 每张表记录一条 RESYNC, 占用的内存与修改的行数无关.
+ */
+class TxChangeBuffer {
+public:
+    void AppendInsert(TableId tableId, RowId rowId, const RAMTuple *tuple);
+
+    // cols 为空时记录整行
+    void AppendUpdate(TableId tableId, RowId rowId, const RAMTuple *tuple, const UndoColumnDesc *cols, uint32 colCnt);
+
+    void AppendDelete(TableId tableId, RowId rowId);
+
+    [[nodiscard]] bool Empty() const {
+        return m_recordCnt == 0;
+    }
+
+    [[nodiscard]] uint32 RecordCount() const {
+        return m_recordCnt;
+    }
+
+    [[nodiscard]] const char *Data() const {
+        return m_buf.data();
+    }
+
+    [[nodiscard]] size_t Size() const {
+        return m_buf.size();
+    }
+
+    [[nodiscard]] bool Overflowed() const {
+        return m_overflowed;
+    }
+
+    void Clear() {
+        m_buf.clear();
+        m_recordCnt = 0;
+        m_overflowed = false;
+    }
+
+private:
+    // 返回数据区, 缓冲区已经溢出时返回 nullptr, 调用者不再写数据
+    char *AppendRecord(TableId tableId, RowId rowId, ChangeType type, uint32 payload);
+
+    void AppendOverflow(TableId tableId);
+
+    void AppendTuple(TableId tableId, RowId rowId, ChangeType type, const RAMTuple *tuple,
+                     const UndoColumnDesc *cols, uint32 colCnt);
+
+    std::vector<char> m_buf;
+    uint32 m_recordCnt = 0;
+    bool m_overflowed = false;
+};
+
+/*
+ * 顺序解析 ChangeStreamConsumer 收到的一批变更. 用法:
+ *   ChangeStreamReader reader(data, len);
+ *   while (reader.NextTx(&head)) { while ((record = reader.NextRecord()) != nullptr) { ... } }
+ */
+class ChangeStreamReader {
+public:
+    ChangeStreamReader(const char *data, size_t len) : m_cur(data), m_end(data + len) { }
+
+    bool NextTx(const ChangeTxHead **head);
+
+    // 当前事务的下一条变更, 没有时返回 nullptr
+    const ChangeRecord *NextRecord();
+
+    // 把 INSERT / UPDATE 的数据写到 tuple 上, 没有记录的列保持原值
+    static void ApplyToTuple(const ChangeRecord *record, RAMTuple *tuple);
+
+private:
+    const char *m_cur;
+    const char *m_end;
+    const char *m_txEnd = nullptr;
+};
+
+class ChangeStreamConsumer {
+public:
+    virtual ~ChangeStreamConsumer() = default;
+
+    // 在交付线程中按提交 CSN 顺序收到一批已提交事务的变更, data 只在调用期间有效
+    virtual void Consume(const char *data, size_t len) = 0;
+};
+
+static constexpr size_t CHANGE_LOG_SEGMENT_SIZE = CompileValue(64 * 1024 * 1024, 1024 * 1024);
+static constexpr size_t CHANGE_LOG_MAX_SEGMENT_NUM = 1024;
+
+/* 变更日志的第一个页面 */
+struct ChangeLogHead {
+    uint64 m_freeBegin;     /* 下一条日志写入的位置 */
+    uint64 m_recycledBegin; /* 之前的日志都已经交付, 所在的 segment 已经回收 */
+    uint64 m_deliveredCSN;  /* 订阅者的消费位置, CSN 小于它的事务都已经交付 */
+};
+
+/* 一条日志: [ChangeLogEntry][ChangeRecord * m_head.m_recordCnt], 可以跨 segment */
+struct ChangeLogEntry {
+    TxSlotPtr m_txSlot;     /* 重启时根据 tx slot 判断事务是否已经提交 */
+    uint64 m_aborted;       /* 重启时发现事务没有提交, 置为 1, 之后不再检查 tx slot (可能已经被回收) */
+    ChangeTxHead m_head;
+};
+
+/*
+ * 一个 NUMA group 的持久化变更日志, 放在该 group 的目录下, 文件名 changelog<groupId>.
+ * 日志按写入顺序追加, 不按 CSN 排序; 所有访问都持有 m_mutex.
+ */
+class ChangeLog {
+public:
+    ChangeLog(const std::string &directory, uint32 groupId)
+        : m_logicFile(std::make_shared<DirectoryConfig>(directory), "changelog" + std::to_string(groupId),
+                      CHANGE_LOG_SEGMENT_SIZE, CHANGE_LOG_MAX_SEGMENT_NUM) {
+        m_head = static_cast<ChangeLogHead *>(m_logicFile.getNvmAddrByPageId(0));
+        CHECK(m_head != nullptr) << "mount change log head failed";
+    }
+
+    ~ChangeLog() {
+        m_logicFile.unmount();
+    }
+
+    void Create(uint64 deliveredCSN);
+
+    // 重启时在 undo 后台回滚之前调用, 把 tx slot 没有提交的日志标记为 aborted
+    void Mount();
+
+    // 返回时日志已经落盘, 之后才能把 tx slot 标记为提交
+    void Write(TxSlotPtr txSlot, uint64 csn, const TxChangeBuffer &changes);
+
+    // 把 CSN 在 [beginCSN, endCSN) 之间的已提交事务以 [ChangeTxHead][ChangeRecord...] 的格式追加到 buf
+    void Load(uint64 beginCSN, uint64 endCSN, std::vector<char> *buf);
+
+    // 持久化消费位置, 回收之前的日志
+    void Recycle(uint64 deliveredCSN);
+
+    [[nodiscard]] uint64 GetDeliveredCSN() const {
+        return m_head->m_deliveredCSN;
+    }
+
+private:
+    void WriteAt(uint64 offset, const void *src, size_t len);
+
+    void ReadAt(uint64 offset, void *dst, size_t len);
+
+    std::mutex m_mutex;
+    ChangeLogHead *m_head;
+    LogicFile m_logicFile;
+};
+
+/*
+ * 提交时产生的变更流, 供备机回放和逻辑解码使用. 一个事务的提交分三步:
+ *   1. BeginCommit: 取提交 CSN 之前登记, 登记的值 (当时的全局 CSN) 不大于之后取到的提交 CSN;
+ *   2. Persist: tx slot 标记为提交之前, 把变更写入所在 NUMA group 的 ChangeLog 并落盘;
+ *   3. Append: tx slot 落盘之后、推进全局 CSN 之前, 把变更复制到所在 group 的缓冲区, 然后注销登记.
+ * 后台交付线程每隔 flushIntervalUs 微秒, 或者某个缓冲区攒到 batchBytes 时, 先读全局 CSN 和正在提交的事务
+ * 登记的最小值作为上界, 再取出所有缓冲区. CSN 小于上界的事务都已经追加过, 按 CSN 排序后整批交给订阅者;
+ * 其余的留到之后的批次, 所以跨批次也按 CSN 顺序交付.
+ * 缓冲区超过 batchBytes 的 4 倍 (订阅者跟不上) 时, 提交的事务自己交付, 限制占用的内存.
+ *
+ * 每批交付之后把上界作为消费位置写入 ChangeLog, 并回收位置之前的日志. 崩溃重启之后, 消费位置之后、tx slot
+ * 已提交的事务从 ChangeLog 读回, 重新交付给之后订阅的订阅者 (至少交付一次, 位置落盘之前崩溃时会重复交付).
+ * 没有订阅者时不推进消费位置, 变更只保留在 ChangeLog 中, 第一个订阅者订阅时读回.
+ * 没有调用 CreateLog / MountLog (单元测试) 时不写日志, 没有订阅者时的变更直接丢弃.
+ */
+class ChangeStream {
+public:
+    ChangeStream(uint64 batchBytes, uint64 flushIntervalUs);
+
+    ~ChangeStream();
+
+    ChangeStream(const ChangeStream &) = delete;
+
+    ChangeStream &operator=(const ChangeStream &) = delete;
+
+    // initdb 时在每个目录下创建 ChangeLog, 消费位置从当前的全局 CSN 开始
+    void CreateLog(const std::shared_ptr<DirectoryConfig> &dirConfig);
+
+    // 启动时在 undo segment 挂载之后、后台回滚之前调用, 这时 tx slot 还是崩溃时的状态
+    void MountLog(const std::shared_ptr<DirectoryConfig> &dirConfig);
+
+    // committer 为事务的 ProcessArray 槽位, 同一个槽位上同时只有一个事务在提交
+    void BeginCommit(uint32 committer);
+
+    void Persist(TxSlotPtr txSlot, uint64 csn, const TxChangeBuffer &changes, int groupId);
+
+    void Append(uint64 csn, const TxChangeBuffer &changes, int groupId, uint32 committer);
+
+    // 立即交付 CSN 小于当前上界的变更, 返回时已经交给所有订阅者
+    void Flush();
+
+    // 订阅之后交付的变更, 订阅者由调用者持有
+    void Subscribe(ChangeStreamConsumer *consumer);
+
+    void Unsubscribe(ChangeStreamConsumer *consumer);
+
+    // 启动时的消费位置, CSN 更小的事务在之前已经交付, 不会出现在变更流中
+    [[nodiscard]] uint64 GetStartCSN() const {
+        return m_startCSN.load(std::memory_order_acquire);
+    }
+
+    [[nodiscard]] uint64 GetAppendedTxs() const {
+        return m_appendedTxs.load(std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] uint64 GetAppendedBytes() const {
+        return m_appendedBytes.load(std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] uint64 GetFlushedBatches() const {
+        return m_flushedBatches.load(std::memory_order_relaxed);
+    }
+
+public:
+    // 只有打开 change_stream 时才创建, 否则 GetGlobalChangeStream 返回 nullptr
+    inline static void InitGlobalChangeStream() {
+        DCHECK(g_changeStream == nullptr);
+        if (FLAGS_change_stream) {
+            g_changeStream = std::make_unique<ChangeStream>(FLAGS_change_stream_batch_bytes,
+                                                            FLAGS_change_stream_flush_interval_us);
+        }
+    }
+
+    inline static void DestroyGlobalChangeStream() {
+        g_changeStream = nullptr;
+    }
+
+    inline static auto* GetGlobalChangeStream() {
+        return g_changeStream.get();
+    }
+
+private:
+    struct alignas(NVM_CACHE_LINE_SIZE) Shard {
+        std::mutex m_mutex;
+        std::vector<char> m_buf;
+    };
+
+    struct alignas(NVM_CACHE_LINE_SIZE) Committer {
+        // 正在提交的事务登记的 CSN 下界, 0 表示没有
+        std::atomic<uint64> m_csn = {0};
+    };
+
+    void FlusherMain();
+
+    uint64 m_batchBytes;
+
+    uint64 m_flushIntervalUs;
+
+    std::vector<Shard> m_shards;
+
+    std::vector<Committer> m_committers;
+
+    // 每个 NUMA group 一个, 为空时不持久化
+    std::vector<std::unique_ptr<ChangeLog>> m_logs;
+
+    // 串行化交付, 同时保护订阅者列表、m_logs 和下面的交付状态
+    std::mutex m_flushMutex;
+    std::vector<ChangeStreamConsumer *> m_consumers;
+    std::vector<char> m_batch;
+    // 已经取出但 CSN 不小于上界, 留到之后交付的事务
+    std::vector<char> m_pending;
+    // CSN 小于 m_deliveredCSN 的事务都已经交付
+    uint64 m_deliveredCSN = 0;
+    // CSN 在 [m_deliveredCSN, m_retainedCSN) 之间的事务没有订阅者, 只保存在 ChangeLog 中
+    uint64 m_retainedCSN = 0;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    bool m_stop = false;
+    bool m_flushRequested = false;
+    std::thread m_flusher;
+
+    std::atomic<uint64> m_startCSN = {0};
+
+    std::atomic<uint64> m_appendedTxs = {0};
+
+    std::atomic<uint64> m_appendedBytes = {0};
+
+    std::atomic<uint64> m_flushedBatches = {0};
+
+    static std::unique_ptr<ChangeStream> g_changeStream;
+};
+
+}  // namespace NVMDB
+
+#endif  // NVMDB_CHANGE_STREAM_H
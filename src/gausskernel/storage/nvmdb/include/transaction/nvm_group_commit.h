@@ -0,0 +1,86 @@
+#ifndef NVMDB_GROUP_COMMIT_H
+#define NVMDB_GROUP_COMMIT_H
+
+#include "undo/nvm_undo_page.h"
+#include "common/nvm_cfg.h"
+#include "glog/logging.h"
+#include "gflags/gflags.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace NVMDB {
+
+DECLARE_bool(group_commit);
+DECLARE_int64(group_commit_max_wait_us);
+DECLARE_int64(group_commit_max_batch);
+
+/*
+ * 组提交: 同一个 NUMA group 内并发提交的事务把 tx slot 的持久化合并成一次 fence.
+ * 第一个进入批次的事务成为 leader, 最多等待 maxWaitUs 微秒或者批次攒满 maxBatch 个 slot,
+ * 然后关闭批次, 由 leader 对批次内所有 slot 做 flush, 最后只做一次 drain; 其他事务等待自己所在的批次持久化.
+ * 必须由 leader 自己 flush: fence 只保证本线程发出的 flush 完成.
+ */
+class GroupCommitter {
+public:
+    GroupCommitter(uint64 maxWaitUs, uint64 maxBatch)
+        : m_maxWaitUs(maxWaitUs), m_maxBatch(std::max<uint64>(maxBatch, 1)), m_groups(NVMDB_MAX_GROUP) { }
+
+    // 持久化 slot, 返回时 slot 已经落盘
+    void Persist(const TxSlot *slot, int groupId);
+
+    // 已经持久化的 slot 数量和 fence 次数, 二者之比是平均批次大小
+    [[nodiscard]] uint64 GetPersistedSlots() const {
+        return m_persistedSlots.load(std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] uint64 GetPersistedBatches() const {
+        return m_persistedBatches.load(std::memory_order_relaxed);
+    }
+
+public:
+    inline static void InitGlobalGroupCommitter() {
+        DCHECK(g_groupCommitter == nullptr);
+        g_groupCommitter = std::make_unique<GroupCommitter>(FLAGS_group_commit_max_wait_us,
+                                                            FLAGS_group_commit_max_batch);
+    }
+
+    inline static void DestroyGlobalGroupCommitter() {
+        g_groupCommitter = nullptr;
+    }
+
+    inline static auto* GetGlobalGroupCommitter() {
+        return g_groupCommitter.get();
+    }
+
+private:
+    struct alignas(NVM_CACHE_LINE_SIZE) CommitGroup {
+        std::mutex m_mutex;
+        std::condition_variable m_cond;
+        // 正在攒的批次中的 slot
+        std::vector<const TxSlot *> m_pending;
+        // 正在攒的批次号
+        uint64 m_fillingBatch = 1;
+        // 该批次号及之前的批次都已经持久化
+        uint64 m_durableBatch = 0;
+    };
+
+    uint64 m_maxWaitUs;
+
+    uint64 m_maxBatch;
+
+    std::vector<CommitGroup> m_groups;
+
+    std::atomic<uint64> m_persistedSlots = {0};
+
+    std::atomic<uint64> m_persistedBatches = {0};
+
+    static std::unique_ptr<GroupCommitter> g_groupCommitter;
+};
+
+}  // namespace NVMDB
+
+#endif  // NVMDB_GROUP_COMMIT_H
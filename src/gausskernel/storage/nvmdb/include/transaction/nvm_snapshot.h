@@ -3,37 +3,43 @@
 #include "common/nvm_spinlock.h"
 #include "common/nvm_cfg.h"
 #include "glog/logging.h"
+#include "nvmdb_thread.h"
+#include <atomic>
+#include <cstdint>
+#include <memory>
 #include <vector>
 #include <mutex>
 #include <thread>
 
 namespace NVMDB {
 
+/*
+ * 记录每个线程的读快照, 用来计算全局最小快照 (回收水位线).
+ * 槽位按 NUMA group 分片, 线程优先使用本 group 分片中的槽位; 每个槽位独占一个 cache line, 避免 Begin 时的伪共享.
+ * 另外用一组 bitmap 记录哪些槽位正在使用, 计算最小快照时只访问在用的槽位, 不必扫描全部 NVMDB_MAX_THREAD_NUM 个.
+ */
 class ProcessArray {
 public:
     // 系统最多支持多少个线程
     explicit ProcessArray(int maxCount)
-        : m_processArray(maxCount) { }
+        : m_processArray(maxCount),
+          m_shardSize(maxCount / NVMDB_MAX_GROUP),
+          m_activeMasks(new std::atomic<uint64>[maxCount / ACTIVE_MASK_BITS]()),
+          m_shardCounters(NVMDB_MAX_GROUP) {
+        CHECK(maxCount % (NVMDB_MAX_GROUP * ACTIVE_MASK_BITS) == 0);
+    }
 
     // return process index
     size_t addProcess() {
+        // 优先在当前线程所属 group 的分片中找空闲槽位, 本分片满了再找其他分片
+        const size_t shard = static_cast<size_t>(GetCurrentGroupId()) % NVMDB_MAX_GROUP;
         while (true) {
-            const auto index = (m_arrayIndexCounter++) % m_processArray.size();
-            auto& procStruct = m_processArray[index];
-            if (procStruct.m_inUsed.load(std::memory_order_relaxed)) {
-                continue;   // trick
+            for (size_t i = 0; i < NVMDB_MAX_GROUP; i++) {
+                size_t index = tryAddProcess((shard + i) % NVMDB_MAX_GROUP);
+                if (index != INVALID_PROCESS_INDEX) {
+                    return index;
+                }
             }
-            std::lock_guard<PassiveSpinner42> guard(procStruct.mutex);
-            if (procStruct.m_inUsed.load(std::memory_order_relaxed)) {
-                continue;
-            }
-            // 事务基于至少这个版本进行读取, 因此不会产生小于 m_snapshotCSN 的 Undo 日志
-            auto snapshotCSN = m_globalCSN.load(std::memory_order_relaxed);
-            procStruct.m_snapshotCSN.store(snapshotCSN, std::memory_order_relaxed);
-            LOG(INFO) << "Create a txn process, id: " << index;
-            // 最后设置 in used
-            procStruct.m_inUsed.store(true, std::memory_order_release);
-            return index;
         }
     }
 
@@ -43,13 +49,14 @@ public:
         DCHECK(index < m_processArray.size());
         DCHECK(m_processArray[index].m_inUsed);
         m_processArray[index].m_inUsed.store(false, std::memory_order_release);
+        m_activeMasks[index / ACTIVE_MASK_BITS].fetch_and(~(1LLU << (index % ACTIVE_MASK_BITS)));
         LOG(INFO) << "Destroy a txn process, id: " << index;
     }
 
     // 事务将基于这个返回的CSN进行读取
     uint64 getAndUpdateProcessLocalCSN(uint32 index) {
         // 所有低于 m_globalCSN 的事务均已经完成执行, 可以使用 m_globalCSN 作为读取的版本
-        auto globalCSN = m_globalCSN.load(std::memory_order_relaxed);
+        auto globalCSN = m_globalCSN.load(std::memory_order_acquire);
         auto& procStruct = m_processArray[index];
         std::lock_guard<PassiveSpinner42> guard(procStruct.mutex);
         procStruct.m_snapshotCSN.store(globalCSN, std::memory_order_relaxed);
@@ -63,21 +70,31 @@ public:
         return procStruct.m_snapshotCSN.load(std::memory_order_relaxed);
     }
 
-    // 更新最小全局 csn 来回收日志
+    /*
+     * 更新最小全局 csn 来回收日志. 先读 m_globalCSN 再扫描在用的槽位: 扫描时还没有登记的线程,
+     * 之后 Begin 读到的 m_globalCSN 不会小于这里读到的值, 所以不会漏掉更小的快照.
+     */
     uint64 getAndUpdateGlobalMinCSN() {
-        uint64 globalMinCSN = m_globalCSN.load(std::memory_order_relaxed);
-        for (auto & procStruct : m_processArray) {
-            if (procStruct.m_inUsed.load(std::memory_order_acquire)) {  // trick
-                // 可能读到过期的 m_snapshotCSN 但是因为 m_snapshotCSN 是单调递增的, 不影响正确性
+        uint64 globalMinCSN = m_globalCSN.load(std::memory_order_acquire);
+        const size_t maskCount = m_processArray.size() / ACTIVE_MASK_BITS;
+        for (size_t i = 0; i < maskCount; i++) {
+            uint64 mask = m_activeMasks[i].load(std::memory_order_acquire);
+            while (mask != 0) {
+                const size_t index = i * ACTIVE_MASK_BITS + __builtin_ctzll(mask);
+                mask &= mask - 1;
+                auto& procStruct = m_processArray[index];
+                if (procStruct.m_inUsed.load(std::memory_order_acquire)) {  // trick
+                    // 可能读到过期的 m_snapshotCSN 但是因为 m_snapshotCSN 是单调递增的, 不影响正确性
+                    globalMinCSN = std::min(globalMinCSN, procStruct.m_snapshotCSN.load(std::memory_order_relaxed));
+                    continue;
+                }
+                std::lock_guard<PassiveSpinner42> guard(procStruct.mutex);
+                if (!procStruct.m_inUsed.load(std::memory_order_relaxed)) {
+                    continue;   // 如果没有在使用, 一定没有在使用, 可以安全继续
+                }
+                // 找到所有process中CSN最小的那个
                 globalMinCSN = std::min(globalMinCSN, procStruct.m_snapshotCSN.load(std::memory_order_relaxed));
-                continue;
             }
-            std::lock_guard<PassiveSpinner42> guard(procStruct.mutex);
-            if (!procStruct.m_inUsed.load(std::memory_order_relaxed)) {
-                continue;   // 如果没有在使用, 一定没有在使用, 可以安全继续
-            }
-            // 找到所有process中CSN最小的那个
-            globalMinCSN = std::min(globalMinCSN, procStruct.m_snapshotCSN.load(std::memory_order_relaxed));
         }
         DCHECK(globalMinCSN >= m_globalMinCSN.load(std::memory_order_relaxed));
         m_globalMinCSN.store(globalMinCSN, std::memory_order_release);
@@ -86,12 +103,22 @@ public:
 
     // 提交时间戳, 几个事务的提交时间戳可以相同
     [[nodiscard]] inline uint64 getGlobalCSN() const {
-        return m_globalCSN.load(std::memory_order_relaxed);
+        return m_globalCSN.load(std::memory_order_acquire);
     }
 
-    // 事物被提交, 更新全局 csn
-    inline uint64 advanceGlobalCSN() {
-        return m_globalCSN.fetch_add(1, std::memory_order_relaxed);
+    /*
+     * 事物被提交, 保证全局 csn 大于 commitCSN. 并发提交的事务拿到的是同一个 commitCSN, 只需要其中一个推进:
+     * 已经被别人推进过就直接返回, 否则用一次 CAS 推进, CAS 失败同样说明别人已经推进过.
+     * 这样同一批提交只有一次写 m_globalCSN, 不再每次提交都对这个 cache line 做 fetch_add.
+     */
+    inline void advanceGlobalCSN(uint64 commitCSN) {
+        if (m_globalCSN.load(std::memory_order_relaxed) != commitCSN) {
+            DCHECK(m_globalCSN.load(std::memory_order_relaxed) > commitCSN);
+            return;
+        }
+        uint64 expected = commitCSN;
+        m_globalCSN.compare_exchange_strong(expected, commitCSN + 1, std::memory_order_release,
+                                            std::memory_order_relaxed);
     }
 
     // 低于该版本的 Undo 日志可以被安全回收
@@ -120,24 +147,61 @@ public:
     }
 
 private:
-    struct Process {
+    static constexpr uint32 ACTIVE_MASK_BITS = 64;
+    static constexpr size_t INVALID_PROCESS_INDEX = SIZE_MAX;
+
+    // 在指定分片中找一个空闲槽位, 分片已满时返回 INVALID_PROCESS_INDEX
+    size_t tryAddProcess(size_t shard) {
+        for (size_t i = 0; i < m_shardSize; i++) {
+            const auto index = shard * m_shardSize + (m_shardCounters[shard].m_counter++) % m_shardSize;
+            auto& procStruct = m_processArray[index];
+            if (procStruct.m_inUsed.load(std::memory_order_relaxed)) {
+                continue;   // trick
+            }
+            std::lock_guard<PassiveSpinner42> guard(procStruct.mutex);
+            if (procStruct.m_inUsed.load(std::memory_order_relaxed)) {
+                continue;
+            }
+            // 事务基于至少这个版本进行读取, 因此不会产生小于 m_snapshotCSN 的 Undo 日志
+            auto snapshotCSN = m_globalCSN.load(std::memory_order_relaxed);
+            procStruct.m_snapshotCSN.store(snapshotCSN, std::memory_order_relaxed);
+            LOG(INFO) << "Create a txn process, id: " << index;
+            // 最后设置 in used
+            procStruct.m_inUsed.store(true, std::memory_order_release);
+            m_activeMasks[index / ACTIVE_MASK_BITS].fetch_or(1LLU << (index % ACTIVE_MASK_BITS));
+            return index;
+        }
+        return INVALID_PROCESS_INDEX;
+    }
+
+    struct alignas(NVM_CACHE_LINE_SIZE) Process {
         mutable PassiveSpinner42 mutex;
         std::atomic<bool> m_inUsed = {false};
         std::atomic<uint64> m_snapshotCSN = {MIN_TX_CSN};
     };
 
+    struct alignas(NVM_CACHE_LINE_SIZE) ShardCounter {
+        // 单调递增的指针, 用于判断分片中哪个 index 被使用
+        std::atomic<uint64> m_counter = {0};
+    };
+
     std::vector<Process> m_processArray;
 
-    // 单调递增的指针, 用于判断哪个 index 被使用
-    std::atomic<uint64> m_arrayIndexCounter = {0};
+    // 每个分片的槽位数量
+    size_t m_shardSize;
+
+    // 每个槽位一位, 置位表示槽位正在使用
+    std::unique_ptr<std::atomic<uint64>[]> m_activeMasks;
+
+    std::vector<ShardCounter> m_shardCounters;
 
     // 下一个提交交易的CSN
     // 小于m_globalCSN的heap不会再被写, 可以被安全的读取
-    std::atomic<uint64> m_globalCSN = {MIN_TX_CSN};
+    alignas(NVM_CACHE_LINE_SIZE) std::atomic<uint64> m_globalCSN = {MIN_TX_CSN};
 
     // 回收水位线
     // 小于m_globalMinCSN的Undo不会再被读或写, 可以被安全回收
-    std::atomic<uint64> m_globalMinCSN = {MIN_TX_CSN};
+    alignas(NVM_CACHE_LINE_SIZE) std::atomic<uint64> m_globalMinCSN = {MIN_TX_CSN};
 
     static std::unique_ptr<ProcessArray> g_processArray;
 };
@@ -6,9 +6,12 @@
 #include "index/nvm_index.h"
 #include "common/pactree/pactree_snapshot.h"
 #include "transaction/nvm_snapshot.h"
+#include "transaction/nvm_change_stream.h"
 
 namespace NVMDB {
 
+class Table;
+
 enum class TxStatus {
     EMPTY,
     IN_PROGRESS,
@@ -54,12 +57,26 @@ public:
 
     Transaction();
 
+    /*
+     * 并行扫描的工作线程使用: 以 leader 的快照开始一个只读事务, 不在 ProcessArray 中占槽位, 否则并发的并行扫描
+     * 会很快占满槽位, addProcess 一直自旋. 事务只能用 EndWithSnapshot 结束, 不能再 Begin.
+     */
+    explicit Transaction(const Transaction *leader);
+
     ~Transaction();
 
     void PrepareUndo();
 
     void Begin();
 
+    /*
+     * 以 leader 的快照开始一个只读事务, 用 EndWithSnapshot 结束.
+     * leader 在本事务结束前保持活跃, 它登记的快照保证需要的 undo 不会被回收.
+     */
+    void BeginWithSnapshot(const Transaction &leader);
+
+    void EndWithSnapshot();
+
     void Commit();
 
     void Abort();
@@ -85,6 +102,14 @@ public:
     // 事务能否修改当前 tuple
     TMResult SatisfiedUpdate(const NVMTuple& tuple) const;
 
+    // tuple 由已提交的事务写入且提交 CSN 小于所有活跃事务的快照, 或由已回滚的事务写入, 不会再有事务需要它之前的版本
+    bool VersionIsFrozen(const NVMTuple& tuple) const;
+
+    // 事务是否已经写入过数据 (申请了 undo 空间)
+    [[nodiscard]] bool HasWrites() const {
+        return m_undoTxContext != nullptr;
+    }
+
     inline LookupSnapshot GetIndexLookupSnapshot() const {
         return LookupSnapshot {
             .snapshot = m_snapshotCSN,
@@ -98,7 +123,7 @@ public:
         Key_t key;
         this->PrepareUndo();
         index->Encode(indexTuple, &key, rowId);
-        PrepareIndexInsertUndo(key);
+        PrepareIndexInsertUndo(index->Id(), key);
         index->Insert(indexTuple, rowId);
     }
 
@@ -106,21 +131,39 @@ public:
         Key_t key;
         this->PrepareUndo();
         index->Encode(indexTuple, &key, rowId);
-        PrepareIndexDeleteUndo(key);
+        PrepareIndexDeleteUndo(index->Id(), key);
         index->Delete(indexTuple, rowId, this->GetTxSlotLocation());
     }
 
+    /*
+     * 批量导入: 为行号区间 [rowBegin, rowBegin + count) 在索引 idxId 中的键写一条 IndexBulkInsertUndo.
+     * undo 中只记录行号区间和索引列 (rowDes, indexDes) 在行内的位置, 不记录键, 回滚时重新读出这些行编码出键.
+     * 调用者保证这些行已经写入 NVM, 并在写 undo 之后再插入键.
+     */
+    void PrepareIndexBulkInsertUndo(IndexId idxId, const ColumnDesc *rowDes, const IndexColumnDesc *indexDes,
+                                    uint32 colCnt, uint32 segHead, uint16 rowLen, RowId rowBegin, uint32 count);
+
     inline void PushWriteSet(RowIdMapEntry *row) {
         m_writeSet.push_back(row); }
 
+    // 第一次修改 table 时在表上登记, 事务结束时注销, 见 Table::WriterEnter
+    void EnterTable(Table *table);
+
+    [[nodiscard]] bool HasEnteredTable(const Table *table) const;
+
+    // 本事务的变更, 打开 change_stream 时由 heap 写操作追加, 提交时交给 ChangeStream
+    inline TxChangeBuffer *GetChangeBuffer() {
+        return &m_changes;
+    }
+
     // For testing only
     inline uint64 GetSnapshot() const { return m_snapshotCSN; }
 
 protected:
-    void PrepareIndexInsertUndo(const Key_t &key);
+    void PrepareIndexInsertUndo(IndexId idxId, const Key_t &key);
 
     // 删除的时候可以保证，自己可以看见，且没有并发的修改，即在删除之前肯定是可见的。所以回滚直接设置value 为InvalidCSN即可。
-    void PrepareIndexDeleteUndo(Key_t &key);
+    void PrepareIndexDeleteUndo(IndexId idxId, const Key_t &key);
 
 private:
     // NVM对应的undo segment
@@ -140,6 +183,11 @@ private:
     // 事务当前的状态
     TxStatus m_txStatus;
     std::vector<RowIdMapEntry *> m_writeSet;
+    // 登记过的表和登记时的 epoch 奇偶位
+    std::vector<std::pair<Table *, uint32>> m_writeTables;
+    TxChangeBuffer m_changes;
+
+    void ExitTables();
 
     constexpr static uint32 INVALID_PROC_ARRAY_INDEX = 0xffffffff;
     uint32 m_procArrayTID = {INVALID_PROC_ARRAY_INDEX};
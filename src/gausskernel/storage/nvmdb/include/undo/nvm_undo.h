@@ -10,9 +10,9 @@ inline void UndoCreate() {
     UndoSegmentCreate();
 }
 
-/* 数据库启动时调用，初始化基本信息，启动清理线程。 */
-inline void UndoBootStrap() {
-    UndoSegmentMount();
+/* 数据库启动时调用，初始化基本信息，启动清理线程。beforeRecovery 在挂载之后、后台回滚之前调用，这时 tx slot 还是崩溃时的状态。 */
+inline void UndoBootStrap(const std::function<void()> &beforeRecovery = nullptr) {
+    UndoSegmentMount(beforeRecovery);
 }
 
 /* 事务启动时调用，绑定事务的 undo context；事务执行过程中通过UndoLocalContext插入undo日志 */
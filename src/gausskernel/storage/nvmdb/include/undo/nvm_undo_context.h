@@ -3,6 +3,7 @@
 
 #include "undo/nvm_undo_segment.h"
 #include "undo/nvm_undo_rollback.h"
+#include <libpmem.h>
 
 namespace NVMDB {
 
@@ -23,6 +24,15 @@ public:
         m_slot->status = status;
     }
 
+    // 单独持久化 tx slot, 每次调用都有一次 fence
+    void PersistTxSlot() {
+        pmem_persist(m_slot, sizeof(TxSlot));
+    }
+
+    inline const TxSlot *GetTxSlot() const {
+        return m_slot;
+    }
+
     // 根据segment id和segment 中的slot id生成全局slot id
     inline TxSlotPtr GetTxSlotLocation() const {
         auto segmentId = m_undoSegment->getSegmentId();
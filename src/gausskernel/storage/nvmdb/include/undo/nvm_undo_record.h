@@ -31,6 +31,10 @@ enum UndoRecordType {
     IndexInsertUndo,
     IndexDeleteUndo,
 
+    // 批量导入, 一条记录覆盖一段连续的行或一批索引键. 新类型只能追加, 已持久化的类型值不能改变
+    HeapBulkInsertUndo,
+    IndexBulkInsertUndo,
+
     MaxUndoRecordType,
 };
 
@@ -4,10 +4,14 @@
 #include "undo/nvm_undo_page.h"
 #include "undo/nvm_undo_record.h"
 #include "table_space/nvm_logic_file.h"
+#include "gflags/gflags.h"
 #include <atomic>
+#include <functional>
 
 namespace NVMDB {
 
+DECLARE_int32(recovery_threads_per_dir);
+
 /*
  * 前16位， segment id,  后48位，segment 内 tx slot id
  * 但是实际不会有 1<<48 这么多个 tx slot，实际在文件头部存有 UNDO_TX_SLOTS 个 slot， slot id通过求模映射到对应的位置。
@@ -198,7 +202,11 @@ private:
 
 void UndoSegmentCreate();
 
-void UndoSegmentMount();
+// 并行挂载所有 undo segment, 之后由后台线程池并行回滚未提交的事务
+void UndoSegmentMount(const std::function<void()> &beforeRecovery);
+
+// 后台 undo 回滚是否已经完成
+bool IsUndoRecoveryFinished();
 
 void UndoSegmentUnmount();
 
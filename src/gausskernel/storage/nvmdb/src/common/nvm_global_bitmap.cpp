@@ -1,5 +1,6 @@
 #include "common/nvm_global_bitmap.h"
 #include "glog/logging.h"
+#include <algorithm>
 
 namespace NVMDB {
 
@@ -91,4 +92,17 @@ void GlobalBitMap::SyncRelease(uint32 bit) {
     }
 }
 
+void GlobalBitMap::SyncSet(uint32 bit) {
+    uint32 aryoff = AryOffset(bit);
+    uint64 mask = 1LLU << BitOffset(bit);
+    __sync_fetch_and_or(&m_map[aryoff], mask);
+    UpdateHint(0, bit);
+}
+
+void GlobalBitMap::Reset() {
+    std::fill(m_map.begin(), m_map.end(), 0);
+    m_startHint = 0;
+    m_highestBit = 0;
+}
+
 }  // namespace NVMDB
@@ -3,22 +3,19 @@
 
 namespace NVMDB {
 
-ListNode *LinkedList::Initialize() {
+ListNode *LinkedList::Initialize(uint32_t treeSlot) {
     genId = 0;
-    auto *oplog = (OpStruct *)PMem::getOpLog(0);
+    PMEMoid oid;
 
-    PMem::alloc(LIST_NODE_SIZE, (void **)&headPtr, &(oplog->newNodeOid));
+    PMem::alloc(LIST_NODE_SIZE, (void **)&headPtr, &oid);
     auto *head = (ListNode *)new (headPtr.getVaddr()) ListNode();
     flushToNVM((char *)&headPtr, sizeof(NVMPtr<ListNode>));
     smp_wmb();
 
-    auto *oplog2 = (OpStruct *)PMem::getOpLog(1);
-
-    PMem::alloc(LIST_NODE_SIZE, (void **)&tailPtr, &(oplog->newNodeOid));
+    PMem::alloc(LIST_NODE_SIZE, (void **)&tailPtr, &oid);
     auto *tail = (ListNode *)new (tailPtr.getVaddr()) ListNode();
-
-    oplog->op = OpStruct::done;
-    oplog2->op = OpStruct::done;
+    head->SetTreeSlot(treeSlot);
+    tail->SetTreeSlot(treeSlot);
 
     NVMPtr<ListNode> nullPtr(0, 0);
 
@@ -102,10 +99,10 @@ static ListNode *searchAndLockNode(ListNode *cur, uint64_t genId, Key_t &key) {
 /*
  * return: true(更新成功）， false(传入的head有问题，需要重新遍历 art）
  */
-bool LinkedList::Insert(Key_t &key, Val_t value, ListNode *head) {
+bool LinkedList::Insert(Key_t &key, Val_t value, ListNode *head, bool keepExisting) {
     ListNode* cur = searchAndLockNode(head, genId, key);
     /* current node is locked and the range is matched */
-    bool res = cur->Insert(key, value, 0);
+    bool res = cur->Insert(key, value, 0, keepExisting);
     cur->getVersionedLock().unlock();
     return res;
 }
@@ -162,6 +159,12 @@ uint32_t LinkedList::Size(ListNode *head) {
     return count;
 }
 
+void LinkedList::GetStats(ListNode *head, PACTreeStats *stats) {
+    for (ListNode *cur = head; cur != nullptr; cur = cur->GetNext()) {
+        cur->GetStats(stats);
+    }
+}
+
 ListNode *LinkedList::GetHead() {
     auto *head = (ListNode *)headPtr.getVaddr();
     return head;
@@ -197,53 +200,109 @@ bool LinkedList::ScanInOrder(Key_t &startKey, Key_t &endKey, ListNode *head, int
     return true;
 }
 
-void LinkedList::Recover(void *sl) {
-    genId++;
-    auto art = (SearchLayer *)sl;
+bool LinkedList::ScanNode(Key_t &startKey, Key_t &endKey, ListNode *head, LookupSnapshot snapshot,
+                          ScanBuffer &result, ListNode **next, Key_t *resumeKey) const {
+    ListNode *cur = searchAndLockNode(head, genId, startKey);
+    DCHECK(!cur->GetDeleted() && cur->GetMin() <= startKey && startKey < cur->GetMax());
 
-    for (int i = 0; i < NVMDB_NUM_LOGS_PER_THREAD * NVMDB_MAX_THREAD_NUM; i++) {
-        auto oplog = (OpStruct *)PMem::getOpLog(i);
-        if (oplog->op == OpStruct::done || oplog->op == OpStruct::dummy) {
+    result.Clear();
+    bool needPrune;
+    bool end = cur->ScanInOrder(startKey, endKey, snapshot, result, &needPrune);
+    if (needPrune) {
+        cur->Prune(snapshot, genId);
+    }
+    end |= endKey < cur->GetMax();
+    if (!end) {
+        *next = cur->GetNext();
+        *resumeKey = cur->GetMax();
+    }
+    cur->getVersionedLock().unlock();
+    return end;
+}
+
+void LinkedList::SampleNodes(Key_t &startKey, Key_t &endKey, ListNode *head, uint64_t stride,
+                             LookupSnapshot snapshot, ScanBuffer &result) const {
+    DCHECK(stride > 0);
+    result.Clear();
+    uint64_t pos = 0;
+    for (ListNode *cur = head; cur != nullptr; pos++) {
+        if (pos % stride != 0) {
+            cur = cur->GetNext();
             continue;
         }
-        if (!(oplog->searchLayers.load() & art->grpMask)) {
-            if (oplog->searchLayers.load() == 0) {
-                oplog->op = OpStruct::done;
+        cur->getVersionedLock().lock(genId);
+        // 已删除的节点中没有 key; 只读取节点内 [max(startKey, min), endKey) 的部分
+        Key_t from = startKey < cur->GetMin() ? cur->GetMin() : startKey;
+        if (!cur->GetDeleted() && from < cur->GetMax() && from < endKey) {
+            bool needPrune;
+            (void)cur->ScanInOrder(from, endKey, snapshot, result, &needPrune);
+            if (needPrune) {
+                cur->Prune(snapshot, genId);
             }
-            continue;
         }
-        auto remain = oplog->searchLayers.fetch_sub(art->grpMask);
-
-        if (oplog->op == OpStruct::insert) {
-            NVMPtr<ListNode> node;
-            NVMPtr<ListNode> next(oplog->poolId, oplog->newNodeOid.off);
-            node.setRawPtr(oplog->oldNodePtr);
-            if (oplog->step == OpStruct::initial) {
-                // nothing to do
-            } else if (oplog->step == OpStruct::during_split) {
-                if (remain == art->grpMask) {
-                    /* the split is not finished, just recover the old node; the insert operation considered as failed
-                     * not that only one thread need do the recovery
-                     * */
-                    node.getVaddr()->RecoverSplit(oplog);
-                }
-            } else {
-                // todo: update next's prev point if necessary
-                CHECK(oplog->step == OpStruct::finish_split);
-                if (!next.getVaddr()->GetDeleted() &&
-                    (art->IsEmpty() || art->lookup(oplog->key) != (void *)next.getRawPtr())) {
-                    art->Insert(oplog->key, (void *)next.getRawPtr());
-                }
+        ListNode *next = cur->GetNext();
+        cur->getVersionedLock().unlock();
+        cur = next;
+    }
+}
+
+void LinkedList::Destroy() {
+    // 先断开持久化的头尾指针再逐个释放, 崩溃时最多泄漏节点, 不会重复释放
+    ListNode *cur = headPtr.getVaddr();
+    headPtr = NVMPtr<ListNode>();
+    tailPtr = NVMPtr<ListNode>();
+    flushToNVM(reinterpret_cast<char *>(this), sizeof(LinkedList));
+    smp_wmb();
+    while (cur != nullptr) {
+        ListNode *next = cur->GetNext();
+        PMem::freeVaddr(cur);
+        cur = next;
+    }
+}
+
+void LinkedList::Recover() {
+    genId++;
+}
+
+void LinkedList::RecoverOpLog(OpStruct *oplog, void *sl) {
+    auto art = (SearchLayer *)sl;
+    if (!(oplog->searchLayers.load() & art->grpMask)) {
+        if (oplog->searchLayers.load() == 0) {
+            oplog->op = OpStruct::done;
+        }
+        return;
+    }
+    auto remain = oplog->searchLayers.fetch_sub(art->grpMask);
+
+    if (oplog->op == OpStruct::insert) {
+        NVMPtr<ListNode> node;
+        NVMPtr<ListNode> next(oplog->poolId, oplog->newNodeOid.off);
+        node.setRawPtr(oplog->oldNodePtr);
+        if (oplog->step == OpStruct::initial) {
+            // nothing to do
+        } else if (oplog->step == OpStruct::during_split) {
+            if (remain == art->grpMask) {
+                /* the split is not finished, just recover the old node; the insert operation considered as failed
+                 * not that only one thread need do the recovery
+                 * */
+                node.getVaddr()->RecoverSplit(oplog);
             }
-        } else if (oplog->op == OpStruct::remove) {
-            if (art->lookup(oplog->key) != nullptr) {
-                art->remove(oplog->key, oplog->oldNodePtr);
+        } else {
+            // todo: update next's prev point if necessary
+            CHECK(oplog->step == OpStruct::finish_split);
+            if (!next.getVaddr()->GetDeleted() &&
+                (art->IsEmpty() || art->lookup(oplog->key) != (void *)next.getRawPtr())) {
+                art->Insert(oplog->key, (void *)next.getRawPtr());
             }
         }
-        if (remain == art->grpMask) {
-            oplog->op = OpStruct::done;
+    } else if (oplog->op == OpStruct::remove) {
+        if (art->lookup(oplog->key) != nullptr) {
+            art->remove(oplog->key, oplog->oldNodePtr);
         }
     }
+    if (remain == art->grpMask) {
+        oplog->op = OpStruct::done;
+    }
 }
 
 }  // namespace NVMDB
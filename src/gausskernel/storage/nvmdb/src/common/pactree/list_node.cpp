@@ -13,15 +13,13 @@ void SetPACTreeWhiteBoxBP(PACTreeWhiteBoxType type) {
     g_whiteBoxType = type;
 }
 
-static void destroy_remain_key(VarLenString *remain_key) {
-    auto key = (Key_t *)remain_key;
-    delete key;
+/* 剩余 key 放在调用者栈上的 Key_t 里, 按 VarLenString 使用 */
+static inline VarLenString *AsVarLen(Key_t *key) {
+    return (VarLenString *)key;
 }
 
-VarLenString *ListNode::GetRemainKey(Key_t *origin_key) const {
-    auto *remain_key = new Key_t();
-    remain_key->set(origin_key->getData() + prefix.keyLength, origin_key->keyLength - prefix.keyLength);
-    return (VarLenString *)remain_key;
+void ListNode::GetRemainKey(const Key_t &originKey, Key_t *remainKey) const {
+    remainKey->set(originKey.getData() + prefix.keyLength, originKey.keyLength - prefix.keyLength);
 }
 
 void ListNode::GetOriginKey(VarLenString *remain_key, Key_t *origin_key) {
@@ -101,6 +99,8 @@ void LNodeReport() {
         return;
     }
     g_reported = true;
+    LOG(INFO) << "ListNode split caused by line point full: " << g_linepointFull.load()
+              << ", by kv storage full: " << g_storageFull.load();
 }
 
 bool ListNode::StorageSpaceFull(int size) const {
@@ -260,7 +260,7 @@ NVMPtr<ListNode> ListNode::Split(Key_t &key, Val_t value) {
     SecureRetCheck(ret);
 
     // 1) Add Oplog and set the information for current(overflown) node.
-    Oplog::WriteOpLog(oplog, OpStruct::insert, new_min, (void *)curPtr.getRawPtr(), 0, key, value);
+    Oplog::WriteOpLog(oplog, OpStruct::insert, new_min, (void *)curPtr.getRawPtr(), 0, key, value, treeSlot);
     oplog->step = OpStruct::during_split;
 
     if (lpa->recyclable > MAX_RECYCLE) {
@@ -283,6 +283,7 @@ NVMPtr<ListNode> ListNode::Split(Key_t &key, Val_t value) {
     //    3-1) Update New node
     newNode->SetMin(new_min);
     newNode->SetMax(GetMax());
+    newNode->SetTreeSlot(treeSlot);
     newNode->MakePrefix();
     int prefixDelta = newNode->prefix.keyLength - prefix.keyLength;
     CHECK(prefixDelta >= 0);
@@ -345,20 +346,22 @@ NVMPtr<ListNode> ListNode::Split(Key_t &key, Val_t value) {
     return newNodePtr;
 }
 
-bool ListNode::Insert(Key_t &key, Val_t value, int duringSplit) {
-    auto remain_key = GetRemainKey(&key);
-    uint8_t keyHash = GetKeyFingerPrint(remain_key);
-    int index = GetKeyIndex(remain_key, keyHash);
+bool ListNode::Insert(Key_t &key, Val_t value, int duringSplit, bool keepExisting) {
+    Key_t remainKey;
+    GetRemainKey(key, &remainKey);
+    auto remain = AsVarLen(&remainKey);
+    uint8_t keyHash = GetKeyFingerPrint(remain);
+    int index = GetKeyIndex(remain, keyHash);
     if (index >= 0) {
         // key exists
-        UpdateAtIndex(value, index);
-        destroy_remain_key(remain_key);
+        if (!keepExisting) {
+            UpdateAtIndex(value, index);
+        }
         return true;
     }
 
     // key not exists, insert into current node if free space is enough
-    int offset = InsertKVItem(remain_key, value, duringSplit);
-    destroy_remain_key(remain_key);
+    int offset = InsertKVItem(remain, value, duringSplit);
     if (offset < 0) {  // need split
         CHECK(!duringSplit);
         Split(key, value);
@@ -373,10 +376,10 @@ bool ListNode::Insert(Key_t &key, Val_t value, int duringSplit) {
 }
 
 bool ListNode::Lookup(Key_t &key, Val_t &value) {
-    auto remain_key = GetRemainKey(&key);
-    uint8_t keyHash = GetKeyFingerPrint(remain_key);
-    int index = GetKeyIndex(remain_key, keyHash);
-    destroy_remain_key(remain_key);
+    Key_t remainKey;
+    GetRemainKey(key, &remainKey);
+    uint8_t keyHash = GetKeyFingerPrint(AsVarLen(&remainKey));
+    int index = GetKeyIndex(AsVarLen(&remainKey), keyHash);
 
     if (index >= 0) {
         auto lpa = GetCurrPerm();
@@ -387,23 +390,19 @@ bool ListNode::Lookup(Key_t &key, Val_t &value) {
     return false;
 }
 
-bool ListNode::ScanInOrder(Key_t &startKey, Key_t &endKey, int maxRange, LookupSnapshot snapshot,
-                           std::vector<std::pair<Key_t, Val_t>> &result, bool continueScan, bool *needPrune) {
-    VarLenString *ed_remain;
-    if (endKey >= max) {
-        ed_remain = GetRemainKey(&max);
-    } else {
-        ed_remain = GetRemainKey(&endKey);
-    }
+template <typename Emit>
+bool ListNode::ScanItems(Key_t &startKey, Key_t &endKey, int todo, LookupSnapshot snapshot, bool continueScan,
+                         bool *needPrune, Emit &&emit) {
+    Key_t edRemain;
+    GetRemainKey(endKey >= max ? max : endKey, &edRemain);
     uint8_t startIndex = 0;
     if (!continueScan) {
         DCHECK(startKey >= GetMin() && startKey < GetMax());
-        auto st_remain = GetRemainKey(&startKey);
-        startIndex = PermuteLowerBound(st_remain);
-        destroy_remain_key(st_remain);
+        Key_t stRemain;
+        GetRemainKey(startKey, &stRemain);
+        startIndex = PermuteLowerBound(AsVarLen(&stRemain));
     }
 
-    int todo = maxRange - (int)result.size();
     bool end = false;
     int removeItems = 0;
     int scanItems = 0;
@@ -412,16 +411,14 @@ bool ListNode::ScanInOrder(Key_t &startKey, Key_t &endKey, int maxRange, LookupS
         scanItems++;
         auto kv = GetKVItem(lpa->linePoint[i].offset);
         auto status = CheckMVCCVisibility(kv, snapshot);
-        if (kv->key >= *ed_remain) {
+        if (kv->key >= *AsVarLen(&edRemain)) {
             end = true;
             break;
         }
 
         if (status == MVCCVisibility::VISIBLE) {
-            Key_t match;
             CHECK(kv->key.keyLength != 0);
-            GetOriginKey(&kv->key, &match);
-            result.emplace_back(match, kv->value);
+            emit(kv);
             todo--;
         } else if (status == MVCCVisibility::REMOVABLE) {
             removeItems++;
@@ -429,14 +426,42 @@ bool ListNode::ScanInOrder(Key_t &startKey, Key_t &endKey, int maxRange, LookupS
     }
 
     *needPrune = (scanItems > 0 && removeItems >= scanItems / SCAN_ITEM_DIV);
+    return end;
+}
 
-    destroy_remain_key(ed_remain);
+bool ListNode::ScanInOrder(Key_t &startKey, Key_t &endKey, int maxRange, LookupSnapshot snapshot,
+                           std::vector<std::pair<Key_t, Val_t>> &result, bool continueScan, bool *needPrune) {
+    int todo = maxRange - (int)result.size();
+    bool end = ScanItems(startKey, endKey, todo, snapshot, continueScan, needPrune, [&](KVItem *kv) {
+        Key_t match;
+        GetOriginKey(&kv->key, &match);
+        result.emplace_back(match, kv->value);
+    });
     if (end) {
         return true;
     }
     return result.size() == maxRange;
 }
 
+bool ListNode::ScanInOrder(Key_t &startKey, Key_t &endKey, LookupSnapshot snapshot, ScanBuffer &result,
+                           bool *needPrune) {
+    // 一个节点最多 MAX_ENTRIES 个 key, 不会被 todo 截断
+    return ScanItems(startKey, endKey, MAX_ENTRIES, snapshot, false, needPrune,
+                     [&](KVItem *kv) { result.Append(prefix, kv->key, kv->value); });
+}
+
+void ListNode::GetStats(PACTreeStats *stats) {
+    auto lpa = GetCurrPerm();
+    stats->nodes++;
+    stats->keys += lpa->count;
+    stats->keyBytes += lpa->count * prefix.keyLength;
+    for (int i = 0; i < lpa->count; i++) {
+        auto kv = GetKVItem(lpa->GetOffset(i));
+        stats->keyBytes += kv->key.keyLength;
+        stats->kvBytes += ALIGN_ANY(GetKVItemSize(kv), KV_ALIGN_BYTES);
+    }
+}
+
 void ListNode::RecoverSplit(OpStruct *oplog) {
     int ret = memcpy_s((void *)this, LIST_NODE_SIZE, (void *)oplog->oldNodeData, LIST_NODE_SIZE);
     SecureRetCheck(ret);
@@ -491,7 +516,8 @@ void ListNode::MergeEmptyNodeWithPrev(uint64_t genId) {
 
     prevNode->getVersionedLock().unlock();
 
-    Oplog::WriteOpLog(oplog, OpStruct::remove, GetMin(), (void *)curPtr.getRawPtr(), curPtr.getPoolId(), Key_t(-1), -1);
+    Oplog::WriteOpLog(oplog, OpStruct::remove, GetMin(), (void *)curPtr.getRawPtr(), curPtr.getPoolId(), Key_t(-1), -1,
+                      treeSlot);
     Oplog::EnqPerThreadLog(oplog);
 }
 
@@ -5,6 +5,10 @@
 
 namespace NVMDB {
 
+DEFINE_int32(pactree_oplog_min_workers, 1, "min oplog workers per numa group applying search layer updates");
+DEFINE_int32(pactree_oplog_scale_up_lag, 8, "merged oplog backlog of a numa group that adds one more oplog worker");
+DEFINE_int64(pactree_oplog_scale_interval_us, 1000, "interval the combiner samples oplog backlog and rescales workers");
+
 constexpr int RUN_CNT_MOD = 2;
 constexpr int SLEEP_TIME = 200;
 
@@ -34,7 +38,13 @@ constexpr int SLEEP_TIME = 200;
 
 std::vector<WorkerThread *> g_WorkerThreadInst(NVMDB_MAX_GROUP *NVMDB_OPLOG_WORKER_THREAD_PER_GROUP);
 
-std::vector<SearchLayer *> g_perGrpSlPtr(NVMDB_MAX_GROUP);
+std::atomic<int> g_oplogActiveWorkers[NVMDB_MAX_GROUP];
+
+static PACTreeOplogStats g_oplogStats;
+
+static std::mutex g_oplogStatsLock;
+
+SearchLayer *g_perTreeSlPtr[NVMDB_PACTREE_MAX_TREE_NUM][NVMDB_MAX_GROUP];
 
 std::set<ThreadData *> g_threadDataSet;
 
@@ -48,9 +58,7 @@ thread_local ThreadData *g_curThreadData = nullptr;
 
 volatile int PACTreeImpl::totalGroupActive = 0;
 
-volatile bool threadInitialized[NVMDB_MAX_GROUP];
-
-volatile bool slReady[NVMDB_MAX_GROUP];
+volatile bool workerReady[NVMDB_MAX_GROUP * NVMDB_OPLOG_WORKER_THREAD_PER_GROUP];
 
 std::mutex g_threadDataLock;
 
@@ -58,20 +66,19 @@ uint64_t g_removeCount;
 
 volatile std::atomic<bool> g_removeDetected;
 
-void workerThreadExec(int threadId, int activeGrp, root_obj *root) {
+// 已删除, 等待回收的树的槽位
+std::vector<uint32_t> g_droppedTrees;
+
+std::mutex g_droppedTreeLock;
+
+void workerThreadExec(int threadId, int activeGrp) {
     CHECK(activeGrp > 0);
     auto thread_name = std::string("PACTreeW_") + std::to_string(threadId);
     pthread_setname_np(pthread_self(), thread_name.c_str());
-    PACTreeImpl::SetThreadGroupId(threadId);
+    PACTreeImpl::SetThreadGroupId(threadId % activeGrp);
     WorkerThread wt(threadId, activeGrp);
     g_WorkerThreadInst[threadId] = &wt;
-    if (threadId < activeGrp) {
-        while (threadInitialized[threadId] == 0) { }
-        slReady[threadId] = false;
-        g_perGrpSlPtr[threadId] = PACTreeImpl::CreateSearchLayer(root, threadId);
-        g_perGrpSlPtr[threadId]->SetGroupId(threadId);
-        slReady[threadId] = true;
-    }
+    workerReady[threadId] = true;
     int count = 0;
     uint64_t lastRemoveCount = 0;
     while (!g_combinerStop) {
@@ -135,7 +142,43 @@ void BroadcastDoneCount(uint64_t removeCount) {
     g_removeCount = removeCount;
 }
 
-void CombinerThreadExec(int activeGrp) {
+/*
+ * 回收已删除的树. 先等待正在访问 PACTree 的用户线程退出当前操作, 此时它们产生的 oplog 都已进入
+ * 线程本地队列; 再把这些 oplog 下发并等待 worker 全部应用完, 之后不会再有线程访问这些树.
+ */
+static void ReclaimDroppedTrees(PACTreeImpl *pt, CombinerThread &ct, int activeGrp) {
+    std::vector<uint32_t> slots;
+    {
+        std::lock_guard<std::mutex> lockGuard(g_droppedTreeLock);
+        if (g_droppedTrees.empty()) {
+            return;
+        }
+        slots.swap(g_droppedTrees);
+    }
+    std::vector<ThreadData *> threadsToWait;
+    uint64_t gpStartTime = gracePeriodInit(threadsToWait);
+    waitForThreads(threadsToWait, gpStartTime);
+    std::vector<OpStruct *> *mergedLog = ct.combineLogs();
+    if (mergedLog != nullptr) {
+        ct.broadcastMergedLog(mergedLog, activeGrp);
+    }
+    ct.WaitForWorkers(activeGrp);
+    for (auto slot : slots) {
+        pt->FreeTree(slot);
+    }
+}
+
+void PublishPACTreeOplogStats(const PACTreeOplogStats &stats) {
+    std::lock_guard<std::mutex> lockGuard(g_oplogStatsLock);
+    g_oplogStats = stats;
+}
+
+PACTreeOplogStats GetPACTreeOplogStats() {
+    std::lock_guard<std::mutex> lockGuard(g_oplogStatsLock);
+    return g_oplogStats;
+}
+
+void CombinerThreadExec(int activeGrp, PACTreeImpl *pt) {
     pthread_setname_np(pthread_self(), "PACTreeCombiner");
     CombinerThread ct;
     int count = 0;
@@ -145,6 +188,8 @@ void CombinerThreadExec(int activeGrp) {
             count++;
             ct.broadcastMergedLog(mergedLog, activeGrp);
         }
+        ReclaimDroppedTrees(pt, ct, activeGrp);
+        ct.AdjustWorkers(activeGrp);
         uint64_t doneCountWt = ct.FreeMergedLogs(activeGrp, false);
         std::vector<ThreadData *> threadsToWait;
         if (g_removeDetected && doneCountWt != 0) {
@@ -171,18 +216,20 @@ void CombinerThreadExec(int activeGrp) {
     g_combinerStop = true;
 }
 
-void PACTreeImpl::CreateWorkerThread(int numGrp, root_obj *root) {
-    for (int i = 0; i < numGrp * NVMDB_OPLOG_WORKER_THREAD_PER_GROUP; i++) {
-        threadInitialized[i % numGrp] = false;
-        auto *wt = new std::thread(workerThreadExec, i, numGrp, root);
-        usleep(1);
+void PACTreeImpl::CreateWorkerThread(int numGrp) {
+    int workerNum = numGrp * NVMDB_OPLOG_WORKER_THREAD_PER_GROUP;
+    for (int i = 0; i < workerNum; i++) {
+        workerReady[i] = false;
+        auto *wt = new std::thread(workerThreadExec, i, numGrp);
         wtArray->push_back(wt);
-        threadInitialized[i % numGrp] = true;
+    }
+    for (int i = 0; i < workerNum; i++) {
+        while (!workerReady[i]) { }
     }
 }
 
 void PACTreeImpl::CreateCombinerThread() {
-    combinerThead = new std::thread(CombinerThreadExec, totalGroupActive);
+    combinerThead = new std::thread(CombinerThreadExec, totalGroupActive, this);
 }
 
 PACTreeImpl *InitPT() {
@@ -194,58 +241,62 @@ PACTreeImpl *InitPT() {
     int poolNum = PMem::GetPoolNum();
     if (isCreate == 0) {
         auto *pt = (PACTreeImpl *)pmemobj_direct(root->ptr[0]);
-        pt->Init(poolNum, sl_root);
+        CHECK(pt->IsCompatibleFormat()) << "Incompatible PACTree persistent format " << pt->GetFormatVersion()
+                                        << ", expected " << PACTREE_FORMAT_VERSION
+                                        << ". The data directory was created by an older NVMDB and must be rebuilt.";
+        pt->Init(poolNum);
         return pt;
     }
 
     auto *pop = (PMEMobjpool *)PMem::getBaseOf(1);
     pmemobj_alloc(pop, &(root->ptr[0]), sizeof(PACTreeImpl), 0, nullptr, nullptr);
     void *rootVirtAddr = pmemobj_direct(root->ptr[0]);
-    auto *pt = (PACTreeImpl *)new (rootVirtAddr) PACTreeImpl(poolNum, sl_root);
+    auto *pt = (PACTreeImpl *)new (rootVirtAddr) PACTreeImpl(poolNum);
     flushToNVM((char *)root, sizeof(root_obj));
     smp_wmb();
     return pt;
 }
 
-void PACTreeImpl::Init(int numGrp, root_obj *root) {
+void PACTreeImpl::StartThreads(int numGrp) {
     InitGlobalLogMgr();
     totalGroupActive = numGrp;
     wtArray = new std::vector<std::thread *>;
-    g_WorkerThreadInst.clear();
-    g_perGrpSlPtr.clear();
+    g_WorkerThreadInst.assign(NVMDB_MAX_GROUP * NVMDB_OPLOG_WORKER_THREAD_PER_GROUP, nullptr);
     g_threadDataSet.clear();
+    g_droppedTrees.clear();
+    for (auto &sls : g_perTreeSlPtr) {
+        std::fill(std::begin(sls), std::end(sls), nullptr);
+    }
+
+    for (auto &activeWorkers : g_oplogActiveWorkers) {
+        activeWorkers.store(CombinerThread::GetMinWorkers());
+    }
+    PublishPACTreeOplogStats(PACTreeOplogStats());
 
-    g_perGrpSlPtr.resize(totalGroupActive);
     g_globalStop = false;
     g_combinerStop = false;
-    CreateWorkerThread(numGrp, root);
+    CreateWorkerThread(numGrp);
     CreateCombinerThread();
-    for (int i = 0; i < totalGroupActive; i++) {
-        while (!slReady[i]) { }
-    }
+    HYDRALIST_RESET_TIMERS();
+}
+
+void PACTreeImpl::Init(int numGrp) {
+    StartThreads(numGrp);
+    OpenTrees();
     RegisterThread(0);
     Recover();
     UnregisterThread();
-    HYDRALIST_RESET_TIMERS();
 }
 
-PACTreeImpl::PACTreeImpl(int numGrp, root_obj *root) {
-    totalGroupActive = numGrp;
-    InitGlobalLogMgr();
-    wtArray = new std::vector<std::thread *>;
-    g_perGrpSlPtr.resize(totalGroupActive);
-    dl.Initialize();
-    // need to read from PM
-
-    g_globalStop = false;
-    g_combinerStop = false;
-
-    CreateWorkerThread(numGrp, root);
-    CreateCombinerThread();
-    for (int i = 0; i < totalGroupActive; i++) {
-        while (!slReady[i]) { }
+PACTreeImpl::PACTreeImpl(int numGrp) : formatMagic(PACTREE_FORMAT_MAGIC), formatVersion(PACTREE_FORMAT_VERSION) {
+    flushToNVM(reinterpret_cast<char *>(&formatMagic), sizeof(formatMagic) + sizeof(formatVersion));
+    for (auto &root : roots) {
+        root.treeId = 0;
+        root.state = PACTreeState::FREE;
     }
-    HYDRALIST_RESET_TIMERS();
+    flushToNVM(reinterpret_cast<char *>(roots), sizeof(roots));
+    smp_wmb();
+    StartThreads(numGrp);
 }
 
 PACTreeImpl::~PACTreeImpl() {
@@ -255,31 +306,150 @@ PACTreeImpl::~PACTreeImpl() {
     combinerThead->join();
 }
 
-ListNode *PACTreeImpl::getJumpNode(Key_t &key) {
+void PACTreeImpl::OpenTrees() {
+    int oldGrpId = g_threadGroupId;
+    for (uint32_t slot = 0; slot < NVMDB_PACTREE_MAX_TREE_NUM; slot++) {
+        PACTreeRoot &root = roots[slot];
+        if (root.state == PACTreeState::FREE) {
+            continue;
+        }
+        for (int grp = 0; grp < totalGroupActive; grp++) {
+            auto *sl = root.slPtr[grp].getVaddr();
+            if (sl == nullptr) {
+                // 回收过程中崩溃, 已经释放了的 search layer
+                DCHECK(root.state == PACTreeState::DROPPED);
+                continue;
+            }
+            SetThreadGroupId(grp);
+            sl->Init();
+            sl->SetGroupId(grp);
+            g_perTreeSlPtr[slot][grp] = sl;
+        }
+    }
+    SetThreadGroupId(oldGrpId);
+}
+
+uint32_t PACTreeImpl::CreateTree(uint32_t treeId) {
+    uint32_t slot = 0;
+    while (slot < NVMDB_PACTREE_MAX_TREE_NUM && roots[slot].state != PACTreeState::FREE) {
+        slot++;
+    }
+    if (slot == NVMDB_PACTREE_MAX_TREE_NUM) {
+        LOG(WARNING) << "Too many PACTrees, treeId: " << treeId;
+        return PACTREE_INVALID_SLOT;
+    }
+
+    PACTreeRoot &root = roots[slot];
+    root.treeId = treeId;
+    int oldGrpId = g_threadGroupId;
+    for (int grp = 0; grp < totalGroupActive; grp++) {
+        // search layer 分配在所属 group 的内存池中
+        SetThreadGroupId(grp);
+        PMEMoid oid;
+        PMem::alloc(sizeof(SearchLayer), (void **)&root.slPtr[grp], &oid);
+        auto *sl = new (root.slPtr[grp].getVaddr()) SearchLayer();
+        sl->SetGroupId(grp);
+        g_perTreeSlPtr[slot][grp] = sl;
+    }
+    SetThreadGroupId(oldGrpId);
+    root.dl.Initialize(slot);
+    flushToNVM(reinterpret_cast<char *>(&root), sizeof(PACTreeRoot));
+    smp_wmb();
+
+    // 最后才置为 ACTIVE, 创建过程中崩溃的槽位仍然是 FREE, 最多泄漏内存
+    root.state = PACTreeState::ACTIVE;
+    flushToNVM(reinterpret_cast<char *>(&root.state), sizeof(root.state));
+    smp_wmb();
+    return slot;
+}
+
+uint32_t PACTreeImpl::GetFreeSlotCount() const {
+    uint32_t count = 0;
+    for (uint32_t slot = 0; slot < NVMDB_PACTREE_MAX_TREE_NUM; slot++) {
+        if (roots[slot].state == PACTreeState::FREE) {
+            count++;
+        }
+    }
+    return count;
+}
+
+uint32_t PACTreeImpl::FindTree(uint32_t treeId) const {
+    for (uint32_t slot = 0; slot < NVMDB_PACTREE_MAX_TREE_NUM; slot++) {
+        if (roots[slot].state == PACTreeState::ACTIVE && roots[slot].treeId == treeId) {
+            return slot;
+        }
+    }
+    return PACTREE_INVALID_SLOT;
+}
+
+void PACTreeImpl::DetachTree(uint32_t slot) {
+    PACTreeRoot &root = roots[slot];
+    CHECK(root.state == PACTreeState::ACTIVE);
+    root.state = PACTreeState::DROPPED;
+    flushToNVM(reinterpret_cast<char *>(&root.state), sizeof(root.state));
+    smp_wmb();
+}
+
+void PACTreeImpl::DropTree(uint32_t slot) {
+    if (roots[slot].state == PACTreeState::ACTIVE) {
+        DetachTree(slot);
+    }
+    DCHECK(roots[slot].state == PACTreeState::DROPPED);
+
+    std::lock_guard<std::mutex> lockGuard(g_droppedTreeLock);
+    g_droppedTrees.push_back(slot);
+}
+
+void PACTreeImpl::FreeTree(uint32_t slot) {
+    PACTreeRoot &root = roots[slot];
+    DCHECK(root.state == PACTreeState::DROPPED);
+    for (int grp = 0; grp < NVMDB_MAX_GROUP; grp++) {
+        auto *sl = g_perTreeSlPtr[slot][grp];
+        if (sl == nullptr) {
+            continue;
+        }
+        // 先断开持久化指针再释放, 崩溃时最多泄漏内存, 不会重复释放
+        NVMPtr<SearchLayer> slPtr = root.slPtr[grp];
+        root.slPtr[grp] = NVMPtr<SearchLayer>();
+        flushToNVM(reinterpret_cast<char *>(&root.slPtr[grp]), sizeof(NVMPtr<SearchLayer>));
+        smp_wmb();
+        g_perTreeSlPtr[slot][grp] = nullptr;
+        sl->Destroy();
+        PMem::free((void *)slPtr.getRawPtr());
+    }
+    root.dl.Destroy();
+
+    root.state = PACTreeState::FREE;
+    flushToNVM(reinterpret_cast<char *>(&root.state), sizeof(root.state));
+    smp_wmb();
+}
+
+ListNode *PACTreeImpl::getJumpNode(uint32_t slot, Key_t &key) {
     int grpId = GetThreadGroupId();
     CHECK(grpId == NVMDB::GetCurrentGroupId());
-    SearchLayer &sl = *g_perGrpSlPtr[grpId];
+    SearchLayer &sl = *g_perTreeSlPtr[slot][grpId];
+    ListNode *head = roots[slot].dl.GetHead();
     if (sl.IsEmpty()) {
-        return dl.GetHead();
+        return head;
     }
     auto *jumpNode = reinterpret_cast<ListNode *>(sl.lookup(key));
     if (jumpNode == nullptr)
-        jumpNode = dl.GetHead();
+        jumpNode = head;
     return jumpNode;
 }
 
-bool PACTreeImpl::Insert(Key_t &key, Val_t val) {
+bool PACTreeImpl::Insert(uint32_t slot, Key_t &key, Val_t val, bool keepExisting) {
     uint64_t clock = ordo_get_clock();
     g_curThreadData->ReadLock(clock);
 
     bool ret;
     HYDRALIST_START_TIMER();
-    ListNode *jumpNode = getJumpNode(key);
+    ListNode *jumpNode = getJumpNode(slot, key);
 
     HYDRALIST_STOP_TIMER(ticks);
     HYDRALIST_START_TIMER();
     ACC_SL_TIME(ticks);
-    ret = dl.Insert(key, val, jumpNode);
+    ret = roots[slot].dl.Insert(key, val, jumpNode, keepExisting);
 
     HYDRALIST_STOP_TIMER(ticks);
     ACC_DL_TIME(ticks);
@@ -288,30 +458,17 @@ bool PACTreeImpl::Insert(Key_t &key, Val_t val) {
     return ret;
 }
 
-Val_t PACTreeImpl::Lookup(Key_t &key, bool *found) {
+Val_t PACTreeImpl::Lookup(uint32_t slot, Key_t &key, bool *found) {
     uint64_t clock = ordo_get_clock();
     g_curThreadData->ReadLock(clock);
     Val_t val;
 
-    ListNode *jumpNode = getJumpNode(key);
-    *found = dl.Lookup(key, val, jumpNode);
+    ListNode *jumpNode = getJumpNode(slot, key);
+    *found = roots[slot].dl.Lookup(key, val, jumpNode);
     g_curThreadData->ReadUnlock();
     return val;
 }
 
-SearchLayer *PACTreeImpl::CreateSearchLayer(root_obj *root, int threadId) {
-    // Read from Root Object or Allocate new one.
-    if (pmemobj_direct(root->ptr[threadId]) == nullptr) {
-        NVMPtr<SearchLayer> sPtr;
-        PMem::alloc(sizeof(SearchLayer), (void **)&sPtr, &(root->ptr[threadId]));
-        auto *s = new (sPtr.getVaddr()) SearchLayer();
-        return s;
-    }
-    auto *s = (SearchLayer *)pmemobj_direct(root->ptr[threadId]);
-    s->Init();
-    return s;
-}
-
 int PACTreeImpl::GetThreadGroupId() {
     if (g_threadGroupId == -1) {
         return 0;
@@ -324,7 +481,8 @@ void PACTreeImpl::SetThreadGroupId(int grpId) {
     g_threadGroupId = grpId;
 }
 
-void PACTreeImpl::Scan(Key_t &startKey,
+void PACTreeImpl::Scan(uint32_t slot,
+                       Key_t &startKey,
                        Key_t &endKey,
                        int maxRange,
                        LookupSnapshot snapshot,
@@ -334,8 +492,8 @@ void PACTreeImpl::Scan(Key_t &startKey,
         if (reverse) {
             CHECK(false);
         }
-        ListNode *jumpNode = getJumpNode(startKey);
-        if (dl.ScanInOrder(startKey, endKey, jumpNode, maxRange, snapshot, result)) {
+        ListNode *jumpNode = getJumpNode(slot, startKey);
+        if (roots[slot].dl.ScanInOrder(startKey, endKey, jumpNode, maxRange, snapshot, result)) {
             return;
         }
     }
@@ -361,8 +519,32 @@ void PACTreeImpl::UnregisterThread() {
 }
 
 void PACTreeImpl::Recover() {
-    for (int i = 0; i < totalGroupActive; i++) {
-        dl.Recover(g_perGrpSlPtr[i]);
+    for (auto &root : roots) {
+        if (root.state == PACTreeState::ACTIVE) {
+            root.dl.Recover();
+        }
+    }
+    // 所有树共享 oplog, 每个 group 只需遍历一遍, 按 oplog 记录的槽位找到对应的 search layer
+    for (int grp = 0; grp < totalGroupActive; grp++) {
+        for (int i = 0; i < NVMDB_NUM_LOGS_PER_THREAD * NVMDB_MAX_THREAD_NUM; i++) {
+            auto oplog = (OpStruct *)PMem::getOpLog(i);
+            if (oplog->op == OpStruct::done || oplog->op == OpStruct::dummy) {
+                continue;
+            }
+            DCHECK(oplog->treeSlot < NVMDB_PACTREE_MAX_TREE_NUM);
+            if (roots[oplog->treeSlot].state != PACTreeState::ACTIVE) {
+                // 树已经被删除, 不需要恢复
+                oplog->op = OpStruct::done;
+                continue;
+            }
+            LinkedList::RecoverOpLog(oplog, g_perTreeSlPtr[oplog->treeSlot][grp]);
+        }
+    }
+    // 上次运行中已删除但还没来得及回收的树
+    for (uint32_t slot = 0; slot < NVMDB_PACTREE_MAX_TREE_NUM; slot++) {
+        if (roots[slot].state == PACTreeState::DROPPED) {
+            FreeTree(slot);
+        }
     }
 }
 
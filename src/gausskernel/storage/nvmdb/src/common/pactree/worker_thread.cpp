@@ -3,30 +3,48 @@
 
 namespace NVMDB {
 
-extern std::vector<SearchLayer *> g_perGrpSlPtr;
+extern SearchLayer *g_perTreeSlPtr[NVMDB_PACTREE_MAX_TREE_NUM][NVMDB_MAX_GROUP];
 
 WorkerThread::WorkerThread(int id, int activeGrp) {
     this->workerThreadId = id;
     this->activeGrp = activeGrp;
     this->workQueue = &g_workQueue[workerThreadId];
     this->logDoneCount = 0;
-    this->opcount = 0;
     if (id == 0) {
         freeQueue = new std::queue<std::pair<uint64_t, void *>>();
     }
 }
 
+// 同一个数据节点的 insert 和 remove 使用相同的 key, 按 key 分片保证它们由同一个 worker 按顺序应用
+static inline int GetOplogShard(const Key_t &key, int shards) {
+    constexpr int leftOffset = 5;
+    constexpr int rightOffset = 27;
+    uint32_t hash = key.keyLength;
+    const char *str = key.getData();
+    for (uint32_t i = 0; i < key.keyLength; ++str, ++i) {
+        hash = ((hash << leftOffset) ^ (hash >> rightOffset)) ^ static_cast<uint8_t>(*str);
+    }
+    return static_cast<int>(hash % static_cast<uint32_t>(shards));
+}
+
 bool WorkerThread::ApplyOperation() {
     std::vector<OpStruct *> *oplog = workQueue->front();
     int grpId = workerThreadId % activeGrp;
-    SearchLayer *sl = g_perGrpSlPtr[grpId];
-    auto hash = static_cast<uint8_t>(workerThreadId / activeGrp);
+    int shard = workerThreadId / activeGrp;
+    int shards = g_oplogActiveWorkers[grpId].load(std::memory_order_acquire);
+    if (shard >= shards) {
+        // 当前没有被启用, 只推进消费进度
+        workQueue->pop();
+        logDoneCount++;
+        return true;
+    }
     for (auto opsPtr : *oplog) {
         OpStruct &ops = *opsPtr;
-        if (ops.hash != hash) {
+        if (shards > 1 && GetOplogShard(ops.key, shards) != shard) {
             continue;
         }
-        opcount++;
+        SearchLayer *sl = g_perTreeSlPtr[ops.treeSlot][grpId];
+        opcount.store(opcount.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
         if (ops.op == OpStruct::insert) {
             void *newNodePtr = reinterpret_cast<void *>((static_cast<unsigned long>(ops.poolId) << 48) | ops.newNodeOid.off);
             sl->Insert(ops.key, newNodePtr);
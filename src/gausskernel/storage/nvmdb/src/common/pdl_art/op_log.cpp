@@ -118,13 +118,14 @@ void Oplog::EnqPerThreadLog(OpStruct *ops) {
 }
 
 void Oplog::WriteOpLog(OpStruct *oplog, OpStruct::Operation op, const Key_t& key, void *oldNodeRawPtr, uint16_t poolId,
-                       const Key_t& newKey, Val_t newVal) {
+                       const Key_t& newKey, Val_t newVal, uint16_t treeSlot) {
     oplog->op = op;
     oplog->key = key;
     oplog->oldNodePtr = oldNodeRawPtr;  // should be persistent ptr
     oplog->poolId = poolId;
     oplog->newKey = newKey;
     oplog->newVal = newVal;
+    oplog->treeSlot = treeSlot;
     oplog->searchLayers = (1 << PMem::GetPoolNum()) - 1;
     oplog->step = OpStruct::initial;
 }
@@ -9,6 +9,17 @@ void Tree::Recover() {
     }
 }
 
+void Tree::Destroy() {
+    N *rootNode = root.getVaddr();
+    root = NVMPtr<N>();
+    flushToNVM(reinterpret_cast<char *>(&root), sizeof(NVMPtr<N>));
+    smp_wmb();
+    if (rootNode != nullptr) {
+        N::DeleteChildren(rootNode);
+        N::DeleteNode(rootNode);
+    }
+}
+
 Tree::Tree(LoadKeyFunction loadKey) : loadKey(loadKey) {
     NVMPtr<OpStruct> ologPtr;
     PMEMoid oid;
@@ -1,27 +1,110 @@
 #include "heap/nvm_heap.h"
+#include "heap/nvm_rowid_map.h"
+#include <algorithm>
+#include <condition_variable>
+#include <thread>
 
 namespace NVMDB {
 
+DEFINE_string(heap_tier_dir, "", "directory on ssd holding cold heap extents, empty disables heap tiering");
+DEFINE_int64(heap_tier_ssd_bytes, 1024LL * 1024 * 1024 * 1024, "max bytes of cold heap extents on ssd");
+DEFINE_int64(heap_tier_pmem_limit_bytes, 0, "heap pmem usage above which cold extents are spilled, 0 spills all cold extents");
+DEFINE_int32(heap_tier_interval_ms, 1000, "interval of the heap tiering rounds");
+DEFINE_int32(heap_tier_cold_rounds, 60, "tiering rounds an extent stays unaccessed before it is cold");
+
 TableSpace *g_heapSpace = nullptr;
+ColdExtentStore *g_heapColdStore = nullptr;
+
+static const char *HEAP_COLD_FILENAME = "heap.cold";
+
+// 每轮最多换出的 extent 数, 避免一轮占用 SSD 带宽过久
+static constexpr uint32 HEAP_TIER_MAX_EXTENTS_PER_ROUND = 256;
+
+static std::thread g_heapTierThread;
+static std::mutex g_heapTierMutex;
+static std::condition_variable g_heapTierCond;
+static bool g_heapTierStop = false;
+
+static void HeapOpenColdStore(bool init) {
+    if (FLAGS_heap_tier_dir.empty()) {
+        return;
+    }
+    const uint32 slotSize = GetPageCountPerExtent(EXT_SIZE_2M) * NVM_PAGE_SIZE;
+    const uint64 slotCount = FLAGS_heap_tier_ssd_bytes / slotSize;
+    CHECK(slotCount > 0 && slotCount < HEAP_COLD_EXTENT_FLAG) << "Invalid heap_tier_ssd_bytes";
+    g_heapColdStore = new ColdExtentStore(FLAGS_heap_tier_dir + "/" + HEAP_COLD_FILENAME, slotSize, slotCount, init);
+}
 
 // pass in all dirs, HEAP_FILENAME:"heap"
 // TableSpace is also a logical file
 void HeapCreate(const std::shared_ptr<DirectoryConfig>& dirConfig) {
     g_heapSpace = new TableSpace(dirConfig);
     g_heapSpace->create();
+    HeapOpenColdStore(true);
 }
 
 void HeapBootStrap(const std::shared_ptr<DirectoryConfig>& dirConfig) {
     g_heapSpace = new TableSpace(dirConfig);
     g_heapSpace->mount();
+    HeapOpenColdStore(false);
+}
+
+uint32 HeapTierOnce() {
+    g_heapTierClock.fetch_add(1, std::memory_order_relaxed);
+    uint32 maxExtents = HEAP_TIER_MAX_EXTENTS_PER_ROUND;
+    if (FLAGS_heap_tier_pmem_limit_bytes > 0) {
+        const uint64 used = GetHeapAllocatedBytes();
+        const uint64 limit = FLAGS_heap_tier_pmem_limit_bytes;
+        if (used <= limit) {
+            return 0;
+        }
+        const uint64 extentBytes = GetPageCountPerExtent(EXT_SIZE_2M) * NVM_PAGE_SIZE;
+        maxExtents = std::min<uint64>(maxExtents, (used - limit + extentBytes - 1) / extentBytes);
+    }
+    return SpillColdHeapExtents(FLAGS_heap_tier_cold_rounds, maxExtents);
+}
+
+void HeapStartTiering() {
+    if (g_heapColdStore == nullptr) {
+        return;
+    }
+    g_heapTierStop = false;
+    g_heapTierThread = std::thread([] {
+        std::unique_lock<std::mutex> lock(g_heapTierMutex);
+        while (!g_heapTierStop) {
+            g_heapTierCond.wait_for(lock, std::chrono::milliseconds(FLAGS_heap_tier_interval_ms),
+                                    [] { return g_heapTierStop; });
+            if (g_heapTierStop) {
+                break;
+            }
+            lock.unlock();
+            uint32 spilled = HeapTierOnce();
+            if (spilled != 0) {
+                LOG(INFO) << "NVMDB heap tiering spilled " << spilled << " cold extents to ssd.";
+            }
+            lock.lock();
+        }
+    });
 }
 
 void HeapExitProcess() {
+    if (g_heapTierThread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lockGuard(g_heapTierMutex);
+            g_heapTierStop = true;
+        }
+        g_heapTierCond.notify_all();
+        g_heapTierThread.join();
+    }
     if (g_heapSpace != nullptr) {
         g_heapSpace->unmount();
         delete g_heapSpace;
         g_heapSpace = nullptr;
     }
+    if (g_heapColdStore != nullptr) {
+        delete g_heapColdStore;
+        g_heapColdStore = nullptr;
+    }
 }
 
-}  // namespace NVMDB
\ No newline at end of file
+}  // namespace NVMDB
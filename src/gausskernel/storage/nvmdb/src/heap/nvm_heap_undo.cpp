@@ -6,17 +6,21 @@
 namespace NVMDB {
 static constexpr size_t UNDO_DATA_MAX_SIZE = MAX_UNDO_RECORD_CACHE_SIZE - NVMTupleHeadSize;
 
+/* [TxSlotPtr], 行在 undo 之后才写入, 崩溃回滚时行头中可能还是上一个版本的内容 */
 UndoRecPtr PrepareInsertUndo(Transaction *tx, uint32 segHead, RowId rowId, uint16 rowLen) {
     auto *undo = reinterpret_cast<UndoRecord *>(tx->undoRecordCache);
     undo->m_undoType = HeapInsertUndo;
     undo->m_rowLen = rowLen;
     undo->m_segHead = segHead;
     undo->m_rowId = rowId;
-    undo->m_payload = 0;
+    undo->m_payload = sizeof(TxSlotPtr);
     undo->m_pre = 0;
 #ifndef NDEBUG
     undo->m_txSlot = tx->GetTxSlotLocation();
 #endif
+    TxSlotPtr txSlot = tx->GetTxSlotLocation();
+    int ret = memcpy_s(undo->data, MAX_UNDO_RECORD_CACHE_SIZE, &txSlot, sizeof(txSlot));
+    SecureRetCheck(ret);
     UndoRecPtr undoPtr = tx->insertUndoRecord(undo);
     return undoPtr;
 }
@@ -93,22 +97,62 @@ UndoRecPtr PrepareDeleteUndo(Transaction *tx, uint32 segHead, RowId rowid, const
     return undoPtr;
 }
 
+/* [TxSlotPtr][count], 行内容在 undo 之后才写入, 回滚时不能依赖行头中的内容 */
+struct BulkInsertUndoData {
+    TxSlotPtr m_txSlot;
+    uint32 m_count;
+};
+
+UndoRecPtr PrepareBulkInsertUndo(Transaction *tx, uint32 segHead, RowId rowId, uint16 rowLen, uint32 count) {
+    auto *undo = reinterpret_cast<UndoRecord *>(tx->undoRecordCache);
+    undo->m_undoType = HeapBulkInsertUndo;
+    undo->m_rowLen = rowLen;
+    undo->m_segHead = segHead;
+    undo->m_rowId = rowId;
+    undo->m_payload = sizeof(BulkInsertUndoData);
+    undo->m_pre = 0;
+#ifndef NDEBUG
+    undo->m_txSlot = tx->GetTxSlotLocation();
+#endif
+    BulkInsertUndoData data = {tx->GetTxSlotLocation(), count};
+    int ret = memcpy_s(undo->data, MAX_UNDO_RECORD_CACHE_SIZE, &data, sizeof(data));
+    SecureRetCheck(ret);
+    UndoRecPtr undoPtr = tx->insertUndoRecord(undo);
+    return undoPtr;
+}
+
+/*
+ * 行标记为被回滚事务删除, 而不是只设置占用标记: 否则这一行永远不会被 VACUUM 回收, 行号也就不会再分配出去.
+ * 旧格式的 undo 没有 TxSlotPtr, 沿用行头中的事务信息.
+ */
 void UndoInsert(const UndoRecord *undo) {
     RowIdMap *rowidMap = GetRowIdMap(undo->m_segHead, undo->m_rowLen);
     RowIdMapEntry *row = rowidMap->GetEntry(undo->m_rowId, false);
-    row->Lock();
-    const auto setUsedFunc = [](char* addr) {
+    rowidMap->LockEntry(undo->m_rowId, row);
+    TxSlotPtr txSlot = 0;
+    const bool hasTxSlot = undo->m_payload == sizeof(txSlot);
+    if (hasTxSlot) {
+        int ret = memcpy_s(&txSlot, sizeof(txSlot), undo->data, sizeof(txSlot));
+        SecureRetCheck(ret);
+    }
+    const auto setDeletedFunc = [&](char* addr) {
         auto* tuple = reinterpret_cast<NVMTuple *>(addr);
+        if (hasTxSlot) {
+            tuple->m_txInfo = txSlot;
+            tuple->m_prev = InvalidUndoRecPtr;
+            tuple->m_dataSize = undo->m_rowLen;
+        }
         tuple->m_isUsed = true;
+        tuple->m_isDeleted = true;
     };
-    row->wrightThroughCache(setUsedFunc, NVMTupleHeadSize);
+    row->wrightThroughCache(setDeletedFunc, NVMTupleHeadSize);
     row->Unlock();
 }
 
 void UndoUpdate(const UndoRecord *undo) {
     RowIdMap *rowidMap = GetRowIdMap(undo->m_segHead, undo->m_rowLen);
     RowIdMapEntry *row = rowidMap->GetEntry(undo->m_rowId, false);
-    row->Lock();
+    rowidMap->LockEntry(undo->m_rowId, row);
     const auto nvmFunc = [&](char* addr) {
         auto ret = memcpy_s(addr, RealTupleSize(undo->m_rowLen), undo->data, NVMTupleHeadSize);
         SecureRetCheck(ret);
@@ -127,7 +171,7 @@ void UndoUpdate(const UndoRecord *undo, NVMTuple *tuple, char* rowData) {
 void UndoDelete(const UndoRecord *undo) {
     RowIdMap *rowidMap = GetRowIdMap(undo->m_segHead, undo->m_rowLen);
     RowIdMapEntry *row = rowidMap->GetEntry(undo->m_rowId, false);
-    row->Lock();
+    rowidMap->LockEntry(undo->m_rowId, row);
     const auto nvmFunc = [&](char* addr) {
         int ret = memcpy_s(addr, RealTupleSize(undo->m_rowLen), undo->data, undo->m_payload);
         SecureRetCheck(ret);
@@ -136,4 +180,30 @@ void UndoDelete(const UndoRecord *undo) {
     row->Unlock();
 }
 
+/*
+ * 整段重写行头: 崩溃时行内容可能还没写到 NVM, 所以不能像 UndoInsert 那样只设置占用标记.
+ * 行标记为被回滚事务删除: slot 回收之后仍然不可见, 并且可以被 VACUUM 回收.
+ */
+void UndoBulkInsert(const UndoRecord *undo) {
+    BulkInsertUndoData data{};
+    DCHECK(undo->m_payload == sizeof(data));
+    int ret = memcpy_s(&data, sizeof(data), undo->data, sizeof(data));
+    SecureRetCheck(ret);
+    RowIdMap *rowidMap = GetRowIdMap(undo->m_segHead, undo->m_rowLen);
+    const auto setHeadFunc = [&](char* addr) {
+        auto* tuple = reinterpret_cast<NVMTuple *>(addr);
+        tuple->m_txInfo = data.m_txSlot;
+        tuple->m_prev = InvalidUndoRecPtr;
+        tuple->m_isUsed = true;
+        tuple->m_isDeleted = true;
+        tuple->m_dataSize = undo->m_rowLen;
+    };
+    for (RowId rowId = undo->m_rowId; rowId < undo->m_rowId + data.m_count; rowId++) {
+        RowIdMapEntry *row = rowidMap->GetEntry(rowId, false);
+        rowidMap->LockEntry(rowId, row);
+        row->wrightThroughCache(setHeadFunc, NVMTupleHeadSize);
+        row->Unlock();
+    }
+}
+
 }  // namespace NVMDB
\ No newline at end of file
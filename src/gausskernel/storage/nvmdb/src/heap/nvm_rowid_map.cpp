@@ -1,11 +1,14 @@
 #include "heap/nvm_rowid_map.h"
 #include "heap/nvm_heap.h"
+#include "undo/nvm_undo_segment.h"
 #include <unordered_map>
+#include <vector>
 
 namespace NVMDB {
 
-DEFINE_int64(cache_size, 16384, "the max size of lru cache");
-DEFINE_int64(cache_elasticity, 64, "the elasticity of lru cache");
+thread_local uint64 g_heapNVMWriteBytes = 0;
+
+std::atomic<uint32> g_heapTierClock{0};
 
 /*
  * 这里的难点在于 extend 的时候，segments的指针会指向新的地址；而并发的读可能会读到旧的地址
@@ -66,16 +69,21 @@ RowIdMapEntry *RowIdMap::GetEntry(RowId rowId, bool isRead) {
     int segId = (int)rowId / RowIdMapSegmentLen;
     RowIdMapEntry *segment = GetSegment(segId);
     RowIdMapEntry *entry = &segment[rowId % RowIdMapSegmentLen];
+    if (m_extentTicks != nullptr) {
+        TouchExtent(rowId);
+    }
 
     if (!entry->IsValid()) {
-        char *nvmTuple = m_rowidMgr->getNVMTupleByRowId(rowId, false);
-        /* not valid row on nvm. */
-        if (nvmTuple == nullptr) {
-            DCHECK(isRead);
-            return nullptr;
-        }
+        // 持有行锁时查找 NVM 地址, 这时 extent 不会被换出, 查到的地址不会失效
         entry->Lock();  // init entry if not valid
         if (!entry->IsValid()) {
+            char *nvmTuple = m_rowidMgr->getNVMTupleByRowId(rowId, false);
+            /* not valid row on nvm. */
+            if (nvmTuple == nullptr) {
+                DCHECK(isRead);
+                entry->Unlock();
+                return nullptr;
+            }
             entry->Init(nvmTuple);
         }
         entry->Unlock();
@@ -84,6 +92,120 @@ RowIdMapEntry *RowIdMap::GetEntry(RowId rowId, bool isRead) {
     return entry;
 }
 
+bool RowIdMap::SpillExtent(uint32 leafExtentId) {
+    const uint32 tuplesPerExtent = m_rowidMgr->getTuplesPerExtent();
+    const RowId begin = leafExtentId * tuplesPerExtent;
+    const RowId end = begin + tuplesPerExtent;
+    // 按行号顺序 TryLock, 有行正在被访问时放弃, 不会和持有行锁的线程死锁
+    RowId locked = begin;
+    for (; locked < end; locked++) {
+        RowIdMapEntry *segment = GetSegment((int)locked / RowIdMapSegmentLen);
+        if (!segment[locked % RowIdMapSegmentLen].TryLock()) {
+            break;
+        }
+    }
+    const auto unlockAll = [&]() {
+        for (RowId rowId = begin; rowId < locked; rowId++) {
+            GetSegment((int)rowId / RowIdMapSegmentLen)[rowId % RowIdMapSegmentLen].Unlock();
+        }
+    };
+    if (locked != end || !m_rowidMgr->isExtentHot(leafExtentId) || !m_rowidMgr->isExtentFull(leafExtentId)) {
+        unlockAll();
+        return false;
+    }
+
+    /*
+     * 行的事务都已结束 (提交, 已回滚, 或者 slot 已回收) 时才换出. 已提交但没有写回 CSN 的行在这里写回,
+     * 读回之后的可见性判断不需要再读 tx slot.
+     */
+    for (RowId rowId = begin; rowId < end; rowId++) {
+        RowIdMapEntry *entry = &GetSegment((int)rowId / RowIdMapSegmentLen)[rowId % RowIdMapSegmentLen];
+        auto *tuple = reinterpret_cast<NVMTuple *>(m_rowidMgr->getNVMTupleByRowId(rowId, false));
+        if (!tuple->m_isUsed || TxInfoIsCSN(tuple->m_txInfo)) {
+            continue;
+        }
+        TransactionInfo txInfo{};
+        if (!GetTransactionInfo(static_cast<TxSlotPtr>(tuple->m_txInfo), &txInfo) ||
+            txInfo.status == TxSlotStatus::ROLL_BACKED) {
+            continue;
+        }
+        if (txInfo.status != TxSlotStatus::COMMITTED) {
+            unlockAll();
+            return false;
+        }
+        if (entry->IsValid()) {
+            entry->stampCSN(txInfo.csn);
+        } else {
+            tuple->m_txInfo = txInfo.csn;
+        }
+    }
+
+    const bool spilled = m_rowidMgr->spillExtent(leafExtentId);
+    if (spilled) {
+        for (RowId rowId = begin; rowId < end; rowId++) {
+            RowIdMapEntry *entry = &GetSegment((int)rowId / RowIdMapSegmentLen)[rowId % RowIdMapSegmentLen];
+            if (entry->IsValid()) {
+                entry->Invalidate();
+            }
+        }
+    }
+    unlockAll();
+    return spilled;
+}
+
+uint32 RowIdMap::SpillColdExtents(uint32 coldRounds, uint32 maxExtents) {
+    if (m_extentTicks == nullptr) {
+        return 0;
+    }
+    const uint32 clock = g_heapTierClock.load(std::memory_order_relaxed);
+    const uint32 maxExtentId = std::min(m_rowidMgr->getMaxLeafExtentId(), HEAP_MAX_LEAF_EXTENTS - 1);
+    uint32 spilled = 0;
+    for (uint32 extentId = 0; extentId <= maxExtentId && spilled < maxExtents; extentId++) {
+        if (clock - m_extentTicks[extentId].load(std::memory_order_relaxed) < coldRounds) {
+            continue;
+        }
+        if (m_rowidMgr->isExtentHot(extentId) && m_rowidMgr->isExtentFull(extentId) && SpillExtent(extentId)) {
+            spilled++;
+        }
+    }
+    return spilled;
+}
+
+void RowIdMap::DropCache(RowId begin, RowId end) {
+    for (RowId rowId = begin; rowId < end; rowId++) {
+        RowIdMapEntry *segment = GetSegment((int)rowId / RowIdMapSegmentLen);
+        RowIdMapEntry *entry = &segment[rowId % RowIdMapSegmentLen];
+        if (!entry->IsValid()) {
+            continue;
+        }
+        entry->Lock();
+        entry->clearCache();
+        entry->Unlock();
+    }
+}
+
+void RowIdMap::Truncate() {
+    std::lock_guard<std::mutex> lockGuard(m_mutex);
+    RowIdMapEntry **segments = m_segments.load();
+    for (int segId = 0; segId < m_segmentCapacity.load(); segId++) {
+        RowIdMapEntry *segment = segments[segId];
+        if (segment == nullptr) {
+            continue;
+        }
+        for (int i = 0; i < RowIdMapSegmentLen; i++) {
+            RowIdMapEntry *entry = &segment[i];
+            if (!entry->IsValid()) {
+                continue;
+            }
+            entry->Lock();
+            entry->Invalidate();
+            entry->Unlock();
+        }
+    }
+    m_rowidMgr->truncate();
+    m_vecStore->Reset();
+}
+
 static std::unordered_map<uint32, RowIdMap *> g_globalRowidMaps;
 static std::mutex g_grimMtx;
 thread_local std::unordered_map<uint32, RowIdMap *> g_localRowidMaps;
@@ -94,7 +216,7 @@ RowIdMap *GetRowIdMap(uint32 segHead, uint32 rowLen) {
         std::lock_guard<std::mutex> lockGuard(g_grimMtx);
         if (g_globalRowidMaps.find(segHead) == g_globalRowidMaps.end()) {
             // 为这张 table 创建 RowidMap, row id 为 table 中的行 id, 可以通过 row id 查找对应的 nvm tuple
-            g_globalRowidMaps[segHead] = new RowIdMap(g_heapSpace, segHead, rowLen);
+            g_globalRowidMaps[segHead] = new RowIdMap(g_heapSpace, segHead, rowLen, g_heapColdStore);
         }
         g_localRowidMaps[segHead] = g_globalRowidMaps[segHead];
     }
@@ -103,6 +225,36 @@ RowIdMap *GetRowIdMap(uint32 segHead, uint32 rowLen) {
     return result;
 }
 
+uint32 SpillColdHeapExtents(uint32 coldRounds, uint32 maxExtents) {
+    // 下沉要写 SSD, 不能持有 g_grimMtx, 否则所有线程第一次访问表时都要等它.
+    // RowIdMap 进程退出 (下沉线程已停止) 之前不会释放, 复制出来之后可以不加锁访问
+    std::vector<RowIdMap *> maps;
+    {
+        std::lock_guard<std::mutex> lockGuard(g_grimMtx);
+        maps.reserve(g_globalRowidMaps.size());
+        for (auto &entry : g_globalRowidMaps) {
+            maps.push_back(entry.second);
+        }
+    }
+    uint32 spilled = 0;
+    for (auto *map : maps) {
+        if (spilled >= maxExtents) {
+            break;
+        }
+        spilled += map->SpillColdExtents(coldRounds, maxExtents - spilled);
+    }
+    return spilled;
+}
+
+uint64 GetHeapAllocatedBytes() {
+    std::lock_guard<std::mutex> lockGuard(g_grimMtx);
+    uint64 bytes = 0;
+    for (auto &entry : g_globalRowidMaps) {
+        bytes += entry.second->GetAllocatedBytes();
+    }
+    return bytes;
+}
+
 void InitGlobalRowIdMapCache() {
     g_globalRowidMaps.clear();
 }
@@ -12,6 +12,18 @@ void RAMTuple::Serialize(char *buf, size_t bufLen) {
     SecureRetCheck(ret);
 }
 
+void RAMTuple::SerializeUpdatedCols(char *buf, size_t bufLen) {
+    m_nvmTuple.m_dataSize = m_rowLen;
+    int ret = memcpy_s(buf, bufLen, &m_nvmTuple, NVMTupleHeadSize);
+    SecureRetCheck(ret);
+    for (uint32 i = 0; i < m_updateCnt; i++) {
+        uint64 offset = NVMTupleHeadSize + m_updatedCols[i].m_colOffset;
+        ret = memcpy_s(buf + offset, bufLen - offset, m_rowData + m_updatedCols[i].m_colOffset,
+                       m_updatedCols[i].m_colLen);
+        SecureRetCheck(ret);
+    }
+}
+
 void RAMTuple::Deserialize(const char *nvmTuple) {
     int ret = memcpy_s(&m_nvmTuple, sizeof(m_nvmTuple), nvmTuple, NVMTupleHeadSize);
     SecureRetCheck(ret);
@@ -23,6 +35,20 @@ void RAMTuple::Deserialize(const char *nvmTuple) {
     SecureRetCheck(ret);
 }
 
+void RAMTuple::Deserialize(const char *nvmTuple, const UndoColumnDesc *cols, uint32 colCnt) {
+    int ret = memcpy_s(&m_nvmTuple, sizeof(m_nvmTuple), nvmTuple, NVMTupleHeadSize);
+    SecureRetCheck(ret);
+    if (!m_nvmTuple.m_isUsed) {
+        return;
+    }
+    DCHECK(m_rowLen == m_nvmTuple.m_dataSize);
+    for (uint32 i = 0; i < colCnt; i++) {
+        ret = memcpy_s(m_rowData + cols[i].m_colOffset, m_rowLen - cols[i].m_colOffset,
+                       nvmTuple + NVMTupleHeadSize + cols[i].m_colOffset, cols[i].m_colLen);
+        SecureRetCheck(ret);
+    }
+}
+
 void RAMTuple::FetchPreVersion(char* buffer) {
     DCHECK(!UndoRecPtrIsInValid(m_nvmTuple.m_prev));
     auto* undoRecordCache = reinterpret_cast<UndoRecord *>(buffer);
@@ -0,0 +1,249 @@
+#include "heap/nvm_tuple_cache.h"
+#include "heap/nvm_rowid_map.h"
+#include "nvmdb_thread.h"
+#include <cstdlib>
+#include <new>
+
+namespace NVMDB {
+
+DEFINE_int64(tuple_cache_bytes, 1024 * 1024 * 1024, "the dram budget of the instance-wide tuple cache");
+
+std::unique_ptr<TupleCache> TupleCache::g_tupleCache = nullptr;
+
+TupleCache::~TupleCache() {
+    // 不访问 owner, 调用者保证之后不再使用 entry 中的缓存指针
+    for (auto &sizeClass : m_classes) {
+        for (ChunkHeader *chunk : sizeClass.m_chunks) {
+            std::free(chunk);
+        }
+    }
+}
+
+TupleCache::Counters &TupleCache::GetLocalCounters() {
+    return m_counters[static_cast<size_t>(GetCurrentGroupId()) % NVMDB_MAX_GROUP];
+}
+
+char *TupleCache::Allocate(RowIdMapEntry *owner, uint32 size) {
+    DCHECK(size <= MAX_TUPLE_LEN);
+    const uint32 classId = GetClassId(size);
+    const uint32 slotSize = GetSlotSize(classId);
+    auto &sizeClass = m_classes[classId];
+    GetLocalCounters().m_misses.fetch_add(1, std::memory_order_relaxed);
+
+    std::lock_guard<std::mutex> guard(sizeClass.m_mutex);
+    // 超出预算时先在本级淘汰, 本级没有可淘汰的再去其他级; 都淘汰不掉时暂时超出预算
+    while (m_usedBytes.load(std::memory_order_relaxed) + slotSize > m_budgetBytes) {
+        if (!EvictOne(classId) && !EvictFromOthers(classId)) {
+            break;
+        }
+    }
+    if (sizeClass.m_partialChunks.empty()) {
+        // chunk 内存超出预算时先回收其他级的 chunk, 回收不到再复用本级的槽位; 都不行时暂时超出预算
+        if (m_chunkBytes.load(std::memory_order_relaxed) + CHUNK_SIZE > m_budgetBytes &&
+            !ReclaimChunkFromOthers(classId)) {
+            (void)EvictOne(classId);
+        }
+        if (sizeClass.m_partialChunks.empty()) {
+            AllocateChunk(classId);
+        }
+    }
+    ChunkHeader *chunk = sizeClass.m_partialChunks.back();
+    char *slot = chunk->m_freeList;
+    chunk->m_freeList = GetNextFreeSlot(slot);
+    chunk->m_usedSlots++;
+    if (chunk->m_freeList == nullptr) {
+        sizeClass.m_partialChunks.pop_back();
+        chunk->m_partialIndex = INVALID_INDEX;
+    }
+    m_usedBytes.fetch_add(slotSize, std::memory_order_relaxed);
+
+    auto *header = reinterpret_cast<SlotHeader *>(slot);
+    DCHECK(header->m_owner == nullptr && header->m_classId == classId);
+    header->m_owner = owner;
+    header->m_referenced.store(true, std::memory_order_relaxed);
+    header->m_ringIndex = static_cast<uint32>(sizeClass.m_ring.size());
+    sizeClass.m_ring.push_back(slot);
+    return slot + sizeof(SlotHeader);
+}
+
+void TupleCache::AllocateChunk(uint32 classId) {
+    auto &sizeClass = m_classes[classId];
+    // 只有 slab 增长时才申请内存
+    void *mem = std::aligned_alloc(CHUNK_SIZE, CHUNK_SIZE);
+    if (mem == nullptr) {
+        throw std::bad_alloc();
+    }
+    auto *chunk = new (mem) ChunkHeader();
+    chunk->m_freeList = nullptr;
+    chunk->m_usedSlots = 0;
+    for (uint64 i = GetSlotsPerChunk(classId); i > 0; i--) {
+        char *slot = GetSlot(chunk, classId, i - 1);
+        auto *header = new (slot) SlotHeader();
+        header->m_owner = nullptr;
+        header->m_classId = static_cast<uint16>(classId);
+        GetNextFreeSlot(slot) = chunk->m_freeList;
+        chunk->m_freeList = slot;
+    }
+    chunk->m_chunkIndex = static_cast<uint32>(sizeClass.m_chunks.size());
+    sizeClass.m_chunks.push_back(chunk);
+    chunk->m_partialIndex = static_cast<uint32>(sizeClass.m_partialChunks.size());
+    sizeClass.m_partialChunks.push_back(chunk);
+    m_chunkBytes.fetch_add(CHUNK_SIZE, std::memory_order_relaxed);
+}
+
+void TupleCache::ReleaseChunk(SizeClass &sizeClass, ChunkHeader *chunk) {
+    DCHECK(chunk->m_usedSlots == 0);
+    // 用最后一个 chunk 填补空位
+    ChunkHeader *last = sizeClass.m_chunks.back();
+    sizeClass.m_chunks[chunk->m_chunkIndex] = last;
+    last->m_chunkIndex = chunk->m_chunkIndex;
+    sizeClass.m_chunks.pop_back();
+    if (chunk->m_partialIndex != INVALID_INDEX) {
+        last = sizeClass.m_partialChunks.back();
+        sizeClass.m_partialChunks[chunk->m_partialIndex] = last;
+        last->m_partialIndex = chunk->m_partialIndex;
+        sizeClass.m_partialChunks.pop_back();
+    }
+    std::free(chunk);
+    m_chunkBytes.fetch_sub(CHUNK_SIZE, std::memory_order_relaxed);
+}
+
+void TupleCache::FreeSlot(SizeClass &sizeClass, SlotHeader *header, bool keepLastChunk) {
+    DCHECK(header->m_owner != nullptr);
+    const uint32 index = header->m_ringIndex;
+    DCHECK(sizeClass.m_ring[index] == reinterpret_cast<char *>(header));
+    char *last = sizeClass.m_ring.back();
+    sizeClass.m_ring[index] = last;
+    reinterpret_cast<SlotHeader *>(last)->m_ringIndex = index;
+    sizeClass.m_ring.pop_back();
+
+    header->m_owner = nullptr;
+    header->m_referenced.store(false, std::memory_order_relaxed);
+    m_usedBytes.fetch_sub(GetSlotSize(header->m_classId), std::memory_order_relaxed);
+
+    auto *slot = reinterpret_cast<char *>(header);
+    ChunkHeader *chunk = GetChunk(header);
+    GetNextFreeSlot(slot) = chunk->m_freeList;
+    chunk->m_freeList = slot;
+    if (chunk->m_partialIndex == INVALID_INDEX) {
+        chunk->m_partialIndex = static_cast<uint32>(sizeClass.m_partialChunks.size());
+        sizeClass.m_partialChunks.push_back(chunk);
+    }
+    chunk->m_usedSlots--;
+    if (chunk->m_usedSlots == 0 && (!keepLastChunk || sizeClass.m_chunks.size() > 1)) {
+        ReleaseChunk(sizeClass, chunk);
+    }
+}
+
+void TupleCache::Release(char *buf) {
+    auto *header = GetSlotHeader(buf);
+    auto &sizeClass = m_classes[header->m_classId];
+    std::lock_guard<std::mutex> guard(sizeClass.m_mutex);
+    FreeSlot(sizeClass, header);
+}
+
+void TupleCache::Touch(char *buf) {
+    auto *header = GetSlotHeader(buf);
+    // 已经置位时不再写, 避免热点 tuple 的 cache line 在线程间来回传递
+    if (!header->m_referenced.load(std::memory_order_relaxed)) {
+        header->m_referenced.store(true, std::memory_order_relaxed);
+    }
+    GetLocalCounters().m_hits.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool TupleCache::EvictOne(uint32 classId) {
+    auto &sizeClass = m_classes[classId];
+    const uint64 ringSize = sizeClass.m_ring.size();
+    // 最多扫两圈: 第一圈清除访问位; 命中时会并发地重新设置访问位, 第二圈不再看访问位, 只要 entry 能加锁就淘汰
+    for (uint64 i = 0; i < 2 * ringSize; i++) {
+        auto *header = reinterpret_cast<SlotHeader *>(sizeClass.m_ring[sizeClass.m_clockHand++ % ringSize]);
+        if (i < ringSize && header->m_referenced.load(std::memory_order_relaxed)) {
+            header->m_referenced.store(false, std::memory_order_relaxed);
+            continue;
+        }
+        RowIdMapEntry *owner = header->m_owner;
+        if (!owner->TryLock()) {
+            continue;   // entry 正在被使用 (也可能是调用者自己), 跳过
+        }
+        // owner 的锁和 slab 的锁都已持有, owner 不会同时归还这个槽位
+        owner->dropCache();
+        owner->Unlock();
+        FreeSlot(sizeClass, header);
+        GetLocalCounters().m_evictions.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+    return false;
+}
+
+bool TupleCache::EvictFromOthers(uint32 classId) {
+    for (uint32 i = 1; i < SIZE_CLASS_NUM; i++) {
+        const uint32 otherId = (classId + i) % SIZE_CLASS_NUM;
+        auto &other = m_classes[otherId];
+        std::unique_lock<std::mutex> lock(other.m_mutex, std::try_to_lock);
+        if (!lock.owns_lock()) {
+            continue;
+        }
+        if (EvictOne(otherId)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool TupleCache::ReclaimChunkFromOthers(uint32 classId) {
+    for (uint32 i = 1; i < SIZE_CLASS_NUM; i++) {
+        const uint32 otherId = (classId + i) % SIZE_CLASS_NUM;
+        auto &other = m_classes[otherId];
+        std::unique_lock<std::mutex> lock(other.m_mutex, std::try_to_lock);
+        if (!lock.owns_lock() || other.m_chunks.empty()) {
+            continue;
+        }
+        ChunkHeader *victim = other.m_chunks[0];
+        for (ChunkHeader *chunk : other.m_chunks) {
+            if (chunk->m_usedSlots < victim->m_usedSlots) {
+                victim = chunk;
+            }
+        }
+        if (victim->m_usedSlots == 0) {
+            ReleaseChunk(other, victim);
+            return true;
+        }
+        // 最后一个槽位淘汰后 victim 即被释放, 之后不能再访问
+        uint32 remaining = victim->m_usedSlots;
+        const uint64 slotsPerChunk = GetSlotsPerChunk(otherId);
+        for (uint64 j = 0; j < slotsPerChunk && remaining > 0; j++) {
+            auto *header = reinterpret_cast<SlotHeader *>(GetSlot(victim, otherId, j));
+            RowIdMapEntry *owner = header->m_owner;
+            if (owner == nullptr) {
+                continue;
+            }
+            if (!owner->TryLock()) {
+                break;  // entry 正在被使用, 这个 chunk 释放不掉
+            }
+            owner->dropCache();
+            owner->Unlock();
+            remaining--;
+            FreeSlot(other, header, false);
+            GetLocalCounters().m_evictions.fetch_add(1, std::memory_order_relaxed);
+        }
+        if (remaining == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+TupleCacheStats TupleCache::GetStats() const {
+    TupleCacheStats stats{};
+    for (const auto &counters : m_counters) {
+        stats.hits += counters.m_hits.load(std::memory_order_relaxed);
+        stats.misses += counters.m_misses.load(std::memory_order_relaxed);
+        stats.evictions += counters.m_evictions.load(std::memory_order_relaxed);
+    }
+    stats.usedBytes = m_usedBytes.load(std::memory_order_relaxed);
+    stats.chunkBytes = m_chunkBytes.load(std::memory_order_relaxed);
+    stats.budgetBytes = m_budgetBytes;
+    return stats;
+}
+
+}  // namespace NVMDB
@@ -2,14 +2,16 @@
 #include "heap/nvm_tuple.h"
 #include "heap/nvm_heap_cache.h"
 #include "nvmdb_thread.h"
+#include <algorithm>
 #include <memory>
 
 namespace NVMDB {
 
-VecStore::VecStore(TableSpace *tableSpace, uint32 segHead, uint32 tuplesPerExtent) {
+VecStore::VecStore(TableSpace *tableSpace, RowIDMgr *rowidMgr, uint32 segHead) {
     m_tableSpace = tableSpace;  // 可以通过 table space 搜索表
     m_segHead = segHead;    // 一张表的 segment head 对应的 page ID
-    m_tuplesPerExtent = tuplesPerExtent;   // 每个extent存的元组数量
+    m_rowidMgr = rowidMgr;
+    m_tuplesPerExtent = rowidMgr->getTuplesPerExtent();   // 每个extent存的元组数量
 
     // 一共有多少个目录
     auto spaceCount = m_tableSpace->getDirConfig()->size();
@@ -21,11 +23,25 @@ VecStore::VecStore(TableSpace *tableSpace, uint32 segHead, uint32 tuplesPerExten
         // 内存中, 每个目录初始化一个bit map 并置为0, 每个page一个bit
         m_gbm[i] = std::make_unique<GlobalBitMap>(pagesPerDir);
     }
+
+    // 按持久化的 FSM 标记已满的 extent, 分配行号时直接跳过
+    const uint32 maxExtentId = std::min(m_rowidMgr->getMaxLeafExtentId(), HEAP_MAX_LEAF_EXTENTS - 1);
+    for (uint32 extentId = 0; extentId <= maxExtentId; extentId++) {
+        if (m_rowidMgr->isExtentFull(extentId)) {
+            m_gbm[extentId % spaceCount]->SyncSet(extentId / spaceCount);
+        }
+    }
 }
 
-RowId VecStore::tryNextRowid() const {
+RowId VecStore::tryNextRowid() {
     // 在 table中锁定一个 extent (一组连续的pages), 用以写入数据
     auto *localTableCache = TLTableCache::GetThreadLocalTableCache(m_segHead);
+    const uint64 version = m_version.load(std::memory_order_acquire);
+    if (unlikely(localTableCache->m_version != version)) {
+        // 表被 TRUNCATE 过, 本地缓存的行号都已失效
+        *localTableCache = {};
+        localTableCache->m_version = version;
+    }
 
     // 1. 从 RowID Cache 中找，是否有自己之前删过的。
     RowId rid = localTableCache->m_rowidCache.pop();
@@ -33,21 +49,84 @@ RowId VecStore::tryNextRowid() const {
         return rid;
     }
 
+    // 2. 从 VACUUM 回收的行号中取一批到本地
+    if (m_freeCount.load(std::memory_order_relaxed) != 0) {
+        RowId rowIds[FREE_ROWID_FETCH_BATCH];
+        uint32 count = FetchFreeRowIds(rowIds, FREE_ROWID_FETCH_BATCH);
+        for (uint32 i = 1; i < count; i++) {
+            localTableCache->m_rowidCache.push_back(rowIds[i]);
+        }
+        if (count != 0) {
+            return rowIds[0];
+        }
+    }
+
     while (true) {
-        // 2. 从 Range 中找从来没有用过的。
+        // 3. 从 Range 中找从来没有用过的。
         rid = localTableCache->m_range.next();
         if (RowIdIsValid(rid)) {
             return rid;
         }
+        // 本线程的插入是串行的, 走到这里时 range 中最后一个行号也已经写入, 这个 extent 在 FSM 中标记为已满
+        RowId rangeEnd = localTableCache->m_range.end();
+        if (RowIdIsValid(rangeEnd)) {
+            m_rowidMgr->setExtentFull((rangeEnd - 1) / m_tuplesPerExtent);
+        }
 
-        // 3. 从 GlobalBitMap中分配一个新的Range
-        auto spaceCount = m_tableSpace->getDirConfig()->size();
-        uint32 dirSeq = GetCurrentGroupId() % spaceCount;
-        uint32 localBit = m_gbm[dirSeq]->SyncAcquire(); // 表分区对应的未用过的位
-        uint32 globalBit = dirSeq + spaceCount * localBit;    // 表全局对应的未用过的位
-        localTableCache->m_range.setRange(globalBit * m_tuplesPerExtent, (globalBit + 1) * m_tuplesPerExtent);
+        // 4. 从 GlobalBitMap中分配一个新的Range
+        RowId begin;
+        RowId end;
+        AcquireExtent(&begin, &end);
+        localTableCache->m_range.setRange(begin, end);
     }
     CHECK(false);
 }
 
-}  // namespace NVMDB
\ No newline at end of file
+void VecStore::AcquireExtent(RowId *begin, RowId *end) {
+    auto spaceCount = m_tableSpace->getDirConfig()->size();
+    uint32 dirSeq = GetCurrentGroupId() % spaceCount;
+    uint32 localBit = m_gbm[dirSeq]->SyncAcquire(); // 表分区对应的未用过的位
+    uint32 globalBit = dirSeq + spaceCount * localBit;    // 表全局对应的未用过的位
+    *begin = globalBit * m_tuplesPerExtent;
+    *end = (globalBit + 1) * m_tuplesPerExtent;
+}
+
+void VecStore::ReleaseRowIds(const std::vector<RowId> &rowIds) {
+    // 回收的行号只缓存在内存中, 清除对应 extent 的 FSM 位, 重启后这些 extent 会重新分配并探测出空行
+    uint32 lastExtentId = InvalidRowId;
+    for (RowId rowId : rowIds) {
+        uint32 extentId = rowId / m_tuplesPerExtent;
+        if (extentId != lastExtentId) {
+            m_rowidMgr->clearExtentFull(extentId);
+            lastExtentId = extentId;
+        }
+    }
+    std::lock_guard<std::mutex> lockGuard(m_freeMutex);
+    m_freeRowIds.insert(m_freeRowIds.end(), rowIds.begin(), rowIds.end());
+    m_freeCount.store(m_freeRowIds.size(), std::memory_order_relaxed);
+}
+
+uint32 VecStore::FetchFreeRowIds(RowId *rowIds, uint32 count) {
+    std::lock_guard<std::mutex> lockGuard(m_freeMutex);
+    uint32 fetched = 0;
+    while (fetched < count && !m_freeRowIds.empty()) {
+        rowIds[fetched++] = m_freeRowIds.back();
+        m_freeRowIds.pop_back();
+    }
+    m_freeCount.store(m_freeRowIds.size(), std::memory_order_relaxed);
+    return fetched;
+}
+
+void VecStore::Reset() {
+    for (auto &gbm : m_gbm) {
+        gbm->Reset();
+    }
+    {
+        std::lock_guard<std::mutex> lockGuard(m_freeMutex);
+        m_freeRowIds.clear();
+        m_freeCount.store(0, std::memory_order_relaxed);
+    }
+    m_version.fetch_add(1, std::memory_order_release);
+}
+
+}  // namespace NVMDB
@@ -1,32 +1,150 @@
 #include "index/nvm_index.h"
 
+#include <algorithm>
+#include <mutex>
+#include <string>
+#include <vector>
+
 namespace NVMDB {
 
-static PACTree *g_pt = nullptr;
+DEFINE_int64(analyze_index_sample_nodes, 1024, "max pactree data nodes read by ANALYZE to estimate distinct index keys");
+
+static PACTreeManager *g_ptMgr = nullptr;
+
+struct RetiredIndexTree {
+    PACTree *tree;
+    NVMIndex *index;
+    uint64 csn;
+};
+
+static std::mutex g_retiredTreeLock;
+static std::vector<RetiredIndexTree> g_retiredTrees;
 
 void IndexBootstrap() {
-    DCHECK(g_pt == nullptr);
-    g_pt = new PACTree();
+    DCHECK(g_ptMgr == nullptr);
+    g_ptMgr = new PACTreeManager();
+}
+
+PACTree *OpenIndexTree(IndexId id, bool useReserved) {
+    DCHECK(g_ptMgr != nullptr);
+    return g_ptMgr->CreateTree(id, useReserved);
 }
 
-PACTree *GetGlobalPACTree() {
-    DCHECK(g_pt != nullptr);
-    return g_pt;
+bool ReserveIndexTrees(uint32 count) {
+    DCHECK(g_ptMgr != nullptr);
+    return g_ptMgr->ReserveTrees(count);
+}
+
+void UnreserveIndexTrees(uint32 count) {
+    DCHECK(g_ptMgr != nullptr);
+    g_ptMgr->UnreserveTrees(count);
+}
+
+PACTree *GetIndexTree(IndexId id) {
+    DCHECK(g_ptMgr != nullptr);
+    return g_ptMgr->GetTree(id);
+}
+
+void DropIndexTree(IndexId id) {
+    DCHECK(g_ptMgr != nullptr);
+    g_ptMgr->DropTree(id);
+}
+
+void RetireIndexTree(IndexId id, NVMIndex *index, uint64 csn) {
+    DCHECK(g_ptMgr != nullptr);
+    PACTree *tree = g_ptMgr->DetachTree(id);
+    if (tree == nullptr && index == nullptr) {
+        return;
+    }
+    std::lock_guard<std::mutex> lockGuard(g_retiredTreeLock);
+    g_retiredTrees.push_back({tree, index, csn});
+}
+
+void ReclaimRetiredIndexTrees(uint64 minSnapshotCSN) {
+    std::vector<RetiredIndexTree> reclaimable;
+    {
+        std::lock_guard<std::mutex> lockGuard(g_retiredTreeLock);
+        auto iter = g_retiredTrees.begin();
+        while (iter != g_retiredTrees.end()) {
+            if (iter->csn < minSnapshotCSN) {
+                reclaimable.push_back(*iter);
+                iter = g_retiredTrees.erase(iter);
+            } else {
+                ++iter;
+            }
+        }
+    }
+    for (auto &retired : reclaimable) {
+        if (retired.tree != nullptr) {
+            g_ptMgr->ReleaseTree(retired.tree);
+        }
+        delete retired.index;
+    }
+}
+
+uint64 NVMIndex::AnalyzeDistinctKeys(LookupSnapshot snapshot) {
+    // 编码后的索引键都以列类型标记开头, 标记不会超过 CODE_VARCHAR, 这个范围之外只有链表首尾的哨兵 key
+    Key_t begin;
+    Key_t end;
+    char tag = CODE_ROWID;
+    begin.set(&tag, 1);
+    tag = CODE_VARCHAR + 1;
+    end.set(&tag, 1);
+
+    // 数据节点不超过采样上限时读取所有节点, 否则等间隔读取
+    const uint64 sampleNodes = std::max<int64>(FLAGS_analyze_index_sample_nodes, 1);
+    const uint64 nodes = m_tree->GetNodeCount();
+    const uint64 stride = (nodes + sampleNodes - 1) / sampleNodes;
+    ScanBuffer sample;
+    m_tree->sampleNodes(begin, end, std::max<uint64>(stride, 1), snapshot, sample);
+
+    // 样本按 key 有序, 同一个索引键的不同 rowid 相邻, 只需要和上一个 key 比较; 同时统计只出现一次的索引键个数
+    uint64 distinct = 0;
+    uint64 singles = 0;
+    uint64 run = 0;
+    const char *last = nullptr;
+    uint32 lastLen = 0;
+    for (size_t i = 0; i < sample.Size(); i++) {
+        DCHECK(sample.KeyLength(i) > KEY_EXTRA_LENGTH);
+        uint32 len = sample.KeyLength(i) - KEY_EXTRA_LENGTH;
+        if (last != nullptr && lastLen == len && memcmp(last, sample.KeyData(i), len) == 0) {
+            run++;
+            continue;
+        }
+        singles += run == 1 ? 1 : 0;
+        distinct++;
+        run = 1;
+        last = sample.KeyData(i);
+        lastLen = len;
+    }
+    singles += run == 1 ? 1 : 0;
+
+    if (stride > 1 && distinct > 0) {
+        // 按采样比例估计总 key 数, 用 Haas-Stokes 估计量 n*d / (n - f1 + f1*n/N) 外推, 结果在 [d, N] 之间
+        const double n = static_cast<double>(sample.Size());
+        const double total = n * static_cast<double>(stride);
+        const double estimate = n * distinct / (n - singles + singles * n / total);
+        distinct = static_cast<uint64>(std::min(std::max(estimate, static_cast<double>(distinct)), total) + 0.5);
+    }
+    m_distinctKeys.store(distinct, std::memory_order_relaxed);
+    return distinct;
 }
 
 void IndexExitProcess() {
-    delete g_pt;
-    g_pt = nullptr;
+    // 退出时不会再有事务访问, 剩下的树只标记删除, 下次启动时由 Recover 回收
+    ReclaimRetiredIndexTrees(UINT64_MAX);
+    delete g_ptMgr;
+    g_ptMgr = nullptr;
 }
 
 void InitLocalIndex(int grpId) {
-    DCHECK(g_pt != nullptr);
-    g_pt->registerThread(grpId);
+    DCHECK(g_ptMgr != nullptr);
+    g_ptMgr->registerThread(grpId);
 }
 
 void DestroyLocalIndex() {
-    DCHECK(g_pt != nullptr);
-    g_pt->unregisterThread();
+    DCHECK(g_ptMgr != nullptr);
+    g_ptMgr->unregisterThread();
 }
 
-}  // namespace NVMDB
\ No newline at end of file
+}  // namespace NVMDB
@@ -1,24 +1,85 @@
 #include "index/nvm_index_undo.h"
 
+#include <vector>
+
 namespace NVMDB {
+
+// 解析 undo 中的 [IndexId][Key_t], 返回索引对应的 PACTree; 索引已被删除时返回 nullptr
+static PACTree *DecodeIndexUndo(const UndoRecord *undo, Key_t *key) {
+    IndexId idxId;
+    DCHECK(undo->m_payload == sizeof(idxId) + sizeof(Key_t));
+    int ret = memcpy_s(&idxId, sizeof(idxId), undo->data, sizeof(idxId));
+    SecureRetCheck(ret);
+    ret = memcpy_s(key, sizeof(Key_t), undo->data + sizeof(idxId), sizeof(Key_t));
+    SecureRetCheck(ret);
+    return GetIndexTree(idxId);
+}
+
 void UndoIndexInsert(const UndoRecord *undo) {
     uint64 csn = undo->m_segHead;
     csn = (csn << BIS_PER_U32) | undo->m_rowId;
     Key_t key;
-    DCHECK(undo->m_payload == sizeof(Key_t));
-    int ret = memcpy_s(&key, sizeof(key), undo->data, undo->m_payload);
+    auto pt = DecodeIndexUndo(undo, &key);
+    if (pt != nullptr) {
+        pt->Insert(key, csn);
+    }
+}
+
+/*
+ * 重新读出行号区间中的行, 按 undo 中记录的索引列编码出键, 与 UndoIndexInsert 一样标记为在 csn 时删除.
+ * 回滚时先于对应的 HeapBulkInsertUndo 执行, 行内容还在.
+ */
+void UndoIndexBulkInsert(const UndoRecord *undo) {
+    uint64 csn = undo->m_segHead;
+    csn = (csn << BIS_PER_U32) | undo->m_rowId;
+    IndexBulkInsertUndoData head{};
+    int ret = memcpy_s(&head, sizeof(head), undo->data, sizeof(head));
     SecureRetCheck(ret);
-    auto pt = GetGlobalPACTree();
-    pt->Insert(key, csn);
+    DCHECK(undo->m_payload == sizeof(head) + head.m_colCnt * sizeof(IndexBulkUndoColumn));
+    auto pt = GetIndexTree(head.m_idxId);
+    if (pt == nullptr) {
+        return;
+    }
+
+    // 只描述索引列的行定义, 第 i 个索引列对应第 i 列
+    std::vector<ColumnDesc> rowDes(head.m_colCnt);
+    std::vector<IndexColumnDesc> indexDes(head.m_colCnt);
+    const char *colData = undo->data + sizeof(head);
+    for (uint32 i = 0; i < head.m_colCnt; i++) {
+        IndexBulkUndoColumn col{};
+        ret = memcpy_s(&col, sizeof(col), colData + i * sizeof(col), sizeof(col));
+        SecureRetCheck(ret);
+        rowDes[i].m_colType = static_cast<ColumnType>(col.m_colType);
+        rowDes[i].m_colLen = col.m_colLen;
+        rowDes[i].m_colOffset = col.m_colOffset;
+        indexDes[i].m_colId = i;
+    }
+    uint64 indexLen = 0;
+    InitIndexDesc(indexDes.data(), rowDes.data(), head.m_colCnt, indexLen);
+
+    DRAMIndexTuple indexTuple(rowDes.data(), indexDes.data(), head.m_colCnt, indexLen);
+    RowIdMap *rowidMap = GetRowIdMap(head.m_segHead, undo->m_rowLen);
+    const size_t tupleSize = RealTupleSize(undo->m_rowLen);
+    Key_t key;
+    for (RowId rowId = head.m_rowBegin; rowId < head.m_rowBegin + head.m_count; rowId++) {
+        RowIdMapEntry *row = rowidMap->GetEntry(rowId, false);
+        rowidMap->LockEntry(rowId, row);
+        const char *rowData = row->peekTuple(tupleSize) + NVMTupleHeadSize;
+        for (uint32 i = 0; i < head.m_colCnt; i++) {
+            indexTuple.SetCol(i, rowData + rowDes[i].m_colOffset, rowDes[i].m_colLen);
+        }
+        row->Unlock();
+        EncodeIndexKey(&indexTuple, &key, rowId);
+        pt->Insert(key, csn);
+    }
 }
 
 void UndoIndexDelete(const UndoRecord *undo) {
     Key_t key;
-    DCHECK(undo->m_payload == sizeof(Key_t));
-    int ret = memcpy_s(&key, sizeof(key), undo->data, undo->m_payload);
-    SecureRetCheck(ret);
-    auto pt = GetGlobalPACTree();
-    pt->Insert(key, INVALID_CSN);
+    auto pt = DecodeIndexUndo(undo, &key);
+    if (pt != nullptr) {
+        pt->Insert(key, INVALID_CSN);
+    }
 }
 
-}  // namespace NVMDB
\ No newline at end of file
+}  // namespace NVMDB
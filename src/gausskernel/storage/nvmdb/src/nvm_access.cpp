@@ -1,13 +1,68 @@
 #include "nvm_access.h"
 #include "heap/nvm_heap_undo.h"
 #include "heap/nvm_heap_cache.h"
+#include "nvmdb_thread.h"
+#include <libpmem.h>
+#include <algorithm>
 
 namespace NVMDB {
 
+DEFINE_bool(heap_delta_update, true, "only persist the tuple header and the updated columns on heap update");
+DEFINE_bool(heap_csn_stamp, true, "replace the tx slot pointer in a committed tuple header with its commit csn on read");
+DEFINE_bool(heap_bulk_load, true, "load COPY FROM rows through HeapBulkLoader instead of row by row inserts");
+DEFINE_int32(heap_parallel_scan_workers, 4, "worker threads of a parallel sequential scan, 1 disables parallel scan");
+DEFINE_int32(heap_parallel_scan_min_extents, 4, "minimum heap extents of a table to use parallel sequential scan");
+
+// 批量导入时一次写入 NVM 的行数据量, 以及每个索引排序插入前最多缓存的键数
+static constexpr size_t HEAP_BULK_STAGE_SIZE = 256 * 1024;
+static constexpr size_t INDEX_BULK_SORT_KEYS = 256 * 1024;
+
 static inline bool CheckTxStatus(const Transaction *tx) {
     return tx->GetTxStatus() == TxStatus::WAIT_ABORT;
 }
 
+/*
+ * 事务提交后 tuple header 中仍是 TxSlotPtr, 每次可见性判断都要去 (可能在远端 NUMA 节点的) undo segment 读 tx slot.
+ * 读到事务已提交时把提交 CSN 写回 header, 之后的可见性判断只需要和快照比较. 调用者需持有锁.
+ * 只处理已提交的 slot: 回滚的事务由 undo 恢复旧版本, 已回收的 slot 无法得知 CSN, 都保持原样.
+ */
+static void HeapStampCommittedCSN(RowIdMapEntry *rowEntry, const NVMTuple *header) {
+    if (!FLAGS_heap_csn_stamp || !header->m_isUsed || TxInfoIsCSN(header->m_txInfo)) {
+        return;
+    }
+    TransactionInfo txInfo{};
+    if (!GetTransactionInfo(static_cast<TxSlotPtr>(header->m_txInfo), &txInfo)) {
+        return;
+    }
+    if (txInfo.status == TxSlotStatus::COMMITTED) {
+        rowEntry->stampCSN(txInfo.csn);
+    }
+}
+
+/* 对已读出的 tuple 做可见性判断, 必要时沿 undo 链回溯到可见的旧版本 */
+static HamStatus HeapFetchVisibleVersion(const Transaction *tx, RAMTuple *tuple) {
+    if (!tuple->IsUsed()) {
+        return HamStatus::READ_ROW_NOT_USED;
+    }
+    while (true) {
+        TMResult result = tx->VersionIsVisible(tuple->getNVMTuple());
+        if (result == TMResult::OK || result == TMResult::SELF_UPDATED) {
+            if (tuple->IsDeleted()) {
+                return HamStatus::ROW_DELETED;
+            }
+            return HamStatus::OK;
+        }
+        if (result == TMResult::INVISIBLE || result == TMResult::ABORTED || result == TMResult::BEING_MODIFIED) {
+            if (!tuple->HasPreVersion()) {
+                return HamStatus::NO_VISIBLE_VERSION;
+            }
+            tuple->FetchPreVersion(tx->undoRecordCache);
+            continue;
+        }
+        CHECK(false) << "should not enter here!";
+    }
+}
+
 RowId HeapUpperRowId(const Table *table) {
     DCHECK(table->Ready());
     RowIdMap *rowIdMap = table->m_rowIdMap;
@@ -22,6 +77,7 @@ RowId HeapInsert(Transaction *tx, Table *table, RAMTuple *tuple) {
     }
 
     tx->PrepareUndo();
+    tx->EnterTable(table);
     DCHECK(table->Ready());
     RowIdMap *rowIdMap = table->m_rowIdMap;
 
@@ -31,7 +87,7 @@ RowId HeapInsert(Transaction *tx, Table *table, RAMTuple *tuple) {
 
     PrepareInsertUndo(tx, table->SegmentHead(), rowId, tuple->getRowLen());
 
-    rowEntry->Lock();
+    rowIdMap->LockEntry(rowId, rowEntry);
     // Write tuple to NVM; note marking head as used
     tuple->InitHead(tx->GetTxSlotLocation(), InvalidUndoRecPtr, true, false);
     // 如能写回DRAM cache, 写回 cache, 否则直接写入nvm
@@ -39,11 +95,12 @@ RowId HeapInsert(Transaction *tx, Table *table, RAMTuple *tuple) {
         tuple->Serialize(addr, RealTupleSize(tuple->getRowLen()));
     };
     rowEntry->wrightThroughCache(nvmFunc, RealTupleSize(tuple->getRowLen()));
-    // 写操作不需要加入到LRU
-    // TLTupleCache::Touch(table->SegmentHead(), rowId, rowEntry);
     rowEntry->Unlock();
 
     tx->PushWriteSet(rowEntry);
+    if (FLAGS_change_stream) {
+        tx->GetChangeBuffer()->AppendInsert(table->Id(), rowId, tuple);
+    }
     return rowId;
 }
 
@@ -60,33 +117,220 @@ HamStatus HeapRead(const Transaction *tx, const Table *table, RowId rowId, RAMTu
     }
 
     // 只读访问 dramCache
-    rowEntry->Lock();
-    // 读记录, 加入到LRU
-    TLTupleCache::Touch(table->SegmentHead(), rowId, rowEntry);
+    rowIdMap->LockEntry(rowId, rowEntry);
     const auto* dramCache = rowEntry->loadDRAMCache<char>(RealTupleSize(tuple->getRowLen()));
+    HeapStampCommittedCSN(rowEntry, reinterpret_cast<const NVMTuple *>(dramCache));
     tuple->Deserialize(dramCache);
     rowEntry->Unlock();
 
-    if (!tuple->IsUsed()) {
-        return HamStatus::READ_ROW_NOT_USED;
+    return HeapFetchVisibleVersion(tx, tuple);
+}
+
+HeapScanFilter::HeapScanFilter(const Table *table) : m_table(table) {}
+
+bool HeapScanFilter::AddQual(uint32 colId, Oper oper, const char *value) {
+    DCHECK(colId < m_table->GetColCount());
+    Qual qual{colId, oper, {}};
+    if (oper != Oper::IS_NULL && oper != Oper::IS_NOT_NULL) {
+        const ColumnDesc *desc = m_table->GetColDesc(colId);
+        switch (desc->m_colType) {
+            case COL_TYPE_TINY:
+            case COL_TYPE_SHORT:
+            case COL_TYPE_INT:
+            case COL_TYPE_LONG:
+            case COL_TYPE_UNSIGNED_LONG:
+            case COL_TYPE_DATE:
+            case COL_TYPE_TIME:
+            case COL_TYPE_TIMESTAMP:
+            case COL_TYPE_TIMESTAMPTZ:
+                break;
+            default:
+                // 浮点数的 NaN 和变长类型的排序规则与内存比较不一致, 不下推
+                return false;
+        }
+        DCHECK(value != nullptr && desc->m_colLen <= sizeof(qual.m_value));
+        int ret = memcpy_s(qual.m_value, sizeof(qual.m_value), value, desc->m_colLen);
+        SecureRetCheck(ret);
     }
-    while (true) {
-        TMResult result = tx->VersionIsVisible(tuple->getNVMTuple());
-        if (result == TMResult::OK || result == TMResult::SELF_UPDATED) {
-            if (tuple->IsDeleted()) {
-                return HamStatus::ROW_DELETED;
-            }
-            return HamStatus::OK;
+    m_quals.push_back(qual);
+    AddCopyColumn(colId);
+    return true;
+}
+
+void HeapScanFilter::SetProjection(const uint32 *colIds, uint32 colCnt) {
+    m_projected = true;
+    for (uint32 i = 0; i < colCnt; i++) {
+        DCHECK(colIds[i] < m_table->GetColCount());
+        AddCopyColumn(colIds[i]);
+    }
+}
+
+void HeapScanFilter::AddCopyColumn(uint32 colId) {
+    const ColumnDesc *desc = m_table->GetColDesc(colId);
+    m_copyCols.push_back({desc->m_colOffset, desc->m_colLen});
+    std::sort(m_copyCols.begin(), m_copyCols.end(), [](const UndoColumnDesc &a, const UndoColumnDesc &b) {
+        return a.m_colOffset < b.m_colOffset;
+    });
+    size_t merged = 0;
+    for (size_t i = 1; i < m_copyCols.size(); i++) {
+        UndoColumnDesc &last = m_copyCols[merged];
+        if (m_copyCols[i].m_colOffset <= last.m_colOffset + last.m_colLen) {
+            last.m_colLen = std::max(last.m_colLen, m_copyCols[i].m_colOffset + m_copyCols[i].m_colLen - last.m_colOffset);
+        } else {
+            m_copyCols[++merged] = m_copyCols[i];
         }
-        if (result == TMResult::INVISIBLE || result == TMResult::ABORTED || result == TMResult::BEING_MODIFIED) {
-            if (!tuple->HasPreVersion()) {
-                return HamStatus::NO_VISIBLE_VERSION;
+    }
+    m_copyCols.resize(merged + 1);
+}
+
+template <typename T>
+bool HeapScanFilter::Compare(Oper oper, const char *colData, const char *value) {
+    T lhs;
+    T rhs;
+    // tuple 中的列没有按类型对齐
+    int ret = memcpy_s(&lhs, sizeof(T), colData, sizeof(T));
+    SecureRetCheck(ret);
+    ret = memcpy_s(&rhs, sizeof(T), value, sizeof(T));
+    SecureRetCheck(ret);
+    switch (oper) {
+        case Oper::EQ:
+            return lhs == rhs;
+        case Oper::NE:
+            return lhs != rhs;
+        case Oper::LT:
+            return lhs < rhs;
+        case Oper::LE:
+            return lhs <= rhs;
+        case Oper::GT:
+            return lhs > rhs;
+        case Oper::GE:
+            return lhs >= rhs;
+        default:
+            CHECK(false) << "should not enter here!";
+    }
+    return false;
+}
+
+bool HeapScanFilter::Match(const NvmNullType &nullBitmap, const char *rowData) const {
+    for (const auto &qual : m_quals) {
+        bool isNull = nullBitmap[qual.m_colId];
+        if (qual.m_oper == Oper::IS_NULL || qual.m_oper == Oper::IS_NOT_NULL) {
+            if (isNull != (qual.m_oper == Oper::IS_NULL)) {
+                return false;
             }
-            tuple->FetchPreVersion(tx->undoRecordCache);
             continue;
         }
-        CHECK(false) << "should not enter here!";
+        // 和 NULL 比较的结果不为真
+        if (isNull) {
+            return false;
+        }
+        const ColumnDesc *desc = m_table->GetColDesc(qual.m_colId);
+        const char *colData = rowData + desc->m_colOffset;
+        bool match = false;
+        switch (desc->m_colType) {
+            case COL_TYPE_TINY:
+                match = Compare<uint8>(qual.m_oper, colData, qual.m_value);
+                break;
+            case COL_TYPE_SHORT:
+                match = Compare<int16_t>(qual.m_oper, colData, qual.m_value);
+                break;
+            case COL_TYPE_INT:
+            case COL_TYPE_DATE:
+                match = Compare<int32>(qual.m_oper, colData, qual.m_value);
+                break;
+            case COL_TYPE_LONG:
+            case COL_TYPE_TIME:
+            case COL_TYPE_TIMESTAMP:
+            case COL_TYPE_TIMESTAMPTZ:
+                match = Compare<int64>(qual.m_oper, colData, qual.m_value);
+                break;
+            case COL_TYPE_UNSIGNED_LONG:
+                match = Compare<uint64>(qual.m_oper, colData, qual.m_value);
+                break;
+            default:
+                CHECK(false) << "should not enter here!";
+        }
+        if (!match) {
+            return false;
+        }
     }
+    return true;
+}
+
+void HeapScanFilter::Deserialize(RAMTuple *tuple, const char *nvmTuple) const {
+    if (!m_projected) {
+        tuple->Deserialize(nvmTuple);
+        return;
+    }
+    tuple->Deserialize(nvmTuple, m_copyCols.data(), static_cast<uint32>(m_copyCols.size()));
+}
+
+/*
+ * 当前版本对 tx 可见时, 直接在 tuple 缓存上判断过滤条件, 返回 true 表示这一行不需要拷贝. 调用者需持有锁.
+ * 当前版本不可见时需要沿 undo 链回溯, 返回 false, 由调用者拷贝并找到可见版本后再判断.
+ */
+static bool HeapFilterSkipRow(const Transaction *tx, const NVMTuple *header, const HeapScanFilter *filter) {
+    if (!header->m_isUsed) {
+        return true;
+    }
+    TMResult result = tx->VersionIsVisible(*header);
+    if (result != TMResult::OK && result != TMResult::SELF_UPDATED) {
+        return false;
+    }
+    return header->m_isDeleted || !filter->Match(header->m_nullBitmap, header->m_data);
+}
+
+uint32 HeapReadBatch(const Transaction *tx, const Table *table, RowId *cursor, RowId end,
+                     RAMTuple **tuples, RowId *rowIds, uint32 batchSize, const HeapScanFilter *filter) {
+    DCHECK(cursor != nullptr && tuples != nullptr && rowIds != nullptr);
+    if (CheckTxStatus(tx)) {
+        *cursor = end;
+        return 0;
+    }
+
+    RowIdMap *rowIdMap = table->m_rowIdMap;
+    const size_t tupleSize = RealTupleSize(table->GetRowLen());
+    uint32 count = 0;
+    RowId rowId = *cursor;
+    RowIdMapEntry *nextEntry = rowId < end ? rowIdMap->GetEntry(rowId, true) : nullptr;
+    while (rowId < end && count < batchSize) {
+        RowIdMapEntry *rowEntry = nextEntry;
+        // 提前取下一行的 entry, 并预取其 NVM 上的 tuple 头
+        nextEntry = rowId + 1 < end ? rowIdMap->GetEntry(rowId + 1, true) : nullptr;
+        if (nextEntry != nullptr) {
+            __builtin_prefetch(nextEntry->getNVMAddr(), 0, 0);
+        }
+        if (rowEntry == nullptr) {
+            rowId++;
+            continue;
+        }
+
+        RAMTuple *tuple = tuples[count];
+        DCHECK(table->m_rowLen == tuple->getRowLen());
+        rowIdMap->LockEntry(rowId, rowEntry);
+        HeapStampCommittedCSN(rowEntry, reinterpret_cast<const NVMTuple *>(rowEntry->peekTuple(tupleSize)));
+        const char *nvmTuple = rowEntry->peekTuple(tupleSize);
+        if (filter == nullptr) {
+            tuple->Deserialize(nvmTuple);
+        } else if (HeapFilterSkipRow(tx, reinterpret_cast<const NVMTuple *>(nvmTuple), filter)) {
+            rowEntry->Unlock();
+            rowId++;
+            continue;
+        } else {
+            filter->Deserialize(tuple, nvmTuple);
+        }
+        rowEntry->Unlock();
+
+        // 可见版本可能是回溯到的旧版本, 拷贝后再判断一次过滤条件
+        if (HeapFetchVisibleVersion(tx, tuple) == HamStatus::OK &&
+            (filter == nullptr || filter->Match(tuple->getNVMTuple().m_nullBitmap, tuple->getRowData()))) {
+            rowIds[count] = rowId;
+            count++;
+        }
+        rowId++;
+    }
+    *cursor = rowId;
+    return count;
 }
 
 HamStatus HeapUpdate(Transaction *tx, Table *table, RowId rowId, RAMTuple *tuple) {
@@ -96,12 +340,11 @@ HamStatus HeapUpdate(Transaction *tx, Table *table, RowId rowId, RAMTuple *tuple
     }
 
     tx->PrepareUndo();
+    tx->EnterTable(table);
     RowIdMap *rowIdMap = table->m_rowIdMap;
     RowIdMapEntry *rowEntry = rowIdMap->GetEntry(rowId, false);
 
-    rowEntry->Lock();
-    // 更新时读记录, 加入到LRU
-    TLTupleCache::Touch(table->SegmentHead(), rowId, rowEntry);
+    rowIdMap->LockEntry(rowId, rowEntry);
     const auto* dramCache = rowEntry->loadDRAMCache<NVMTuple>(RealTupleSize(tuple->getRowLen()));
     TMResult result = tx->SatisfiedUpdate(*dramCache);
     if (result == TMResult::INVISIBLE || result == TMResult::BEING_MODIFIED) {
@@ -131,11 +374,20 @@ HamStatus HeapUpdate(Transaction *tx, Table *table, RowId rowId, RAMTuple *tuple
 
     // inplace update
     auto* dramCacheAddr = rowEntry->loadDRAMCache<char>(RealTupleSize(tuple->getRowLen()));
-    tuple->Serialize(dramCacheAddr, RealTupleSize(table->GetRowLen()));
-    rowEntry->flushToNVM();
+    if (FLAGS_heap_delta_update && updateCnt != 0) {
+        // 只写回 header 和被更新的列, 其余列与 undo 中记录的旧值一致, 不需要重写
+        tuple->SerializeUpdatedCols(dramCacheAddr, RealTupleSize(table->GetRowLen()));
+        rowEntry->flushColumnsToNVM(updatedCols, updateCnt);
+    } else {
+        tuple->Serialize(dramCacheAddr, RealTupleSize(table->GetRowLen()));
+        rowEntry->flushToNVM();
+    }
     rowEntry->Unlock();
 
     tx->PushWriteSet(rowEntry);
+    if (FLAGS_change_stream) {
+        tx->GetChangeBuffer()->AppendUpdate(table->Id(), rowId, tuple, updatedCols, updateCnt);
+    }
     return HamStatus::OK;
 }
 
@@ -145,12 +397,11 @@ HamStatus HeapDelete(Transaction *tx, Table *table, RowId rowId) {
     }
 
     tx->PrepareUndo();
+    tx->EnterTable(table);
     RowIdMap *rowIdMap = table->m_rowIdMap;
     RowIdMapEntry *rowEntry = rowIdMap->GetEntry(rowId, false);
 
-    rowEntry->Lock();
-    // 删除时读记录, 加入到LRU
-    TLTupleCache::Touch(table->SegmentHead(), rowId, rowEntry);
+    rowIdMap->LockEntry(rowId, rowEntry);
     auto* dramCache = rowEntry->loadDRAMCache<NVMTuple>(RealTupleSize(table->GetRowLen()));
     TMResult result = tx->SatisfiedUpdate(*dramCache);
     if (result == TMResult::INVISIBLE || result == TMResult::BEING_MODIFIED) {
@@ -176,7 +427,383 @@ HamStatus HeapDelete(Transaction *tx, Table *table, RowId rowId) {
     rowEntry->Unlock();
 
     tx->PushWriteSet(rowEntry);
+    if (FLAGS_change_stream) {
+        tx->GetChangeBuffer()->AppendDelete(table->Id(), rowId);
+    }
     return HamStatus::OK;
 }
 
+void HeapTruncate(Table *table) {
+    DCHECK(table->Ready());
+    table->m_rowIdMap->Truncate();
+}
+
+uint64 HeapVacuum(const Transaction *tx, Table *table) {
+    DCHECK(table->Ready());
+    RowIdMap *rowIdMap = table->m_rowIdMap;
+    const size_t tupleSize = RealTupleSize(table->GetRowLen());
+    const RowId upper = rowIdMap->getUpperRowId();
+    const uint32 tuplesPerExtent = rowIdMap->GetTuplesPerExtent();
+    std::vector<RowId> reclaimed;
+    for (RowId rowId = 0; rowId < upper; rowId++) {
+        // 换出到 SSD 的 extent 不读回, 其中已删除的行等 extent 被访问读回之后再回收
+        if (rowId % tuplesPerExtent == 0 && rowIdMap->IsExtentCold(rowId / tuplesPerExtent)) {
+            rowId += tuplesPerExtent - 1;
+            continue;
+        }
+        RowIdMapEntry *rowEntry = rowIdMap->GetEntry(rowId, true);
+        if (rowEntry == nullptr) {
+            continue;
+        }
+        rowIdMap->LockEntry(rowId, rowEntry);
+        const auto *tuple = reinterpret_cast<const NVMTuple *>(rowEntry->peekTuple(tupleSize));
+        if (tuple->m_isUsed && tuple->m_isDeleted && tx->VersionIsFrozen(*tuple)) {
+            // 先清除 FSM 位再回收: 崩溃后这个 extent 会在重启时重新分配并探测出空行; 反过来回收的行会被永远跳过
+            if (reclaimed.empty() || reclaimed.back() / tuplesPerExtent != rowId / tuplesPerExtent) {
+                rowIdMap->ClearExtentFull(rowId);
+            }
+            rowEntry->Reclaim();
+            reclaimed.push_back(rowId);
+        }
+        rowEntry->Unlock();
+    }
+    rowIdMap->ReleaseRowIds(reclaimed);
+    return reclaimed.size();
+}
+
+uint64 HeapAllocatedBytes(const Table *table) {
+    DCHECK(table->Ready());
+    return table->m_rowIdMap->GetAllocatedBytes();
+}
+
+// 当前线程创建的, 还没有析构的并行扫描
+static thread_local std::vector<HeapParallelScan *> t_parallelScans;
+
+HeapParallelScan::HeapParallelScan(const Transaction *tx, const Table *table, uint32 workerNum,
+                                   const HeapScanFilter *filter)
+    : m_tx(tx), m_table(table), m_filter(filter), m_upper(HeapUpperRowId(table)),
+      m_rangeRows(table->m_rowIdMap->GetTuplesPerExtent()) {
+    DCHECK(workerNum > 0);
+    DCHECK(!tx->HasWrites());
+    const uint64 rowLen = table->GetRowLen();
+    // 每个工作线程一个正在填充的 batch, 队列中最多再积压一轮, 另外两个由调用者持有
+    const uint32 batchNum = workerNum * 2 + 2;
+    for (uint32 i = 0; i < batchNum; i++) {
+        auto batch = std::make_unique<Batch>();
+        batch->m_rowData = std::make_unique<char[]>(rowLen * BATCH_SIZE);
+        for (uint32 j = 0; j < BATCH_SIZE; j++) {
+            batch->m_tuples[j] = new RAMTuple(table->GetColDesc(), rowLen, batch->m_rowData.get() + j * rowLen);
+        }
+        m_free.push_back(batch.get());
+        m_batches.push_back(std::move(batch));
+    }
+    m_runningWorkers = workerNum;
+    for (uint32 i = 0; i < workerNum; i++) {
+        m_workers.emplace_back(&HeapParallelScan::WorkerMain, this);
+    }
+    t_parallelScans.push_back(this);
+}
+
+HeapParallelScan::~HeapParallelScan() {
+    Stop();
+    t_parallelScans.erase(std::find(t_parallelScans.begin(), t_parallelScans.end(), this));
+    for (auto &batch : m_batches) {
+        for (auto *tuple : batch->m_tuples) {
+            delete tuple;
+        }
+    }
+}
+
+void HeapParallelScan::Stop() {
+    {
+        std::lock_guard<std::mutex> lockGuard(m_mutex);
+        m_stop = true;
+    }
+    m_freeCond.notify_all();
+    for (auto &worker : m_workers) {
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+}
+
+void StopHeapParallelScans() {
+    for (auto *scan : t_parallelScans) {
+        scan->Stop();
+    }
+}
+
+bool HeapParallelScan::NextRange(RowId *begin, RowId *end) {
+    const uint64 rangeBegin = m_nextRange.fetch_add(m_rangeRows, std::memory_order_relaxed);
+    if (rangeBegin >= m_upper) {
+        return false;
+    }
+    *begin = static_cast<RowId>(rangeBegin);
+    *end = static_cast<RowId>(std::min<uint64>(rangeBegin + m_rangeRows, m_upper));
+    return true;
+}
+
+HeapParallelScan::Batch *HeapParallelScan::AcquireFreeBatch() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_freeCond.wait(lock, [this] { return m_stop || !m_free.empty(); });
+    if (m_stop) {
+        return nullptr;
+    }
+    Batch *batch = m_free.back();
+    m_free.pop_back();
+    return batch;
+}
+
+void HeapParallelScan::WorkerMain() {
+    InitThreadLocalStorage();
+    {
+        // 共用 leader 的 ProcessArray 槽位, leader 在所有工作线程结束之前不会结束事务
+        Transaction tx(m_tx);
+        RowId begin;
+        RowId end;
+        Batch *batch = nullptr;
+        bool stopped = false;
+        while (!stopped && NextRange(&begin, &end)) {
+            RowId cursor = begin;
+            while (cursor < end) {
+                if (batch == nullptr && (batch = AcquireFreeBatch()) == nullptr) {
+                    stopped = true;
+                    break;
+                }
+                batch->m_count = HeapReadBatch(&tx, m_table, &cursor, end, batch->m_tuples, batch->m_rowIds,
+                                               BATCH_SIZE, m_filter);
+                if (batch->m_count == 0) {
+                    continue;
+                }
+                {
+                    std::lock_guard<std::mutex> lockGuard(m_mutex);
+                    m_ready.push_back(batch);
+                }
+                m_readyCond.notify_one();
+                batch = nullptr;
+            }
+        }
+        std::lock_guard<std::mutex> lockGuard(m_mutex);
+        if (batch != nullptr) {
+            m_free.push_back(batch);
+        }
+        m_runningWorkers--;
+        tx.EndWithSnapshot();
+    }
+    m_readyCond.notify_all();
+    DestroyThreadLocalStorage();
+}
+
+uint32 HeapParallelScan::NextBatch(RAMTuple ***tuples, RowId **rowIds) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_previous != nullptr) {
+        m_free.push_back(m_previous);
+        m_freeCond.notify_one();
+    }
+    m_previous = m_current;
+    m_current = nullptr;
+    m_readyCond.wait(lock, [this] { return !m_ready.empty() || m_runningWorkers == 0; });
+    if (m_ready.empty()) {
+        return 0;
+    }
+    m_current = m_ready.front();
+    m_ready.pop_front();
+    *tuples = m_current->m_tuples;
+    *rowIds = m_current->m_rowIds;
+    return m_current->m_count;
+}
+
+bool HeapParallelScanEnabled(const Transaction *tx, const Table *table) {
+    if (FLAGS_heap_parallel_scan_workers <= 1 || tx->HasWrites()) {
+        return false;
+    }
+    const uint64 minRows = static_cast<uint64>(std::max(FLAGS_heap_parallel_scan_min_extents, 1)) *
+                           table->m_rowIdMap->GetTuplesPerExtent();
+    return HeapUpperRowId(table) >= minRows;
+}
+
+// 键排序后按键序插入, 相邻的键落在同一个数据节点
+static void HeapInsertIndexKeys(NVMIndex *index, std::vector<Key_t> *keys) {
+    std::sort(keys->begin(), keys->end());
+    for (auto &key : *keys) {
+        index->InsertKeyIfAbsent(key);
+    }
+    keys->clear();
+}
+
+bool HeapBuildIndexOnline(const Transaction *tx, Table *table, NVMIndex *index) {
+    DCHECK(table->Ready());
+    if (tx != nullptr && tx->HasEnteredTable(table)) {
+        return false;
+    }
+    index->SetBuilding();
+    table->AddIndex(index);
+    table->WaitForOldWriters();
+
+    Transaction buildTx;
+    buildTx.Begin();
+    const IndexColumnDesc *indexDesc = index->GetIndexDesc();
+    std::vector<uint32> colIds(index->GetColCount());
+    for (uint32 i = 0; i < index->GetColCount(); i++) {
+        colIds[i] = indexDesc[i].m_colId;
+    }
+    HeapScanFilter filter(table);
+    filter.SetProjection(colIds.data(), colIds.size());
+    DRAMIndexTuple indexTuple(table->GetColDesc(), indexDesc, index->GetColCount(), index->GetRowLen());
+    std::vector<Key_t> keys;
+    {
+        HeapParallelScan scan(&buildTx, table, std::max(FLAGS_heap_parallel_scan_workers, 1), &filter);
+        RAMTuple **tuples = nullptr;
+        RowId *rowIds = nullptr;
+        uint32 count;
+        while ((count = scan.NextBatch(&tuples, &rowIds)) != 0) {
+            for (uint32 i = 0; i < count; i++) {
+                indexTuple.ExtractFromTuple(tuples[i]);
+                keys.emplace_back();
+                index->Encode(&indexTuple, &keys.back(), rowIds[i]);
+            }
+            if (keys.size() >= INDEX_BULK_SORT_KEYS) {
+                HeapInsertIndexKeys(index, &keys);
+            }
+        }
+    }
+    HeapInsertIndexKeys(index, &keys);
+    index->SetReady(buildTx.GetIndexLookupSnapshot().snapshot);
+    buildTx.Commit();
+    return true;
+}
+
+HeapBulkLoader::HeapBulkLoader(Transaction *tx, Table *table)
+    : m_tx(tx), m_table(table), m_rowIdMap(table->m_rowIdMap), m_tupleSize(RealTupleSize(table->GetRowLen())) {
+    DCHECK(table->Ready());
+    m_stageRows = std::max<size_t>(1, HEAP_BULK_STAGE_SIZE / m_tupleSize);
+    m_stage.resize(m_stageRows * m_tupleSize);
+}
+
+RowId HeapBulkLoader::NextEmptyRow() {
+    while (true) {
+        if (m_nextRowId == m_extentEnd) {
+            // 暂存的行号必须和 extent 连续
+            FlushRows();
+            if (RowIdIsValid(m_extentEnd)) {
+                m_rowIdMap->SetExtentFull(m_extentEnd - 1);
+            }
+            bool isNew = true;
+            m_extentAddr = m_rowIdMap->AcquireExtent(&m_extentBegin, &m_extentEnd, &isNew);
+            m_probeUsed = !isNew;
+            m_nextRowId = m_extentBegin;
+        }
+        RowId rowId = m_nextRowId++;
+        if (m_probeUsed && reinterpret_cast<const NVMTuple *>(GetNVMTuple(rowId))->m_isUsed) {
+            FlushRows();
+            continue;   // 重启前已占用的行
+        }
+        return rowId;
+    }
+}
+
+RowId HeapBulkLoader::Insert(RAMTuple *tuple) {
+    DCHECK(m_table->GetRowLen() == tuple->getRowLen());
+    if (CheckTxStatus(m_tx)) {
+        LOG(ERROR) << "Insert cannot fail by default!";
+        return InvalidRowId;
+    }
+
+    m_tx->PrepareUndo();
+    m_tx->EnterTable(m_table);
+    RowId rowId = NextEmptyRow();
+    if (m_stageCount == 0) {
+        m_stageBegin = rowId;
+    }
+    DCHECK(rowId == m_stageBegin + m_stageCount);
+    tuple->InitHead(m_tx->GetTxSlotLocation(), InvalidUndoRecPtr, true, false);
+    tuple->Serialize(m_stage.data() + m_stageCount * m_tupleSize, m_tupleSize);
+    if (FLAGS_change_stream) {
+        m_tx->GetChangeBuffer()->AppendInsert(m_table->Id(), rowId, tuple);
+    }
+    m_stageCount++;
+    m_loadedRows++;
+    if (m_stageCount == m_stageRows) {
+        FlushRows();
+    }
+    return rowId;
+}
+
+void HeapBulkLoader::FlushRows() {
+    if (m_stageCount == 0) {
+        return;
+    }
+    // 先写 undo 再写行, 中途崩溃时整个区间都能被回滚
+    PrepareBulkInsertUndo(m_tx, m_table->SegmentHead(), m_stageBegin, m_table->GetRowLen(), m_stageCount);
+    const size_t bytes = m_stageCount * m_tupleSize;
+    pmem_memcpy_nodrain(GetNVMTuple(m_stageBegin), m_stage.data(), bytes);
+    pmem_drain();
+    g_heapNVMWriteBytes += bytes;
+    // 并发的扫描可能在写入之前加载过这些行的缓存
+    m_rowIdMap->DropCache(m_stageBegin, m_stageBegin + m_stageCount);
+    m_stageCount = 0;
+}
+
+void HeapBulkLoader::IndexInsert(NVMIndex *index, DRAMIndexTuple *indexTuple, RowId rowId) {
+    auto iter = std::find_if(m_indexKeys.begin(), m_indexKeys.end(),
+                             [index](const IndexKeys &entry) { return entry.index == index; });
+    if (iter == m_indexKeys.end()) {
+        m_indexKeys.push_back({index, indexTuple->m_rowDes, indexTuple->m_indexDes, indexTuple->m_colCnt, {}, {}});
+        iter = m_indexKeys.end() - 1;
+    }
+    iter->keys.emplace_back();
+    index->Encode(indexTuple, &iter->keys.back(), rowId);
+    // 行号大多连续, 只在跨 extent 或跳过已占用的行时开始新的区间
+    auto &ranges = iter->rowRanges;
+    if (!ranges.empty() && ranges.back().first + ranges.back().second == rowId) {
+        ranges.back().second++;
+    } else {
+        ranges.emplace_back(rowId, 1);
+    }
+    if (iter->keys.size() >= INDEX_BULK_SORT_KEYS) {
+        FlushIndexKeys(&*iter);
+    }
+}
+
+void HeapBulkLoader::FlushIndexKeys(IndexKeys *entry) {
+    if (entry->keys.empty()) {
+        return;
+    }
+    // 索引键指向的行先写入 NVM, 回滚时要从这些行重新编码出键
+    FlushRows();
+    // 先写 undo 再插入, 崩溃后这些键都能被回滚
+    for (auto &range : entry->rowRanges) {
+        m_tx->PrepareIndexBulkInsertUndo(entry->index->Id(), entry->rowDes, entry->indexDes, entry->colCnt,
+                                         m_table->SegmentHead(), m_table->GetRowLen(), range.first, range.second);
+    }
+    // 按键序插入, 相邻的键落在同一个数据节点, 查找路径上的节点一直在 cache 中
+    std::sort(entry->keys.begin(), entry->keys.end());
+    for (auto &key : entry->keys) {
+        entry->index->InsertKey(key);
+    }
+    entry->keys.clear();
+    entry->rowRanges.clear();
+}
+
+void HeapBulkLoader::Finish() {
+    FlushRows();
+    if (RowIdIsValid(m_extentEnd)) {
+        if (m_nextRowId < m_extentEnd) {
+            std::vector<RowId> rowIds;
+            rowIds.reserve(m_extentEnd - m_nextRowId);
+            for (RowId rowId = m_nextRowId; rowId < m_extentEnd; rowId++) {
+                rowIds.push_back(rowId);
+            }
+            m_rowIdMap->ReleaseRowIds(rowIds);
+        } else {
+            m_rowIdMap->SetExtentFull(m_extentEnd - 1);
+        }
+        m_extentBegin = m_extentEnd = m_nextRowId = InvalidRowId;
+        m_extentAddr = nullptr;
+    }
+    for (auto &entry : m_indexKeys) {
+        FlushIndexKeys(&entry);
+    }
+}
+
 }  // namespace NVMDB
@@ -3,23 +3,55 @@
 #include "heap/nvm_heap.h"
 #include "index/nvm_index.h"
 #include "nvmdb_thread.h"
+#include "transaction/nvm_change_stream.h"
+#include <chrono>
 
 namespace NVMDB {
 
+static void CreateChangeStreamLog() {
+    auto *changeStream = ChangeStream::GetGlobalChangeStream();
+    if (changeStream != nullptr) {
+        changeStream->CreateLog(g_dir_config);
+    }
+}
+
+// 在 undo 后台回滚之前调用, 根据 tx slot 跳过崩溃时没有提交的事务的变更日志
+static void MountChangeStreamLog() {
+    auto *changeStream = ChangeStream::GetGlobalChangeStream();
+    if (changeStream != nullptr) {
+        changeStream->MountLog(g_dir_config);
+    }
+}
+
 void InitDB(const std::string& dir) {
     g_dir_config = std::make_shared<DirectoryConfig>(dir, true);
     InitGlobalVariables();
     UndoCreate();
     HeapCreate(g_dir_config);    // heap is one table space
     IndexBootstrap();
+    HeapStartTiering();
+    CreateChangeStreamLog();
 }
 
 void BootStrap(const std::string& dir) {
+    // 按阶段打印启动耗时, undo 回滚在后台进行, 由回滚线程单独打印进度和耗时
+    auto phaseStart = std::chrono::steady_clock::now();
+    auto logPhase = [&phaseStart](const char *phase) {
+        auto now = std::chrono::steady_clock::now();
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - phaseStart);
+        LOG(INFO) << "NVMDB bootstrap phase " << phase << " took " << elapsed.count() << " ms.";
+        phaseStart = now;
+    };
     g_dir_config = std::make_shared<DirectoryConfig>(dir, false);
     InitGlobalVariables();
+    logPhase("init global variables");
     HeapBootStrap(g_dir_config);
+    logPhase("heap mount");
     IndexBootstrap();
-    UndoBootStrap(); // mount the heap so we can undo the logs
+    logPhase("index recovery");
+    UndoBootStrap(MountChangeStreamLog); // mount the heap so we can undo the logs
+    logPhase("undo mount");
+    HeapStartTiering();
 }
 
 void ExitDBProcess() {
@@ -1,6 +1,7 @@
 #include "nvm_table.h"
 #include "heap/nvm_heap.h"
 #include "heap/nvm_rowid_map.h"
+#include <thread>
 
 namespace NVMDB {
 
@@ -32,4 +33,31 @@ uint32 Table::GetColIdByName(const char *name) const {
     return (i < max ? i : InvalidColId);
 }
 
+uint32 Table::WriterEnter() {
+    while (true) {
+        uint64 epoch = m_writerEpoch.load();
+        uint32 slot = epoch & 1;
+        m_writers[slot].fetch_add(1);
+        // 计数之后 epoch 没有变, 推进 epoch 的线程一定能看到这次计数
+        if (m_writerEpoch.load() == epoch) {
+            return slot;
+        }
+        m_writers[slot].fetch_sub(1);
+    }
+}
+
+void Table::WriterExit(uint32 epochSlot) {
+    DCHECK(m_writers[epochSlot].load() > 0);
+    m_writers[epochSlot].fetch_sub(1);
+}
+
+void Table::WaitForOldWriters() {
+    // 同时有多个索引在建时串行推进, 保证旧 epoch 的计数不会和新登记的写事务混在一起
+    std::lock_guard<std::mutex> lockGuard(m_writerEpochMutex);
+    uint32 oldSlot = m_writerEpoch.fetch_add(1) & 1;
+    while (m_writers[oldSlot].load() != 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
 }  // namespace NVMDB
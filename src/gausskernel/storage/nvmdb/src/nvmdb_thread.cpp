@@ -2,6 +2,8 @@
 #include "heap/nvm_heap_cache.h"
 #include "index/nvm_index.h"
 #include "transaction/nvm_transaction.h"
+#include "transaction/nvm_group_commit.h"
+#include "transaction/nvm_change_stream.h"
 #include <unordered_map>
 
 
@@ -57,12 +59,19 @@ void InitGlobalThreadStorageMgr() {
 void InitGlobalVariables() {
     InitGlobalThreadStorageMgr();
     InitGlobalRowIdMapCache();  // clear g_globalRowidMaps
+    TupleCache::InitGlobalTupleCache();
     ProcessArray::InitGlobalProcArray();
+    GroupCommitter::InitGlobalGroupCommitter();
+    ChangeStream::InitGlobalChangeStream();
 }
 
 void DestroyGlobalVariables() {
+    // 析构时交付剩下的变更, 需要全局 CSN, 先于 ProcessArray 销毁
+    ChangeStream::DestroyGlobalChangeStream();
     DestroyGlobalRowIdMapCache();
+    TupleCache::DestroyGlobalTupleCache();
     ProcessArray::DestroyGlobalProcArray();
+    GroupCommitter::DestroyGlobalGroupCommitter();
 }
 
 static thread_local ThreadLocalStorage *t_storage = nullptr;
@@ -97,7 +106,6 @@ void InitThreadLocalVariables() {
 
 void DestroyThreadLocalVariables() {
     DestroyThreadLocalStorage();
-    TLTupleCache::Clear();
     TLTableCache::Clear();
     DestroyLocalRowIdMapCache();
     DestroyLocalIndex();
@@ -0,0 +1,131 @@
+#include "table_space/nvm_cold_store.h"
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace NVMDB {
+
+static void WriteFully(int fd, const char *data, size_t len, uint64 offset) {
+    while (len > 0) {
+        ssize_t ret = pwrite(fd, data, len, static_cast<off_t>(offset));
+        CHECK(ret > 0) << "Write cold extent file failed, errno: " << errno;
+        data += ret;
+        len -= ret;
+        offset += ret;
+    }
+}
+
+static void ReadFully(int fd, char *data, size_t len, uint64 offset) {
+    while (len > 0) {
+        ssize_t ret = pread(fd, data, len, static_cast<off_t>(offset));
+        CHECK(ret > 0) << "Read cold extent file failed, errno: " << errno;
+        data += ret;
+        len -= ret;
+        offset += ret;
+    }
+}
+
+ColdExtentStore::ColdExtentStore(const std::string &path, uint32 slotSize, uint32 slotCount, bool init)
+    : m_path(path), m_slotSize(slotSize), m_slotCount(slotCount) {
+    int flags = O_RDWR | O_CREAT;
+    if (init) {
+        flags |= O_TRUNC;
+    }
+    m_fd = open(m_path.c_str(), flags, 0666);
+    CHECK(m_fd >= 0) << "Cannot open cold extent file " << m_path << ", errno: " << errno;
+
+    FileHeader header{};
+    const bool exists = !init && lseek(m_fd, 0, SEEK_END) >= static_cast<off_t>(COLD_STORE_HEADER_SIZE);
+    if (exists) {
+        ReadFully(m_fd, reinterpret_cast<char *>(&header), sizeof(header), 0);
+        CHECK(header.m_magic == COLD_STORE_MAGIC) << "Invalid cold extent file " << m_path;
+        CHECK(header.m_slotSize == m_slotSize) << "Cold extent file " << m_path << " has a different slot size";
+        m_slotCount = header.m_slotCount;
+    }
+
+    const uint64 bitmapBytes = (m_slotCount + BITMAP_UNIT_BITS - 1) / BITMAP_UNIT_BITS * sizeof(uint64);
+    m_bitmap.resize(bitmapBytes / sizeof(uint64), 0);
+    // slot 按页对齐
+    m_dataOffset = (COLD_STORE_HEADER_SIZE + bitmapBytes + NVM_PAGE_SIZE - 1) / NVM_PAGE_SIZE * NVM_PAGE_SIZE;
+
+    if (exists) {
+        ReadFully(m_fd, reinterpret_cast<char *>(m_bitmap.data()), bitmapBytes, COLD_STORE_HEADER_SIZE);
+        for (uint64 unit : m_bitmap) {
+            m_usedSlots += __builtin_popcountll(unit);
+        }
+        return;
+    }
+    header = {COLD_STORE_MAGIC, m_slotSize, m_slotCount};
+    WriteFully(m_fd, reinterpret_cast<const char *>(m_bitmap.data()), bitmapBytes, COLD_STORE_HEADER_SIZE);
+    WriteFully(m_fd, reinterpret_cast<const char *>(&header), sizeof(header), 0);
+    CHECK(fdatasync(m_fd) == 0) << "Sync cold extent file failed, errno: " << errno;
+}
+
+ColdExtentStore::~ColdExtentStore() {
+    if (m_fd >= 0) {
+        close(m_fd);
+    }
+}
+
+void ColdExtentStore::WriteBitmapUnit(uint32 slot) {
+    const uint32 unit = slot / BITMAP_UNIT_BITS;
+    WriteFully(m_fd, reinterpret_cast<const char *>(&m_bitmap[unit]), sizeof(uint64),
+               COLD_STORE_HEADER_SIZE + unit * sizeof(uint64));
+}
+
+uint32 ColdExtentStore::Write(const char *data, size_t len) {
+    DCHECK(len <= m_slotSize);
+    uint32 slot = INVALID_SLOT;
+    {
+        // 先只在 DRAM 中占用, 数据落盘之后再写位图
+        std::lock_guard<std::mutex> lockGuard(m_mutex);
+        for (uint32 i = 0; i < m_bitmap.size(); i++) {
+            const uint32 unit = (m_hint + i) % m_bitmap.size();
+            const uint64 bits = m_bitmap[unit];
+            if (bits == UINT64_MAX) {
+                continue;
+            }
+            const uint32 bit = __builtin_ctzll(~bits);
+            if (unit * BITMAP_UNIT_BITS + bit >= m_slotCount) {
+                continue;
+            }
+            m_bitmap[unit] |= 1LLU << bit;
+            m_usedSlots++;
+            m_hint = unit;
+            slot = unit * BITMAP_UNIT_BITS + bit;
+            break;
+        }
+    }
+    if (slot == INVALID_SLOT) {
+        return INVALID_SLOT;
+    }
+    WriteFully(m_fd, data, len, SlotOffset(slot));
+    CHECK(fdatasync(m_fd) == 0) << "Sync cold extent file failed, errno: " << errno;
+    {
+        std::lock_guard<std::mutex> lockGuard(m_mutex);
+        WriteBitmapUnit(slot);
+    }
+    CHECK(fdatasync(m_fd) == 0) << "Sync cold extent file failed, errno: " << errno;
+    return slot;
+}
+
+void ColdExtentStore::Read(uint32 slot, char *data, size_t len) const {
+    DCHECK(slot < m_slotCount && len <= m_slotSize);
+    ReadFully(m_fd, data, len, SlotOffset(slot));
+}
+
+void ColdExtentStore::Free(uint32 slot) {
+    DCHECK(slot < m_slotCount);
+    std::lock_guard<std::mutex> lockGuard(m_mutex);
+    const uint32 unit = slot / BITMAP_UNIT_BITS;
+    DCHECK(m_bitmap[unit] & (1LLU << (slot % BITMAP_UNIT_BITS)));
+    m_bitmap[unit] &= ~(1LLU << (slot % BITMAP_UNIT_BITS));
+    m_usedSlots--;
+    WriteBitmapUnit(slot);
+}
+
+uint32 ColdExtentStore::GetUsedSlots() {
+    std::lock_guard<std::mutex> lockGuard(m_mutex);
+    return m_usedSlots;
+}
+
+}  // namespace NVMDB
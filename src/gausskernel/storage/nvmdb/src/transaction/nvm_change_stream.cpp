@@ -0,0 +1,474 @@
+#include "transaction/nvm_change_stream.h"
+#include "transaction/nvm_snapshot.h"
+#include <libpmem.h>
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+
+namespace NVMDB {
+
+DEFINE_bool(change_stream, false, "emit a change record stream of committed heap writes for replication and decoding");
+DEFINE_int64(change_stream_batch_bytes, 256 * 1024, "buffered change bytes of a numa group that trigger a delivery");
+DEFINE_int64(change_stream_flush_interval_us, 1000, "max time committed changes wait before delivery");
+DEFINE_int64(change_stream_tx_max_bytes, 64 * 1024 * 1024,
+             "buffered change bytes of a transaction above which its changes are replaced by per-table resync marks");
+
+std::unique_ptr<ChangeStream> ChangeStream::g_changeStream = nullptr;
+
+void TxChangeBuffer::AppendOverflow(TableId tableId) {
+    for (const char *cur = m_buf.data(); cur < m_buf.data() + m_buf.size(); cur += ChangeRecordSize(0)) {
+        if (reinterpret_cast<const ChangeRecord *>(cur)->m_tableId == tableId) {
+            return;
+        }
+    }
+    const size_t offset = m_buf.size();
+    m_buf.resize(offset + ChangeRecordSize(0));
+    auto *record = reinterpret_cast<ChangeRecord *>(m_buf.data() + offset);
+    record->m_tableId = tableId;
+    record->m_rowId = InvalidRowId;
+    record->m_payload = 0;
+    record->m_type = ChangeType::RESYNC;
+    m_recordCnt++;
+}
+
+char *TxChangeBuffer::AppendRecord(TableId tableId, RowId rowId, ChangeType type, uint32 payload) {
+    if (!m_overflowed && m_buf.size() + ChangeRecordSize(payload) > static_cast<uint64>(FLAGS_change_stream_tx_max_bytes)) {
+        // 已经攒下的变更换成每张表一条 RESYNC
+        std::vector<char> old;
+        old.swap(m_buf);
+        m_recordCnt = 0;
+        m_overflowed = true;
+        for (const char *cur = old.data(); cur < old.data() + old.size();) {
+            const auto *record = reinterpret_cast<const ChangeRecord *>(cur);
+            AppendOverflow(record->m_tableId);
+            cur += ChangeRecordSize(record->m_payload);
+        }
+    }
+    if (m_overflowed) {
+        AppendOverflow(tableId);
+        return nullptr;
+    }
+    const size_t offset = m_buf.size();
+    m_buf.resize(offset + ChangeRecordSize(payload));
+    auto *record = reinterpret_cast<ChangeRecord *>(m_buf.data() + offset);
+    record->m_tableId = tableId;
+    record->m_rowId = rowId;
+    record->m_payload = payload;
+    record->m_type = type;
+    m_recordCnt++;
+    return record->data;
+}
+
+void TxChangeBuffer::AppendTuple(TableId tableId, RowId rowId, ChangeType type, const RAMTuple *tuple,
+                                 const UndoColumnDesc *cols, uint32 colCnt) {
+    const UndoColumnDesc fullRow = {0, tuple->getRowLen()};
+    if (cols == nullptr || colCnt == 0) {
+        cols = &fullRow;
+        colCnt = 1;
+    }
+    uint64 dataLen = 0;
+    for (uint32 i = 0; i < colCnt; i++) {
+        dataLen += cols[i].m_colLen;
+    }
+    const NvmNullType &nullBitmap = tuple->getNVMTuple().m_nullBitmap;
+    const size_t colsLen = colCnt * sizeof(UndoColumnDesc);
+    const uint32 payload = sizeof(NvmNullType) + sizeof(uint32) + colsLen + dataLen;
+    char *data = AppendRecord(tableId, rowId, type, payload);
+    if (data == nullptr) {
+        return;
+    }
+    char *dataEnd = data + payload;
+    int ret = memcpy_s(data, dataEnd - data, &nullBitmap, sizeof(NvmNullType));
+    SecureRetCheck(ret);
+    data += sizeof(NvmNullType);
+    ret = memcpy_s(data, dataEnd - data, &colCnt, sizeof(uint32));
+    SecureRetCheck(ret);
+    data += sizeof(uint32);
+    ret = memcpy_s(data, dataEnd - data, cols, colsLen);
+    SecureRetCheck(ret);
+    data += colsLen;
+    for (uint32 i = 0; i < colCnt; i++) {
+        ret = memcpy_s(data, dataEnd - data, tuple->getRowData() + cols[i].m_colOffset, cols[i].m_colLen);
+        SecureRetCheck(ret);
+        data += cols[i].m_colLen;
+    }
+    DCHECK(data == dataEnd);
+}
+
+void TxChangeBuffer::AppendInsert(TableId tableId, RowId rowId, const RAMTuple *tuple) {
+    AppendTuple(tableId, rowId, ChangeType::INSERT, tuple, nullptr, 0);
+}
+
+void TxChangeBuffer::AppendUpdate(TableId tableId, RowId rowId, const RAMTuple *tuple, const UndoColumnDesc *cols,
+                                  uint32 colCnt) {
+    AppendTuple(tableId, rowId, ChangeType::UPDATE, tuple, cols, colCnt);
+}
+
+void TxChangeBuffer::AppendDelete(TableId tableId, RowId rowId) {
+    AppendRecord(tableId, rowId, ChangeType::DELETE, 0);
+}
+
+bool ChangeStreamReader::NextTx(const ChangeTxHead **head) {
+    if (m_txEnd != nullptr) {
+        // 跳过当前事务没有读完的变更
+        m_cur = m_txEnd;
+    }
+    if (m_cur >= m_end) {
+        return false;
+    }
+    *head = reinterpret_cast<const ChangeTxHead *>(m_cur);
+    m_cur += sizeof(ChangeTxHead);
+    m_txEnd = m_cur + (*head)->m_len;
+    DCHECK(m_txEnd <= m_end);
+    return true;
+}
+
+const ChangeRecord *ChangeStreamReader::NextRecord() {
+    if (m_txEnd == nullptr || m_cur >= m_txEnd) {
+        return nullptr;
+    }
+    const auto *record = reinterpret_cast<const ChangeRecord *>(m_cur);
+    m_cur += ChangeRecordSize(record->m_payload);
+    DCHECK(m_cur <= m_txEnd);
+    return record;
+}
+
+void ChangeStreamReader::ApplyToTuple(const ChangeRecord *record, RAMTuple *tuple) {
+    DCHECK(record->m_type == ChangeType::INSERT || record->m_type == ChangeType::UPDATE);
+    const char *data = record->data;
+    NvmNullType nullBitmap;
+    int ret = memcpy_s(&nullBitmap, sizeof(NvmNullType), data, sizeof(NvmNullType));
+    SecureRetCheck(ret);
+    tuple->setNullBitmap(nullBitmap);
+    // 被更新的区间只记录本条变更的列, 回放 UPDATE 时按增量更新写入
+    tuple->ClearUpdatedCols();
+    data += sizeof(NvmNullType);
+    uint32 colCnt;
+    ret = memcpy_s(&colCnt, sizeof(uint32), data, sizeof(uint32));
+    SecureRetCheck(ret);
+    data += sizeof(uint32);
+    const char *colData = data + colCnt * sizeof(UndoColumnDesc);
+    for (uint32 i = 0; i < colCnt; i++) {
+        UndoColumnDesc col;
+        ret = memcpy_s(&col, sizeof(UndoColumnDesc), data + i * sizeof(UndoColumnDesc), sizeof(UndoColumnDesc));
+        SecureRetCheck(ret);
+        tuple->UpdateColRange(col, colData);
+        colData += col.m_colLen;
+    }
+    DCHECK(colData == record->data + record->m_payload);
+}
+
+void ChangeLog::WriteAt(uint64 offset, const void *src, size_t len) {
+    const auto *data = static_cast<const char *>(src);
+    while (len > 0) {
+        const auto pageId = static_cast<uint32>(offset / NVM_PAGE_SIZE);
+        const size_t size = std::min<size_t>(len, CHANGE_LOG_SEGMENT_SIZE - offset % CHANGE_LOG_SEGMENT_SIZE);
+        m_logicFile.extend(pageId);
+        auto *nvmAddr = static_cast<char *>(m_logicFile.getNvmAddrByPageId(pageId)) + offset % NVM_PAGE_SIZE;
+        pmem_memcpy_nodrain(nvmAddr, data, size);
+        offset += size;
+        data += size;
+        len -= size;
+    }
+}
+
+void ChangeLog::ReadAt(uint64 offset, void *dst, size_t len) {
+    auto *data = static_cast<char *>(dst);
+    while (len > 0) {
+        const auto pageId = static_cast<uint32>(offset / NVM_PAGE_SIZE);
+        const size_t size = std::min<size_t>(len, CHANGE_LOG_SEGMENT_SIZE - offset % CHANGE_LOG_SEGMENT_SIZE);
+        m_logicFile.extend(pageId);
+        const auto *nvmAddr = static_cast<const char *>(m_logicFile.getNvmAddrByPageId(pageId)) + offset % NVM_PAGE_SIZE;
+        int ret = memcpy_s(data, size, nvmAddr, size);
+        SecureRetCheck(ret);
+        offset += size;
+        data += size;
+        len -= size;
+    }
+}
+
+void ChangeLog::Create(uint64 deliveredCSN) {
+    std::lock_guard<std::mutex> lockGuard(m_mutex);
+    // 第一个页面留给日志头, 第一个 segment 不回收
+    m_head->m_freeBegin = NVM_PAGE_SIZE;
+    m_head->m_recycledBegin = NVM_PAGE_SIZE;
+    m_head->m_deliveredCSN = deliveredCSN;
+    pmem_persist(m_head, sizeof(ChangeLogHead));
+}
+
+void ChangeLog::Mount() {
+    std::lock_guard<std::mutex> lockGuard(m_mutex);
+    ChangeLogEntry entry {};
+    uint64 aborted = 0;
+    for (uint64 offset = m_head->m_recycledBegin; offset < m_head->m_freeBegin;
+         offset += sizeof(ChangeLogEntry) + entry.m_head.m_len) {
+        ReadAt(offset, &entry, sizeof(ChangeLogEntry));
+        if (entry.m_aborted != 0) {
+            continue;
+        }
+        // 日志落盘之后、tx slot 标记为提交之前崩溃的事务, 会被后台回滚; slot 已经回收的事务一定已经提交
+        TransactionInfo txInfo {};
+        if (GetTransactionInfo(entry.m_txSlot, &txInfo) && txInfo.status != TxSlotStatus::COMMITTED) {
+            entry.m_aborted = 1;
+            WriteAt(offset + offsetof(ChangeLogEntry, m_aborted), &entry.m_aborted, sizeof(uint64));
+            aborted++;
+        }
+    }
+    pmem_drain();
+    if (aborted != 0) {
+        LOG(INFO) << "NVMDB change log skipped " << aborted << " uncommitted transactions.";
+    }
+}
+
+void ChangeLog::Write(TxSlotPtr txSlot, uint64 csn, const TxChangeBuffer &changes) {
+    const ChangeLogEntry entry = {txSlot, 0, {csn, changes.RecordCount(), static_cast<uint32>(changes.Size())}};
+    std::lock_guard<std::mutex> lockGuard(m_mutex);
+    const uint64 offset = m_head->m_freeBegin;
+    WriteAt(offset, &entry, sizeof(ChangeLogEntry));
+    WriteAt(offset + sizeof(ChangeLogEntry), changes.Data(), changes.Size());
+    pmem_drain();
+    // 日志落盘之后再推进 m_freeBegin, 重启时不会读到写了一半的日志
+    m_head->m_freeBegin = offset + sizeof(ChangeLogEntry) + changes.Size();
+    pmem_persist(&m_head->m_freeBegin, sizeof(uint64));
+}
+
+void ChangeLog::Load(uint64 beginCSN, uint64 endCSN, std::vector<char> *buf) {
+    std::lock_guard<std::mutex> lockGuard(m_mutex);
+    ChangeLogEntry entry {};
+    for (uint64 offset = m_head->m_recycledBegin; offset < m_head->m_freeBegin;
+         offset += sizeof(ChangeLogEntry) + entry.m_head.m_len) {
+        ReadAt(offset, &entry, sizeof(ChangeLogEntry));
+        if (entry.m_aborted != 0 || entry.m_head.m_csn < beginCSN || entry.m_head.m_csn >= endCSN) {
+            continue;
+        }
+        const size_t bufEnd = buf->size();
+        buf->resize(bufEnd + sizeof(ChangeTxHead) + entry.m_head.m_len);
+        int ret = memcpy_s(buf->data() + bufEnd, sizeof(ChangeTxHead), &entry.m_head, sizeof(ChangeTxHead));
+        SecureRetCheck(ret);
+        ReadAt(offset + sizeof(ChangeLogEntry), buf->data() + bufEnd + sizeof(ChangeTxHead), entry.m_head.m_len);
+    }
+}
+
+void ChangeLog::Recycle(uint64 deliveredCSN) {
+    std::lock_guard<std::mutex> lockGuard(m_mutex);
+    m_head->m_deliveredCSN = deliveredCSN;
+    // 日志不按 CSN 排序, 回收到第一条还没有交付的日志为止
+    const uint64 recycledBegin = m_head->m_recycledBegin;
+    uint64 offset = recycledBegin;
+    ChangeLogEntry entry {};
+    while (offset < m_head->m_freeBegin) {
+        ReadAt(offset, &entry, sizeof(ChangeLogEntry));
+        if (entry.m_aborted == 0 && entry.m_head.m_csn >= deliveredCSN) {
+            break;
+        }
+        offset += sizeof(ChangeLogEntry) + entry.m_head.m_len;
+    }
+    m_head->m_recycledBegin = offset;
+    pmem_persist(m_head, sizeof(ChangeLogHead));
+    uint32 startSegmentId = std::max<uint64>(recycledBegin / CHANGE_LOG_SEGMENT_SIZE, 1);
+    uint32 endSegmentId = offset / CHANGE_LOG_SEGMENT_SIZE;
+    if (startSegmentId < endSegmentId) {
+        m_logicFile.punch(startSegmentId, endSegmentId);
+    }
+}
+
+ChangeStream::ChangeStream(uint64 batchBytes, uint64 flushIntervalUs)
+    : m_batchBytes(std::max<uint64>(batchBytes, 1)), m_flushIntervalUs(std::max<uint64>(flushIntervalUs, 1)),
+      m_shards(NVMDB_MAX_GROUP), m_committers(NVMDB_MAX_THREAD_NUM) {
+    m_flusher = std::thread(&ChangeStream::FlusherMain, this);
+}
+
+ChangeStream::~ChangeStream() {
+    {
+        std::lock_guard<std::mutex> lockGuard(m_mutex);
+        m_stop = true;
+    }
+    m_cond.notify_all();
+    m_flusher.join();
+    Flush();
+}
+
+void ChangeStream::CreateLog(const std::shared_ptr<DirectoryConfig> &dirConfig) {
+    std::lock_guard<std::mutex> flushGuard(m_flushMutex);
+    const uint64 csn = ProcessArray::GetGlobalProcArray()->getGlobalCSN();
+    m_logs.clear();
+    for (uint32 i = 0; i < dirConfig->size(); i++) {
+        m_logs.push_back(std::make_unique<ChangeLog>(dirConfig->getDirPathByIndex(i), i));
+        m_logs.back()->Create(csn);
+    }
+    m_deliveredCSN = csn;
+    m_retainedCSN = csn;
+    m_startCSN.store(csn, std::memory_order_release);
+}
+
+void ChangeStream::MountLog(const std::shared_ptr<DirectoryConfig> &dirConfig) {
+    std::lock_guard<std::mutex> flushGuard(m_flushMutex);
+    m_logs.clear();
+    uint64 deliveredCSN = UINT64_MAX;
+    for (uint32 i = 0; i < dirConfig->size(); i++) {
+        m_logs.push_back(std::make_unique<ChangeLog>(dirConfig->getDirPathByIndex(i), i));
+        m_logs.back()->Mount();
+        // 各个日志的消费位置一起更新, 中途崩溃时取最小的
+        deliveredCSN = std::min(deliveredCSN, m_logs.back()->GetDeliveredCSN());
+    }
+    // 重启之前提交的事务 CSN 都小于恢复出的全局 CSN, 没有交付的都在日志中, 订阅时读回
+    m_deliveredCSN = deliveredCSN;
+    m_retainedCSN = std::max(deliveredCSN, ProcessArray::GetGlobalProcArray()->getGlobalCSN());
+    m_startCSN.store(deliveredCSN, std::memory_order_release);
+}
+
+void ChangeStream::BeginCommit(uint32 committer) {
+    DCHECK(committer < m_committers.size());
+    DCHECK(m_committers[committer].m_csn.load(std::memory_order_relaxed) == 0);
+    // 登记之后再取提交 CSN, 与 Flush 中先读全局 CSN 再扫描登记对应
+    m_committers[committer].m_csn.store(ProcessArray::GetGlobalProcArray()->getGlobalCSN(),
+                                        std::memory_order_seq_cst);
+}
+
+void ChangeStream::Persist(TxSlotPtr txSlot, uint64 csn, const TxChangeBuffer &changes, int groupId) {
+    if (m_logs.empty()) {
+        return;
+    }
+    m_logs[static_cast<size_t>(groupId) % m_logs.size()]->Write(txSlot, csn, changes);
+}
+
+void ChangeStream::Append(uint64 csn, const TxChangeBuffer &changes, int groupId, uint32 committer) {
+    DCHECK(!changes.Empty());
+    auto &shard = m_shards[static_cast<size_t>(groupId) % NVMDB_MAX_GROUP];
+    const ChangeTxHead head = {csn, changes.RecordCount(), static_cast<uint32>(changes.Size())};
+    size_t shardBytes;
+    {
+        std::lock_guard<std::mutex> lockGuard(shard.m_mutex);
+        const auto *headData = reinterpret_cast<const char *>(&head);
+        shard.m_buf.insert(shard.m_buf.end(), headData, headData + sizeof(ChangeTxHead));
+        shard.m_buf.insert(shard.m_buf.end(), changes.Data(), changes.Data() + changes.Size());
+        shardBytes = shard.m_buf.size();
+    }
+    // 追加之后才注销, Flush 扫描时已经注销的事务一定在它取出的缓冲区中
+    m_committers[committer].m_csn.store(0, std::memory_order_release);
+    m_appendedTxs.fetch_add(1, std::memory_order_relaxed);
+    m_appendedBytes.fetch_add(sizeof(ChangeTxHead) + changes.Size(), std::memory_order_relaxed);
+    if (shardBytes >= m_batchBytes * 4) {
+        // 订阅者跟不上, 由提交的事务自己交付
+        Flush();
+    } else if (shardBytes >= m_batchBytes) {
+        {
+            std::lock_guard<std::mutex> lockGuard(m_mutex);
+            m_flushRequested = true;
+        }
+        m_cond.notify_one();
+    }
+}
+
+void ChangeStream::Flush() {
+    std::lock_guard<std::mutex> flushGuard(m_flushMutex);
+    /*
+     * 先读全局 CSN 再扫描正在提交的事务, 取最小值作为上界: 扫描时还没有登记的事务, 之后取到的提交 CSN
+     * 不会小于这里读到的全局 CSN; 扫描之后才取出缓冲区, 扫描时已经注销的事务都已经追加过.
+     * 所以 CSN 小于上界的事务此时都在取出的缓冲区或 m_pending 中.
+     */
+    uint64 bound = ProcessArray::GetGlobalProcArray()->getGlobalCSN();
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    for (auto &committer : m_committers) {
+        const uint64 csn = committer.m_csn.load(std::memory_order_acquire);
+        if (csn != 0) {
+            bound = std::min(bound, csn);
+        }
+    }
+    // 同时锁住所有 shard 再取出, 先于另一个事务 Append 的事务, 要么在同一批, 要么在更早的批次
+    for (auto &shard : m_shards) {
+        shard.m_mutex.lock();
+    }
+    for (auto &shard : m_shards) {
+        m_pending.insert(m_pending.end(), shard.m_buf.begin(), shard.m_buf.end());
+        shard.m_buf.clear();
+    }
+    for (auto &shard : m_shards) {
+        shard.m_mutex.unlock();
+    }
+
+    struct TxRef {
+        uint64 csn;
+        const char *data;
+        size_t len;
+    };
+    std::vector<TxRef> txs;
+    std::vector<char> held;
+    size_t total = 0;
+    const char *cur = m_pending.data();
+    const char *end = m_pending.data() + m_pending.size();
+    while (cur < end) {
+        const auto *head = reinterpret_cast<const ChangeTxHead *>(cur);
+        const size_t len = sizeof(ChangeTxHead) + head->m_len;
+        if (head->m_csn < bound) {
+            txs.push_back({head->m_csn, cur, len});
+            total += len;
+        } else {
+            held.insert(held.end(), cur, cur + len);
+        }
+        cur += len;
+    }
+    if (!txs.empty() && !m_consumers.empty()) {
+        // m_pending 中按 Append 的顺序排列, 稳定排序保持相同 CSN 的事务的相对顺序
+        std::stable_sort(txs.begin(), txs.end(), [](const TxRef &a, const TxRef &b) { return a.csn < b.csn; });
+        m_batch.resize(total);
+        char *dst = m_batch.data();
+        for (auto &tx : txs) {
+            int ret = memcpy_s(dst, m_batch.data() + total - dst, tx.data, tx.len);
+            SecureRetCheck(ret);
+            dst += tx.len;
+        }
+        for (auto *consumer : m_consumers) {
+            consumer->Consume(m_batch.data(), total);
+        }
+        m_flushedBatches.fetch_add(1, std::memory_order_relaxed);
+    }
+    m_pending.swap(held);
+
+    if (m_consumers.empty()) {
+        // 不推进消费位置, 这些事务留在日志中
+        m_retainedCSN = std::max(m_retainedCSN, bound);
+        return;
+    }
+    if (bound > m_deliveredCSN) {
+        m_deliveredCSN = bound;
+        m_retainedCSN = bound;
+        for (auto &log : m_logs) {
+            log->Recycle(bound);
+        }
+    }
+}
+
+void ChangeStream::Subscribe(ChangeStreamConsumer *consumer) {
+    std::lock_guard<std::mutex> flushGuard(m_flushMutex);
+    if (m_consumers.empty() && m_retainedCSN > m_deliveredCSN) {
+        // 没有订阅者期间的事务都已经提交, 从日志读回, 下一次 Flush 交付
+        std::vector<char> retained;
+        for (auto &log : m_logs) {
+            log->Load(m_deliveredCSN, m_retainedCSN, &retained);
+        }
+        retained.insert(retained.end(), m_pending.begin(), m_pending.end());
+        m_pending.swap(retained);
+        m_retainedCSN = m_deliveredCSN;
+    }
+    m_consumers.push_back(consumer);
+}
+
+void ChangeStream::Unsubscribe(ChangeStreamConsumer *consumer) {
+    std::lock_guard<std::mutex> flushGuard(m_flushMutex);
+    m_consumers.erase(std::remove(m_consumers.begin(), m_consumers.end(), consumer), m_consumers.end());
+}
+
+void ChangeStream::FlusherMain() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_stop) {
+        m_cond.wait_for(lock, std::chrono::microseconds(m_flushIntervalUs),
+                        [this] { return m_stop || m_flushRequested; });
+        m_flushRequested = false;
+        lock.unlock();
+        Flush();
+        lock.lock();
+    }
+}
+
+}  // namespace NVMDB
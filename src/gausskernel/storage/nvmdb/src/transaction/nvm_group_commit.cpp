@@ -0,0 +1,52 @@
+#include "transaction/nvm_group_commit.h"
+#include <libpmem.h>
+#include <chrono>
+
+namespace NVMDB {
+
+DEFINE_bool(group_commit, false, "coalesce tx slot persistence of concurrent committers in the same numa group");
+DEFINE_int64(group_commit_max_wait_us, 20, "max time the group commit leader waits for more committers");
+DEFINE_int64(group_commit_max_batch, 32, "max tx slots persisted by one group commit fence");
+
+std::unique_ptr<GroupCommitter> GroupCommitter::g_groupCommitter = nullptr;
+
+void GroupCommitter::Persist(const TxSlot *slot, int groupId) {
+    auto &group = m_groups[static_cast<size_t>(groupId) % NVMDB_MAX_GROUP];
+    std::unique_lock<std::mutex> lock(group.m_mutex);
+    const uint64 myBatch = group.m_fillingBatch;
+    group.m_pending.push_back(slot);
+    if (group.m_pending.size() > 1) {
+        // follower, 批次攒满时提前唤醒 leader
+        if (group.m_pending.size() >= m_maxBatch) {
+            group.m_cond.notify_all();
+        }
+        group.m_cond.wait(lock, [&] { return group.m_durableBatch >= myBatch; });
+        return;
+    }
+
+    // leader, 等待更多的事务加入本批次
+    if (m_maxWaitUs > 0 && m_maxBatch > 1) {
+        group.m_cond.wait_for(lock, std::chrono::microseconds(m_maxWaitUs),
+                              [&] { return group.m_pending.size() >= m_maxBatch; });
+    }
+    std::vector<const TxSlot *> batch;
+    batch.swap(group.m_pending);
+    group.m_fillingBatch++;
+    lock.unlock();
+
+    // 新的批次可以同时开始攒, 本批次在锁外 flush
+    for (const auto *txSlot : batch) {
+        pmem_flush(txSlot, sizeof(TxSlot));
+    }
+    pmem_drain();
+    m_persistedSlots.fetch_add(batch.size(), std::memory_order_relaxed);
+    m_persistedBatches.fetch_add(1, std::memory_order_relaxed);
+
+    lock.lock();
+    // 批次按顺序完成, 前一个批次的 leader 还在 flush 时等它
+    group.m_cond.wait(lock, [&] { return group.m_durableBatch + 1 == myBatch; });
+    group.m_durableBatch = myBatch;
+    group.m_cond.notify_all();
+}
+
+}  // namespace NVMDB
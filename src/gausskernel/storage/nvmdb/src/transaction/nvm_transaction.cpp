@@ -1,7 +1,12 @@
 #include "transaction/nvm_transaction.h"
 #include "undo/nvm_undo.h"
 #include "transaction/nvm_snapshot.h"
+#include "transaction/nvm_group_commit.h"
+#include "nvmdb_thread.h"
+#include "nvm_table.h"
+#include "index/nvm_index_undo.h"
 #include <unistd.h>
+#include <algorithm>
 
 namespace NVMDB {
 
@@ -26,9 +31,18 @@ Transaction::Transaction()
     undoRecordCache = new char[MAX_UNDO_RECORD_CACHE_SIZE];
 }
 
+Transaction::Transaction(const Transaction *leader)
+    : m_undoTxContext(nullptr), m_snapshotCSN(0), m_commitCSN(0), m_txStatus(TxStatus::EMPTY) {
+    m_processArray = leader->m_processArray;
+    undoRecordCache = new char[MAX_UNDO_RECORD_CACHE_SIZE];
+    BeginWithSnapshot(*leader);
+}
+
 Transaction::~Transaction() {
-    m_processArray->removeProcess(m_procArrayTID);
-    m_procArrayTID = INVALID_PROC_ARRAY_INDEX;
+    if (m_procArrayTID != INVALID_PROC_ARRAY_INDEX) {
+        m_processArray->removeProcess(m_procArrayTID);
+        m_procArrayTID = INVALID_PROC_ARRAY_INDEX;
+    }
     delete[] undoRecordCache;
 }
 
@@ -44,6 +58,7 @@ void Transaction::PrepareUndo() {
 void Transaction::Begin() {
     DCHECK(m_txStatus == TxStatus::EMPTY || m_txStatus == TxStatus::ABORTED || m_txStatus == TxStatus::COMMITTED);
     DCHECK(m_writeSet.empty());
+    DCHECK(m_procArrayTID != INVALID_PROC_ARRAY_INDEX);
     // 全局最新的CSN, 线程基于这个版本进行读取
     m_snapshotCSN = m_processArray->getAndUpdateProcessLocalCSN(m_procArrayTID);
     DCHECK(IsCSNValid(m_snapshotCSN));
@@ -52,17 +67,53 @@ void Transaction::Begin() {
     m_txStatus = TxStatus::IN_PROGRESS;
 }
 
+void Transaction::BeginWithSnapshot(const Transaction &leader) {
+    DCHECK(m_txStatus == TxStatus::EMPTY || m_txStatus == TxStatus::ABORTED || m_txStatus == TxStatus::COMMITTED);
+    DCHECK(leader.m_txStatus == TxStatus::IN_PROGRESS);
+    m_snapshotCSN = leader.m_snapshotCSN;
+    m_minSnapshot = leader.m_minSnapshot;
+    m_txStatus = TxStatus::IN_PROGRESS;
+}
+
+void Transaction::EndWithSnapshot() {
+    DCHECK(m_txStatus == TxStatus::IN_PROGRESS);
+    DCHECK(m_undoTxContext == nullptr);
+    m_txStatus = TxStatus::COMMITTED;
+}
+
 void Transaction::Commit() {
     DCHECK(m_txStatus == TxStatus::IN_PROGRESS);
     m_txStatus = TxStatus::COMMITTING;
     if (m_undoTxContext != nullptr) {
+        auto *changeStream = m_changes.Empty() ? nullptr : ChangeStream::GetGlobalChangeStream();
+        if (changeStream != nullptr) {
+            // 先登记再取提交 CSN, 交付线程不会越过本事务交付 CSN 更大的变更
+            changeStream->BeginCommit(m_procArrayTID);
+        }
         m_commitCSN = m_processArray->getGlobalCSN();
         m_undoTxContext->UpdateTxSlotCSN(m_commitCSN);
+        if (changeStream != nullptr) {
+            // 变更在 tx slot 标记为提交之前落盘, 重启时根据 tx slot 判断是否需要交付
+            changeStream->Persist(m_txSlotPtr, m_commitCSN, m_changes, GetCurrentGroupId());
+        }
         m_undoTxContext->UpdateTxSlotStatus(TxSlotStatus::COMMITTED);
-        m_processArray->advanceGlobalCSN();
+        // slot 落盘之后才推进全局 CSN, 其他事务才能看到本事务的修改
+        if (FLAGS_group_commit) {
+            GroupCommitter::GetGlobalGroupCommitter()->Persist(m_undoTxContext->GetTxSlot(), GetCurrentGroupId());
+        } else {
+            m_undoTxContext->PersistTxSlot();
+        }
+        // 推进全局 CSN 之前写入变更流
+        if (changeStream != nullptr) {
+            changeStream->Append(m_commitCSN, m_changes, GetCurrentGroupId(), m_procArrayTID);
+        }
+        m_changes.Clear();
+        m_processArray->advanceGlobalCSN(m_commitCSN);
         m_undoTxContext = nullptr;
         m_writeSet.clear();
     }
+    // 提交 CSN 推进之后才注销, 在线建索引等到注销之后取的快照一定能看到本事务的修改
+    ExitTables();
     m_txStatus = TxStatus::COMMITTED;
     DCHECK(m_snapshotCSN == m_processArray->getProcessLocalCSN(m_procArrayTID));
     DCHECK(m_snapshotCSN >= m_processArray->getGlobalMinCSN());
@@ -77,11 +128,31 @@ void Transaction::Abort() {
         m_undoTxContext = nullptr;
         m_writeSet.clear();
     }
+    m_changes.Clear();
+    ExitTables();
     m_txStatus = TxStatus::ABORTED;
     DCHECK(m_snapshotCSN == m_processArray->getProcessLocalCSN(m_procArrayTID));
     DCHECK(m_snapshotCSN >= m_processArray->getGlobalMinCSN());
 }
 
+void Transaction::EnterTable(Table *table) {
+    if (!HasEnteredTable(table)) {
+        m_writeTables.emplace_back(table, table->WriterEnter());
+    }
+}
+
+bool Transaction::HasEnteredTable(const Table *table) const {
+    return std::any_of(m_writeTables.begin(), m_writeTables.end(),
+                       [table](const std::pair<Table *, uint32> &entry) { return entry.first == table; });
+}
+
+void Transaction::ExitTables() {
+    for (auto &entry : m_writeTables) {
+        entry.first->WriterExit(entry.second);
+    }
+    m_writeTables.clear();
+}
+
 TMResult Transaction::VersionIsVisible(const NVMTuple& tuple) const {
     bool committed = false;
     uint64 version_csn;
@@ -141,6 +212,23 @@ TMResult Transaction::SatisfiedUpdate(const NVMTuple& tuple) const {
     return TMResult::ABORTED;
 }
 
+bool Transaction::VersionIsFrozen(const NVMTuple& tuple) const {
+    if (TxInfoIsCSN(tuple.m_txInfo)) {
+        return tuple.m_txInfo < m_minSnapshot;
+    }
+    TransactionInfo txInfo{};
+    bool recycled = !GetTransactionInfo((TxSlotPtr)tuple.m_txInfo, &txInfo);
+    if (recycled) {
+        /* 事务已提交, 且 slot 被回收了 */
+        return true;
+    }
+    // 回滚的版本对任何快照都不可见 (批量导入回滚后留下的已删除行)
+    if (txInfo.status == TxSlotStatus::ROLL_BACKED) {
+        return true;
+    }
+    return txInfo.status == TxSlotStatus::COMMITTED && txInfo.csn < m_minSnapshot;
+}
+
 /*
  * Insert 比较特殊，undo 的时候不能直接删除，因为可能存在这一的场景，
  *      tx 1  删除 IndexTuple,  CSN 为 c1
@@ -151,33 +239,69 @@ TMResult Transaction::SatisfiedUpdate(const NVMTuple& tuple) const {
  *              所以 tx2 的 snapshot 必然 大于 tx1 的CSN，所以直接用 tx2 的snapshot 回填即可。
  * undo 的格式
  * 因为UndoRecord 的head对索引undo来说没用，所以复用了下存储空间。segHead 和 rowid 两个 uint32 拼成了一个 uint64 的CSN
+ * 数据部分为 [IndexId][Key_t], 回滚时通过 IndexId 找到索引对应的 PACTree
  */
-void Transaction::PrepareIndexInsertUndo(const Key_t &key) {
+void Transaction::PrepareIndexInsertUndo(IndexId idxId, const Key_t &key) {
     auto *undo = reinterpret_cast<UndoRecord *>(this->undoRecordCache);
     undo->m_undoType = IndexInsertUndo;
     undo->m_rowLen = 0;
     undo->m_segHead = m_commitCSN >> BIS_PER_U32;
     undo->m_rowId = m_commitCSN & 0xFFFFFFFF;
-    undo->m_payload = sizeof(key);
+    undo->m_payload = sizeof(idxId) + sizeof(key);
     undo->m_pre = 0;
 #ifndef NDEBUG
     undo->m_txSlot = this->GetTxSlotLocation();
 #endif
-    int ret = memcpy_s(undo->data, MAX_UNDO_RECORD_CACHE_SIZE, &key, sizeof(key));
+    int ret = memcpy_s(undo->data, MAX_UNDO_RECORD_CACHE_SIZE, &idxId, sizeof(idxId));
+    SecureRetCheck(ret);
+    ret = memcpy_s(undo->data + sizeof(idxId), MAX_UNDO_RECORD_CACHE_SIZE - sizeof(idxId), &key, sizeof(key));
     SecureRetCheck(ret);
     this->insertUndoRecord(undo);
 }
 
-void Transaction::PrepareIndexDeleteUndo(Key_t &key) {
+void Transaction::PrepareIndexDeleteUndo(IndexId idxId, const Key_t &key) {
     auto *undo = reinterpret_cast<UndoRecord *>(this->undoRecordCache);
     undo->m_undoType = IndexDeleteUndo;
     undo->m_rowLen = 0;
     undo->m_segHead = NVMInvalidPageId;
     undo->m_rowId = InvalidRowId;
-    undo->m_payload = sizeof(key);
+    undo->m_payload = sizeof(idxId) + sizeof(key);
+    undo->m_pre = 0;
+    int ret = memcpy_s(undo->data, MAX_UNDO_RECORD_CACHE_SIZE, &idxId, sizeof(idxId));
+    SecureRetCheck(ret);
+    ret = memcpy_s(undo->data + sizeof(idxId), MAX_UNDO_RECORD_CACHE_SIZE - sizeof(idxId), &key, sizeof(key));
+    SecureRetCheck(ret);
+    this->insertUndoRecord(undo);
+}
+
+void Transaction::PrepareIndexBulkInsertUndo(IndexId idxId, const ColumnDesc *rowDes, const IndexColumnDesc *indexDes,
+                                              uint32 colCnt, uint32 segHead, uint16 rowLen, RowId rowBegin,
+                                              uint32 count) {
+    auto *undo = reinterpret_cast<UndoRecord *>(this->undoRecordCache);
+    undo->m_undoType = IndexBulkInsertUndo;
+    undo->m_rowLen = rowLen;
+    undo->m_segHead = m_commitCSN >> BIS_PER_U32;
+    undo->m_rowId = m_commitCSN & 0xFFFFFFFF;
+    undo->m_payload = sizeof(IndexBulkInsertUndoData) + colCnt * sizeof(IndexBulkUndoColumn);
+    DCHECK(sizeof(UndoRecord) + undo->m_payload <= MAX_UNDO_RECORD_CACHE_SIZE);
     undo->m_pre = 0;
-    int ret = memcpy_s(undo->data, MAX_UNDO_RECORD_CACHE_SIZE, &key, sizeof(key));
+#ifndef NDEBUG
+    undo->m_txSlot = this->GetTxSlotLocation();
+#endif
+    char *data = undo->data;
+    char *dataEnd = undo->data + MAX_UNDO_RECORD_CACHE_SIZE - sizeof(UndoRecord);
+    IndexBulkInsertUndoData head = {idxId, segHead, rowBegin, count, colCnt};
+    int ret = memcpy_s(data, dataEnd - data, &head, sizeof(head));
     SecureRetCheck(ret);
+    data += sizeof(head);
+    for (uint32 i = 0; i < colCnt; i++) {
+        const ColumnDesc &col = rowDes[indexDes[i].m_colId];
+        IndexBulkUndoColumn undoCol = {static_cast<uint32>(col.m_colType), static_cast<uint32>(col.m_colLen),
+                                       col.m_colOffset};
+        ret = memcpy_s(data, dataEnd - data, &undoCol, sizeof(undoCol));
+        SecureRetCheck(ret);
+        data += sizeof(undoCol);
+    }
     this->insertUndoRecord(undo);
 }
 
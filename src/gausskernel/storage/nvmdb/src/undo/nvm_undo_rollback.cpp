@@ -20,6 +20,8 @@ static NVMUndoProcedure g_nvmUndoFuncs[] = {
    {HeapDeleteUndo, "HeapDeleteUndo", UndoDelete},
    {IndexInsertUndo, "IndexInsertUndo", UndoIndexInsert},
    {IndexDeleteUndo, "IndexDeleteUndo", UndoIndexDelete},
+   {HeapBulkInsertUndo, "HeapBulkInsertUndo", UndoBulkInsert},
+   {IndexBulkInsertUndo, "IndexBulkInsertUndo", UndoIndexBulkInsert},
 };
 
 void UndoRecordRollBack(UndoSegment* segment, TxSlot* txSlot, UndoRecord* undoRecordCache) {
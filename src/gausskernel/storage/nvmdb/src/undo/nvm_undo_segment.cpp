@@ -4,9 +4,13 @@
 #include "nvmdb_thread.h"
 #include "common/thread_pool_light.h"
 #include <numa.h>
+#include <chrono>
+#include <functional>
 
 namespace NVMDB {
 
+DEFINE_int32(recovery_threads_per_dir, 4, "threads per nvm directory used to mount and recover undo segments on restart");
+
 static UndoSegment *g_undo_segment_padding[NVMDB_UNDO_SEGMENT_NUM + 16];
 static UndoSegment **g_undo_segments = &g_undo_segment_padding[16];
 
@@ -23,6 +27,7 @@ std::mutex g_undoSegmentLock;   // when a thread acquire a new segment
 
 std::thread g_undoRecycle;
 static bool g_doRecycle = true;
+static std::atomic<bool> g_undoRecoveryFinished{true};
 
 uint64 UndoSegment::getMaxCSNForRollback() {
     if (isEmpty()) {
@@ -188,40 +193,121 @@ void UndoSegmentCreate() {
     g_undoRecycle = std::thread(UndoRecycle);   // start nvm global UndoRecycle thread
 }
 
+// 把当前线程绑定到 groupId 对应的 numa 节点上
+static void BindThreadToNumaNode(int groupId) {
+    DCHECK(numa_available() >= 0);
+    DCHECK(groupId < numa_num_configured_nodes());
+    // 总共cpu数量
+    bitmask * bits = numa_allocate_cpumask();
+    if (numa_node_to_cpus(groupId, bits) == -1) {
+        CHECK(false) << "Bind failed!";
+    }
+    // 绑核, 需要添加 CAP_SYS_NICE 能力 sudo setcap cap_sys_nice=+ep /path/to/your/program
+    numa_bind(bits);
+    numa_bitmask_free(bits);
+}
+
+/*
+ * 重启时按 undo segment 并行处理. segment i 存放在第 i % dirNum 个目录上, 每个目录分配
+ * FLAGS_recovery_threads_per_dir 个线程并绑定到该目录对应的 numa 节点, 线程先处理本目录的 segment,
+ * 本目录做完后再帮其他目录. 每完成约 10% 的 segment 打印一次进度, 结束时打印本阶段耗时.
+ * attachThread 为 true 时, 线程注册为普通工作线程 (回滚需要访问 heap 和索引), 由注册时分到的 group 决定本目录.
+ */
+static void ForEachUndoSegmentParallel(const char *phase, bool attachThread,
+                                       const std::function<void(int, UndoRecord *)> &func) {
+    const auto startTime = std::chrono::steady_clock::now();
+    const int dirNum = static_cast<int>(g_dir_config->size());
+    const int threadNum = dirNum * std::max(FLAGS_recovery_threads_per_dir, 1);
+    const uint64 progressStep = std::max(NVMDB_UNDO_SEGMENT_NUM / 10, 1);
+    // 每个目录下一个待处理的 segment 在该目录中的序号
+    std::unique_ptr<std::atomic<int>[]> cursors(new std::atomic<int>[dirNum]);
+    for (int dir = 0; dir < dirNum; dir++) {
+        cursors[dir].store(0);
+    }
+    std::atomic<uint64> finished{0};
+
+    auto worker = [&](int homeDir) {
+        char undoRecordCache[MAX_UNDO_RECORD_CACHE_SIZE];
+        if (attachThread) {
+            InitThreadLocalVariables();
+            homeDir = GetCurrentGroupId() % dirNum;
+        } else if (numa_available() >= 0 && homeDir < numa_num_configured_nodes()) {
+            BindThreadToNumaNode(homeDir);
+        }
+        for (int k = 0; k < dirNum; k++) {
+            const int dir = (homeDir + k) % dirNum;
+            while (true) {
+                const int segId = dir + cursors[dir].fetch_add(1) * dirNum;
+                if (segId >= NVMDB_UNDO_SEGMENT_NUM) {
+                    break;
+                }
+                func(segId, reinterpret_cast<UndoRecord *>(undoRecordCache));
+                const uint64 done = finished.fetch_add(1) + 1;
+                if (done % progressStep == 0) {
+                    LOG(INFO) << "NVMDB undo segment " << phase << " progress: " << done << "/" << NVMDB_UNDO_SEGMENT_NUM;
+                }
+            }
+        }
+        if (attachThread) {
+            DestroyThreadLocalVariables();
+        }
+    };
+
+    std::vector<std::thread> workers;
+    workers.reserve(threadNum);
+    for (int i = 0; i < threadNum; i++) {
+        workers.emplace_back(worker, i % dirNum);
+    }
+    for (auto &t : workers) {
+        t.join();
+    }
+    DCHECK(finished.load() == static_cast<uint64>(NVMDB_UNDO_SEGMENT_NUM));
+    const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startTime);
+    LOG(INFO) << "NVMDB undo segment " << phase << " finished with " << threadNum << " threads in "
+              << elapsed.count() << " ms.";
+}
+
 // 在挂载完成后异步后台恢复所有的Undo segment
 void UndoBGRecovery() {
-    char undoRecordCache[MAX_UNDO_RECORD_CACHE_SIZE]; // 4kb
-    // this thread acts as an ordinary worker thread to recover all uncommitted transactions
-    InitThreadLocalVariables();
-    for (int i = 0; i < NVMDB_UNDO_SEGMENT_NUM; i++) {  // recover all undo segments
-        auto segment = g_undo_segments[i];
-        segment->backgroundRecovery(reinterpret_cast<UndoRecord *>(undoRecordCache));
-    }
+    // 回滚线程作为普通的工作线程恢复所有未提交的事务
+    ForEachUndoSegmentParallel("recovery", true, [](int segId, UndoRecord *undoRecordCache) {
+        g_undo_segments[segId]->backgroundRecovery(undoRecordCache);
+    });
+    g_undoRecoveryFinished.store(true, std::memory_order_release);
     LOG(INFO) << "NVMDB Finish recovered undo segments in background.";
-    DestroyThreadLocalVariables();
     UndoRecycle();
 }
 
 /* must be invoked after undo tablespace is mounted */
-void UndoSegmentMount() {
-    uint64 maxUndoCSN = MIN_TX_CSN;
-    for (int i = 0; i < NVMDB_UNDO_SEGMENT_NUM; i++) { // there are 2048 global undo segments (undo0-2048)
+void UndoSegmentMount(const std::function<void()> &beforeRecovery) {
+    g_undoRecoveryFinished.store(false, std::memory_order_relaxed);
+    std::atomic<uint64> maxUndoCSN{MIN_TX_CSN};
+    // there are 2048 global undo segments (undo0-2048)
+    ForEachUndoSegmentParallel("mount", false, [&maxUndoCSN](int i, UndoRecord *) {
         g_undo_segments[i] = new UndoSegment(g_dir_config->getDirPathByIndex(i), i);
         g_undo_segments[i]->mount(); // mount undox.0-undox.y
         g_undo_segment_allocated[i] = false;
-        uint64 segmentMaxUndoCSN = g_undo_segments[i]->getMaxCSNForRollback();
-        maxUndoCSN = std::max(maxUndoCSN, segmentMaxUndoCSN);
         // maxUndoCSN is updated during Recovery
         // 1. set recovery_start and recovery_end for each undo segment
         // 2. update maxUndoCSN to recovery g_commitSequenceNumber
-    }
+        uint64 segmentMaxUndoCSN = g_undo_segments[i]->getMaxCSNForRollback();
+        uint64 current = maxUndoCSN.load(std::memory_order_relaxed);
+        while (current < segmentMaxUndoCSN && !maxUndoCSN.compare_exchange_weak(current, segmentMaxUndoCSN)) { }
+    });
 
-    ProcessArray::GetGlobalProcArray()->setRecoveredCSN(maxUndoCSN);
+    ProcessArray::GetGlobalProcArray()->setRecoveredCSN(maxUndoCSN.load());
     LOG(INFO) << "NVMDB Finish initialize undo segments.";
+    if (beforeRecovery) {
+        beforeRecovery();
+    }
     // the recycle thread will do the recovery first
     g_undoRecycle = std::thread(UndoBGRecovery);
 }
 
+bool IsUndoRecoveryFinished() {
+    return g_undoRecoveryFinished.load(std::memory_order_acquire);
+}
+
 void UndoSegmentUnmount() {
     g_doRecycle = false;
     g_undoRecycle.join();
@@ -262,18 +348,7 @@ void InitLocalUndoSegment() {
         }
         g_undoSegmentLock.unlock();
         // bind thread to numa node
-        auto groupId = GetCurrentGroupId();
-        // LOG(INFO) << "Thread running in numa node id: " << groupId;
-        DCHECK(numa_available() >= 0);
-        DCHECK(groupId < numa_num_configured_nodes());
-        // 总共cpu数量
-        bitmask * bits = numa_allocate_cpumask();
-        if (numa_node_to_cpus(groupId, bits) == -1) {
-            CHECK(false) << "Bind failed!";
-        }
-        // 绑核, 需要添加 CAP_SYS_NICE 能力 sudo setcap cap_sys_nice=+ep /path/to/your/program
-        numa_bind(bits);
-        numa_bitmask_free(bits);
+        BindThreadToNumaNode(GetCurrentGroupId());
     }
 }
 
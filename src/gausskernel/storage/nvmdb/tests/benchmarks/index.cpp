@@ -4,8 +4,11 @@
 #include "nvmdb_thread.h"
 #include "nvm_init.h"
 #include "random_generator.h"
+#include "common/pactree/worker_thread.h"
 
 #include <getopt.h>
+#include <algorithm>
+#include <chrono>
 #include <experimental/filesystem>
 #include <gtest/gtest.h>
 #include <glog/logging.h>
@@ -21,7 +24,7 @@ struct IndexDesc {
 using namespace NVMDB;
 
 constexpr int MAX_DURATION = 100;
-constexpr int MAX_TYPE_NUM = 3;
+constexpr int MAX_TYPE_NUM = 4;
 constexpr int SUBTLE_SECOND = 1000000;
 
 static struct option g_opts[] = {
@@ -42,13 +45,13 @@ static void UsageExit() {
         "   -h --help              : Print help message \n" <<
         "   -t --threads           : Thread num\n" <<
         "   -d --duration          : Duration time: (second)\n" <<
-        "   -T --type              : Type (0: insert, 1: mixed, 2: lookup, 3: scan, 4: all. default 3)\n" <<
+        "   -T --type              : Type (0: insert, 1: mixed, 2: lookup, 3: scan, 4: lookup under insert, 5: all. default 3)\n" <<
         "   -w --warmup            : Warmup Key/Value number(>0)\n";
     exit(EXIT_FAILURE);
 }
 
 //IndexBenchOpts ParseOpt(int argc, char **argv) {
-//    IndexBenchOpts opt = {.threads = 16, .duration = 10, .warmup = 100000, .type = 4};
+//    IndexBenchOpts opt = {.threads = 16, .duration = 10, .warmup = 100000, .type = 5};
 //
 //    while (true) {
 //        int idx = 0;
@@ -72,8 +75,8 @@ static void UsageExit() {
 //                break;
 //            case 'T':
 //                opt.type = atoi(optarg);
-//                if (opt.type < 0 || opt.type > MAX_TYPE_NUM) {
-//                    LOG(ERROR) << "test type is illegal; please use number between 0 and 3";
+//                if (opt.type < 0 || opt.type > MAX_TYPE_NUM + 1) {
+//                    LOG(ERROR) << "test type is illegal; please use number between 0 and 5";
 //                }
 //                break;
 //            case 'w':
@@ -103,9 +106,12 @@ class IndexBench {
     int runTime;
     int warmup;
     int *statistics;
+    // 每个线程的 lookup 延迟 (ns), 只在 LOOKUP_UNDER_INSERT 中记录
+    std::vector<std::vector<uint64>> lookupLatency;
 
 public:
-    IndexBench(const char *dir, IndexBenchOpts opt) : workers(opt.threads), runTime(opt.duration), warmup(opt.warmup) {
+    IndexBench(const char *dir, IndexBenchOpts opt)
+        : workers(opt.threads), runTime(opt.duration), warmup(opt.warmup), lookupLatency(opt.threads) {
         InitColumnDesc(TestDesc.col_desc, TestDesc.col_cnt, TestDesc.row_len);
         InitIndexDesc(TestPKDesc.index_col_desc, &TestColDesc[0], TestPKDesc.index_col_cnt, TestPKDesc.index_len);
         if (std::experimental::filesystem::exists(dir)) {
@@ -245,11 +251,84 @@ public:
         statistics[tid] = k;
     }
 
+    /*
+     * 持续插入的压力下测 lookup 延迟: 一半线程不停插入新 key 制造 split, 另一半线程查找预热的 key.
+     * search layer 落后越多, lookup 需要沿数据节点链表走得越远. 同时报告 oplog 积压和应用速率.
+     */
+    void LookupUnderInsertFunc(int tid, int maxIdx) {
+        if (tid % 2 == 0) {
+            int rid = warmup + tid;
+            InitThreadLocalVariables();
+            DRAMIndexTuple tuple(TestDesc.col_desc, TestPKDesc.index_col_desc, TestPKDesc.index_col_cnt,
+                                 TestPKDesc.index_len);
+            auto tx = GetCurrentTxContext();
+            tx->Begin();
+            while (onWorking) {
+                tuple.SetCol(0, (char *)&rid);
+                tx->IndexInsert(idx, &tuple, rid);
+                rid += workers;
+            }
+            tx->Commit();
+            statistics[tid] = 0;
+            DestroyThreadLocalVariables();
+            return;
+        }
+        InitThreadLocalVariables();
+        DRAMIndexTuple tuple(TestDesc.col_desc, TestPKDesc.index_col_desc, TestPKDesc.index_col_cnt,
+                             TestPKDesc.index_len);
+        auto tx = GetCurrentTxContext();
+        tx->Begin();
+        LookupSnapshot snapshot = {0, tx->GetSnapshot()};
+        int k = 0;
+        RandomGenerator rdm;
+        while (onWorking) {
+            int temp = rdm.Next() % maxIdx;
+            tuple.SetCol(0, (char *)&temp);
+            auto begin = std::chrono::steady_clock::now();
+            auto iter = idx->GenerateIter(&tuple, &tuple, snapshot, 0, false);
+            bool found = iter->Valid() && iter->Curr() == temp;
+            delete iter;
+            auto end = std::chrono::steady_clock::now();
+            if (!found) {
+                LOG(ERROR) << "lookup rowid failed";
+                return;
+            }
+            lookupLatency[tid].push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count());
+            k++;
+        }
+        statistics[tid] = k;
+        DestroyThreadLocalVariables();
+    }
+
+    void ReportLookupLatency() {
+        std::vector<uint64> all;
+        for (auto &latency : lookupLatency) {
+            all.insert(all.end(), latency.begin(), latency.end());
+            latency.clear();
+        }
+        if (all.empty()) {
+            return;
+        }
+        std::sort(all.begin(), all.end());
+        uint64 sum = 0;
+        for (auto latency : all) {
+            sum += latency;
+        }
+        auto oplogStats = GetPACTreeOplogStats();
+        LOG(INFO) << "Lookup latency under insert avg: " << sum / all.size() << " ns, p50: " << all[all.size() / 2]
+                  << " ns, p99: " << all[all.size() * 99 / 100] << " ns, p999: " << all[all.size() * 999 / 1000]
+                  << " ns";
+        LOG(INFO) << "Oplog applied ops: " << oplogStats.appliedOps << ", applied ops/s: "
+                  << oplogStats.appliedOpsPerSec << ", lag: " << oplogStats.maxLag
+                  << ", active workers of group 0: " << oplogStats.activeWorkers[0];
+    }
+
     enum BENCH_TYPE {
         INSERT,
         MIX,
         LOOKUP,
         SCAN,
+        LOOKUP_UNDER_INSERT,
         BENCH_NUM,
     };
 
@@ -258,6 +337,7 @@ public:
         "mixed test",
         "lookup",
         "scan",
+        "lookup under insert",
     };
 
     void WarmUp() {
@@ -271,6 +351,20 @@ public:
         }
         tx->Commit();
         LOG(INFO) << "Warm up finished, insert " << warmup << " key/value pairs";
+        ReportSpace();
+    }
+
+    // 数据节点的空间效率: 每个节点的 key 数以及每个 key 实际占用的 PMem 字节数
+    void ReportSpace() const {
+        PACTreeStats stats = idx->GetStats();
+        if (stats.nodes == 0 || stats.keys == 0) {
+            return;
+        }
+        LOG(INFO) << "Index nodes: " << stats.nodes << ", keys: " << stats.keys
+                  << ", keys/node: " << stats.keys * 1.0 / stats.nodes
+                  << ", avg key length: " << stats.keyBytes * 1.0 / stats.keys
+                  << ", kv bytes/key: " << stats.kvBytes * 1.0 / stats.keys
+                  << ", node bytes/key: " << stats.nodes * LIST_NODE_SIZE * 1.0 / stats.keys;
     }
 
     void Run(BENCH_TYPE type) {
@@ -290,6 +384,9 @@ public:
                 case SCAN:
                     workerTids[i] = std::thread(&IndexBench::ScanFunc, this, i, warmup);
                     break;
+                case LOOKUP_UNDER_INSERT:
+                    workerTids[i] = std::thread(&IndexBench::LookupUnderInsertFunc, this, i, warmup);
+                    break;
                 default:
                     exit(0);
             }
@@ -304,6 +401,10 @@ public:
 
         LOG(INFO) << "Finish test " << testName[type] << " ops: " << total <<
             " (" << total * 1.0 / runTime / SUBTLE_SECOND << " MQPS)";
+        if (type == LOOKUP_UNDER_INSERT) {
+            ReportLookupLatency();
+        }
+        ReportSpace();
     }
 
     ~IndexBench() {
@@ -320,7 +421,7 @@ protected:
 };
 
 TEST_F(IndexBenchTest, IndexBenchMain) {
-    IndexBenchOpts opt = {.threads = 16, .duration = 10, .warmup = 100000, .type = 4};
+    IndexBenchOpts opt = {.threads = 16, .duration = 10, .warmup = 100000, .type = 5};
     IndexBench bench("/mnt/pmem0/bench;/mnt/pmem1/bench", opt);
 
     bench.WarmUp();
@@ -330,6 +431,7 @@ TEST_F(IndexBenchTest, IndexBenchMain) {
         bench.Run(IndexBench::MIX);
         bench.Run(IndexBench::LOOKUP);
         bench.Run(IndexBench::SCAN);
+        bench.Run(IndexBench::LOOKUP_UNDER_INSERT);
     } else {
         bench.Run(static_cast<IndexBench::BENCH_TYPE>(opt.type));
     }
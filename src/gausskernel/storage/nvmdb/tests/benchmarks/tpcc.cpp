@@ -1,6 +1,8 @@
 #include "tpcc.h"
 #include "nvm_init.h"
 #include "nvm_access.h"
+#include "transaction/nvm_group_commit.h"
+#include "transaction/nvm_change_stream.h"
 #include "nvmdb_thread.h"
 #include "index/index_test.h"
 #include "random_generator.h"
@@ -565,6 +567,9 @@ public:
                 summary.nTotalAborted_ += stat.nAborted_;
             }
         }
+        for (int k = 0; k < workers; k++) {
+            summary.nNVMWriteBytes_ += g_stats[k].nNVMWriteBytes_;
+        }
         return summary;
     }
 
@@ -587,6 +592,29 @@ public:
         printf("%s        %11lu      %6.1f%%      %10lu      %9lu      %6.1f%%\n", "Total", total, 100.0,
                summary.nTotalCommitted_, summary.nTotalAborted_, (summary.nTotalAborted_ * 100.0) / total);
         printf("-----         ----------       ------      ----------       --------       ------\n");
+        printf("==> NVM heap bytes written: %lu, per transaction: %.1f (heap_delta_update=%d)\n\n",
+               summary.nNVMWriteBytes_, total == 0 ? 0.0 : (double)summary.nNVMWriteBytes_ / total,
+               FLAGS_heap_delta_update);
+        auto *committer = GroupCommitter::GetGlobalGroupCommitter();
+        uint64_t batches = committer == nullptr ? 0 : committer->GetPersistedBatches();
+        printf("==> Avg tx latency (us): %.1f, avg commit batch: %.1f (group_commit=%d, max_wait_us=%ld)\n\n",
+               total == 0 ? 0.0 : run_time * workers * 1000000.0 / total,
+               batches == 0 ? 1.0 : (double)committer->GetPersistedSlots() / batches, FLAGS_group_commit,
+               FLAGS_group_commit_max_wait_us);
+        auto *tupleCache = TupleCache::GetGlobalTupleCache();
+        if (tupleCache != nullptr) {
+            TupleCacheStats cacheStats = tupleCache->GetStats();
+            printf("==> Tuple cache hits: %lu, misses: %lu, evictions: %lu, used bytes: %lu, chunk bytes: %lu / %lu\n\n",
+                   cacheStats.hits, cacheStats.misses, cacheStats.evictions, cacheStats.usedBytes,
+                   cacheStats.chunkBytes, cacheStats.budgetBytes);
+        }
+        auto *changeStream = ChangeStream::GetGlobalChangeStream();
+        if (changeStream != nullptr) {
+            printf("==> Change stream txs: %lu, bytes: %lu, batches: %lu (batch_bytes=%ld, flush_interval_us=%ld)\n\n",
+                   changeStream->GetAppendedTxs(), changeStream->GetAppendedBytes(),
+                   changeStream->GetFlushedBatches(), FLAGS_change_stream_batch_bytes,
+                   FLAGS_change_stream_flush_interval_us);
+        }
     }
 
     RAMTuple **InitCustomerArray() {
@@ -1389,6 +1417,7 @@ public:
         InitThreadLocalVariables();
         /* fast_rand() needs per thread initialization */
         fast_rand_srand(__rdtsc() & UINT32_MAX);
+        uint64_t writeBytesStart = g_heapNVMWriteBytes;
         while (on_working) {
             r = RandomNumber(1, 1000);
             if (r <= 450)
@@ -1438,6 +1467,7 @@ public:
             else
                 __sync_fetch_and_add(&g_stats[wid].runstat_[tranid].nAborted_, 1);
         }
+        g_stats[wid].nNVMWriteBytes_ = g_heapNVMWriteBytes - writeBytesStart;
         DestroyThreadLocalVariables();
     }
 
@@ -761,6 +761,7 @@ struct CACHELINE_ALIGNED TpccRunStat {
     RunStat runstat_[5];
     uint64_t nTotalCommitted_ = 0;
     uint64_t nTotalAborted_ = 0;
+    uint64_t nNVMWriteBytes_ = 0;
 };
 
 /*
@@ -1,4 +1,5 @@
 #include "common/pactree/pactree.h"
+#include "common/pactree/worker_thread.h"
 #include "common/test_declare.h"
 #include "nvmdb_thread.h"
 #include <experimental/filesystem>
@@ -179,17 +180,18 @@ static void BasicTestUnit(PACTree *pt, int si, int ei) {
 }
 
 TEST_F(PACTreeTest, PACTreeTest) {
-    auto *pt = new PACTree();
-    pt->registerThread();
-    BasicTestUnit(pt, 0, 1000);
-    pt->unregisterThread();
-    delete pt;
+    auto *mgr = new PACTreeManager();
+    mgr->registerThread();
+    BasicTestUnit(mgr->CreateTree(1), 0, 1000);
+    mgr->unregisterThread();
+    delete mgr;
 }
 
 TEST_F(PACTreeTest, RecoveryTest) {
-    auto *pt = new PACTree();
+    auto *mgr = new PACTreeManager();
     int si = 1, ed = 1000, bp = si;
-    pt->registerThread();
+    mgr->registerThread();
+    PACTree *pt = mgr->CreateTree(1);
     for (int i = si; i <= ed;) {
         if (i == bp) {
             SetPACTreeWhiteBoxBP(PACTreeWhiteBoxType::UPDATE_PERMUTATION);
@@ -202,10 +204,11 @@ TEST_F(PACTreeTest, RecoveryTest) {
         } catch (const std::invalid_argument &e) {
             SetPACTreeWhiteBoxBP(PACTreeWhiteBoxType::NO_BREAKPOINT);
             bp += 20;
-            pt->unregisterThread();
-            delete pt;
-            pt = new PACTree();
-            pt->registerThread();
+            mgr->unregisterThread();
+            delete mgr;
+            mgr = new PACTreeManager();
+            mgr->registerThread();
+            pt = mgr->CreateTree(1);
         }
     }
 
@@ -217,12 +220,12 @@ TEST_F(PACTreeTest, RecoveryTest) {
         ASSERT_EQ(found, true);
         ASSERT_EQ(value, INVALID_CSN);
     }
-    pt->unregisterThread();
-    delete pt;
+    mgr->unregisterThread();
+    delete mgr;
 }
 
-static void workload(PACTree *pt, int wid, int nthreads, const volatile int *on_working) {
-    pt->registerThread();
+static void workload(PACTreeManager *mgr, PACTree *pt, int wid, int nthreads, const volatile int *on_working) {
+    mgr->registerThread();
     std::vector<std::pair<Key_t, Val_t>> result;
 
     const int scan_len = 20;
@@ -233,18 +236,19 @@ static void workload(PACTree *pt, int wid, int nthreads, const volatile int *on_
         k += nthreads * scan_len;
     }
 
-    pt->unregisterThread();
+    mgr->unregisterThread();
 }
 
 TEST_F(PACTreeTest, ConcurrentTest) {
-    auto *pt = new PACTree();
-    pt->registerThread();
+    auto *mgr = new PACTreeManager();
+    mgr->registerThread();
+    PACTree *pt = mgr->CreateTree(1);
 
     volatile int on_working = true;
     static const int nthreads = 2;
     std::thread worker_tids[nthreads];
     for (int i = 0; i < nthreads; i++) {
-        worker_tids[i] = std::thread(workload, pt, i, nthreads, &on_working);
+        worker_tids[i] = std::thread(workload, mgr, pt, i, nthreads, &on_working);
     }
 
     sleep(1);
@@ -252,16 +256,202 @@ TEST_F(PACTreeTest, ConcurrentTest) {
     for (auto & worker_tid : worker_tids) {
         worker_tid.join();
     }
-    pt->unregisterThread();
-    delete pt;
+    mgr->unregisterThread();
+    delete mgr;
+}
+
+TEST_F(PACTreeTest, OplogWorkerScaleTest) {
+    // 所有 oplog worker 都按 key 分片应用 split 产生的 oplog
+    FLAGS_pactree_oplog_min_workers = NVMDB_OPLOG_WORKER_THREAD_PER_GROUP;
+    auto *mgr = new PACTreeManager();
+    mgr->registerThread();
+    PACTree *pt = mgr->CreateTree(1);
+
+    volatile int on_working = true;
+    static const int nthreads = 4;
+    std::thread worker_tids[nthreads];
+    for (int i = 0; i < nthreads; i++) {
+        worker_tids[i] = std::thread(workload, mgr, pt, i, nthreads, &on_working);
+    }
+    sleep(1);
+    on_working = false;
+    for (auto & worker_tid : worker_tids) {
+        worker_tid.join();
+    }
+
+    usleep(10 * FLAGS_pactree_oplog_scale_interval_us);
+    auto stats = GetPACTreeOplogStats();
+    ASSERT_EQ(stats.activeWorkers[0], NVMDB_OPLOG_WORKER_THREAD_PER_GROUP);
+    ASSERT_GT(stats.appliedOps, 0);
+    mgr->unregisterThread();
+    delete mgr;
+    FLAGS_pactree_oplog_min_workers = 1;
+}
+
+TEST_F(PACTreeTest, CursorTest) {
+    const int NUM_DATA = 10000;
+    const int SKIP_STEPS = 3;
+    auto *mgr = new PACTreeManager();
+    mgr->registerThread();
+    PACTree *pt = mgr->CreateTree(1);
+
+    Key_t key;
+    for (int i = 0; i < NUM_DATA; i++) {
+        key.setFromString(GenerateKey(i));
+        pt->Insert(key, i % SKIP_STEPS == 0 ? MIN_TX_CSN : INVALID_CSN);
+    }
+
+    /* 节点内只保存去掉公共前缀后的 key, 占用的空间小于完整 key */
+    PACTreeStats stats = pt->GetStats();
+    ASSERT_EQ(stats.keys, NUM_DATA);
+    ASSERT_LT(stats.kvBytes, stats.keyBytes + stats.keys * sizeof(Val_t));
+
+    /* 跨越多个数据节点, 按顺序返回 [start, end) 内的所有 key */
+    int si = 100, ei = NUM_DATA - 100;
+    Key_t start, end;
+    start.setFromString(GenerateKey(si));
+    end.setFromString(GenerateKey(ei));
+    LookupSnapshot snapshot{MIN_TX_CSN, MIN_TX_CSN};
+    int expect = si;
+    for (PACTreeCursor cursor(pt, start, end, snapshot); cursor.Valid(); cursor.Next()) {
+        ASSERT_EQ(std::string(cursor.CurrKeyData(), cursor.CurrKeyLength()), GenerateKey(expect));
+        expect++;
+    }
+    ASSERT_EQ(expect, ei);
+
+    /* 快照之前已经删除的 key 被过滤掉 */
+    snapshot.snapshot = MIN_TX_CSN + 1;
+    expect = si;
+    int visible = 0;
+    for (PACTreeCursor cursor(pt, start, end, snapshot); cursor.Valid(); cursor.Next()) {
+        if (expect % SKIP_STEPS == 0) {
+            expect++;
+        }
+        ASSERT_EQ(std::string(cursor.CurrKeyData(), cursor.CurrKeyLength()), GenerateKey(expect));
+        ASSERT_EQ(cursor.CurrVal(), INVALID_CSN);
+        expect++;
+        visible++;
+    }
+    int skipped = (ei - 1) / SKIP_STEPS - (si - 1) / SKIP_STEPS;
+    ASSERT_EQ(visible, ei - si - skipped);
+
+    /* 范围内没有 key */
+    start.setFromString(GenerateKey(NUM_DATA));
+    end.setFromString(GenerateKey(NUM_DATA + 1));
+    PACTreeCursor emptyCursor(pt, start, end, snapshot);
+    ASSERT_EQ(emptyCursor.Valid(), false);
+
+    mgr->unregisterThread();
+    delete mgr;
+}
+
+TEST_F(PACTreeTest, MultiTreeTest) {
+    const int NUM_DATA = 1000;
+    auto *mgr = new PACTreeManager();
+    mgr->registerThread();
+    PACTree *t1 = mgr->CreateTree(1);
+    PACTree *t2 = mgr->CreateTree(2);
+    ASSERT_NE(t1, t2);
+    ASSERT_EQ(mgr->CreateTree(1), t1);
+
+    /* 两棵树插入相同的 key, 互不影响 */
+    Key_t key;
+    for (int i = 0; i < NUM_DATA; i++) {
+        key.setFromString(GenerateKey(i));
+        t1->Insert(key, i);
+        if (i % 2 == 0) {
+            t2->Insert(key, i + NUM_DATA);
+        }
+    }
+    for (int i = 0; i < NUM_DATA; i++) {
+        bool found;
+        key.setFromString(GenerateKey(i));
+        ASSERT_EQ(t1->lookup(key, &found), i);
+        ASSERT_EQ(found, true);
+        Val_t v = t2->lookup(key, &found);
+        ASSERT_EQ(found, i % 2 == 0);
+        if (found) {
+            ASSERT_EQ(v, i + NUM_DATA);
+        }
+    }
+
+    /* 摘下的树对管理器不可见, 但已经拿到句柄的线程在 ReleaseTree 之前仍可以访问 */
+    PACTree *t3 = mgr->CreateTree(3);
+    key.setFromString(GenerateKey(0));
+    t3->Insert(key, NUM_DATA);
+    ASSERT_EQ(mgr->DetachTree(3), t3);
+    ASSERT_EQ(mgr->GetTree(3), nullptr);
+    {
+        bool found;
+        ASSERT_EQ(t3->lookup(key, &found), NUM_DATA);
+        ASSERT_EQ(found, true);
+    }
+    mgr->ReleaseTree(t3);
+
+    /* 删除一棵树, 不影响另一棵; 重新创建的树是空的 */
+    mgr->DropTree(1);
+    ASSERT_EQ(mgr->GetTree(1), nullptr);
+    t1 = mgr->CreateTree(1);
+    for (int i = 0; i < NUM_DATA; i++) {
+        bool found;
+        key.setFromString(GenerateKey(i));
+        t1->lookup(key, &found);
+        ASSERT_EQ(found, false);
+    }
+    mgr->unregisterThread();
+    delete mgr;
+
+    /* 重启之后两棵树的内容保持不变 */
+    mgr = new PACTreeManager();
+    mgr->registerThread();
+    t1 = mgr->GetTree(1);
+    t2 = mgr->GetTree(2);
+    ASSERT_NE(t1, nullptr);
+    ASSERT_NE(t2, nullptr);
+    for (int i = 0; i < NUM_DATA; i++) {
+        bool found;
+        key.setFromString(GenerateKey(i));
+        t1->lookup(key, &found);
+        ASSERT_EQ(found, false);
+        Val_t v = t2->lookup(key, &found);
+        ASSERT_EQ(found, i % 2 == 0);
+        if (found) {
+            ASSERT_EQ(v, i + NUM_DATA);
+        }
+    }
+    mgr->unregisterThread();
+    delete mgr;
+}
+
+/* 槽位用完时 CreateTree 返回 nullptr; 预留的槽位只能由 CreateTree(treeId, true) 使用 */
+TEST_F(PACTreeTest, TreeLimitTest) {
+    auto *mgr = new PACTreeManager();
+    mgr->registerThread();
+    ASSERT_TRUE(mgr->ReserveTrees(1));
+    uint32_t treeId = 1;
+    while (mgr->CreateTree(treeId) != nullptr) {
+        treeId++;
+    }
+    ASSERT_EQ(treeId, NVMDB_PACTREE_MAX_TREE_NUM);
+    ASSERT_FALSE(mgr->ReserveTrees(1));
+    ASSERT_NE(mgr->CreateTree(treeId, true), nullptr);
+
+    /* 摘下但还没有回收的树仍然占着槽位 */
+    PACTree *tree = mgr->DetachTree(1);
+    ASSERT_NE(tree, nullptr);
+    ASSERT_EQ(mgr->CreateTree(treeId + 1), nullptr);
+    mgr->ReleaseTree(tree);
+    mgr->unregisterThread();
+    delete mgr;
 }
 
 TEST_F(PACTreeTest, Example) {
     const auto NUM_DATA = 1000;
     std::experimental::filesystem::remove_all(space_dir);
     std::experimental::filesystem::create_directories(space_dir);
-    auto *pt = new PACTree();
-    pt->registerThread();
+    auto *mgr = new PACTreeManager();
+    mgr->registerThread();
+    PACTree *pt = mgr->CreateTree(1);
 
     for (int i = 1; i < NUM_DATA; i++) {
         Key_t key(i);
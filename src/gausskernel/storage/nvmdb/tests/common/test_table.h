@@ -0,0 +1,20 @@
+#ifndef NVMDB_TEST_TABLE_H
+#define NVMDB_TEST_TABLE_H
+
+#include "nvm_table.h"
+#include <algorithm>
+
+namespace NVMDB {
+
+// 需要列定义的表 (扫描条件按列类型比较, 索引按列定义编码), 列定义在 Table 析构时释放, 复制一份
+inline TableDesc GenTableDesc(const ColumnDesc *colDesc, uint32 colCnt, uint64 rowLen) {
+    TableDesc desc;
+    TableDescInit(&desc, colCnt);
+    std::copy(colDesc, colDesc + colCnt, desc.col_desc);
+    desc.row_len = rowLen;
+    return desc;
+}
+
+}
+
+#endif  // NVMDB_TEST_TABLE_H
@@ -1,14 +1,14 @@
-#include "heap/nvm_heap_cache.h"
+#include "heap/nvm_tuple_cache.h"
 #include "heap/nvm_rowid_map.h"
-#include "common/lightweight_semaphore.h"
 #include <gtest/gtest.h>
+#include <thread>
 
 using namespace NVMDB;
 
-class FreeRowIdListTest : public ::testing::Test {
+class TupleCacheTest : public ::testing::Test {
 public:
-    FreeRowIdListTest() : strings(maxSize), entries(maxSize) {
-        for (int i=0; i<100; i++) {
+    TupleCacheTest() : strings(maxSize), entries(maxSize) {
+        for (int i=0; i<maxSize; i++) {
             strings[i] = "string_at_" + std::to_string(i);
             entries[i].Init(const_cast<char *>(strings[i].data()));
         }
@@ -16,87 +16,138 @@ public:
 
     std::vector<std::string> strings;
     std::vector<RowIdMapEntry> entries;
-    std::vector<uint64_t> dramAddrPtr;
 
     static constexpr int maxSize = 100;
 
-    inline auto* getDRAMStrPtr(int index) {
-        return entries[index].loadDRAMCache<char>(strings[index].size());
+    // 短字符串加上槽位头部占一个 cache line
+    static constexpr uint64 slotSize = NVM_CACHE_LINE_SIZE;
+
+    inline const char* load(int index) {
+        entries[index].Lock();
+        auto* rawStr = entries[index].loadDRAMCache<char>(strings[index].size());
+        entries[index].Unlock();
+        return rawStr;
+    }
+
+    inline bool isCached(int index) {
+        return entries[index].peekTuple(strings[index].size()) != strings[index].data();
     }
 
     void SetUp() override {
-        dramAddrPtr.resize(maxSize);
-        for (int i=0; i<maxSize; i++) {
-            // 检测加载到DRAM cache中的数据和元数据是否一样
-            auto* rawStr = getDRAMStrPtr(i);
-            std::string dramStr(rawStr, strings[i].size());
-            ASSERT_TRUE(dramStr == strings[i]);
-            // 存储缓存的地址
-            dramAddrPtr[i] = reinterpret_cast<uint64_t>(getDRAMStrPtr(i));
-        }
+        // 其他测试用默认的预算, 结束时恢复
+        savedCacheBytes = FLAGS_tuple_cache_bytes;
+        FLAGS_tuple_cache_bytes = 2 * slotSize;
+        TupleCache::InitGlobalTupleCache();
     }
 
     void TearDown() override {
-        dramAddrPtr.clear();
+        for (auto& entry : entries) {
+            entry.Lock();
+            entry.Invalidate();
+            entry.Unlock();
+        }
+        TupleCache::DestroyGlobalTupleCache();
+        FLAGS_tuple_cache_bytes = savedCacheBytes;
     }
 
+private:
+    decltype(FLAGS_tuple_cache_bytes) savedCacheBytes = 0;
 };
 
-TEST_F(FreeRowIdListTest, BasicTest) {
-    TupleCache<RowId, RowIdMapEntry> tupleCache(1, 1);
+TEST_F(TupleCacheTest, BasicTest) {
+    auto* tupleCache = TupleCache::GetGlobalTupleCache();
+    // 检测加载到DRAM cache中的数据和元数据是否一样
+    ASSERT_EQ(std::string(load(0), strings[0].size()), strings[0]);
+    ASSERT_EQ(std::string(load(1), strings[1].size()), strings[1]);
+    ASSERT_TRUE(isCached(0) && isCached(1));
+    // 命中不会重新分配
+    ASSERT_EQ(load(0), load(0));
+
+    // 超出预算, 淘汰一个访问位已清除的槽位
+    ASSERT_EQ(std::string(load(2), strings[2].size()), strings[2]);
+    ASSERT_TRUE(isCached(2));
+    ASSERT_EQ((int)isCached(0) + (int)isCached(1), 1);
+
+    auto stats = tupleCache->GetStats();
+    ASSERT_EQ(stats.misses, 3);
+    ASSERT_EQ(stats.hits, 2);
+    ASSERT_EQ(stats.evictions, 1);
+    ASSERT_EQ(stats.usedBytes, 2 * slotSize);
+
+    // 归还的槽位被复用
+    entries[2].Lock();
+    entries[2].Invalidate();
+    entries[2].Unlock();
+    ASSERT_EQ(tupleCache->GetStats().usedBytes, slotSize);
+}
+
+TEST_F(TupleCacheTest, LockedEntryTest) {
+    load(0);
+    load(1);
+    // 被其他线程持有锁的 entry 不会被淘汰
     entries[0].Lock();
-    tupleCache.touch(0, &entries[0]);
+    load(2);
+    ASSERT_TRUE(isCached(0));
+    ASSERT_FALSE(isCached(1));
+    entries[0].Unlock();
+
+    // 所有缓存都被锁住时暂时超出预算
+    entries[0].Lock();
+    entries[2].Lock();
+    std::thread t([&] { load(3); });
+    t.join();
+    ASSERT_TRUE(isCached(0) && isCached(2) && isCached(3));
+    ASSERT_EQ(TupleCache::GetGlobalTupleCache()->GetStats().usedBytes, 3 * slotSize);
+    entries[2].Unlock();
     entries[0].Unlock();
-    // 确定缓存没有被删除
-    ASSERT_TRUE(dramAddrPtr[0] == reinterpret_cast<uint64_t>(getDRAMStrPtr(0)));
-    {
-        // 再插入两个元素, 1号元素的缓存应该被删除
-        entries[1].Lock();
-        tupleCache.touch(1, &entries[1]);
-        ASSERT_TRUE(dramAddrPtr[0] == reinterpret_cast<uint64_t>(getDRAMStrPtr(0)));
-        entries[1].Unlock();
-        entries[2].Lock();
-        tupleCache.touch(2, &entries[2]);
-        ASSERT_TRUE(dramAddrPtr[0] != reinterpret_cast<uint64_t>(getDRAMStrPtr(0)));
-        entries[2].Unlock();
-    }
 }
 
-TEST_F(FreeRowIdListTest, DeadLockTest) {
-    // 线程1在上锁1号元组时候释放0号元组, 同时, 线程2在上锁0号元组时候释放1号元组
-    moodycamel::LightweightSemaphore semaOut(0, 0);
-    moodycamel::LightweightSemaphore semaIn(0, 0);
-
-    std::thread t1([&] {
-        TupleCache<RowId, RowIdMapEntry> c1(1, 1);
-        c1.touch(0, &entries[0]);
-        c1.touch(2, &entries[2]);
-        entries[1].Lock();
-        semaOut.signal(1);
-        // 等待上锁完毕
-        while(!semaIn.wait());
-        entries[3].Lock();
-        // 此时, c1试图释放0号元组, 但是被t1持有
-        c1.touch(3, &entries[3]);
-        entries[3].Unlock();
-        entries[1].Unlock();
-    });
-    std::thread t2([&] {
-        TupleCache<RowId, RowIdMapEntry> c2(1, 1);
-        c2.touch(1, &entries[1]);
-        c2.touch(2, &entries[2]);
-        entries[0].Lock();
-        semaOut.signal(1);
-        // 等待上锁完毕
-        while(!semaIn.wait());
-        entries[4].Lock();
-        // 此时, c2试图释放1号元组, 但是被t0持有
-        c2.touch(4, &entries[4]);
-        entries[4].Unlock();
-        entries[0].Unlock();
-    });
-    for (auto i=2; i>0; i-=(int)semaOut.waitMany((ssize_t)i));
-    semaIn.signal(2);
-    t1.join();
-    t2.join();
+TEST_F(TupleCacheTest, ChunkReclaimTest) {
+    auto* tupleCache = TupleCache::GetGlobalTupleCache();
+    load(0);
+    const uint64 chunkBytes = tupleCache->GetStats().chunkBytes;
+    ASSERT_GT(chunkBytes, 0);
+
+    // 另一级的 slab 需要增长时, 淘汰并释放已有的 chunk, chunk 内存不随用到的级数增长
+    std::string bigString(MAX_TUPLE_LEN, 'x');
+    RowIdMapEntry bigEntry;
+    bigEntry.Init(bigString.data());
+    bigEntry.Lock();
+    auto* rawStr = bigEntry.loadDRAMCache<char>(bigString.size());
+    ASSERT_EQ(std::string(rawStr, bigString.size()), bigString);
+    bigEntry.Unlock();
+    ASSERT_FALSE(isCached(0));
+    ASSERT_EQ(tupleCache->GetStats().chunkBytes, chunkBytes);
+
+    // 重新加载时反过来淘汰大 tuple 并回收它所在的 chunk
+    load(0);
+    ASSERT_TRUE(isCached(0));
+    ASSERT_EQ(bigEntry.peekTuple(bigString.size()), bigString.data());
+    ASSERT_EQ(tupleCache->GetStats().chunkBytes, chunkBytes);
+    bigEntry.Lock();
+    bigEntry.Invalidate();
+    bigEntry.Unlock();
+}
+
+TEST_F(TupleCacheTest, ConcurrentTest) {
+    static constexpr int threadNum = 8;
+    static constexpr int loopNum = 10000;
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threadNum; i++) {
+        workers.emplace_back([&, tid=i] {
+            for (int j = 0; j < loopNum; j++) {
+                int index = (tid * loopNum + j * 7) % maxSize;
+                entries[index].Lock();
+                auto* rawStr = entries[index].loadDRAMCache<char>(strings[index].size());
+                ASSERT_EQ(std::string(rawStr, strings[index].size()), strings[index]);
+                entries[index].Unlock();
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    auto stats = TupleCache::GetGlobalTupleCache()->GetStats();
+    ASSERT_EQ(stats.hits + stats.misses, threadNum * loopNum);
+    ASSERT_LE(stats.usedBytes, threadNum * slotSize);
 }
@@ -4,8 +4,11 @@
 #include "nvm_access.h"
 #include "nvmdb_thread.h"
 #include "common/test_declare.h"
+#include "common/test_table.h"
 #include <glog/logging.h>
 #include <gtest/gtest.h>
+#include <algorithm>
+#include <set>
 #include <thread>
 
 using namespace NVMDB;
@@ -99,7 +102,8 @@ TEST_F(HeapTest, HeapRecoveryTest) {
         RAMTuple *dstTuple = GenRow();
         HamStatus stat = HeapRead(tx, &table, item.first, dstTuple);
         ASSERT_EQ(stat, HamStatus::OK);
-        ASSERT_EQ(TxInfoIsCSN(dstTuple->getNVMTuple().m_txInfo), false);
+        // 恢复后第一次读到已提交的 tuple, header 中的 TxSlotPtr 被替换为提交 CSN
+        ASSERT_EQ(TxInfoIsCSN(dstTuple->getNVMTuple().m_txInfo), true);
         ASSERT_EQ(dstTuple->EqualRow(item.second), true);
         tx->Commit();
 
@@ -152,6 +156,508 @@ TEST_F(HeapTest, BasicTest) {
     ins_set.clear();
 }
 
+/* 只更新一列时, 只落盘 header 和该列所在的 cache line, 重启后读到的仍是完整的新版本 */
+TEST_F(HeapTest, DeltaUpdateTest) {
+    static constexpr uint32 wideColCnt = 32;
+    ColumnDesc wideColDesc[wideColCnt];
+    for (auto &desc : wideColDesc) {
+        desc = InitColDesc(COL_TYPE_LONG);
+    }
+    uint64 wideRowLen = 0;
+    InitColumnDesc(&wideColDesc[0], wideColCnt, wideRowLen);
+
+    Table table(0, wideRowLen);
+    uint32 segHead = table.CreateSegment();
+    ASSERT_EQ(NVMPageIdIsValid(segHead), true);
+
+    RAMTuple srcTuple(&wideColDesc[0], wideRowLen);
+    for (uint32 i = 0; i < wideColCnt; i++) {
+        int64 val = i;
+        srcTuple.SetCol(i, (char *)&val);
+    }
+    Transaction *tx = GetCurrentTxContext();
+    tx->Begin();
+    RowId rowId = HeapInsert(tx, &table, &srcTuple);
+    tx->Commit();
+
+    RAMTuple dstTuple(&wideColDesc[0], wideRowLen);
+    tx->Begin();
+    ASSERT_EQ(HeapRead(tx, &table, rowId, &dstTuple), HamStatus::OK);
+    int64 newVal = 1000;
+    dstTuple.UpdateCol(wideColCnt - 1, (char *)&newVal);
+    uint64 writeBytes = g_heapNVMWriteBytes;
+    ASSERT_EQ(HeapUpdate(tx, &table, rowId, &dstTuple), HamStatus::OK);
+    writeBytes = g_heapNVMWriteBytes - writeBytes;
+    tx->Commit();
+    // header 最多跨两个 cache line, 更新的列占一个
+    ASSERT_LE(writeBytes, 3 * NVM_CACHE_LINE_SIZE);
+    ASSERT_LT(writeBytes, RealTupleSize(wideRowLen));
+    srcTuple.SetCol(wideColCnt - 1, (char *)&newVal);
+
+    DestroyThreadLocalVariables();
+    ExitDBProcess();
+    BootStrap(space_dir);
+    table.Mount(segHead);
+    InitThreadLocalVariables();
+
+    tx = GetCurrentTxContext();
+    tx->Begin();
+    ASSERT_EQ(HeapRead(tx, &table, rowId, &dstTuple), HamStatus::OK);
+    ASSERT_EQ(dstTuple.EqualRow(&srcTuple), true);
+    tx->Commit();
+}
+
+/* 读到已提交的 tuple 时把提交 CSN 写回 header, 未提交的保持 TxSlotPtr */
+TEST_F(HeapTest, CSNStampTest) {
+    Table table(0, row_len);
+    uint32 segHead = table.CreateSegment();
+    ASSERT_EQ(NVMPageIdIsValid(segHead), true);
+
+    Transaction *tx = GetCurrentTxContext();
+    tx->Begin();
+    RAMTuple *srcTuple = GenRow(true, 1, 2);
+    RowId rowId = HeapInsert(tx, &table, srcTuple);
+    RAMTuple *dstTuple = GenRow();
+    ASSERT_EQ(HeapRead(tx, &table, rowId, dstTuple), HamStatus::OK);
+    ASSERT_EQ(TxInfoIsCSN(dstTuple->getNVMTuple().m_txInfo), false);
+    tx->Commit();
+
+    const auto *nvmTuple =
+        reinterpret_cast<const NVMTuple *>(table.m_rowIdMap->GetEntry(rowId, true)->getNVMAddr());
+    ASSERT_EQ(TxInfoIsCSN(nvmTuple->m_txInfo), false);
+    tx->Begin();
+    ASSERT_EQ(HeapRead(tx, &table, rowId, dstTuple), HamStatus::OK);
+    ASSERT_EQ(TxInfoIsCSN(dstTuple->getNVMTuple().m_txInfo), true);
+    ASSERT_EQ(nvmTuple->m_txInfo, dstTuple->getNVMTuple().m_txInfo);
+    ASSERT_EQ(dstTuple->EqualRow(srcTuple), true);
+
+    // 更新后 header 又变成 TxSlotPtr, 旧版本仍能从 undo 读到
+    ASSERT_EQ(UpdateRow(tx, &table, rowId, dstTuple, 3, 4), HamStatus::OK);
+    tx->Commit();
+    ASSERT_EQ(TxInfoIsCSN(nvmTuple->m_txInfo), false);
+
+    tx->Begin();
+    RowId cursor = 0;
+    RowId readRowId = InvalidRowId;
+    uint32 count = HeapReadBatch(tx, &table, &cursor, rowId + 1, &dstTuple, &readRowId, 1);
+    ASSERT_EQ(count, 1);
+    ASSERT_EQ(readRowId, rowId);
+    ASSERT_EQ(ColEqual(dstTuple, 0, 3), true);
+    ASSERT_EQ(TxInfoIsCSN(nvmTuple->m_txInfo), true);
+    tx->Commit();
+
+    delete srcTuple;
+    delete dstTuple;
+}
+
+/* 批量顺序读, 跳过已删除的行, 结果与逐行 HeapRead 一致 */
+TEST_F(HeapTest, BatchReadTest) {
+    Table table(0, row_len);
+    uint32 segHead = table.CreateSegment();
+    ASSERT_EQ(NVMPageIdIsValid(segHead), true);
+
+    static constexpr int rowNum = 300;
+    static constexpr uint32 batchSize = 64;
+    Transaction *tx = GetCurrentTxContext();
+    tx->Begin();
+    std::vector<RowId> rowIds;
+    for (int i = 0; i < rowNum; i++) {
+        RAMTuple *srcTuple = GenRow(true, i, i + 1);
+        rowIds.push_back(HeapInsert(tx, &table, srcTuple));
+        delete srcTuple;
+    }
+    tx->Commit();
+
+    tx->Begin();
+    for (int i = 0; i < rowNum; i += 3) {
+        ASSERT_EQ(HeapDelete(tx, &table, rowIds[i]), HamStatus::OK);
+    }
+    tx->Commit();
+
+    std::vector<RAMTuple *> tuples;
+    for (uint32 i = 0; i < batchSize; i++) {
+        tuples.push_back(GenRow());
+    }
+    RowId batchRowIds[batchSize];
+    RAMTuple *dstTuple = GenRow();
+
+    tx->Begin();
+    RowId cursor = 0;
+    RowId upper = HeapUpperRowId(&table);
+    int total = 0;
+    while (cursor < upper) {
+        uint32 cnt = HeapReadBatch(tx, &table, &cursor, upper, tuples.data(), batchRowIds, batchSize);
+        ASSERT_LE(cnt, batchSize);
+        for (uint32 i = 0; i < cnt; i++) {
+            ASSERT_EQ(HeapRead(tx, &table, batchRowIds[i], dstTuple), HamStatus::OK);
+            ASSERT_EQ(dstTuple->EqualRow(tuples[i]), true);
+        }
+        total += static_cast<int>(cnt);
+    }
+    tx->Commit();
+    ASSERT_EQ(total, rowNum - (rowNum + 2) / 3);
+
+    for (auto *tuple : tuples) {
+        delete tuple;
+    }
+    delete dstTuple;
+}
+
+/* 过滤条件在 tuple 缓存上判断, 当前版本不可见时对回溯到的旧版本判断 */
+TEST_F(HeapTest, FilterScanTest) {
+    Table table(0, GenTableDesc(TestColDesc, col_cnt, row_len));
+    uint32 segHead = table.CreateSegment();
+    ASSERT_EQ(NVMPageIdIsValid(segHead), true);
+
+    static constexpr int rowNum = 300;
+    static constexpr uint32 batchSize = 64;
+    Transaction *tx = GetCurrentTxContext();
+    tx->Begin();
+    std::vector<RowId> rowIds;
+    for (int i = 0; i < rowNum; i++) {
+        RAMTuple *srcTuple = GenRow(true, i, i + 1);
+        // 每 10 行中有一行 col_2 为空
+        srcTuple->SetNull(1, i % 10 == 0);
+        rowIds.push_back(HeapInsert(tx, &table, srcTuple));
+        delete srcTuple;
+    }
+    tx->Commit();
+
+    tx->Begin();
+    // 扫描开始之后其他事务修改 col_1, 修改前后的值分别落在条件内外
+    std::thread([&] {
+        InitThreadLocalVariables();
+        Transaction *otherTx = GetCurrentTxContext();
+        otherTx->Begin();
+        RAMTuple *tuple = GenRow();
+        for (int i = 51; i < 60; i++) {
+            ASSERT_EQ(HeapRead(otherTx, &table, rowIds[i], tuple), HamStatus::OK);
+            ASSERT_EQ(UpdateRow(otherTx, &table, rowIds[i], tuple, i + 1000, i + 1), HamStatus::OK);
+        }
+        for (int i = 201; i < 210; i++) {
+            ASSERT_EQ(HeapRead(otherTx, &table, rowIds[i], tuple), HamStatus::OK);
+            ASSERT_EQ(UpdateRow(otherTx, &table, rowIds[i], tuple, i - 100, i + 1), HamStatus::OK);
+        }
+        otherTx->Commit();
+        delete tuple;
+        DestroyThreadLocalVariables();
+    }).join();
+
+    std::vector<RAMTuple *> tuples;
+    for (uint32 i = 0; i < batchSize; i++) {
+        tuples.push_back(GenRow());
+    }
+    RowId batchRowIds[batchSize];
+    const RowId upper = HeapUpperRowId(&table);
+
+    // col_1 >= 50 AND col_1 < 150 AND col_2 IS NOT NULL, 只投影 col_1
+    int low = 50;
+    int high = 150;
+    uint32 projection[] = {0};
+    HeapScanFilter filter(&table);
+    ASSERT_EQ(filter.AddQual(0, HeapScanFilter::Oper::GE, (char *)&low), true);
+    ASSERT_EQ(filter.AddQual(0, HeapScanFilter::Oper::LT, (char *)&high), true);
+    ASSERT_EQ(filter.AddQual(1, HeapScanFilter::Oper::IS_NOT_NULL), true);
+    filter.SetProjection(projection, 1);
+    std::vector<bool> seen(rowNum, false);
+    RowId cursor = 0;
+    while (cursor < upper) {
+        uint32 cnt = HeapReadBatch(tx, &table, &cursor, upper, tuples.data(), batchRowIds, batchSize, &filter);
+        for (uint32 i = 0; i < cnt; i++) {
+            int col1;
+            tuples[i]->GetCol(0, (char *)&col1);
+            ASSERT_GE(col1, low);
+            ASSERT_LT(col1, high);
+            ASSERT_NE(col1 % 10, 0);
+            ASSERT_EQ(batchRowIds[i], rowIds[col1]);
+            ASSERT_EQ(seen[col1], false);
+            seen[col1] = true;
+        }
+    }
+    ASSERT_EQ(std::count(seen.begin(), seen.end(), true), (high - low) / 10 * 9);
+
+    HeapScanFilter nullFilter(&table);
+    ASSERT_EQ(nullFilter.AddQual(1, HeapScanFilter::Oper::IS_NULL), true);
+    nullFilter.SetProjection(nullptr, 0);
+    int total = 0;
+    cursor = 0;
+    while (cursor < upper) {
+        uint32 cnt = HeapReadBatch(tx, &table, &cursor, upper, tuples.data(), batchRowIds, batchSize, &nullFilter);
+        for (uint32 i = 0; i < cnt; i++) {
+            ASSERT_EQ(tuples[i]->IsNull(1), true);
+        }
+        total += static_cast<int>(cnt);
+    }
+    tx->Commit();
+    ASSERT_EQ(total, rowNum / 10);
+
+    for (auto *tuple : tuples) {
+        delete tuple;
+    }
+}
+
+/* 回收已删除且不再可见的行, 回收的行号被之后的插入复用 */
+TEST_F(HeapTest, VacuumTest) {
+    Table table(0, row_len);
+    uint32 segHead = table.CreateSegment();
+    ASSERT_EQ(NVMPageIdIsValid(segHead), true);
+
+    static constexpr int rowNum = 100;
+    Transaction *tx = GetCurrentTxContext();
+    tx->Begin();
+    std::vector<RowId> rowIds;
+    for (int i = 0; i < rowNum; i++) {
+        RAMTuple *srcTuple = GenRow(true, i, i + 1);
+        rowIds.push_back(HeapInsert(tx, &table, srcTuple));
+        delete srcTuple;
+    }
+    tx->Commit();
+
+    tx->Begin();
+    std::set<RowId> deleted;
+    for (int i = 0; i < rowNum; i += 2) {
+        ASSERT_EQ(HeapDelete(tx, &table, rowIds[i]), HamStatus::OK);
+        deleted.insert(rowIds[i]);
+    }
+    tx->Commit();
+
+    tx->Begin();
+    ASSERT_EQ(HeapVacuum(tx, &table), deleted.size());
+    // 已经回收的行不会被重复回收
+    ASSERT_EQ(HeapVacuum(tx, &table), 0);
+    RAMTuple *dstTuple = GenRow();
+    for (int i = 0; i < rowNum; i++) {
+        HamStatus expect = i % 2 == 0 ? HamStatus::READ_ROW_NOT_USED : HamStatus::OK;
+        ASSERT_EQ(HeapRead(tx, &table, rowIds[i], dstTuple), expect);
+    }
+    tx->Commit();
+
+    // 新插入的行复用回收的行号
+    tx->Begin();
+    for (size_t i = 0; i < deleted.size(); i++) {
+        RAMTuple *srcTuple = GenRow(true, -1, -1);
+        RowId rowId = HeapInsert(tx, &table, srcTuple);
+        ASSERT_EQ(deleted.count(rowId), 1);
+        ASSERT_EQ(HeapRead(tx, &table, rowId, dstTuple), HamStatus::OK);
+        ASSERT_EQ(dstTuple->EqualRow(srcTuple), true);
+        delete srcTuple;
+    }
+    tx->Commit();
+    delete dstTuple;
+}
+
+/* 清空表后 extent 被回收, segment head 不变, 之后可以正常插入 */
+TEST_F(HeapTest, TruncateTest) {
+    Table table(0, row_len);
+    uint32 segHead = table.CreateSegment();
+    ASSERT_EQ(NVMPageIdIsValid(segHead), true);
+    const uint64 emptyBytes = HeapAllocatedBytes(&table);
+
+    static constexpr int rowNum = 300;
+    Transaction *tx = GetCurrentTxContext();
+    tx->Begin();
+    std::vector<RowId> rowIds;
+    for (int i = 0; i < rowNum; i++) {
+        RAMTuple *srcTuple = GenRow(true, i, i + 1);
+        rowIds.push_back(HeapInsert(tx, &table, srcTuple));
+        delete srcTuple;
+    }
+    tx->Commit();
+    ASSERT_GT(HeapAllocatedBytes(&table), emptyBytes);
+
+    HeapTruncate(&table);
+    ASSERT_EQ(table.SegmentHead(), segHead);
+    ASSERT_EQ(HeapAllocatedBytes(&table), emptyBytes);
+
+    RAMTuple *dstTuple = GenRow();
+    tx->Begin();
+    for (RowId rowId : rowIds) {
+        ASSERT_NE(HeapRead(tx, &table, rowId, dstTuple), HamStatus::OK);
+    }
+    tx->Commit();
+
+    // 清空之后可以正常插入
+    tx->Begin();
+    for (int i = 0; i < rowNum; i++) {
+        RAMTuple *srcTuple = GenRow(true, i + 1, i);
+        RowId rowId = HeapInsert(tx, &table, srcTuple);
+        ASSERT_EQ(HeapRead(tx, &table, rowId, dstTuple), HamStatus::OK);
+        ASSERT_EQ(dstTuple->EqualRow(srcTuple), true);
+        delete srcTuple;
+    }
+    tx->Commit();
+    ASSERT_GT(HeapAllocatedBytes(&table), emptyBytes);
+    delete dstTuple;
+}
+
+/* 批量导入的行在 Finish 之后可见, 回滚后整批不可见并能被 VACUUM 回收 */
+TEST_F(HeapTest, BulkLoadTest) {
+    Table table(0, row_len);
+    uint32 segHead = table.CreateSegment();
+    ASSERT_EQ(NVMPageIdIsValid(segHead), true);
+
+    // 超过一个 extent, 覆盖 extent 切换
+    const int rowNum = static_cast<int>(GetExtentSize(HEAP_EXTENT_SIZE) / RealTupleSize(row_len)) + 100;
+    Transaction *tx = GetCurrentTxContext();
+    tx->Begin();
+    std::vector<RowId> rowIds;
+    {
+        HeapBulkLoader loader(tx, &table);
+        for (int i = 0; i < rowNum; i++) {
+            RAMTuple *srcTuple = GenRow(true, i, i + 1);
+            rowIds.push_back(loader.Insert(srcTuple));
+            delete srcTuple;
+        }
+        loader.Finish();
+        ASSERT_EQ(loader.GetLoadedRows(), static_cast<uint64>(rowNum));
+    }
+    tx->Commit();
+    ASSERT_EQ(std::set<RowId>(rowIds.begin(), rowIds.end()).size(), static_cast<size_t>(rowNum));
+
+    RAMTuple *dstTuple = GenRow();
+    tx->Begin();
+    for (int i = 0; i < rowNum; i++) {
+        ASSERT_EQ(HeapRead(tx, &table, rowIds[i], dstTuple), HamStatus::OK);
+        ASSERT_EQ(ColEqual(dstTuple, 0, i), true);
+        ASSERT_EQ(ColEqual(dstTuple, 1, i + 1), true);
+    }
+    tx->Commit();
+
+    // 批量导入之后普通插入不受影响
+    tx->Begin();
+    RAMTuple *srcTuple = GenRow(true, -1, -1);
+    RowId rowId = HeapInsert(tx, &table, srcTuple);
+    ASSERT_EQ(std::find(rowIds.begin(), rowIds.end(), rowId), rowIds.end());
+    ASSERT_EQ(HeapRead(tx, &table, rowId, dstTuple), HamStatus::OK);
+    ASSERT_EQ(dstTuple->EqualRow(srcTuple), true);
+    tx->Commit();
+    delete srcTuple;
+
+    static constexpr int abortNum = 1000;
+    std::vector<RowId> abortRowIds;
+    tx->Begin();
+    {
+        HeapBulkLoader loader(tx, &table);
+        for (int i = 0; i < abortNum; i++) {
+            srcTuple = GenRow(true, i, i);
+            abortRowIds.push_back(loader.Insert(srcTuple));
+            delete srcTuple;
+        }
+        loader.Finish();
+    }
+    tx->Abort();
+
+    tx->Begin();
+    for (RowId abortRowId : abortRowIds) {
+        ASSERT_NE(HeapRead(tx, &table, abortRowId, dstTuple), HamStatus::OK);
+    }
+    ASSERT_EQ(HeapVacuum(tx, &table), abortNum);
+    tx->Commit();
+    delete dstTuple;
+}
+
+/* 回滚的插入留下被回滚事务删除的行, VACUUM 回收之后行号被之后的插入复用 */
+TEST_F(HeapTest, AbortedInsertVacuumTest) {
+    Table table(0, row_len);
+    uint32 segHead = table.CreateSegment();
+    ASSERT_EQ(NVMPageIdIsValid(segHead), true);
+
+    static constexpr int rowNum = 100;
+    Transaction *tx = GetCurrentTxContext();
+    tx->Begin();
+    std::set<RowId> aborted;
+    for (int i = 0; i < rowNum; i++) {
+        RAMTuple *srcTuple = GenRow(true, i, i + 1);
+        aborted.insert(HeapInsert(tx, &table, srcTuple));
+        delete srcTuple;
+    }
+    tx->Abort();
+
+    RAMTuple *dstTuple = GenRow();
+    tx->Begin();
+    for (RowId rowId : aborted) {
+        ASSERT_NE(HeapRead(tx, &table, rowId, dstTuple), HamStatus::OK);
+    }
+    ASSERT_EQ(HeapVacuum(tx, &table), rowNum);
+    tx->Commit();
+
+    tx->Begin();
+    for (int i = 0; i < rowNum; i++) {
+        RAMTuple *srcTuple = GenRow(true, -1, -1);
+        RowId rowId = HeapInsert(tx, &table, srcTuple);
+        ASSERT_EQ(aborted.count(rowId), 1);
+        delete srcTuple;
+    }
+    tx->Commit();
+    delete dstTuple;
+}
+
+/* 并行扫描读到的行和串行扫描一致, 看不到快照之后提交的行, 可以中途停止 */
+TEST_F(HeapTest, ParallelScanTest) {
+    Table table(0, row_len);
+    uint32 segHead = table.CreateSegment();
+    ASSERT_EQ(NVMPageIdIsValid(segHead), true);
+
+    const int rowNum = static_cast<int>(GetExtentSize(HEAP_EXTENT_SIZE) / RealTupleSize(row_len)) * 3 + 100;
+    Transaction *tx = GetCurrentTxContext();
+    tx->Begin();
+    {
+        HeapBulkLoader loader(tx, &table);
+        for (int i = 0; i < rowNum; i++) {
+            RAMTuple *srcTuple = GenRow(true, i, i + 1);
+            loader.Insert(srcTuple);
+            delete srcTuple;
+        }
+        loader.Finish();
+    }
+    tx->Commit();
+
+    FLAGS_heap_parallel_scan_min_extents = 2;
+    tx->Begin();
+    ASSERT_EQ(HeapParallelScanEnabled(tx, &table), true);
+    // 扫描开始之后提交的行对扫描不可见
+    std::thread([&] {
+        InitThreadLocalVariables();
+        Transaction *otherTx = GetCurrentTxContext();
+        otherTx->Begin();
+        RAMTuple *srcTuple = GenRow(true, -1, -1);
+        HeapInsert(otherTx, &table, srcTuple);
+        otherTx->Commit();
+        delete srcTuple;
+        DestroyThreadLocalVariables();
+    }).join();
+
+    std::vector<bool> seen(rowNum, false);
+    {
+        HeapParallelScan scan(tx, &table, 4);
+        RAMTuple **tuples = nullptr;
+        RowId *rowIds = nullptr;
+        uint32 count;
+        while ((count = scan.NextBatch(&tuples, &rowIds)) != 0) {
+            for (uint32 i = 0; i < count; i++) {
+                int col1;
+                tuples[i]->GetCol(0, (char *)&col1);
+                ASSERT_GE(col1, 0);
+                ASSERT_LT(col1, rowNum);
+                ASSERT_EQ(seen[col1], false);
+                ASSERT_EQ(ColEqual(tuples[i], 1, col1 + 1), true);
+                seen[col1] = true;
+            }
+        }
+    }
+    ASSERT_EQ(std::count(seen.begin(), seen.end(), true), rowNum);
+
+    // 没有读完就析构
+    {
+        HeapParallelScan scan(tx, &table, 4);
+        RAMTuple **tuples = nullptr;
+        RowId *rowIds = nullptr;
+        ASSERT_GT(scan.NextBatch(&tuples, &rowIds), 0);
+    }
+    tx->Commit();
+    FLAGS_heap_parallel_scan_min_extents = 4;
+}
+
 class ThreadSync {
     volatile int curr_step;
 
@@ -0,0 +1,126 @@
+#include "nvm_init.h"
+#include "nvm_table.h"
+#include "transaction/nvm_transaction.h"
+#include "nvm_access.h"
+#include "nvmdb_thread.h"
+#include "heap/nvm_heap.h"
+#include "heap/nvm_rowid_map.h"
+#include "common/test_declare.h"
+#include <gtest/gtest.h>
+#include <experimental/filesystem>
+
+using namespace NVMDB;
+
+namespace heap_tier_test {
+
+// 宽行, 一个 extent 只有几千行
+ColumnDesc TestColDesc[] = {
+    InitColDesc(COL_TYPE_INT),               /* col_1 */
+    InitVarColDesc(COL_TYPE_VARCHAR, 500),   /* col_2 */
+};
+
+uint64 row_len = 0;
+uint32 col_cnt = 0;
+
+void InitColumnInfo() {
+    col_cnt = sizeof(TestColDesc) / sizeof(ColumnDesc);
+    InitColumnDesc(&TestColDesc[0], col_cnt, row_len);
+}
+
+inline void SetRow(RAMTuple *tuple, int col1) {
+    std::vector<char> col2(TestColDesc[1].m_colLen, static_cast<char>('a' + col1 % 26));
+    tuple->SetCol(0, (char *)&col1);
+    tuple->SetCol(1, col2.data());
+}
+
+inline bool RowEqual(RAMTuple *tuple, int col1) {
+    std::vector<char> col2(TestColDesc[1].m_colLen, static_cast<char>('a' + col1 % 26));
+    return tuple->ColEqual(0, (char *)&col1) && tuple->ColEqual(1, col2.data());
+}
+
+class HeapTierTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        InitColumnInfo();
+        std::experimental::filesystem::create_directories(tier_dir);
+        FLAGS_heap_tier_dir = tier_dir;
+        FLAGS_heap_tier_cold_rounds = 1;
+        // 后台线程不参与, 由测试调用 HeapTierOnce
+        FLAGS_heap_tier_interval_ms = 1000 * 1000;
+        InitDB(space_dir);
+        ExitDBProcess();
+        BootStrap(space_dir);
+        InitThreadLocalVariables();
+    }
+    void TearDown() override {
+        DestroyThreadLocalVariables();
+        ExitDBProcess();
+        FLAGS_heap_tier_dir = "";
+        FLAGS_heap_tier_cold_rounds = 60;
+        FLAGS_heap_tier_interval_ms = 1000;
+    }
+
+    const std::string space_dir = "/mnt/pmem0/bench;/mnt/pmem1/bench";
+    const std::string tier_dir = "/tmp/nvmdb_heap_tier";
+};
+
+/* 已满且多轮没有访问的 extent 换出到 SSD, 访问时读回; 重启后仍能从 SSD 读回 */
+TEST_F(HeapTierTest, SpillAndFaultTest) {
+    Table table(0, row_len);
+    uint32 segHead = table.CreateSegment();
+    const uint32 tuplesPerExtent = table.m_rowIdMap->GetTuplesPerExtent();
+    // 写满 3 个 extent, 再多写一行让第 3 个 extent 在 FSM 中标记为已满
+    const int rowNum = static_cast<int>(tuplesPerExtent * 3 + 1);
+
+    RAMTuple tuple(&TestColDesc[0], row_len);
+    std::vector<RowId> rowIds;
+    auto tx = GetCurrentTxContext();
+    tx->Begin();
+    for (int i = 0; i < rowNum; i++) {
+        SetRow(&tuple, i);
+        rowIds.push_back(HeapInsert(tx, &table, &tuple));
+    }
+    tx->Commit();
+
+    const uint64 hotBytes = HeapAllocatedBytes(&table);
+    ASSERT_EQ(HeapTierOnce(), 3);
+    ASSERT_EQ(table.m_rowIdMap->GetColdExtents(), 3);
+    ASSERT_EQ(g_heapColdStore->GetUsedSlots(), 3);
+    ASSERT_LT(HeapAllocatedBytes(&table), hotBytes);
+
+    // 读回所有行
+    tx->Begin();
+    for (int i = 0; i < rowNum; i++) {
+        ASSERT_EQ(HeapRead(tx, &table, rowIds[i], &tuple), HamStatus::OK);
+        ASSERT_TRUE(RowEqual(&tuple, i));
+    }
+    tx->Commit();
+    ASSERT_EQ(table.m_rowIdMap->GetColdExtents(), 0);
+    ASSERT_EQ(g_heapColdStore->GetUsedSlots(), 0);
+    ASSERT_EQ(HeapAllocatedBytes(&table), hotBytes);
+
+    // 再次换出之后更新其中的行
+    ASSERT_EQ(HeapTierOnce(), 3);
+    tx->Begin();
+    SetRow(&tuple, rowNum);
+    ASSERT_EQ(HeapUpdate(tx, &table, rowIds[0], &tuple), HamStatus::OK);
+    tx->Commit();
+    ASSERT_EQ(table.m_rowIdMap->GetColdExtents(), 2);
+
+    DestroyThreadLocalVariables();
+    ExitDBProcess();
+    BootStrap(space_dir);
+    table.Mount(segHead);
+    InitThreadLocalVariables();
+
+    tx = GetCurrentTxContext();
+    tx->Begin();
+    for (int i = 0; i < rowNum; i++) {
+        ASSERT_EQ(HeapRead(tx, &table, rowIds[i], &tuple), HamStatus::OK);
+        ASSERT_TRUE(RowEqual(&tuple, i == 0 ? rowNum : i));
+    }
+    tx->Commit();
+    ASSERT_EQ(table.m_rowIdMap->GetColdExtents(), 0);
+}
+
+}  // namespace heap_tier_test
@@ -3,6 +3,7 @@
 #include "nvmdb_thread.h"
 #include <gtest/gtest.h>
 #include <glog/logging.h>
+#include <set>
 #include <thread>
 #include <experimental/filesystem>
 
@@ -26,11 +27,13 @@ protected:
     void SetUp() override {
         g_dir_config = std::make_shared<NVMDB::DirectoryConfig>("/mnt/pmem0/bench;/mnt/pmem1/bench", true);
         InitGlobalThreadStorageMgr();
+        TupleCache::InitGlobalTupleCache();
         space = new TableSpace(g_dir_config);
     }
 
     void TearDown() override {
         space->unmount();
+        TupleCache::DestroyGlobalTupleCache();
         for (const auto & it: g_dir_config->getDirPaths()) {
             std::experimental::filesystem::remove_all(it);
         }
@@ -92,3 +95,60 @@ TEST_F(RowIdMapTest, BasicTest) {
         worker.join();
     }
 }
+
+/* 一个 extent 的行号分配完之后在 FSM 中标记为已满, 重启后按 FSM 跳过已满的 extent */
+TEST_F(RowIdMapTest, PersistentFSMTest) {
+    space->create();
+    uint32 segHead = space->allocNewExtent(EXT_SIZE_2M);
+    auto *rowIdMap = new RowIdMap(space, segHead, TUPLE_SIZE);
+    RowIDMgr rowidMgr(space, segHead, TUPLE_SIZE);
+    const uint32 tuplesPerExtent = rowidMgr.getTuplesPerExtent();
+
+    const auto insertRows = [&](RowIdMap *map, uint32 count) {
+        std::vector<RowId> rowIds;
+        std::thread worker([&] {
+            InitThreadLocalStorage();
+            for (uint32 i = 0; i < count; i++) {
+                RowId rid = map->getNextEmptyRow();
+                auto *entry = map->GetEntry(rid, false);
+                entry->wrightThroughCache([](char *tuple) {
+                    reinterpret_cast<NVMTuple *>(tuple)->m_isUsed = true;
+                }, NVMTupleHeadSize);
+                rowIds.push_back(rid);
+            }
+            DestroyThreadLocalStorage();
+        });
+        worker.join();
+        return rowIds;
+    };
+
+    // 写满两个 extent, 第三个 extent 只写一部分
+    std::vector<RowId> rowIds = insertRows(rowIdMap, 2 * tuplesPerExtent + 10);
+    std::set<RowId> used(rowIds.begin(), rowIds.end());
+    std::set<uint32> extents;
+    for (RowId rid : rowIds) {
+        extents.insert(rid / tuplesPerExtent);
+    }
+    ASSERT_EQ(extents.size(), 3);
+    const uint32 partialExtent = rowIds.back() / tuplesPerExtent;
+    for (uint32 extentId : extents) {
+        ASSERT_EQ(rowidMgr.isExtentFull(extentId), extentId != partialExtent);
+    }
+
+    // 模拟重启: 新建的 RowIdMap 只能从 FSM 恢复分配状态, 新分配的行号不会落在已满的 extent 中
+    auto *recovered = new RowIdMap(space, segHead, TUPLE_SIZE);
+    std::vector<RowId> newRowIds = insertRows(recovered, tuplesPerExtent);
+    for (RowId rid : newRowIds) {
+        ASSERT_EQ(used.count(rid), 0);
+        ASSERT_TRUE(extents.count(rid / tuplesPerExtent) == 0 || rid / tuplesPerExtent == partialExtent);
+    }
+
+    // 回收的行号只在内存中, 对应 extent 的 FSM 位被清除
+    const uint32 fullExtent = rowIds.front() / tuplesPerExtent;
+    ASSERT_TRUE(rowidMgr.isExtentFull(fullExtent));
+    recovered->ReleaseRowIds({rowIds.front()});
+    ASSERT_FALSE(rowidMgr.isExtentFull(fullExtent));
+
+    delete recovered;
+    delete rowIdMap;
+}
@@ -1,8 +1,10 @@
 #include "index_test.h"
 #include "common/test_declare.h"
+#include "common/test_table.h"
 #include "nvmdb_thread.h"
 #include "nvm_init.h"
 #include <gtest/gtest.h>
+#include <algorithm>
 #include <thread>
 
 using namespace NVMDB;
@@ -183,6 +185,86 @@ TEST_F(IndexTest, ConcurrentTest) {
     }
 }
 
+TEST_F(IndexTest, DistinctKeysTest) {
+    NVMIndex idx(2);
+    static const int TEST_NUM = 100;
+    static const int KEY_NUM = 10;
+    ASSERT_EQ(idx.GetDistinctKeys(), 0);
+
+    /* 每个索引键对应 TEST_NUM / KEY_NUM 个 rowid */
+    auto tx = GetCurrentTxContext();
+    tx->Begin();
+    tx->PrepareUndo();
+    DRAMIndexTuple *tuple = GenIndexTuple2();
+    for (int i = 0; i < TEST_NUM; i++) {
+        int key = i % KEY_NUM;
+        tuple->SetCol(0, (char *)&key);
+        idx.Insert(tuple, i);
+    }
+    tx->Commit();
+
+    tx->Begin();
+    ASSERT_EQ(idx.AnalyzeDistinctKeys(tx->GetIndexLookupSnapshot()), KEY_NUM);
+    ASSERT_EQ(idx.GetDistinctKeys(), KEY_NUM);
+    tx->Commit();
+
+    /* 删除一个索引键的所有 rowid 之后, 不再被统计 */
+    tx->Begin();
+    tx->PrepareUndo();
+    int key = 0;
+    tuple->SetCol(0, (char *)&key);
+    for (int i = 0; i < TEST_NUM; i += KEY_NUM) {
+        idx.Delete(tuple, i, tx->GetTxSlotLocation());
+    }
+    tx->Commit();
+
+    tx->Begin();
+    ASSERT_EQ(idx.AnalyzeDistinctKeys(tx->GetIndexLookupSnapshot()), KEY_NUM - 1);
+    tx->Commit();
+    delete tuple;
+}
+
+TEST_F(IndexTest, DistinctKeysSampleTest) {
+    NVMIndex lowIdx(2);
+    NVMIndex uniqueIdx(3);
+    static const int TEST_NUM = 20000;
+    static const int KEY_NUM = 10;
+    static const int BATCH_NUM = 1000;
+    auto savedSampleNodes = FLAGS_analyze_index_sample_nodes;
+    FLAGS_analyze_index_sample_nodes = 64;
+
+    auto tx = GetCurrentTxContext();
+    DRAMIndexTuple *tuple = GenIndexTuple2();
+    for (int i = 0; i < TEST_NUM; i++) {
+        if (i % BATCH_NUM == 0) {
+            tx->Begin();
+            tx->PrepareUndo();
+        }
+        int key = i % KEY_NUM;
+        tuple->SetCol(0, (char *)&key);
+        lowIdx.Insert(tuple, i);
+        tuple->SetCol(0, (char *)&i);
+        uniqueIdx.Insert(tuple, i);
+        if (i % BATCH_NUM == BATCH_NUM - 1) {
+            tx->Commit();
+        }
+    }
+    delete tuple;
+    uint64 nodes = uniqueIdx.GetStats().nodes;
+
+    /* 只读取部分数据节点: 每个索引键都跨越多个被采样的节点, 低基数的索引键数仍然准确; 唯一键按采样比例外推 */
+    tx->Begin();
+    uint64 lowEstimate = lowIdx.AnalyzeDistinctKeys(tx->GetIndexLookupSnapshot());
+    uint64 uniqueEstimate = uniqueIdx.AnalyzeDistinctKeys(tx->GetIndexLookupSnapshot());
+    tx->Commit();
+    FLAGS_analyze_index_sample_nodes = savedSampleNodes;
+
+    ASSERT_GT(nodes, 64);
+    ASSERT_EQ(lowEstimate, KEY_NUM);
+    ASSERT_GT(uniqueEstimate, TEST_NUM * 7 / 10);
+    ASSERT_LT(uniqueEstimate, TEST_NUM * 13 / 10);
+}
+
 TEST_F(IndexTest, TransactionTest) {
     Table table(0, row_len);
     NVMIndex idx(1);
@@ -261,4 +343,166 @@ TEST_F(IndexTest, TransactionTest) {
     delete idx_end;
 }
 
+/* 批量导入乱序的键, 提交后按键序扫到所有行; 回滚的批量导入不留下可见的索引项 */
+TEST_F(IndexTest, BulkLoadTest) {
+    Table table(0, row_len);
+    NVMIndex idx(1);
+    uint32 segHead = table.CreateSegment();
+    ASSERT_EQ(NVMPageIdIsValid(segHead), true);
+
+    static constexpr int test_num = 1000;
+    Transaction *tx = GetCurrentTxContext();
+    auto bulkLoad = [&](int base) {
+        HeapBulkLoader loader(tx, &table);
+        for (int i = 0; i < test_num; i++) {
+            int value = base + (i * 7) % test_num;
+            RAMTuple *tuple = GenRow(true, value, value + 1);
+            RowId rowid = loader.Insert(tuple);
+            DRAMIndexTuple *idx_tuple = GenIndexTuple2();
+            tuple->GetCol(0, idx_tuple->GetCol(0));
+            loader.IndexInsert(&idx, idx_tuple, rowid);
+            delete tuple;
+            delete idx_tuple;
+        }
+        loader.Finish();
+    };
+    tx->Begin();
+    bulkLoad(0);
+    tx->Commit();
+    tx->Begin();
+    bulkLoad(test_num);
+    tx->Abort();
+
+    DRAMIndexTuple *idx_begin = GenIndexTuple2();
+    DRAMIndexTuple *idx_end = GenIndexTuple2();
+    int si = 0;
+    int ei = 2 * test_num - 1;
+    idx_begin->SetCol(0, (char *)&si);
+    idx_end->SetCol(0, (char *)&ei);
+    int res_size;
+    auto *row_ids = new RowId[2 * test_num];
+    auto **tuples = new RAMTuple *[2 * test_num];
+    for (int i = 0; i < 2 * test_num; i++) {
+        tuples[i] = GenRow();
+    }
+
+    tx->Begin();
+    RangeSearch(tx, &idx, &table, idx_begin, idx_end, 2 * test_num, &res_size, row_ids, tuples);
+    ASSERT_EQ(res_size, test_num);
+    for (int i = 0; i < res_size; i++) {
+        ASSERT_EQ(ColEqual(tuples[i], 0, i), true);
+        ASSERT_EQ(ColEqual(tuples[i], 1, i + 1), true);
+    }
+    tx->Commit();
+
+    delete[] row_ids;
+    for (int i = 0; i < 2 * test_num; i++) {
+        delete tuples[i];
+    }
+    delete[] tuples;
+    delete idx_begin;
+    delete idx_end;
+}
+
+/* 在线建索引: 等建索引之前开始的写事务结束后才取快照, 之后的写事务自己维护还在构建的索引 */
+TEST_F(IndexTest, OnlineBuildTest) {
+    Table table(0, GenTableDesc(TestColDesc, col_cnt, row_len));
+    uint32 segHead = table.CreateSegment();
+    ASSERT_EQ(NVMPageIdIsValid(segHead), true);
+
+    static constexpr int test_num = 1000;
+    Transaction *tx = GetCurrentTxContext();
+    tx->Begin();
+    std::vector<RowId> rowIds;
+    for (int i = 0; i < test_num; i++) {
+        RAMTuple *tuple = GenRow(true, i, i + 1);
+        rowIds.push_back(HeapInsert(tx, &table, tuple));
+        delete tuple;
+    }
+    tx->Commit();
+
+    auto updateCol1 = [&](Transaction *trx, NVMIndex *index, int oldValue, int newValue) {
+        RAMTuple *tuple = GenRow();
+        ASSERT_EQ(HeapRead(trx, &table, rowIds[oldValue], tuple), HamStatus::OK);
+        tuple->UpdateCol(0, (char *)&newValue);
+        ASSERT_EQ(HeapUpdate(trx, &table, rowIds[oldValue], tuple), HamStatus::OK);
+        if (index != nullptr) {
+            DRAMIndexTuple *idx_tuple = GenIndexTuple2();
+            idx_tuple->SetCol(0, (char *)&newValue);
+            trx->IndexInsert(index, idx_tuple, rowIds[oldValue]);
+            idx_tuple->SetCol(0, (char *)&oldValue);
+            trx->IndexDelete(index, idx_tuple, rowIds[oldValue]);
+            delete idx_tuple;
+        }
+        delete tuple;
+    };
+
+    // 建索引之前开始写这张表的事务看不到新索引, 建索引要等它提交
+    std::atomic<bool> entered{false};
+    std::thread writer([&] {
+        InitThreadLocalVariables();
+        Transaction *otherTx = GetCurrentTxContext();
+        otherTx->Begin();
+        updateCol1(otherTx, nullptr, 0, 2 * test_num);
+        entered = true;
+        usleep(100 * 1000);
+        otherTx->Commit();
+        DestroyThreadLocalVariables();
+    });
+    while (!entered) {
+        std::this_thread::yield();
+    }
+
+    NVMIndex idx(1);
+    IndexColumnDesc *indexDesc = IndexDescCreate(index_col_cnt2);
+    std::copy(TestIndexDesc2, TestIndexDesc2 + index_col_cnt2, indexDesc);
+    idx.SetIndexDesc(indexDesc, index_col_cnt2, index_len2);
+    tx->Begin();
+    ASSERT_EQ(HeapBuildIndexOnline(tx, &table, &idx), true);
+    writer.join();
+    ASSERT_EQ(table.GetIndexCount(), 1);
+    // 快照早于建索引的事务不能用这个索引
+    ASSERT_EQ(idx.ReadableBy(tx->GetIndexLookupSnapshot().snapshot), false);
+    tx->Commit();
+
+    // 之后的写事务维护索引; 已经写过这张表的事务不能在线建索引
+    tx->Begin();
+    ASSERT_EQ(idx.ReadableBy(tx->GetIndexLookupSnapshot().snapshot), true);
+    updateCol1(tx, &idx, 1, 2 * test_num + 1);
+    NVMIndex idx2(2);
+    ASSERT_EQ(HeapBuildIndexOnline(tx, &table, &idx2), false);
+    tx->Commit();
+
+    DRAMIndexTuple *idx_begin = GenIndexTuple2();
+    DRAMIndexTuple *idx_end = GenIndexTuple2();
+    int si = 0;
+    int ei = 3 * test_num;
+    idx_begin->SetCol(0, (char *)&si);
+    idx_end->SetCol(0, (char *)&ei);
+    int res_size;
+    auto *row_ids = new RowId[test_num + 1];
+    auto **tuples = new RAMTuple *[test_num + 1];
+    for (int i = 0; i <= test_num; i++) {
+        tuples[i] = GenRow();
+    }
+
+    tx->Begin();
+    RangeSearch(tx, &idx, &table, idx_begin, idx_end, test_num + 1, &res_size, row_ids, tuples);
+    ASSERT_EQ(res_size, test_num);
+    for (int i = 0; i < test_num - 2; i++) {
+        ASSERT_EQ(ColEqual(tuples[i], 0, i + 2), true);
+    }
+    ASSERT_EQ(ColEqual(tuples[test_num - 2], 0, 2 * test_num), true);
+    ASSERT_EQ(ColEqual(tuples[test_num - 1], 0, 2 * test_num + 1), true);
+    tx->Commit();
+
+    delete[] row_ids;
+    for (int i = 0; i <= test_num; i++) {
+        delete tuples[i];
+    }
+    delete[] tuples;
+    delete idx_begin;
+    delete idx_end;
+}
+
 }  // namespace index_test
@@ -0,0 +1,355 @@
+#include "nvm_init.h"
+#include "nvm_table.h"
+#include "transaction/nvm_transaction.h"
+#include "transaction/nvm_change_stream.h"
+#include "transaction/nvm_snapshot.h"
+#include "nvm_access.h"
+#include "nvmdb_thread.h"
+#include "common/test_declare.h"
+#include <gtest/gtest.h>
+#include <map>
+
+using namespace NVMDB;
+
+namespace change_stream_test {
+
+ColumnDesc TestColDesc[] = {
+    InitColDesc(COL_TYPE_INT), /* col_1 */
+    InitColDesc(COL_TYPE_INT), /* col_2 */
+};
+
+uint64 row_len = 0;
+uint32 col_cnt = 0;
+
+void InitColumnInfo() {
+    col_cnt = sizeof(TestColDesc) / sizeof(ColumnDesc);
+    InitColumnDesc(&TestColDesc[0], col_cnt, row_len);
+}
+
+inline void SetRow(RAMTuple *tuple, int col1, int col2) {
+    tuple->SetCol(0, (char *)&col1);
+    tuple->SetCol(1, (char *)&col2);
+}
+
+inline bool ColEqual(RAMTuple *tuple, int col_id, int col_val) {
+    return tuple->ColEqual(col_id, (char *)&col_val);
+}
+
+// 把收到的批次拼起来, 由测试线程解析
+class CollectConsumer : public ChangeStreamConsumer {
+public:
+    void Consume(const char *data, size_t len) override {
+        m_data.insert(m_data.end(), data, data + len);
+        m_batches++;
+    }
+
+    std::vector<char> m_data;
+    int m_batches = 0;
+};
+
+// 追加 CSN 为 MIN_TX_CSN + n 的事务, 插入第 n 行并删除第 n + 100 行
+inline void AppendTx(ChangeStream *stream, uint64 n, uint32 committer) {
+    RAMTuple tuple(&TestColDesc[0], row_len);
+    TxChangeBuffer changes;
+    SetRow(&tuple, (int)n, (int)n * 10);
+    changes.AppendInsert(1, n, &tuple);
+    changes.AppendDelete(1, n + 100);
+    stream->Append(MIN_TX_CSN + n, changes, (int)committer % NVMDB_MAX_GROUP, committer);
+}
+
+// 检查收到的事务按 CSN 排列, 返回事务的 n
+std::vector<uint64> CheckTxs(const std::vector<char> &data) {
+    std::vector<uint64> txs;
+    ChangeStreamReader reader(data.data(), data.size());
+    const ChangeTxHead *head = nullptr;
+    while (reader.NextTx(&head)) {
+        const uint64 n = head->m_csn - MIN_TX_CSN;
+        EXPECT_TRUE(txs.empty() || n > txs.back());
+        txs.push_back(n);
+        EXPECT_EQ(head->m_recordCnt, 2);
+        const ChangeRecord *record = reader.NextRecord();
+        EXPECT_EQ(record->m_type, ChangeType::INSERT);
+        EXPECT_EQ(record->m_rowId, n);
+        RAMTuple decoded(&TestColDesc[0], row_len);
+        ChangeStreamReader::ApplyToTuple(record, &decoded);
+        EXPECT_TRUE(ColEqual(&decoded, 0, (int)n));
+        EXPECT_TRUE(ColEqual(&decoded, 1, (int)n * 10));
+        record = reader.NextRecord();
+        EXPECT_EQ(record->m_type, ChangeType::DELETE);
+        EXPECT_EQ(record->m_rowId, n + 100);
+        EXPECT_EQ(reader.NextRecord(), nullptr);
+    }
+    return txs;
+}
+
+/* 不同 group 中 CSN 乱序追加, 交付时按 CSN 排序 */
+TEST(ChangeStreamTest, OrderTest) {
+    InitColumnInfo();
+    ProcessArray::InitGlobalProcArray();
+    ProcessArray::GetGlobalProcArray()->setRecoveredCSN(MIN_TX_CSN + 10);
+    {
+        ChangeStream stream(1024 * 1024, 1000 * 1000);
+        CollectConsumer consumer;
+        stream.Subscribe(&consumer);
+        const uint64 txs[] = {5, 2, 7, 1, 3};
+        for (uint32 i = 0; i < 5; i++) {
+            stream.BeginCommit(i);
+            AppendTx(&stream, txs[i], i);
+        }
+        stream.Flush();
+        ASSERT_EQ(stream.GetAppendedTxs(), 5);
+        ASSERT_EQ(consumer.m_batches, 1);
+        ASSERT_EQ(CheckTxs(consumer.m_data), std::vector<uint64>({1, 2, 3, 5, 7}));
+        stream.Unsubscribe(&consumer);
+    }
+    ProcessArray::DestroyGlobalProcArray();
+}
+
+/* 还在提交的事务登记的 CSN 之后的变更留到之后的批次, 跨批次也按 CSN 顺序交付 */
+TEST(ChangeStreamTest, HoldBackTest) {
+    InitColumnInfo();
+    ProcessArray::InitGlobalProcArray();
+    auto *procArray = ProcessArray::GetGlobalProcArray();
+    procArray->setRecoveredCSN(MIN_TX_CSN + 2);
+    {
+        ChangeStream stream(1024 * 1024, 1000 * 1000);
+        CollectConsumer consumer;
+        stream.Subscribe(&consumer);
+        // 事务 0 登记时全局 CSN 为 MIN_TX_CSN + 3, 之后其他事务提交, 全局 CSN 推进到 MIN_TX_CSN + 10
+        stream.BeginCommit(0);
+        procArray->setRecoveredCSN(MIN_TX_CSN + 9);
+        const uint64 txs[] = {5, 1, 7, 2};
+        for (uint32 i = 0; i < 4; i++) {
+            stream.BeginCommit(i + 1);
+            AppendTx(&stream, txs[i], i + 1);
+        }
+        stream.Flush();
+        ASSERT_EQ(CheckTxs(consumer.m_data), std::vector<uint64>({1, 2}));
+
+        AppendTx(&stream, 3, 0);
+        stream.Flush();
+        ASSERT_EQ(consumer.m_batches, 2);
+        ASSERT_EQ(CheckTxs(consumer.m_data), std::vector<uint64>({1, 2, 3, 5, 7}));
+        stream.Unsubscribe(&consumer);
+    }
+    ProcessArray::DestroyGlobalProcArray();
+}
+
+/* 增量更新只记录被更新的列, 回放时其余列保持原值 */
+TEST(ChangeStreamTest, PartialUpdateTest) {
+    InitColumnInfo();
+    RAMTuple tuple(&TestColDesc[0], row_len);
+    SetRow(&tuple, 1, 2);
+    int newCol2 = 20;
+    RAMTuple::ColumnUpdate update = {1, (char *)&newCol2};
+    tuple.UpdateCols(&update, 1);
+    tuple.SetNull(1, true);
+
+    UndoColumnDesc col = {TestColDesc[1].m_colOffset, TestColDesc[1].m_colLen};
+    TxChangeBuffer changes;
+    changes.AppendUpdate(1, 0, &tuple, &col, 1);
+
+    std::vector<char> data(sizeof(ChangeTxHead));
+    auto *head = reinterpret_cast<ChangeTxHead *>(data.data());
+    head->m_csn = 1;
+    head->m_recordCnt = changes.RecordCount();
+    head->m_len = changes.Size();
+    data.insert(data.end(), changes.Data(), changes.Data() + changes.Size());
+
+    ChangeStreamReader reader(data.data(), data.size());
+    const ChangeTxHead *readHead = nullptr;
+    ASSERT_TRUE(reader.NextTx(&readHead));
+    const ChangeRecord *record = reader.NextRecord();
+    ASSERT_EQ(record->m_type, ChangeType::UPDATE);
+    RAMTuple replica(&TestColDesc[0], row_len);
+    SetRow(&replica, 1, 2);
+    ChangeStreamReader::ApplyToTuple(record, &replica);
+    ASSERT_TRUE(ColEqual(&replica, 0, 1));
+    ASSERT_TRUE(ColEqual(&replica, 1, 20));
+    ASSERT_TRUE(replica.IsNull(1));
+    ASSERT_FALSE(reader.NextTx(&readHead));
+}
+
+/* 事务的变更超过上限之后换成每张表一条 RESYNC, 缓冲区不再随行数增长 */
+TEST(ChangeStreamTest, TxOverflowTest) {
+    InitColumnInfo();
+    RAMTuple tuple(&TestColDesc[0], row_len);
+    SetRow(&tuple, 1, 2);
+    const int64 oldMaxBytes = FLAGS_change_stream_tx_max_bytes;
+    FLAGS_change_stream_tx_max_bytes = 4096;
+
+    TxChangeBuffer changes;
+    changes.AppendInsert(1, 0, &tuple);
+    ASSERT_FALSE(changes.Overflowed());
+    for (RowId rowId = 1; rowId < 1000; rowId++) {
+        changes.AppendInsert(rowId % 2 + 1, rowId, &tuple);
+    }
+    changes.AppendDelete(3, 0);
+    ASSERT_TRUE(changes.Overflowed());
+    ASSERT_EQ(changes.RecordCount(), 3);
+    for (uint32 i = 0; i < changes.RecordCount(); i++) {
+        const auto *record = reinterpret_cast<const ChangeRecord *>(changes.Data() + i * ChangeRecordSize(0));
+        ASSERT_EQ(record->m_type, ChangeType::RESYNC);
+        ASSERT_EQ(record->m_tableId, i + 1);
+    }
+    changes.Clear();
+    ASSERT_FALSE(changes.Overflowed());
+    FLAGS_change_stream_tx_max_bytes = oldMaxBytes;
+}
+
+class ChangeStreamDBTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        InitColumnInfo();
+        FLAGS_change_stream = true;
+        InitDB(space_dir);
+        ExitDBProcess();
+        BootStrap(space_dir);
+        InitThreadLocalVariables();
+    }
+    void TearDown() override {
+        DestroyThreadLocalVariables();
+        ExitDBProcess();
+        FLAGS_change_stream = false;
+    }
+
+    const std::string space_dir = "/mnt/pmem0/bench;/mnt/pmem1/bench";
+};
+
+/* 主表上的写操作经过变更流回放到另一张表, 两张表的内容一致; 回滚的事务不出现在变更流中 */
+TEST_F(ChangeStreamDBTest, ReplayTest) {
+    static constexpr int rowNum = 100;
+    auto *stream = ChangeStream::GetGlobalChangeStream();
+    ASSERT_NE(stream, nullptr);
+    CollectConsumer consumer;
+    stream->Subscribe(&consumer);
+
+    Table primary(0, row_len);
+    primary.CreateSegment();
+    Table replica(1, row_len);
+    replica.CreateSegment();
+    RAMTuple tuple(&TestColDesc[0], row_len);
+    std::vector<RowId> rowIds;
+
+    auto tx = GetCurrentTxContext();
+    tx->Begin();
+    for (int i = 0; i < rowNum; i++) {
+        SetRow(&tuple, i, i + 1);
+        rowIds.push_back(HeapInsert(tx, &primary, &tuple));
+    }
+    tx->Commit();
+
+    tx->Begin();
+    for (int i = 0; i < rowNum / 2; i++) {
+        ASSERT_EQ(HeapRead(tx, &primary, rowIds[i], &tuple), HamStatus::OK);
+        int col1 = i + 1000;
+        RAMTuple::ColumnUpdate update = {0, (char *)&col1};
+        tuple.UpdateCols(&update, 1);
+        ASSERT_EQ(HeapUpdate(tx, &primary, rowIds[i], &tuple), HamStatus::OK);
+    }
+    for (int i = rowNum - 10; i < rowNum; i++) {
+        ASSERT_EQ(HeapDelete(tx, &primary, rowIds[i]), HamStatus::OK);
+    }
+    tx->Commit();
+
+    tx->Begin();
+    SetRow(&tuple, -1, -1);
+    HeapInsert(tx, &primary, &tuple);
+    tx->Abort();
+
+    stream->Flush();
+    stream->Unsubscribe(&consumer);
+
+    // 在测试线程中回放, 主表行号到备表行号的映射
+    std::map<RowId, RowId> rowMap;
+    ChangeStreamReader reader(consumer.m_data.data(), consumer.m_data.size());
+    const ChangeTxHead *head = nullptr;
+    const ChangeRecord *record = nullptr;
+    int txCnt = 0;
+    // 变更流从重启恢复之后的 CSN 开始
+    ASSERT_NE(stream->GetStartCSN(), 0);
+    while (reader.NextTx(&head)) {
+        ASSERT_GE(head->m_csn, stream->GetStartCSN());
+        tx->Begin();
+        while ((record = reader.NextRecord()) != nullptr) {
+            ASSERT_EQ(record->m_tableId, primary.Id());
+            switch (record->m_type) {
+                case ChangeType::INSERT:
+                    ChangeStreamReader::ApplyToTuple(record, &tuple);
+                    rowMap[record->m_rowId] = HeapInsert(tx, &replica, &tuple);
+                    break;
+                case ChangeType::UPDATE:
+                    ASSERT_EQ(HeapRead(tx, &replica, rowMap[record->m_rowId], &tuple), HamStatus::OK);
+                    ChangeStreamReader::ApplyToTuple(record, &tuple);
+                    ASSERT_EQ(HeapUpdate(tx, &replica, rowMap[record->m_rowId], &tuple), HamStatus::OK);
+                    break;
+                case ChangeType::DELETE:
+                    ASSERT_EQ(HeapDelete(tx, &replica, rowMap[record->m_rowId]), HamStatus::OK);
+                    break;
+            }
+        }
+        tx->Commit();
+        txCnt++;
+    }
+    ASSERT_EQ(txCnt, 2);
+    ASSERT_EQ(rowMap.size(), rowNum);
+
+    RAMTuple replicaTuple(&TestColDesc[0], row_len);
+    tx->Begin();
+    for (int i = 0; i < rowNum; i++) {
+        HamStatus status = HeapRead(tx, &primary, rowIds[i], &tuple);
+        ASSERT_EQ(HeapRead(tx, &replica, rowMap[rowIds[i]], &replicaTuple), status);
+        if (status == HamStatus::OK) {
+            ASSERT_TRUE(tuple.EqualRow(&replicaTuple));
+        }
+    }
+    tx->Commit();
+}
+
+/* 没有订阅者时提交的变更保留在日志中, 重启之后订阅时读回; 交付之后推进消费位置, 再次重启不会重复交付 */
+TEST_F(ChangeStreamDBTest, RestartTest) {
+    Table primary(0, row_len);
+    primary.CreateSegment();
+    RAMTuple tuple(&TestColDesc[0], row_len);
+    auto tx = GetCurrentTxContext();
+    tx->Begin();
+    SetRow(&tuple, 1, 2);
+    RowId rowId = HeapInsert(tx, &primary, &tuple);
+    tx->Commit();
+    ChangeStream::GetGlobalChangeStream()->Flush();
+
+    auto restart = [this]() {
+        DestroyThreadLocalVariables();
+        ExitDBProcess();
+        BootStrap(space_dir);
+        InitThreadLocalVariables();
+    };
+    restart();
+    auto *stream = ChangeStream::GetGlobalChangeStream();
+    CollectConsumer consumer;
+    stream->Subscribe(&consumer);
+    stream->Flush();
+    stream->Unsubscribe(&consumer);
+
+    ChangeStreamReader reader(consumer.m_data.data(), consumer.m_data.size());
+    const ChangeTxHead *head = nullptr;
+    ASSERT_TRUE(reader.NextTx(&head));
+    ASSERT_GE(head->m_csn, stream->GetStartCSN());
+    const ChangeRecord *record = reader.NextRecord();
+    ASSERT_EQ(record->m_type, ChangeType::INSERT);
+    ASSERT_EQ(record->m_rowId, rowId);
+    RAMTuple decoded(&TestColDesc[0], row_len);
+    ChangeStreamReader::ApplyToTuple(record, &decoded);
+    ASSERT_TRUE(decoded.EqualRow(&tuple));
+    ASSERT_FALSE(reader.NextTx(&head));
+
+    restart();
+    stream = ChangeStream::GetGlobalChangeStream();
+    CollectConsumer again;
+    stream->Subscribe(&again);
+    stream->Flush();
+    stream->Unsubscribe(&again);
+    ASSERT_TRUE(again.m_data.empty());
+}
+
+}  // namespace change_stream_test
@@ -0,0 +1,39 @@
+#include "transaction/nvm_group_commit.h"
+#include <gtest/gtest.h>
+#include <thread>
+
+using namespace NVMDB;
+
+/* 批次大小为 1 时退化为每个 slot 一次 fence */
+TEST(GroupCommitTest, BasicTest) {
+    GroupCommitter committer(0, 1);
+    TxSlot slots[8] = {};
+    for (auto &slot : slots) {
+        committer.Persist(&slot, 0);
+    }
+    ASSERT_EQ(committer.GetPersistedSlots(), 8);
+    ASSERT_EQ(committer.GetPersistedBatches(), 8);
+}
+
+TEST(GroupCommitTest, ConcurrentTest) {
+    static constexpr int threadNum = 32;
+    static constexpr int txNum = 1000;
+    GroupCommitter committer(100, 16);
+    std::vector<TxSlot> slots(threadNum);
+
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threadNum; i++) {
+        workers.emplace_back([&, i] {
+            for (int j = 0; j < txNum; j++) {
+                committer.Persist(&slots[i], i % NVMDB_MAX_GROUP);
+            }
+        });
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    // 每个 slot 都被持久化, 且并发提交的 slot 被合并到更少的 fence 中
+    ASSERT_EQ(committer.GetPersistedSlots(), threadNum * txNum);
+    ASSERT_LE(committer.GetPersistedBatches(), committer.GetPersistedSlots());
+    ASSERT_GE(committer.GetPersistedBatches() * 16, committer.GetPersistedSlots());
+}
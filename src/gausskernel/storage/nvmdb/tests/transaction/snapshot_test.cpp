@@ -0,0 +1,70 @@
+#include "transaction/nvm_snapshot.h"
+#include <gtest/gtest.h>
+#include <thread>
+
+using namespace NVMDB;
+
+/* 同一个 commitCSN 只推进一次全局 CSN, 最小快照只统计在用的槽位 */
+TEST(ProcessArrayTest, BasicTest) {
+    ProcessArray procArray(NVMDB_MAX_THREAD_NUM);
+    ASSERT_EQ(procArray.getAndUpdateGlobalMinCSN(), MIN_TX_CSN);
+
+    size_t reader = procArray.addProcess();
+    ASSERT_EQ(procArray.getAndUpdateProcessLocalCSN(reader), MIN_TX_CSN);
+
+    // 两个事务并发提交, 拿到同一个 commitCSN
+    uint64 commitCSN = procArray.getGlobalCSN();
+    procArray.advanceGlobalCSN(commitCSN);
+    procArray.advanceGlobalCSN(commitCSN);
+    ASSERT_EQ(procArray.getGlobalCSN(), commitCSN + 1);
+
+    // reader 的快照还没有更新, 拖住回收水位线
+    ASSERT_EQ(procArray.getAndUpdateGlobalMinCSN(), MIN_TX_CSN);
+    ASSERT_EQ(procArray.getAndUpdateProcessLocalCSN(reader), commitCSN + 1);
+    ASSERT_EQ(procArray.getAndUpdateGlobalMinCSN(), commitCSN + 1);
+
+    procArray.removeProcess(reader);
+    commitCSN = procArray.getGlobalCSN();
+    procArray.advanceGlobalCSN(commitCSN);
+    ASSERT_EQ(procArray.getAndUpdateGlobalMinCSN(), commitCSN + 1);
+}
+
+TEST(ProcessArrayTest, ConcurrentTest) {
+    static constexpr int threadNum = 32;
+    static constexpr int txNum = 10000;
+    ProcessArray procArray(NVMDB_MAX_THREAD_NUM);
+    std::atomic<bool> stop{false};
+
+    std::thread recycler([&] {
+        uint64 lastMinCSN = MIN_TX_CSN;
+        while (!stop.load()) {
+            uint64 minCSN = procArray.getAndUpdateGlobalMinCSN();
+            ASSERT_GE(minCSN, lastMinCSN);
+            ASSERT_LE(minCSN, procArray.getGlobalCSN());
+            lastMinCSN = minCSN;
+        }
+    });
+
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threadNum; i++) {
+        workers.emplace_back([&] {
+            size_t index = procArray.addProcess();
+            for (int j = 0; j < txNum; j++) {
+                uint64 snapshot = procArray.getAndUpdateProcessLocalCSN(index);
+                // 事务执行期间, 回收水位线不会超过自己的快照
+                ASSERT_LE(procArray.getGlobalMinCSN(), snapshot);
+                uint64 commitCSN = procArray.getGlobalCSN();
+                ASSERT_GE(commitCSN, snapshot);
+                procArray.advanceGlobalCSN(commitCSN);
+                ASSERT_GT(procArray.getGlobalCSN(), commitCSN);
+            }
+            procArray.removeProcess(index);
+        });
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    stop.store(true);
+    recycler.join();
+    ASSERT_EQ(procArray.getAndUpdateGlobalMinCSN(), procArray.getGlobalCSN());
+}
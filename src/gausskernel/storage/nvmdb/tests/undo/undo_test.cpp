@@ -5,6 +5,7 @@
 #include "common/test_declare.h"
 #include <experimental/filesystem>
 #include <gtest/gtest.h>
+#include <thread>
 
 using namespace NVMDB;
 
@@ -140,4 +141,45 @@ TEST_F(UndoTest, UndoRecoveryTest) {
     DestroyLocalUndoSegment();
     UndoExitProcess();
     delete[] record_cache;
-}
\ No newline at end of file
+}
+
+TEST_F(UndoTest, ParallelRecoveryTest) {
+    auto savedThreads = FLAGS_recovery_threads_per_dir;
+    UndoCreate();
+    UndoExitProcess();
+
+    uint64 csn = MIN_TX_CSN + 1;
+    for (int threads : {1, 8}) {
+        UndoBootStrap();
+        while (!IsUndoRecoveryFinished()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        InitLocalUndoSegment();
+
+        /* 每个 segment 只恢复最后一个 tx slot, 每一轮都先提交一个事务, 再留下一个新的未提交的事务. */
+        auto committedCtx = AllocUndoContext();
+        committedCtx->UpdateTxSlotStatus(TxSlotStatus::COMMITTED);
+        committedCtx->UpdateTxSlotCSN(csn);
+        auto inProgressCtx = AllocUndoContext();
+        UndoSegment *undoSegment = GetThreadLocalUndoSegment();
+        auto segId = undoSegment->getSegmentId();
+        uint64 inProgressSlot = undoSegment->getNextFreeSlot() - 1;
+
+        DestroyLocalUndoSegment();
+        UndoExitProcess();
+
+        FLAGS_recovery_threads_per_dir = threads;
+        UndoBootStrap();
+        while (!IsUndoRecoveryFinished()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        FLAGS_recovery_threads_per_dir = savedThreads;
+        uint64 globalCSN = ProcessArray::GetGlobalProcArray()->getGlobalCSN();
+        auto status = GetUndoSegment(segId)->getTxSlot(inProgressSlot)->status;
+        UndoExitProcess();
+
+        ASSERT_GE(globalCSN, csn + 1);
+        ASSERT_EQ(status, TxSlotStatus::ROLL_BACKED);
+        csn++;
+    }
+}